@@ -0,0 +1,112 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/*
+ * Measures the update throughput of a dup sketch with its table on regular
+ * pages (std::allocator) and on huge pages (huge_page_allocator), updated
+ * twice with the same keys so that the second pass only probes the table.
+ * Usage:
+ *   huge_page_allocator_benchmark [--lg_k K] [--keys N]
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "huge_page_allocator.h"
+#include "theta_sketch_dup.h"
+
+namespace {
+
+using datasketches::huge_page_allocator;
+using datasketches::huge_page_stats;
+using datasketches::theta_sketch_dup_key;
+using datasketches::update_theta_sketch_dup_alloc;
+
+void usage(const char* program) {
+  std::cerr << "usage: " << program << " [--lg_k K] [--keys N]" << std::endl;
+  std::exit(2);
+}
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+template <typename A>
+void run(const std::string& name, uint8_t lg_k,
+         const std::vector<theta_sketch_dup_key>& keys) {
+  auto sketch = typename update_theta_sketch_dup_alloc<A>::builder()
+                    .set_lg_k(lg_k)
+                    .build();
+  auto start = std::chrono::steady_clock::now();
+  sketch.update(keys.data(), keys.size());
+  const double insert_seconds = seconds_since(start);
+  start = std::chrono::steady_clock::now();
+  sketch.update(keys.data(), keys.size());
+  const double probe_seconds = seconds_since(start);
+  std::cout << name << ": " << keys.size() / insert_seconds / 1e6
+            << " M inserts/s, " << keys.size() / probe_seconds / 1e6
+            << " M probes/s, estimate " << sketch.get_estimate() << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  uint8_t lg_k = 24;
+  size_t num_keys = 1 << 26;
+  for (int i = 1; i < argc; i++) {
+    if (i + 1 >= argc) usage(argv[0]);
+    const char* value = argv[++i];
+    if (std::strcmp(argv[i - 1], "--lg_k") == 0) {
+      lg_k = std::atoi(value);
+    } else if (std::strcmp(argv[i - 1], "--keys") == 0) {
+      num_keys = std::atoll(value);
+    } else {
+      usage(argv[0]);
+    }
+  }
+  std::cout << "lg_k " << static_cast<int>(lg_k) << ", " << num_keys
+            << " keys" << std::endl;
+
+  std::vector<theta_sketch_dup_key> keys;
+  keys.reserve(num_keys);
+  const datasketches::theta_sketch_dup_hasher hasher;
+  for (size_t i = 0; i < num_keys; i++) keys.push_back(hasher.hash(i));
+
+  try {
+    run<std::allocator<void>>("regular pages", lg_k, keys);
+    run<huge_page_allocator<void>>("huge pages", lg_k, keys);
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  std::cout << "mapped on 1 GB pages: "
+            << huge_page_stats::get_mapped_bytes(huge_page_stats::GIGANTIC)
+            << " bytes, on 2 MB pages: "
+            << huge_page_stats::get_mapped_bytes(huge_page_stats::HUGE)
+            << " bytes, on transparent huge pages: "
+            << huge_page_stats::get_mapped_bytes(huge_page_stats::TRANSPARENT)
+            << " bytes" << std::endl;
+  return 0;
+}
@@ -0,0 +1,136 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/*
+ * Measures the update throughput of dup sketches under the NUMA placements:
+ * one sketch updated by a thread of node 0 with its table bound to node 0,
+ * bound to the last node, interleaved or first-touched, then the sharded
+ * numa_theta_sketch_dup under the same placements.
+ * Usage:
+ *   numa_theta_sketch_dup_benchmark [--lg_k K] [--keys N] [--shards_per_node S]
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "numa_theta_sketch_dup.h"
+
+namespace {
+
+using datasketches::numa_allocator;
+using datasketches::numa_placement;
+using datasketches::numa_theta_sketch_dup;
+using datasketches::numa_topology;
+using datasketches::theta_sketch_dup_key;
+using datasketches::update_theta_sketch_dup_alloc;
+
+void usage(const char* program) {
+  std::cerr << "usage: " << program
+            << " [--lg_k K] [--keys N] [--shards_per_node S]" << std::endl;
+  std::exit(2);
+}
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+void report(const std::string& name, size_t num_keys, double seconds,
+            double estimate) {
+  std::cout << name << ": " << num_keys / seconds / 1e6
+            << " M updates/s, estimate " << estimate << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  uint8_t lg_k = 24;
+  size_t num_keys = 1 << 26;
+  uint32_t shards_per_node = 1;
+  for (int i = 1; i < argc; i++) {
+    if (i + 1 >= argc) usage(argv[0]);
+    const char* value = argv[++i];
+    if (std::strcmp(argv[i - 1], "--lg_k") == 0) {
+      lg_k = std::atoi(value);
+    } else if (std::strcmp(argv[i - 1], "--keys") == 0) {
+      num_keys = std::atoll(value);
+    } else if (std::strcmp(argv[i - 1], "--shards_per_node") == 0) {
+      shards_per_node = std::atoi(value);
+    } else {
+      usage(argv[0]);
+    }
+  }
+
+  const numa_topology& topology = numa_topology::get();
+  const uint32_t last_node = topology.get_num_nodes() - 1;
+  std::cout << topology.get_num_nodes() << " nodes, lg_k "
+            << static_cast<int>(lg_k) << ", " << num_keys << " keys"
+            << std::endl;
+
+  typedef update_theta_sketch_dup_alloc<numa_allocator<void>> sketch_type;
+  const auto builder = sketch_type::builder().set_lg_k(lg_k);
+  std::vector<theta_sketch_dup_key> keys;
+  keys.reserve(num_keys);
+  const datasketches::theta_sketch_dup_hasher hasher;
+  for (size_t i = 0; i < num_keys; i++) keys.push_back(hasher.hash(i));
+
+  struct placement {
+    const char* name;
+    numa_placement::policy policy;
+    uint32_t node;
+  };
+  const placement placements[] = {
+      {"local", numa_placement::BIND, 0},
+      {"remote", numa_placement::BIND, last_node},
+      {"interleaved", numa_placement::INTERLEAVE, 0},
+      {"first touch", numa_placement::FIRST_TOUCH, 0},
+  };
+
+  try {
+    datasketches::pin_thread_to_node(0);
+    for (const auto& p : placements) {
+      numa_placement scope(p.policy, p.node);
+      auto sketch = builder.build();
+      const auto start = std::chrono::steady_clock::now();
+      sketch.update(keys.data(), keys.size());
+      report(std::string("single sketch, ") + p.name, num_keys,
+             seconds_since(start), sketch.get_estimate());
+    }
+
+    for (const auto& p : placements) {
+      if (p.node != 0) continue;  // the shards are on every node
+      numa_theta_sketch_dup sketch(builder, shards_per_node, p.policy);
+      const auto start = std::chrono::steady_clock::now();
+      sketch.update(keys.data(), keys.size());
+      sketch.flush();
+      const double seconds = seconds_since(start);
+      report(std::to_string(sketch.get_num_shards()) + " shards, " + p.name,
+             num_keys, seconds, sketch.get_result().get_estimate());
+    }
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,116 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/*
+ * Measures the cost per call of hashing and updating integers and doubles
+ * through the generic update(const void*, unsigned) and through the inlined
+ * 8-byte paths of update(int64_t), update(int32_t) and update(double). The
+ * sketch is small enough to stay in cache so that the hash dominates.
+ * Usage:
+ *   theta_sketch_dup_hash_benchmark [--lg_k K] [--calls N]
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "theta_sketch_dup.h"
+
+namespace {
+
+using datasketches::theta_sketch_dup_hasher;
+using datasketches::update_theta_sketch_dup;
+
+void usage(const char* program) {
+  std::cerr << "usage: " << program << " [--lg_k K] [--calls N]" << std::endl;
+  std::exit(2);
+}
+
+const int NUM_ROUNDS = 5;
+
+// run f(i) for i in [0, num_calls) NUM_ROUNDS times and report the time per
+// call of the fastest round
+template <typename F>
+void run(const std::string& name, size_t num_calls, F f) {
+  double best = 0;
+  for (int round = 0; round < NUM_ROUNDS; round++) {
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < num_calls; i++) f(i);
+    const double nanos = std::chrono::duration<double, std::nano>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+    if (round == 0 || nanos < best) best = nanos;
+  }
+  std::cout << name << ": " << best / num_calls << " ns/call" << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  uint8_t lg_k = 12;
+  size_t num_calls = 1 << 24;
+  for (int i = 1; i < argc; i++) {
+    if (i + 1 >= argc) usage(argv[0]);
+    const char* value = argv[++i];
+    if (std::strcmp(argv[i - 1], "--lg_k") == 0) {
+      lg_k = std::atoi(value);
+    } else if (std::strcmp(argv[i - 1], "--calls") == 0) {
+      num_calls = std::atoll(value);
+    } else {
+      usage(argv[0]);
+    }
+  }
+  const uint64_t seed = datasketches::DEFAULT_SEED;
+
+  // the sums keep the hashes from being optimized away
+  uint64_t sum = 0;
+  run("hash, generic", num_calls, [&sum, seed](size_t i) {
+    const uint64_t value = i;
+    sum += theta_sketch_dup_hasher::compute_hash(&value, sizeof(value), seed);
+  });
+  run("hash, 8 bytes", num_calls, [&sum, seed](size_t i) {
+    sum += theta_sketch_dup_hasher::compute_hash64(i, seed);
+  });
+
+  const auto builder = update_theta_sketch_dup::builder().set_lg_k(lg_k);
+  auto sketch = builder.build();
+  run("update(const void*, 8)", num_calls, [&sketch](size_t i) {
+    const int64_t value = i;
+    sketch.update(&value, sizeof(value));
+  });
+  sketch = builder.build();
+  run("update(int64_t)", num_calls,
+      [&sketch](size_t i) { sketch.update(static_cast<int64_t>(i)); });
+  sketch = builder.build();
+  run("update(int32_t)", num_calls,
+      [&sketch](size_t i) { sketch.update(static_cast<int32_t>(i)); });
+  sketch = builder.build();
+  run("update(double), generic", num_calls, [&sketch](size_t i) {
+    const int64_t bits = theta_sketch_dup_hasher::canonical_bits(i * 0.5);
+    sketch.update(&bits, sizeof(bits));
+  });
+  sketch = builder.build();
+  run("update(double)", num_calls,
+      [&sketch](size_t i) { sketch.update(i * 0.5); });
+
+  std::cout << "checksum " << (sum + sketch.get_num_retained()) << std::endl;
+  return 0;
+}
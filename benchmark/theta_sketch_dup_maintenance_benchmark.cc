@@ -0,0 +1,131 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/*
+ * Measures the time spent in the resizes and rebuilds of a dup sketch, as
+ * reported to its listener, when they run on the updating thread and on a
+ * theta_sketch_dup_thread_pool, and checks that both give the same sketch.
+ * Usage:
+ *   theta_sketch_dup_maintenance_benchmark [--lg_k K] [--keys N] [--threads T]
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "theta_sketch_dup_thread_pool.h"
+
+namespace {
+
+using datasketches::theta_sketch_dup_key;
+using datasketches::theta_sketch_dup_thread_pool;
+using datasketches::update_theta_sketch_dup;
+using datasketches::update_theta_sketch_dup_event;
+using datasketches::update_theta_sketch_dup_executor;
+
+void usage(const char* program) {
+  std::cerr << "usage: " << program << " [--lg_k K] [--keys N] [--threads T]"
+            << std::endl;
+  std::exit(2);
+}
+
+class maintenance_timer : public datasketches::update_theta_sketch_dup_listener {
+ public:
+  uint64_t resize_nanos = 0;
+  uint64_t rebuild_nanos = 0;
+  uint32_t num_resizes = 0;
+  uint32_t num_rebuilds = 0;
+
+  void on_event(const update_theta_sketch_dup_event& event) override {
+    if (event.type == update_theta_sketch_dup_event::RESIZE) {
+      resize_nanos += event.nanos;
+      num_resizes++;
+    } else if (event.type == update_theta_sketch_dup_event::REBUILD) {
+      rebuild_nanos += event.nanos;
+      num_rebuilds++;
+    }
+  }
+};
+
+update_theta_sketch_dup run(const std::string& name, uint8_t lg_k,
+                            update_theta_sketch_dup_executor* executor,
+                            const std::vector<theta_sketch_dup_key>& keys) {
+  auto sketch = update_theta_sketch_dup::builder().set_lg_k(lg_k).build();
+  maintenance_timer timer;
+  sketch.set_listener(&timer);
+  sketch.set_executor(executor);
+  const auto start = std::chrono::steady_clock::now();
+  sketch.update(keys.data(), keys.size());
+  const double seconds = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+  std::cout << name << ": " << seconds << " s, " << timer.num_resizes
+            << " resizes in " << timer.resize_nanos / 1e6 << " ms, "
+            << timer.num_rebuilds << " rebuilds in "
+            << timer.rebuild_nanos / 1e6 << " ms" << std::endl;
+  sketch.set_listener(nullptr);
+  sketch.set_executor(nullptr);
+  return sketch;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  uint8_t lg_k = 24;
+  size_t num_keys = 1 << 27;
+  uint32_t num_threads = 0;
+  for (int i = 1; i < argc; i++) {
+    if (i + 1 >= argc) usage(argv[0]);
+    const char* value = argv[++i];
+    if (std::strcmp(argv[i - 1], "--lg_k") == 0) {
+      lg_k = std::atoi(value);
+    } else if (std::strcmp(argv[i - 1], "--keys") == 0) {
+      num_keys = std::atoll(value);
+    } else if (std::strcmp(argv[i - 1], "--threads") == 0) {
+      num_threads = std::atoi(value);
+    } else {
+      usage(argv[0]);
+    }
+  }
+
+  std::vector<theta_sketch_dup_key> keys;
+  keys.reserve(num_keys);
+  const datasketches::theta_sketch_dup_hasher hasher;
+  for (size_t i = 0; i < num_keys; i++) keys.push_back(hasher.hash(i));
+
+  try {
+    theta_sketch_dup_thread_pool pool(num_threads);
+    std::cout << "lg_k " << static_cast<int>(lg_k) << ", " << num_keys
+              << " keys, " << pool.get_concurrency() << " threads"
+              << std::endl;
+    const auto sequential = run("updating thread", lg_k, nullptr, keys);
+    const auto parallel = run("thread pool", lg_k, &pool, keys);
+    if (sequential.serialize() != parallel.serialize()) {
+      std::cerr << "the sketches differ" << std::endl;
+      return 1;
+    }
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
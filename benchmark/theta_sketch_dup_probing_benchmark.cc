@@ -0,0 +1,138 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/*
+ * Measures the throughput of a dup sketch with each probing of its hash
+ * table on mixes of updates and removes:
+ * - sliding window: every key is inserted, and removed once the next --live
+ *   keys have been inserted, so most removes bring a count to 0
+ * - churn: --live keys are inserted twice, then random ones are removed and
+ *   updated again, so no count reaches 0
+ * - probes: the --live keys are updated once more
+ * Usage:
+ *   theta_sketch_dup_probing_benchmark [--lg_k K] [--keys N] [--live L]
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "theta_sketch_dup.h"
+
+namespace {
+
+using datasketches::theta_sketch_dup_key;
+using datasketches::update_theta_sketch_dup;
+
+void usage(const char* program) {
+  std::cerr << "usage: " << program << " [--lg_k K] [--keys N] [--live L]"
+            << std::endl;
+  std::exit(2);
+}
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+void report(const std::string& name, const char* phase, size_t num_ops,
+            double seconds, const update_theta_sketch_dup& sketch) {
+  std::cout << name << ", " << phase << ": " << num_ops / seconds / 1e6
+            << " M ops/s, load factor " << sketch.get_stats().load_factor
+            << ", theta " << sketch.get_theta() << ", estimate "
+            << sketch.get_estimate() << std::endl;
+}
+
+void run(const std::string& name, update_theta_sketch_dup::probing probing,
+         uint8_t lg_k, size_t num_live,
+         const std::vector<theta_sketch_dup_key>& keys) {
+  const auto builder =
+      update_theta_sketch_dup::builder().set_lg_k(lg_k).set_probing(probing);
+  // the counts of 0 left by double hashing fill its table, and its
+  // rebuilds lower theta to make room
+  auto window = builder.build();
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < keys.size(); i++) {
+    window.update(keys[i]);
+    if (i >= num_live) window.remove(keys[i - num_live]);
+  }
+  report(name, "sliding window", 2 * keys.size() - num_live,
+         seconds_since(start), window);
+
+  // the counts of the live keys go between 1 and 2, so both tables hold the
+  // same entries
+  auto churn = builder.build();
+  churn.update(keys.data(), num_live);
+  churn.update(keys.data(), num_live);
+  start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < keys.size(); i++) {
+    const theta_sketch_dup_key& key = keys[keys[i].hash % num_live];
+    churn.remove(key);
+    churn.update(key);
+  }
+  report(name, "churn", 2 * keys.size(), seconds_since(start), churn);
+
+  start = std::chrono::steady_clock::now();
+  churn.update(keys.data(), num_live);
+  report(name, "probes", num_live, seconds_since(start), churn);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  uint8_t lg_k = 16;
+  size_t num_keys = 1 << 24;
+  size_t num_live = 1 << 15;
+  for (int i = 1; i < argc; i++) {
+    if (i + 1 >= argc) usage(argv[0]);
+    const char* value = argv[++i];
+    if (std::strcmp(argv[i - 1], "--lg_k") == 0) {
+      lg_k = std::atoi(value);
+    } else if (std::strcmp(argv[i - 1], "--keys") == 0) {
+      num_keys = std::atoll(value);
+    } else if (std::strcmp(argv[i - 1], "--live") == 0) {
+      num_live = std::atoll(value);
+    } else {
+      usage(argv[0]);
+    }
+  }
+  if (num_live > num_keys) usage(argv[0]);
+  std::cout << "lg_k " << static_cast<int>(lg_k) << ", " << num_keys
+            << " keys, " << num_live << " live" << std::endl;
+
+  std::vector<theta_sketch_dup_key> keys;
+  keys.reserve(num_keys);
+  const datasketches::theta_sketch_dup_hasher hasher;
+  for (size_t i = 0; i < num_keys; i++) keys.push_back(hasher.hash(i));
+
+  try {
+    run("double hashing", update_theta_sketch_dup::DOUBLE_HASHING, lg_k,
+        num_live, keys);
+    run("robin hood", update_theta_sketch_dup::ROBIN_HOOD, lg_k, num_live,
+        keys);
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
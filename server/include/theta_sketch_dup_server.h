@@ -0,0 +1,822 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef THETA_SKETCH_DUP_SERVER_H_
+#define THETA_SKETCH_DUP_SERVER_H_
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "theta_sketch_dup.h"
+
+namespace datasketches {
+
+/*
+ * Binary protocol of theta_sketch_dup_server, in the byte order of the host
+ * since client and server share it.
+ * Request: length of the rest (uint32), op (uint8), name size (uint16), name,
+ * then by op:
+ *   UPDATE, REMOVE: seed hash (uint16), number of hashes (uint32), the
+ *   hashes (uint64) made by theta_sketch_dup_hasher
+ *   ESTIMATE: number of standard deviations of the bounds (uint8)
+ *   SERIALIZE: nothing
+ * Response: length of the rest (uint32), status (uint8), then for OK:
+ *   UPDATE, REMOVE: number of applied hashes (uint32)
+ *   ESTIMATE: estimate, lower bound, upper bound (double)
+ *   SERIALIZE: the sketch as written by serialize()
+ * and an error message for the other statuses.
+ */
+struct theta_sketch_dup_protocol {
+  enum op_type { UPDATE = 1, REMOVE, ESTIMATE, SERIALIZE };
+  enum status_type { OK, NOT_FOUND, BAD_REQUEST, FAILED };
+  // larger frames are rejected and their connection closed
+  static const uint32_t MAX_FRAME_BYTES = 64 << 20;
+
+  static void write_all(int fd, const uint8_t* data, size_t size) {
+    while (size > 0) {
+      const ssize_t n = ::send(fd, data, size, MSG_NOSIGNAL);
+      if (n < 0) {
+        if (errno == EINTR) continue;
+        throw std::system_error(errno, std::generic_category(), "send");
+      }
+      data += n;
+      size -= n;
+    }
+  }
+
+  // @return false if the peer closed the connection before the first byte
+  static bool read_all(int fd, uint8_t* data, size_t size) {
+    size_t total = 0;
+    while (total < size) {
+      const ssize_t n = ::recv(fd, data + total, size - total, 0);
+      if (n < 0) {
+        if (errno == EINTR) continue;
+        throw std::system_error(errno, std::generic_category(), "recv");
+      }
+      if (n == 0) {
+        if (total == 0) return false;
+        throw std::runtime_error("connection closed in the middle of a frame");
+      }
+      total += n;
+    }
+    return true;
+  }
+
+  // read the body of a frame, @return false at the end of the connection
+  template <typename V>
+  static bool read_frame(int fd, V* body) {
+    uint32_t size;
+    if (!read_all(fd, reinterpret_cast<uint8_t*>(&size), sizeof(size)))
+      return false;
+    if (size > MAX_FRAME_BYTES) throw std::length_error("frame is too large");
+    body->resize(size);
+    if (size > 0 && !read_all(fd, body->data(), size))
+      throw std::runtime_error("connection closed in the middle of a frame");
+    return true;
+  }
+};
+
+/*
+ * theta_sketch_dup_server serves named update_theta_sketch_dup sketches to
+ * the processes of a host over Unix domain sockets and TCP loopback, so that
+ * they share one sketch per name instead of merging sketches of their own.
+ * The sketches are sharded by name across worker threads: each sketch is
+ * only touched by the thread of its shard, without locks. Connections are
+ * served by a thread each, which reads a request, hands it to the worker of
+ * its shard and writes the response back.
+ * Updates and removes come in batches of hashes made by the clients with
+ * theta_sketch_dup_hasher, so the server does not hash.
+ * Example:
+ *   theta_sketch_dup_server server(builder, 4);
+ *   server.listen_unix("/run/sketches.sock");
+ *   // in a client process
+ *   theta_sketch_dup_client client;
+ *   client.connect_unix("/run/sketches.sock");
+ *   client.update("active_users", keys, num_keys);
+ */
+template <typename A>
+class theta_sketch_dup_server_alloc {
+ public:
+  typedef typename update_theta_sketch_dup_alloc<A>::builder builder;
+
+  /**
+   * Creates a server without listening sockets
+   * @param sketch_builder builder of the sketches
+   * @param num_workers number of shards, 0 for one per hardware thread
+   */
+  explicit theta_sketch_dup_server_alloc(
+      const builder& sketch_builder = builder(), unsigned num_workers = 0);
+
+  /**
+   * Stops the server
+   */
+  ~theta_sketch_dup_server_alloc();
+
+  theta_sketch_dup_server_alloc(const theta_sketch_dup_server_alloc&) = delete;
+  theta_sketch_dup_server_alloc& operator=(
+      const theta_sketch_dup_server_alloc&) = delete;
+
+  /**
+   * Accept connections on a Unix domain socket, replacing a stale socket
+   * file at the path
+   * @param path path of the socket
+   */
+  void listen_unix(const std::string& path);
+
+  /**
+   * Accept connections on a TCP port of the loopback interface
+   * @param port port number, 0 for a port chosen by the system
+   * @return the port number
+   */
+  uint16_t listen_tcp(uint16_t port);
+
+  /**
+   * Close the sockets and the connections, and stop the workers. The
+   * sketches are dropped.
+   */
+  void stop();
+
+  /**
+   * @return the number of worker threads
+   */
+  unsigned get_num_workers() const;
+
+ private:
+  typedef vector_u8_dup<A> vector_bytes;
+  typedef theta_sketch_dup_protocol protocol;
+
+  // a request handed to a worker, the connection thread waits for done
+  struct task {
+    const vector_bytes* request;
+    vector_bytes* response;
+    std::promise<void> done;
+  };
+
+  struct worker {
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<task*> queue;
+    bool stopping = false;
+    // the sketches of the shard, only touched by the thread
+    std::unordered_map<std::string, update_theta_sketch_dup_alloc<A>> sketches;
+    std::vector<std::pair<uint64_t, int64_t>> ops;
+  };
+
+  // fd is closed by the thread of the connection when it is done
+  struct connection {
+    int fd;
+    std::thread thread;
+    bool done = false;
+  };
+
+  update_theta_sketch_dup_alloc<A> prototype_;
+  std::vector<std::unique_ptr<worker>> workers_;
+  std::mutex mutex_;
+  std::vector<int> listen_fds_;
+  std::vector<std::thread> acceptors_;
+  std::list<connection> connections_;
+  bool stopped_;
+
+  void start_listening(int fd);
+  void accept_loop(int fd);
+  void serve(connection* conn);
+  void run_worker(worker* w);
+  void handle(worker* w, const vector_bytes& request, vector_bytes* response);
+  // join the threads of the closed connections, called with mutex_ held
+  void reap_connections();
+  // @return true once stop() has been called
+  bool is_stopped();
+
+  static void set_response(protocol::status_type status, const void* data,
+                           size_t size, vector_bytes* response);
+  static void set_error(protocol::status_type status, const std::string& what,
+                        vector_bytes* response);
+};
+
+/*
+ * theta_sketch_dup_client talks to a theta_sketch_dup_server. The error
+ * statuses of the server are thrown as exceptions: std::out_of_range for a
+ * missing sketch, std::invalid_argument for a bad request and
+ * std::logic_error for an operation the sketch refused.
+ */
+template <typename A>
+class theta_sketch_dup_client_alloc {
+ public:
+  typedef vector_u8_dup<A> vector_bytes;
+
+  /**
+   * Creates a client with the hasher of the sketches of the server
+   * @param seed seed of the sketches of the server
+   */
+  explicit theta_sketch_dup_client_alloc(uint64_t seed = DEFAULT_SEED);
+
+  ~theta_sketch_dup_client_alloc();
+
+  theta_sketch_dup_client_alloc(const theta_sketch_dup_client_alloc&) = delete;
+  theta_sketch_dup_client_alloc& operator=(
+      const theta_sketch_dup_client_alloc&) = delete;
+
+  void connect_unix(const std::string& path);
+  void connect_tcp(uint16_t port);
+
+  /**
+   * Update a sketch with a batch of hashed elements, creating the sketch if
+   * needed
+   * @param name name of the sketch
+   * @param keys hashed elements
+   * @param num_keys number of hashed elements
+   */
+  void update(const std::string& name, const theta_sketch_dup_key* keys,
+              size_t num_keys);
+
+  /**
+   * Remove a batch of hashed elements from a sketch, in order. If the sketch
+   * refuses a remove, the removes before it are applied and std::logic_error
+   * is thrown.
+   */
+  void remove(const std::string& name, const theta_sketch_dup_key* keys,
+              size_t num_keys);
+
+  /**
+   * @return the estimate of a sketch, and its bounds if lower_bound and
+   * upper_bound are given
+   */
+  double get_estimate(const std::string& name, uint8_t num_std_devs = 2,
+                      double* lower_bound = nullptr,
+                      double* upper_bound = nullptr);
+
+  /**
+   * @return a sketch serialized by serialize(), to be read by
+   * update_theta_sketch_dup::deserialize()
+   */
+  vector_bytes get_serialized(const std::string& name);
+
+  /**
+   * @return the hasher of the elements of the server
+   */
+  const theta_sketch_dup_hasher& get_hasher() const;
+
+ private:
+  typedef theta_sketch_dup_protocol protocol;
+
+  theta_sketch_dup_hasher hasher_;
+  int fd_;
+  vector_bytes request_;
+  vector_bytes response_;
+
+  void connect_to(int domain, const sockaddr* addr, socklen_t addr_size);
+  void start_request(protocol::op_type op, const std::string& name);
+  void send_keys(protocol::op_type op, const std::string& name,
+                 const theta_sketch_dup_key* keys, size_t num_keys);
+  // send request_ and read response_, @return the payload of an OK response
+  const uint8_t* call(size_t* size);
+};
+
+/*
+ * The following are implementations
+ */
+
+template <typename A>
+theta_sketch_dup_server_alloc<A>::theta_sketch_dup_server_alloc(
+    const builder& sketch_builder, unsigned num_workers)
+    : prototype_(sketch_builder.build()),
+      workers_(),
+      mutex_(),
+      listen_fds_(),
+      acceptors_(),
+      connections_(),
+      stopped_(false) {
+  if (num_workers == 0)
+    num_workers = std::max(1u, std::thread::hardware_concurrency());
+  for (unsigned i = 0; i < num_workers; i++) {
+    workers_.emplace_back(new worker());
+    worker* w = workers_.back().get();
+    w->thread = std::thread([this, w]() { run_worker(w); });
+  }
+}
+
+template <typename A>
+theta_sketch_dup_server_alloc<A>::~theta_sketch_dup_server_alloc() {
+  stop();
+}
+
+template <typename A>
+unsigned theta_sketch_dup_server_alloc<A>::get_num_workers() const {
+  return workers_.size();
+}
+
+template <typename A>
+void theta_sketch_dup_server_alloc<A>::listen_unix(const std::string& path) {
+  sockaddr_un addr;
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path))
+    throw std::invalid_argument("socket path is too long");
+  std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+  const int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) throw std::system_error(errno, std::generic_category(), "socket");
+  ::unlink(path.c_str());
+  if (::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+      ::listen(fd, SOMAXCONN) != 0) {
+    const int error = errno;
+    ::close(fd);
+    throw std::system_error(error, std::generic_category(), "bind " + path);
+  }
+  start_listening(fd);
+}
+
+template <typename A>
+uint16_t theta_sketch_dup_server_alloc<A>::listen_tcp(uint16_t port) {
+  sockaddr_in addr;
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  const int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) throw std::system_error(errno, std::generic_category(), "socket");
+  const int one = 1;
+  ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  socklen_t addr_size = sizeof(addr);
+  if (::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+      ::listen(fd, SOMAXCONN) != 0 ||
+      ::getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &addr_size) != 0) {
+    const int error = errno;
+    ::close(fd);
+    throw std::system_error(error, std::generic_category(), "bind tcp");
+  }
+  start_listening(fd);
+  return ntohs(addr.sin_port);
+}
+
+template <typename A>
+void theta_sketch_dup_server_alloc<A>::start_listening(int fd) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (stopped_) {
+    ::close(fd);
+    throw std::logic_error("the server is stopped");
+  }
+  listen_fds_.push_back(fd);
+  acceptors_.emplace_back([this, fd]() { accept_loop(fd); });
+}
+
+template <typename A>
+bool theta_sketch_dup_server_alloc<A>::is_stopped() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stopped_;
+}
+
+template <typename A>
+void theta_sketch_dup_server_alloc<A>::accept_loop(int listen_fd) {
+  // bounds of the pause after a failed accept()
+  const unsigned min_backoff_ms = 10;
+  const unsigned max_backoff_ms = 1000;
+  unsigned backoff_ms = 0;
+  while (true) {
+    const int fd = ::accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) continue;
+      // the socket was shut down by stop(), or accept() failed for a while,
+      // e.g. with EMFILE or ENOBUFS, and is retried after a pause
+      if (is_stopped()) return;
+      backoff_ms =
+          std::min(std::max(2 * backoff_ms, min_backoff_ms), max_backoff_ms);
+      std::this_thread::sleep_for(std::chrono::milliseconds(backoff_ms));
+      continue;
+    }
+    backoff_ms = 0;
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stopped_) {
+      ::close(fd);
+      return;
+    }
+    reap_connections();
+    const int one = 1;
+    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    connections_.emplace_back();
+    connection* conn = &connections_.back();
+    conn->fd = fd;
+    conn->thread = std::thread([this, conn]() { serve(conn); });
+  }
+}
+
+template <typename A>
+void theta_sketch_dup_server_alloc<A>::reap_connections() {
+  for (auto it = connections_.begin(); it != connections_.end();) {
+    if (it->done) {
+      it->thread.join();
+      it = connections_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+template <typename A>
+void theta_sketch_dup_server_alloc<A>::serve(connection* conn) {
+  vector_bytes request;
+  vector_bytes response;
+  try {
+    while (protocol::read_frame(conn->fd, &request)) {
+      // the shard of the request is given by its name
+      uint16_t name_size = 0;
+      if (request.size() >= 1 + sizeof(name_size))
+        copy_from_mem(request.data() + 1, &name_size, sizeof(name_size));
+      if (request.size() < 1 + sizeof(name_size) + name_size) {
+        set_error(protocol::BAD_REQUEST, "truncated request", &response);
+      } else {
+        const std::string name(
+            reinterpret_cast<const char*>(request.data()) + 1 +
+                sizeof(name_size),
+            name_size);
+        worker* w =
+            workers_[std::hash<std::string>()(name) % workers_.size()].get();
+        task t{&request, &response, std::promise<void>()};
+        std::future<void> done = t.done.get_future();
+        {
+          std::lock_guard<std::mutex> lock(w->mutex);
+          if (w->stopping) break;
+          w->queue.push_back(&t);
+        }
+        w->ready.notify_one();
+        done.wait();
+        if (response.empty()) break;
+      }
+      protocol::write_all(conn->fd, response.data(), response.size());
+    }
+  } catch (const std::exception&) {
+    // a broken connection only ends itself
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  ::close(conn->fd);
+  // the connections closed before this one are joined here rather than on
+  // the next accept, so at most one finished thread waits to be joined.
+  // Once stopped, stop() joins them all.
+  if (!stopped_) reap_connections();
+  conn->done = true;
+}
+
+template <typename A>
+void theta_sketch_dup_server_alloc<A>::run_worker(worker* w) {
+  while (true) {
+    task* t;
+    {
+      std::unique_lock<std::mutex> lock(w->mutex);
+      w->ready.wait(lock, [w]() { return w->stopping || !w->queue.empty(); });
+      if (w->queue.empty()) return;
+      t = w->queue.front();
+      w->queue.pop_front();
+    }
+    try {
+      try {
+        handle(w, *t->request, t->response);
+      } catch (const std::bad_alloc&) {
+        set_error(protocol::FAILED, "out of memory", t->response);
+      } catch (const std::exception& e) {
+        set_error(protocol::FAILED, e.what(), t->response);
+      }
+    } catch (...) {
+      // no room for the error either, the connection is closed
+      t->response->clear();
+    }
+    t->done.set_value();
+  }
+}
+
+template <typename A>
+void theta_sketch_dup_server_alloc<A>::handle(worker* w,
+                                              const vector_bytes& request,
+                                              vector_bytes* response) {
+  const uint8_t* ptr = request.data();
+  const uint8_t* end = ptr + request.size();
+  const uint8_t op = *ptr++;
+  uint16_t name_size;
+  ptr += copy_from_mem(ptr, &name_size, sizeof(name_size));
+  const std::string name(reinterpret_cast<const char*>(ptr), name_size);
+  ptr += name_size;
+  auto it = w->sketches.find(name);
+
+  switch (op) {
+    case protocol::UPDATE:
+    case protocol::REMOVE: {
+      uint16_t seed_hash;
+      uint32_t num_keys;
+      if (static_cast<size_t>(end - ptr) < sizeof(seed_hash) + sizeof(num_keys))
+        return set_error(protocol::BAD_REQUEST, "truncated request", response);
+      ptr += copy_from_mem(ptr, &seed_hash, sizeof(seed_hash));
+      ptr += copy_from_mem(ptr, &num_keys, sizeof(num_keys));
+      if (static_cast<size_t>(end - ptr) != sizeof(uint64_t) * num_keys)
+        return set_error(protocol::BAD_REQUEST, "wrong number of hashes",
+                         response);
+      if (seed_hash != prototype_.get_seed_hash())
+        return set_error(protocol::BAD_REQUEST, "incompatible seed hashes",
+                         response);
+      if (op == protocol::UPDATE) {
+        if (it == w->sketches.end())
+          it = w->sketches.emplace(name, prototype_).first;
+        w->ops.resize(num_keys);
+        for (uint32_t i = 0; i < num_keys; i++) {
+          copy_from_mem(ptr + sizeof(uint64_t) * i, &w->ops[i].first,
+                        sizeof(uint64_t));
+          w->ops[i].second = 1;
+        }
+        // an empty string is ignored, as update_theta_sketch_dup does
+        size_t num_ops = 0;
+        for (uint32_t i = 0; i < num_keys; i++)
+          if (w->ops[i].first != theta_sketch_dup_key::IGNORED_HASH)
+            w->ops[num_ops++] = w->ops[i];
+        it->second.internal_apply(w->ops.data(), num_ops);
+      } else {
+        if (it == w->sketches.end())
+          return set_error(protocol::NOT_FOUND, "no sketch named " + name,
+                           response);
+        for (uint32_t i = 0; i < num_keys; i++) {
+          uint64_t hash;
+          copy_from_mem(ptr + sizeof(uint64_t) * i, &hash, sizeof(hash));
+          if (hash == theta_sketch_dup_key::IGNORED_HASH) continue;
+          try {
+            it->second.internal_remove(hash);
+          } catch (const std::logic_error& e) {
+            return set_error(protocol::FAILED,
+                             "remove " + std::to_string(i) + ": " + e.what(),
+                             response);
+          }
+        }
+      }
+      return set_response(protocol::OK, &num_keys, sizeof(num_keys), response);
+    }
+    case protocol::ESTIMATE: {
+      if (end - ptr != 1)
+        return set_error(protocol::BAD_REQUEST, "truncated request", response);
+      const uint8_t num_std_devs = *ptr;
+      if (num_std_devs < 1 || num_std_devs > 3)
+        return set_error(protocol::BAD_REQUEST,
+                         "num_std_devs must be 1, 2 or 3", response);
+      if (it == w->sketches.end())
+        return set_error(protocol::NOT_FOUND, "no sketch named " + name,
+                         response);
+      const double result[3] = {it->second.get_estimate(),
+                                it->second.get_lower_bound(num_std_devs),
+                                it->second.get_upper_bound(num_std_devs)};
+      return set_response(protocol::OK, result, sizeof(result), response);
+    }
+    case protocol::SERIALIZE: {
+      if (it == w->sketches.end())
+        return set_error(protocol::NOT_FOUND, "no sketch named " + name,
+                         response);
+      const auto bytes = it->second.serialize();
+      return set_response(protocol::OK, bytes.data(), bytes.size(), response);
+    }
+  }
+  set_error(protocol::BAD_REQUEST, "unknown op", response);
+}
+
+template <typename A>
+void theta_sketch_dup_server_alloc<A>::set_response(
+    protocol::status_type status, const void* data, size_t size,
+    vector_bytes* response) {
+  const uint32_t frame_size = 1 + size;
+  response->resize(sizeof(frame_size) + frame_size);
+  uint8_t* ptr = response->data();
+  ptr += copy_to_mem(&frame_size, ptr, sizeof(frame_size));
+  *ptr++ = status;
+  copy_to_mem(data, ptr, size);
+}
+
+template <typename A>
+void theta_sketch_dup_server_alloc<A>::set_error(protocol::status_type status,
+                                                 const std::string& what,
+                                                 vector_bytes* response) {
+  set_response(status, what.data(), what.size(), response);
+}
+
+template <typename A>
+void theta_sketch_dup_server_alloc<A>::stop() {
+  std::vector<std::thread> acceptors;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stopped_) return;
+    stopped_ = true;
+    // unblock the accept() and recv() calls
+    for (int fd : listen_fds_) ::shutdown(fd, SHUT_RDWR);
+    for (auto& conn : connections_)
+      if (!conn.done) ::shutdown(conn.fd, SHUT_RDWR);
+    acceptors.swap(acceptors_);
+  }
+  for (auto& acceptor : acceptors) acceptor.join();
+  // no connection is added once the acceptors are done
+  for (auto& conn : connections_) conn.thread.join();
+  connections_.clear();
+  for (int fd : listen_fds_) ::close(fd);
+  listen_fds_.clear();
+  for (auto& w : workers_) {
+    {
+      std::lock_guard<std::mutex> lock(w->mutex);
+      w->stopping = true;
+    }
+    w->ready.notify_one();
+    w->thread.join();
+  }
+}
+
+// client
+
+template <typename A>
+theta_sketch_dup_client_alloc<A>::theta_sketch_dup_client_alloc(uint64_t seed)
+    : hasher_(seed), fd_(-1), request_(), response_() {}
+
+template <typename A>
+theta_sketch_dup_client_alloc<A>::~theta_sketch_dup_client_alloc() {
+  if (fd_ >= 0) ::close(fd_);
+}
+
+template <typename A>
+const theta_sketch_dup_hasher& theta_sketch_dup_client_alloc<A>::get_hasher()
+    const {
+  return hasher_;
+}
+
+template <typename A>
+void theta_sketch_dup_client_alloc<A>::connect_unix(const std::string& path) {
+  sockaddr_un addr;
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path))
+    throw std::invalid_argument("socket path is too long");
+  std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+  connect_to(AF_UNIX, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+}
+
+template <typename A>
+void theta_sketch_dup_client_alloc<A>::connect_tcp(uint16_t port) {
+  sockaddr_in addr;
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  connect_to(AF_INET, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+  const int one = 1;
+  ::setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+template <typename A>
+void theta_sketch_dup_client_alloc<A>::connect_to(int domain,
+                                                  const sockaddr* addr,
+                                                  socklen_t addr_size) {
+  if (fd_ >= 0) throw std::logic_error("the client is already connected");
+  const int fd = ::socket(domain, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) throw std::system_error(errno, std::generic_category(), "socket");
+  if (::connect(fd, addr, addr_size) != 0) {
+    const int error = errno;
+    ::close(fd);
+    throw std::system_error(error, std::generic_category(), "connect");
+  }
+  fd_ = fd;
+}
+
+template <typename A>
+void theta_sketch_dup_client_alloc<A>::start_request(protocol::op_type op,
+                                                     const std::string& name) {
+  if (name.size() > UINT16_MAX)
+    throw std::invalid_argument("sketch name is too long");
+  const uint16_t name_size = name.size();
+  request_.resize(sizeof(uint32_t) + 1 + sizeof(name_size) + name_size);
+  uint8_t* ptr = request_.data() + sizeof(uint32_t);
+  *ptr++ = op;
+  ptr += copy_to_mem(&name_size, ptr, sizeof(name_size));
+  copy_to_mem(name.data(), ptr, name_size);
+}
+
+template <typename A>
+const uint8_t* theta_sketch_dup_client_alloc<A>::call(size_t* size) {
+  if (fd_ < 0) throw std::logic_error("the client is not connected");
+  const uint32_t frame_size = request_.size() - sizeof(uint32_t);
+  if (frame_size > protocol::MAX_FRAME_BYTES)
+    throw std::length_error("request is too large, split the batch");
+  copy_to_mem(&frame_size, request_.data(), sizeof(frame_size));
+  protocol::write_all(fd_, request_.data(), request_.size());
+  if (!protocol::read_frame(fd_, &response_) || response_.empty())
+    throw std::runtime_error("the server closed the connection");
+  const uint8_t status = response_[0];
+  *size = response_.size() - 1;
+  const uint8_t* payload = response_.data() + 1;
+  if (status == protocol::OK) return payload;
+  const std::string what(reinterpret_cast<const char*>(payload), *size);
+  if (status == protocol::NOT_FOUND) throw std::out_of_range(what);
+  if (status == protocol::BAD_REQUEST) throw std::invalid_argument(what);
+  throw std::logic_error(what);
+}
+
+template <typename A>
+void theta_sketch_dup_client_alloc<A>::send_keys(
+    protocol::op_type op, const std::string& name,
+    const theta_sketch_dup_key* keys, size_t num_keys) {
+  for (size_t i = 0; i < num_keys; i++)
+    if (keys[i].seed_hash != hasher_.get_seed_hash())
+      throw std::invalid_argument("key hashed with another seed");
+  start_request(op, name);
+  const uint16_t seed_hash = hasher_.get_seed_hash();
+  const uint32_t num = num_keys;
+  size_t offset = request_.size();
+  request_.resize(offset + sizeof(seed_hash) + sizeof(num) +
+                  sizeof(uint64_t) * num_keys);
+  uint8_t* ptr = request_.data() + offset;
+  ptr += copy_to_mem(&seed_hash, ptr, sizeof(seed_hash));
+  ptr += copy_to_mem(&num, ptr, sizeof(num));
+  for (size_t i = 0; i < num_keys; i++)
+    ptr += copy_to_mem(&keys[i].hash, ptr, sizeof(uint64_t));
+  size_t size;
+  call(&size);
+}
+
+template <typename A>
+void theta_sketch_dup_client_alloc<A>::update(const std::string& name,
+                                              const theta_sketch_dup_key* keys,
+                                              size_t num_keys) {
+  send_keys(protocol::UPDATE, name, keys, num_keys);
+}
+
+template <typename A>
+void theta_sketch_dup_client_alloc<A>::remove(const std::string& name,
+                                              const theta_sketch_dup_key* keys,
+                                              size_t num_keys) {
+  send_keys(protocol::REMOVE, name, keys, num_keys);
+}
+
+template <typename A>
+double theta_sketch_dup_client_alloc<A>::get_estimate(const std::string& name,
+                                                      uint8_t num_std_devs,
+                                                      double* lower_bound,
+                                                      double* upper_bound) {
+  start_request(protocol::ESTIMATE, name);
+  request_.push_back(num_std_devs);
+  size_t size;
+  const uint8_t* payload = call(&size);
+  double result[3];
+  if (size != sizeof(result))
+    throw std::runtime_error("malformed response from the server");
+  copy_from_mem(payload, result, sizeof(result));
+  if (lower_bound != nullptr) *lower_bound = result[1];
+  if (upper_bound != nullptr) *upper_bound = result[2];
+  return result[0];
+}
+
+template <typename A>
+vector_u8_dup<A> theta_sketch_dup_client_alloc<A>::get_serialized(
+    const std::string& name) {
+  start_request(protocol::SERIALIZE, name);
+  size_t size;
+  const uint8_t* payload = call(&size);
+  return vector_bytes(payload, payload + size);
+}
+
+/*
+ * aliases with default allocator for convenience
+ */
+typedef theta_sketch_dup_server_alloc<std::allocator<void>>
+    theta_sketch_dup_server;
+typedef theta_sketch_dup_client_alloc<std::allocator<void>>
+    theta_sketch_dup_client;
+
+} /* namespace datasketches */
+
+#endif
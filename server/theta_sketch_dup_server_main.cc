@@ -0,0 +1,116 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/*
+ * Serves named update_theta_sketch_dup sketches on a Unix domain socket
+ * and/or a TCP loopback port until SIGINT or SIGTERM.
+ * Usage:
+ *   theta_sketch_dup_server [--unix PATH] [--tcp PORT] [--workers N]
+ *                           [--lg_k K]
+ */
+
+#include <signal.h>
+
+#include <cctype>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "theta_sketch_dup_server.h"
+
+namespace {
+
+void usage(const char* program) {
+  std::cerr << "usage: " << program
+            << " [--unix PATH] [--tcp PORT] [--workers N] [--lg_k K]"
+            << std::endl;
+  std::exit(2);
+}
+
+// parses a decimal argument in [min, max], or prints the usage and exits
+unsigned long parse_number(const char* program, const char* value,
+                           unsigned long min, unsigned long max) {
+  // strtoul would skip spaces and accept a sign
+  if (!std::isdigit(static_cast<unsigned char>(value[0]))) usage(program);
+  char* end = nullptr;
+  const unsigned long number = std::strtoul(value, &end, 10);
+  if (*end != '\0' || number < min || number > max) usage(program);
+  return number;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  using datasketches::theta_sketch_dup_server;
+  using datasketches::update_theta_sketch_dup;
+
+  std::string unix_path;
+  long tcp_port = -1;
+  unsigned num_workers = 0;
+  int lg_k = -1;
+  for (int i = 1; i < argc; i++) {
+    if (i + 1 >= argc) usage(argv[0]);
+    const char* value = argv[++i];
+    if (std::strcmp(argv[i - 1], "--unix") == 0) {
+      unix_path = value;
+    } else if (std::strcmp(argv[i - 1], "--tcp") == 0) {
+      // port 0 listens on a free port
+      tcp_port = parse_number(argv[0], value, 0, 65535);
+    } else if (std::strcmp(argv[i - 1], "--workers") == 0) {
+      num_workers = parse_number(argv[0], value, 0, UINT_MAX);
+    } else if (std::strcmp(argv[i - 1], "--lg_k") == 0) {
+      lg_k = parse_number(argv[0], value, 0, UCHAR_MAX);
+    } else {
+      usage(argv[0]);
+    }
+  }
+  if (unix_path.empty() && tcp_port < 0) usage(argv[0]);
+
+  // block the signals before the threads start so that only sigwait gets them
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+  try {
+    // the builder rejects an lg_k below its minimum
+    update_theta_sketch_dup::builder builder;
+    if (lg_k >= 0) builder.set_lg_k(lg_k);
+    theta_sketch_dup_server server(builder, num_workers);
+    if (!unix_path.empty()) {
+      server.listen_unix(unix_path);
+      std::cerr << "listening on " << unix_path << std::endl;
+    }
+    if (tcp_port >= 0) {
+      std::cerr << "listening on 127.0.0.1:" << server.listen_tcp(tcp_port)
+                << std::endl;
+    }
+    int signal;
+    sigwait(&signals, &signal);
+    server.stop();
+    if (!unix_path.empty()) ::unlink(unix_path.c_str());
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,105 @@
+#include "coalescing_theta_sketch_dup.h"
+#include <gtest/gtest.h>
+#include <random>
+#include <stdexcept>
+
+namespace datasketches {
+
+TEST(CoalescingThetaSketchDup, TestSameEstimateAsSketch) {
+  // @a: theta sketch updated directly
+  // @b: the same theta sketch updated through a cache of 2^4 slots
+  // the stream is skewed and has fewer distinct values than k, so both
+  // sketches are exact and hold the same keys
+  auto a = update_theta_sketch_dup::builder().set_lg_k(10).build();
+  coalescing_theta_sketch_dup b(
+      update_theta_sketch_dup::builder().set_lg_k(10).build(), 4);
+  std::mt19937 gen(1);
+  std::geometric_distribution<int> d(0.01);
+  for (int i = 0; i < 100000; i++) {
+    int x = d(gen) % 500;
+    a.update(x);
+    b.update(x);
+  }
+  EXPECT_FALSE(b.is_estimation_mode());
+  EXPECT_EQ(a.get_theta64(), b.get_theta64());
+  EXPECT_EQ(a.get_num_retained(), b.get_num_retained());
+  EXPECT_EQ(a.get_estimate(), b.get_estimate());
+
+  // the serialized sketch holds the flushed counts
+  auto serialized_bytes = b.serialize();
+  auto c = update_theta_sketch_dup::deserialize(serialized_bytes.data(),
+                                                serialized_bytes.size());
+  EXPECT_EQ(a.get_estimate(), c.get_estimate());
+}
+
+TEST(CoalescingThetaSketchDup, TestEstimateWithinSketchBounds) {
+  // @a: theta sketch updated directly
+  // @b: the same theta sketch updated through a cache of 2^4 slots
+  // in estimation mode the order of the updates reaching the sketch differs,
+  // so @b only has to estimate within the bounds of @a
+  auto a = update_theta_sketch_dup::builder().set_lg_k(10).build();
+  coalescing_theta_sketch_dup b(
+      update_theta_sketch_dup::builder().set_lg_k(10).build(), 4);
+  std::mt19937 gen(1);
+  std::geometric_distribution<int> d(0.001);
+  for (int i = 0; i < 100000; i++) {
+    int x = d(gen);
+    a.update(x);
+    b.update(x);
+  }
+  EXPECT_TRUE(a.is_estimation_mode());
+  EXPECT_TRUE(b.is_estimation_mode());
+  EXPECT_GE(b.get_estimate(), a.get_lower_bound(2));
+  EXPECT_LE(b.get_estimate(), a.get_upper_bound(2));
+}
+
+TEST(CoalescingThetaSketchDup, TestRemove) {
+  // @a: theta sketch updated through a cache of 2^2 slots
+  // every element is inserted 3 times and removed 3 times, except for the
+  // first 10 elements, so the result is exact
+  coalescing_theta_sketch_dup a(
+      update_theta_sketch_dup::builder().set_lg_k(5).build(), 2);
+  for (int i = 0; i < 20; i++)
+    for (int j = 0; j < 3; j++) a.update(i);
+  for (int i = 10; i < 20; i++)
+    for (int j = 0; j < 3; j++) a.remove(i);
+  EXPECT_EQ(a.get_estimate(), 10);
+  EXPECT_EQ(a.get_sketch().get_num_retained(), 10);
+
+  // removing more than inserted is reported when the counts are flushed
+  a.remove(0);
+  a.remove(0);
+  a.remove(0);
+  a.remove(0);
+  EXPECT_THROW(a.flush(), std::logic_error);
+
+  // the refused remove is dropped and the rest of the cache is applied
+  a.remove(1);
+  a.remove(2);
+  a.remove(2);
+  a.remove(2);
+  a.remove(2);
+  EXPECT_THROW(a.flush(), std::logic_error);
+  a.flush();
+  EXPECT_EQ(a.get_estimate(), 10);
+  uint64_t num_zeros = 0;
+  int64_t count = 0;
+  for (const auto& entry : a) {
+    if (entry.second == 0) num_zeros++;
+    count += entry.second;
+  }
+  EXPECT_EQ(num_zeros, 10u);
+  EXPECT_EQ(count, 3 * 10 - 1);
+}
+
+TEST(CoalescingThetaSketchDup, TestRemoveFromEmpty) {
+  coalescing_theta_sketch_dup a(
+      update_theta_sketch_dup::builder().set_lg_k(5).build());
+  EXPECT_THROW(a.remove(1), std::logic_error);
+  a.update(1);
+  a.remove(1);
+  EXPECT_FALSE(a.is_empty());
+  EXPECT_EQ(a.get_estimate(), 0);
+}
+
+}  // namespace datasketches
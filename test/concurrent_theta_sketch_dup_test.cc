@@ -0,0 +1,92 @@
+#include "concurrent_theta_sketch_dup.h"
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+
+namespace datasketches {
+
+TEST(ConcurrentThetaSketchDup, TestExactMode) {
+  auto builder = update_theta_sketch_dup::builder().set_lg_k(16);
+  concurrent_theta_sketch_dup sketch(builder);
+  auto local = builder.build();
+  EXPECT_TRUE(sketch.is_empty());
+  EXPECT_THROW(sketch.remove(1), std::logic_error);
+  auto robin_hood = builder;
+  robin_hood.set_probing(update_theta_sketch_dup::ROBIN_HOOD);
+  EXPECT_THROW(concurrent_theta_sketch_dup{robin_hood}, std::invalid_argument);
+
+  const int num_threads = 8;
+  const int num_keys = 20000;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < num_threads; t++) {
+    // every thread adds every key, through the resizes of the table
+    threads.emplace_back([&sketch]() {
+      for (int i = 0; i < num_keys; i++) sketch.update(i);
+    });
+  }
+  for (auto& thread : threads) thread.join();
+  for (int t = 0; t < num_threads; t++)
+    for (int i = 0; i < num_keys; i++) local.update(i);
+  EXPECT_GT(sketch.get_num_migrations(), 0);
+  EXPECT_FALSE(sketch.is_estimation_mode());
+  EXPECT_EQ(sketch.get_estimate(), num_keys);
+  EXPECT_EQ(sketch.get_result(), local);
+
+  // the threads remove all the copies of the even keys
+  threads.clear();
+  for (int t = 0; t < num_threads; t++) {
+    threads.emplace_back([&sketch]() {
+      for (int i = 0; i < num_keys; i += 2) sketch.remove(i);
+    });
+  }
+  for (auto& thread : threads) thread.join();
+  EXPECT_EQ(sketch.get_num_retained(), num_keys / 2);
+  EXPECT_THROW(sketch.remove(0), std::logic_error);
+  for (int t = 0; t < num_threads; t++)
+    for (int i = 0; i < num_keys; i += 2) local.remove(i);
+  EXPECT_EQ(sketch.get_result().get_stats().zeros_ratio,
+            local.get_stats().zeros_ratio);
+  const auto bytes = sketch.serialize();
+  const auto result =
+      update_theta_sketch_dup::deserialize(bytes.data(), bytes.size());
+  EXPECT_EQ(result.get_estimate(), num_keys / 2);
+  EXPECT_EQ(result, local);
+  // the removed keys stay with count 0, as in the table of local
+  int num_zeros = 0;
+  for (const auto& entry : result) {
+    if (entry.second == 0)
+      num_zeros++;
+    else
+      EXPECT_EQ(entry.second, num_threads);
+  }
+  EXPECT_EQ(num_zeros, num_keys / 2);
+}
+
+TEST(ConcurrentThetaSketchDup, TestEstimationMode) {
+  auto builder = update_theta_sketch_dup::builder().set_lg_k(10);
+  concurrent_theta_sketch_dup sketch(builder);
+  const int num_threads = 8;
+  const int num_keys = 50000;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < num_threads; t++) {
+    // the keys of a thread are shared with the next thread, in another order
+    threads.emplace_back([&sketch, t]() {
+      for (int i = 0; i < 2 * num_keys; i++)
+        sketch.update((t * num_keys + i * 7919) % (num_threads * num_keys));
+    });
+  }
+  for (auto& thread : threads) thread.join();
+
+  EXPECT_TRUE(sketch.is_estimation_mode());
+  EXPECT_LE(sketch.get_lower_bound(3), num_threads * num_keys);
+  EXPECT_GE(sketch.get_upper_bound(3), num_threads * num_keys);
+  const auto result = sketch.get_result();
+  EXPECT_EQ(result.get_num_retained(), sketch.get_num_retained());
+  EXPECT_EQ(result.get_theta64(), sketch.get_theta64());
+  for (const auto& entry : result) {
+    EXPECT_LT(entry.first, sketch.get_theta64());
+    EXPECT_GT(entry.second, 0);
+  }
+}
+
+}  // namespace datasketches
@@ -0,0 +1,112 @@
+#include "fixed_theta_sketch_dup.h"
+#include <gtest/gtest.h>
+#include <cstring>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace datasketches {
+
+TEST(FixedThetaSketchDup, TestExactMode) {
+  fixed_theta_sketch_dup<10> sketch;
+  auto local = update_theta_sketch_dup::builder().set_lg_k(10).build();
+  EXPECT_TRUE(sketch.is_empty());
+  EXPECT_THROW(sketch.remove(1), std::logic_error);
+  for (int i = 0; i < 1000; i++) {
+    sketch.update(i % 600);
+    local.update(i % 600);
+  }
+  sketch.update(std::string("element"));
+  local.update(std::string("element"));
+  sketch.update(-0.0);
+  local.update(-0.0);
+  for (int i = 0; i < 200; i++) {
+    sketch.remove(i % 100);
+    local.remove(i % 100);
+  }
+  EXPECT_THROW(sketch.remove(1), std::logic_error);
+  EXPECT_THROW(sketch.remove(5000), std::logic_error);
+  EXPECT_FALSE(sketch.is_estimation_mode());
+  EXPECT_EQ(sketch.get_num_retained(), local.get_num_retained());
+  EXPECT_EQ(sketch.get_estimate(), 502);
+  EXPECT_EQ(sketch.to_sketch(), local);
+
+  // the serialized forms are read by both sketches
+  const auto bytes = sketch.serialize();
+  EXPECT_EQ(update_theta_sketch_dup::deserialize(bytes.data(), bytes.size()),
+            local);
+  const auto local_bytes = local.serialize();
+  auto copy = fixed_theta_sketch_dup<10>::deserialize(local_bytes.data(),
+                                                      local_bytes.size());
+  EXPECT_EQ(copy.to_sketch(), local);
+  std::stringstream s;
+  sketch.serialize(s);
+  EXPECT_EQ(update_theta_sketch_dup::deserialize(s), local);
+  // the stream form is the one of update_theta_sketch_dup byte for byte
+  std::stringstream fixed_stream, update_stream;
+  sketch.serialize(fixed_stream);
+  sketch.to_sketch().serialize(update_stream);
+  EXPECT_EQ(fixed_stream.str(), update_stream.str());
+  EXPECT_THROW(fixed_theta_sketch_dup<11>::deserialize(bytes.data(),
+                                                       bytes.size()),
+               std::invalid_argument);
+
+  copy.reset();
+  EXPECT_TRUE(copy.is_empty());
+  EXPECT_EQ(copy.get_num_retained(), 0u);
+}
+
+TEST(FixedThetaSketchDup, TestEstimationMode) {
+  fixed_theta_sketch_dup<9> sketch;
+  auto local = update_theta_sketch_dup::builder().set_lg_k(9).build();
+  theta_sketch_dup_hasher hasher;
+  std::vector<theta_sketch_dup_key> keys;
+  for (int i = 0; i < 20000; i++) keys.push_back(hasher.hash(i % 15000));
+  sketch.update(keys.data(), keys.size());
+  local.update(keys.data(), keys.size());
+  // the rebuilds in place keep the same theta and entries
+  EXPECT_TRUE(sketch.is_estimation_mode());
+  EXPECT_EQ(sketch.get_theta64(), local.get_theta64());
+  EXPECT_EQ(sketch.to_sketch(), local);
+  EXPECT_EQ(sketch.get_estimate(), local.get_estimate());
+  EXPECT_EQ(sketch.get_lower_bound(2), local.get_lower_bound(2));
+  EXPECT_EQ(sketch.get_upper_bound(2), local.get_upper_bound(2));
+  uint32_t num_live = 0;
+  sketch.for_each_live([&](uint64_t hash, int64_t count) {
+    EXPECT_LT(hash, sketch.get_theta64());
+    EXPECT_GT(count, 0);
+    num_live++;
+  });
+  EXPECT_EQ(num_live, sketch.get_num_retained());
+
+  // every retained entry is found after the rebuilds
+  for (const auto& key : keys) {
+    if (key.hash < sketch.get_theta64()) sketch.remove(key);
+  }
+  EXPECT_EQ(sketch.get_num_retained(), 0u);
+
+  theta_sketch_dup_hasher other(DEFAULT_SEED + 1);
+  EXPECT_THROW(sketch.update(other.hash(1)), std::invalid_argument);
+}
+
+TEST(FixedThetaSketchDup, TestRelocation) {
+  struct holder {
+    int id;
+    fixed_theta_sketch_dup<6> sketch;
+  };
+  holder a{1, fixed_theta_sketch_dup<6>()};
+  for (int i = 0; i < 300; i++) a.sketch.update(i);
+  // moved as raw bytes
+  std::unique_ptr<holder> b(new holder{2, fixed_theta_sketch_dup<6>()});
+  std::memcpy(static_cast<void*>(b.get()), &a, sizeof(holder));
+  EXPECT_EQ(b->id, 1);
+  EXPECT_EQ(b->sketch.to_sketch(), a.sketch.to_sketch());
+  for (int i = 300; i < 600; i++) {
+    a.sketch.update(i);
+    b->sketch.update(i);
+  }
+  EXPECT_EQ(b->sketch.to_sketch(), a.sketch.to_sketch());
+}
+
+}  // namespace datasketches
@@ -0,0 +1,118 @@
+#include "grouped_theta_sketch_dup.h"
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace datasketches {
+
+TEST(GroupedThetaSketchDup, TestSmallGroups) {
+  // @a: 1000 groups with 3 distinct elements each, all kept in compact form
+  grouped_theta_sketch_dup<int> a;
+  for (int g = 0; g < 1000; g++)
+    for (int i = 0; i < 3; i++) a.update(g, i);
+  for (int g = 0; g < 1000; g++) a.remove(g, 0);
+  EXPECT_EQ(a.size(), 1000);
+  for (int g = 0; g < 1000; g++) EXPECT_EQ(a.get_estimate(g), 2);
+  EXPECT_EQ(a.get_estimate(1000), 0);
+  EXPECT_FALSE(a.contains(1000));
+  EXPECT_THROW(a.remove(0, 0), std::logic_error);
+  EXPECT_THROW(a.remove(1000, 0), std::logic_error);
+
+  // the compact form expands into the same sketch
+  auto b = update_theta_sketch_dup::builder().build();
+  b.update(1);
+  b.update(2);
+  EXPECT_EQ(a.get_result(7).get_estimate(), b.get_estimate());
+}
+
+TEST(GroupedThetaSketchDup, TestPromotedGroups) {
+  // @a: groups "x" and "y" get enough elements to be promoted
+  // @b, @c: the sketches of "x" and "y" built directly
+  auto builder = update_theta_sketch_dup::builder().set_lg_k(10);
+  grouped_theta_sketch_dup<std::string> a(builder);
+  auto b = builder.build();
+  auto c = builder.build();
+  std::vector<std::string> groups;
+  std::vector<int> values;
+  for (int i = 0; i < 10000; i++) {
+    groups.push_back("x");
+    values.push_back(i);
+    b.update(i);
+    if (i % 2 == 0) {
+      groups.push_back("y");
+      values.push_back(i);
+      c.update(i);
+    }
+  }
+  a.update(groups.data(), values.data(), values.size());
+  for (int i = 0; i < 1000; i++) {
+    a.remove(std::string("x"), i);
+    b.remove(i);
+  }
+  EXPECT_EQ(a.get_estimate("x"), b.get_estimate());
+  EXPECT_EQ(a.get_upper_bound("x", 2), b.get_upper_bound(2));
+  EXPECT_EQ(a.get_estimate("y"), c.get_estimate());
+  EXPECT_EQ(a.get_result("y"), c);
+}
+
+TEST(GroupedThetaSketchDup, TestRemovedElements) {
+  // @a: group 0 removes 2 of its 4 elements down to count 0 before it gets a
+  // fifth, group 1 does the same with ROBIN_HOOD probing
+  // @b, @c: the same sketches built directly
+  for (auto policy : {update_theta_sketch_dup::DOUBLE_HASHING,
+                      update_theta_sketch_dup::ROBIN_HOOD}) {
+    auto builder = update_theta_sketch_dup::builder().set_probing(policy);
+    grouped_theta_sketch_dup<int> a(builder);
+    auto b = builder.build();
+    for (int i = 1; i <= 4; i++) {
+      a.update(0, i);
+      b.update(i);
+    }
+    for (int i = 1; i <= 2; i++) {
+      a.remove(0, i);
+      b.remove(i);
+    }
+    EXPECT_EQ(a.get_estimate(0), 2);
+    EXPECT_EQ(a.get_result(0).get_stats().zeros_ratio,
+              b.get_stats().zeros_ratio);
+    EXPECT_THROW(a.remove(0, 1), std::logic_error);
+    a.update(0, 5);
+    b.update(5);
+    EXPECT_EQ(a.get_estimate(0), 3);
+    EXPECT_EQ(a.get_result(0), b);
+    EXPECT_EQ(a.get_result(0).get_stats().zeros_ratio,
+              b.get_stats().zeros_ratio);
+    a.update(0, 1);
+    b.update(1);
+    EXPECT_EQ(a.get_result(0), b);
+  }
+}
+
+TEST(GroupedThetaSketchDup, TestMemoryBudget) {
+  // @a: 10 groups, groups 0 and 1 are promoted to full sketches
+  // @b: the same groups with the memory used by @a as the budget, so that
+  // group 2 can't be promoted
+  auto builder = update_theta_sketch_dup::builder().set_lg_k(5);
+  grouped_theta_sketch_dup<int> a(builder);
+  for (int g = 0; g < 10; g++) a.update(g, 0);
+  for (int i = 0; i < 100; i++) a.update(0, i);
+  for (int i = 0; i < 100; i++) a.update(1, i);
+
+  grouped_theta_sketch_dup<int> b(builder, a.get_memory_usage_bytes());
+  for (int g = 0; g < 10; g++) b.update(g, 0);
+  for (int i = 0; i < 100; i++) b.update(0, i);
+  for (int i = 0; i < 100; i++) b.update(1, i);
+  EXPECT_EQ(b.get_estimate(1), a.get_estimate(1));
+  EXPECT_THROW(for (int i = 0; i < 100; i++) b.update(2, i),
+               std::length_error);
+  EXPECT_LE(b.get_memory_usage_bytes(), b.get_max_memory_bytes());
+  EXPECT_EQ(b.get_estimate(2),
+            grouped_theta_sketch_dup<int>::COMPACT_CAPACITY);
+  // new groups still fit into the memory reserved for 16 groups
+  for (int g = 10; g < 16; g++) b.update(g, 0);
+  EXPECT_THROW(b.update(16, 0), std::length_error);
+  EXPECT_FALSE(b.contains(16));
+}
+
+}  // namespace datasketches
@@ -0,0 +1,91 @@
+#include "huge_page_allocator.h"
+#include <gtest/gtest.h>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "theta_sketch_dup.h"
+
+namespace datasketches {
+
+TEST(HugePageAllocator, TestBlocks) {
+  huge_page_allocator<uint64_t> allocator;
+  // a small block comes from operator new
+  uint64_t* small = allocator.allocate(16);
+  small[15] = 1;
+  allocator.deallocate(small, 16);
+
+  // a large block is mapped, aligned to a huge page, on some backing
+  uint64_t before = 0;
+  for (int b = 0; b < huge_page_stats::NUM_BACKINGS; b++)
+    before += huge_page_stats::get_mapped_bytes(
+        static_cast<huge_page_stats::backing>(b));
+  const size_t n = 3 * huge_page_allocator<uint64_t>::HUGE_PAGE_BYTES / 8 + 1;
+  uint64_t* large = allocator.allocate(n);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(large) %
+                huge_page_allocator<uint64_t>::HUGE_PAGE_BYTES,
+            0u);
+  std::memset(large, 0xff, n * sizeof(uint64_t));
+  EXPECT_EQ(large[n - 1], UINT64_MAX);
+  allocator.deallocate(large, n);
+  uint64_t after = 0;
+  for (int b = 0; b < huge_page_stats::NUM_BACKINGS; b++)
+    after += huge_page_stats::get_mapped_bytes(
+        static_cast<huge_page_stats::backing>(b));
+  EXPECT_EQ(after - before, 4 * huge_page_allocator<uint64_t>::HUGE_PAGE_BYTES);
+
+  EXPECT_THROW(allocator.allocate(SIZE_MAX / 4), std::bad_alloc);
+}
+
+TEST(HugePageAllocator, TestGiganticLength) {
+  typedef huge_page_allocator<uint8_t> allocator_type;
+  allocator_type allocator;
+  // a block just past 1 GB is rounded to 1 GB only if it is on 1 GB pages
+  const uint64_t gigantic_before =
+      huge_page_stats::get_mapped_bytes(huge_page_stats::GIGANTIC);
+  uint64_t before = 0;
+  for (int b = 0; b < huge_page_stats::NUM_BACKINGS; b++)
+    before += huge_page_stats::get_mapped_bytes(
+        static_cast<huge_page_stats::backing>(b));
+  const size_t n = allocator_type::GIGANTIC_PAGE_BYTES + 1;
+  uint8_t* block = allocator.allocate(n);
+  block[n - 1] = 1;
+  allocator.deallocate(block, n);
+  uint64_t after = 0;
+  for (int b = 0; b < huge_page_stats::NUM_BACKINGS; b++)
+    after += huge_page_stats::get_mapped_bytes(
+        static_cast<huge_page_stats::backing>(b));
+  if (huge_page_stats::get_mapped_bytes(huge_page_stats::GIGANTIC) !=
+      gigantic_before) {
+    EXPECT_EQ(after - before, 2 * allocator_type::GIGANTIC_PAGE_BYTES);
+  } else {
+    EXPECT_EQ(after - before, allocator_type::GIGANTIC_PAGE_BYTES +
+                                  allocator_type::HUGE_PAGE_BYTES);
+  }
+}
+
+TEST(HugePageAllocator, TestSketch) {
+  // the table of lg_k 16 grows past a huge page
+  auto sketch = update_theta_sketch_dup_alloc<huge_page_allocator<void>>::
+                    builder()
+                        .set_lg_k(16)
+                        .build();
+  auto local = update_theta_sketch_dup::builder().set_lg_k(16).build();
+  for (int i = 0; i < 200000; i++) {
+    sketch.update(i % 150000);
+    local.update(i % 150000);
+  }
+  for (int i = 0; i < 1000; i++) {
+    sketch.remove(i);
+    local.remove(i);
+  }
+  EXPECT_EQ(sketch.get_estimate(), local.get_estimate());
+  const auto bytes = sketch.serialize();
+  const auto local_bytes = local.serialize();
+  EXPECT_EQ(std::vector<uint8_t>(bytes.begin(), bytes.end()),
+            std::vector<uint8_t>(local_bytes.begin(), local_bytes.end()));
+
+  auto copy = sketch;
+  EXPECT_EQ(copy, sketch);
+}
+
+}  // namespace datasketches
@@ -0,0 +1,87 @@
+#include "numa_theta_sketch_dup.h"
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+namespace datasketches {
+
+TEST(NumaThetaSketchDup, TestAllocator) {
+  const numa_topology& topology = numa_topology::get();
+  ASSERT_GE(topology.get_num_nodes(), 1);
+  EXPECT_FALSE(topology.get_cpus(0).empty());
+  EXPECT_LT(topology.get_current_node(), topology.get_num_nodes());
+
+  // a table large enough to be mapped, under every placement
+  for (auto policy : {numa_placement::FIRST_TOUCH, numa_placement::BIND,
+                      numa_placement::INTERLEAVE}) {
+    numa_placement placement(policy, topology.get_num_nodes() - 1);
+    EXPECT_EQ(numa_placement::get_policy(), policy);
+    auto sketch = update_theta_sketch_dup_alloc<numa_allocator<void>>::builder()
+                      .set_lg_k(16)
+                      .build();
+    auto local = update_theta_sketch_dup::builder().set_lg_k(16).build();
+    for (int i = 0; i < 100000; i++) {
+      sketch.update(i);
+      local.update(i);
+    }
+    EXPECT_EQ(sketch.get_estimate(), local.get_estimate());
+  }
+  EXPECT_EQ(numa_placement::get_policy(), numa_placement::FIRST_TOUCH);
+}
+
+TEST(NumaThetaSketchDup, TestShards) {
+  numa_theta_sketch_dup sketch(numa_theta_sketch_dup::builder().set_lg_k(12),
+                               3);
+  EXPECT_EQ(sketch.get_num_shards(), 3 * numa_topology::get().get_num_nodes());
+  auto local = numa_theta_sketch_dup::builder().set_lg_k(12).build();
+
+  std::vector<theta_sketch_dup_key> keys;
+  for (int i = 0; i < 3000; i++) keys.push_back(sketch.get_hasher().hash(i));
+  sketch.update(keys.data(), keys.size());
+  sketch.update(keys.data(), keys.size());
+  sketch.remove(keys.data(), 1000);
+  local.update(keys.data(), keys.size());
+  local.update(keys.data(), keys.size());
+  local.remove(keys.data(), 1000);
+  // exact mode: the union of the shards is the sketch of the stream
+  auto result = sketch.get_result();
+  EXPECT_EQ(result, local);
+
+  // estimation mode
+  keys.clear();
+  for (int i = 3000; i < 100000; i++)
+    keys.push_back(sketch.get_hasher().hash(i));
+  sketch.update(keys.data(), keys.size());
+  result = sketch.get_result();
+  EXPECT_TRUE(result.is_estimation_mode());
+  EXPECT_LE(result.get_lower_bound(3), 100000);
+  EXPECT_GE(result.get_upper_bound(3), 100000);
+
+  // a refused remove is reported by the next flush, and only by it
+  auto key = keys.begin();
+  while (key->hash >= result.get_theta64()) ++key;
+  const std::vector<theta_sketch_dup_key> twice(2, *key);
+  sketch.remove(twice.data(), twice.size());
+  EXPECT_THROW(sketch.flush(), std::logic_error);
+  EXPECT_NO_THROW(sketch.flush());
+
+  // the removes after a refused one are applied, and every refused remove
+  // is counted
+  std::vector<theta_sketch_dup_key> removes;
+  for (++key; removes.size() < 6; ++key) {
+    if (key->hash >= result.get_theta64()) continue;
+    removes.push_back(*key);
+    removes.push_back(*key);
+  }
+  const uint32_t num_retained = sketch.get_result().get_num_retained();
+  sketch.remove(removes.data(), removes.size());
+  try {
+    sketch.flush();
+    FAIL();
+  } catch (const std::logic_error& e) {
+    EXPECT_EQ(std::string(e.what()).find("3 operations failed"), 0u);
+  }
+  EXPECT_EQ(sketch.get_result().get_num_retained(), num_retained - 3);
+}
+
+}  // namespace datasketches
@@ -0,0 +1,115 @@
+#include "shared_theta_sketch_dup.h"
+#include <gtest/gtest.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+namespace datasketches {
+
+// @return a segment name of this test process
+static std::string make_name(const std::string& test) {
+  return "/theta_dup_" + test + "_" + std::to_string(getpid());
+}
+
+TEST(SharedThetaSketchDup, TestUpdateRemove) {
+  const std::string name = make_name("update_remove");
+  auto builder = update_theta_sketch_dup::builder().set_lg_k(10);
+  auto local = builder.build();
+  {
+    shared_theta_sketch_dup shared(name, builder);
+    EXPECT_TRUE(shared.is_empty());
+    EXPECT_EQ(shared.get_estimate(), 0);
+    for (int i = 0; i < 10000; i++) {
+      shared.update(i);
+      local.update(i);
+    }
+    for (int i = 0; i < 10000; i += 3) {
+      const auto key = shared.get_hasher().hash(i);
+      shared.remove(key);
+      local.remove(key);
+    }
+    // a removed key retained by the sketch can't be removed again
+    int removed = 0;
+    while (shared.get_hasher().hash(removed).hash >= local.get_theta64())
+      removed += 3;
+    EXPECT_THROW(shared.remove(removed), std::logic_error);
+    // one process resizes and rebuilds as the local sketch does
+    EXPECT_EQ(shared.get_theta64(), local.get_theta64());
+    EXPECT_EQ(shared.get_num_retained(), local.get_num_retained());
+    EXPECT_EQ(shared.get_estimate(), local.get_estimate());
+    EXPECT_EQ(shared.get_lower_bound(2), local.get_lower_bound(2));
+    EXPECT_EQ(shared.get_result(), local);
+    EXPECT_EQ(shared.get_result().get_stats().zeros_ratio,
+              local.get_stats().zeros_ratio);
+    const auto bytes = shared.serialize();
+    EXPECT_EQ(update_theta_sketch_dup::deserialize(bytes.data(), bytes.size()),
+              local);
+  }
+  // the segment outlives the processes attached to it
+  shared_theta_sketch_dup attached(name, builder);
+  EXPECT_EQ(attached.get_result(), local);
+  EXPECT_THROW(shared_theta_sketch_dup(name, update_theta_sketch_dup::builder()),
+               std::invalid_argument);
+  auto robin_hood = builder;
+  robin_hood.set_probing(update_theta_sketch_dup::ROBIN_HOOD);
+  EXPECT_THROW(shared_theta_sketch_dup(name, robin_hood),
+               std::invalid_argument);
+  EXPECT_TRUE(shared_theta_sketch_dup::unlink(name));
+  EXPECT_FALSE(shared_theta_sketch_dup::unlink(name));
+}
+
+TEST(SharedThetaSketchDup, TestDeadCreator) {
+  // a creator that died after sizing the segment, before initializing it
+  const std::string name = make_name("dead_creator");
+  const int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ(ftruncate(fd, 1 << 20), 0);
+  close(fd);
+  shared_theta_sketch_dup shared(name);
+  EXPECT_TRUE(shared.is_empty());
+  shared.update(1);
+  EXPECT_EQ(shared.get_estimate(), 1);
+  shared_theta_sketch_dup attached(name);
+  EXPECT_EQ(attached.get_estimate(), 1);
+  EXPECT_TRUE(shared_theta_sketch_dup::unlink(name));
+}
+
+TEST(SharedThetaSketchDup, TestProcesses) {
+  const std::string name = make_name("processes");
+  auto builder = update_theta_sketch_dup::builder().set_lg_k(12);
+  const int num_processes = 4;
+  const int num_keys = 20000;
+  std::vector<pid_t> children;
+  for (int p = 0; p < num_processes; p++) {
+    const pid_t pid = fork();
+    ASSERT_GE(pid, 0);
+    if (pid == 0) {
+      // every process adds every key, and its own keys twice, through resizes
+      // and rebuilds done by any of them
+      shared_theta_sketch_dup shared(name, builder);
+      for (int i = 0; i < num_keys; i++) shared.update(i);
+      for (int i = p; i < num_keys; i += num_processes) shared.update(i);
+      _exit(0);
+    }
+    children.push_back(pid);
+  }
+  for (pid_t pid : children) {
+    int status;
+    ASSERT_EQ(waitpid(pid, &status, 0), pid);
+    ASSERT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  }
+
+  shared_theta_sketch_dup shared(name, builder);
+  EXPECT_TRUE(shared.is_estimation_mode());
+  EXPECT_LE(shared.get_lower_bound(3), num_keys);
+  EXPECT_GE(shared.get_upper_bound(3), num_keys);
+  const auto result = shared.get_result();
+  EXPECT_EQ(result.get_num_retained(), shared.get_num_retained());
+  for (const auto& entry : result) EXPECT_EQ(entry.second, num_processes + 1);
+  shared_theta_sketch_dup::unlink(name);
+}
+
+}  // namespace datasketches
@@ -0,0 +1,72 @@
+#include "theta_sketch_dup_converter.h"
+#include <gtest/gtest.h>
+#include "theta_intersection.hpp"
+#include "theta_union.hpp"
+
+namespace datasketches {
+
+TEST(ThetaSketchDupConverter, TestToCompact) {
+  // @a: dup sketch with elements [0, 10000) and [0, 1000) removed
+  // @b: classic sketch with elements [1000, 10000)
+  auto a = update_theta_sketch_dup::builder().set_lg_k(12).build();
+  auto b = update_theta_sketch::builder().set_lg_k(12).build();
+  for (int i = 0; i < 10000; i++) a.update(i);
+  for (int i = 0; i < 1000; i++) a.remove(i);
+  for (int i = 1000; i < 10000; i++) b.update(i);
+  compact_theta_sketch c = theta_sketch_dup_converter::to_compact(a);
+  EXPECT_TRUE(c.is_ordered());
+  EXPECT_EQ(c.get_num_retained(), a.get_num_retained());
+  EXPECT_EQ(c.get_theta64(), a.get_theta64());
+  EXPECT_EQ(c.get_estimate(), a.get_estimate());
+
+  theta_intersection intersection;
+  intersection.update(c);
+  intersection.update(b);
+  EXPECT_NEAR(intersection.get_result().get_estimate(), 9000, 9000 * 0.05);
+  theta_union u = theta_union::builder().set_lg_k(12).build();
+  u.update(theta_sketch_dup_converter::to_compact(a, false));
+  u.update(b);
+  EXPECT_NEAR(u.get_result().get_estimate(), 9000, 9000 * 0.05);
+
+  auto empty = update_theta_sketch_dup::builder().build();
+  EXPECT_TRUE(theta_sketch_dup_converter::to_compact(empty).is_empty());
+}
+
+TEST(ThetaSketchDupConverter, TestFromTheta) {
+  // @a: classic sketch, @b: its conversion, @c: dup sketch with the same
+  // elements
+  auto a = update_theta_sketch::builder().set_lg_k(10).build();
+  auto c = update_theta_sketch_dup::builder().set_lg_k(10).build();
+  for (int i = 0; i < 5000; i++) {
+    a.update(i);
+    c.update(i);
+  }
+  auto b = theta_sketch_dup_converter::from_theta(
+      a, update_theta_sketch_dup::builder().set_lg_k(10));
+  EXPECT_EQ(b.get_theta64(), a.get_theta64());
+  EXPECT_EQ(b.get_num_retained(), a.get_num_retained());
+  EXPECT_EQ(b.get_estimate(), a.get_estimate());
+  for (const auto& entry : b) EXPECT_EQ(entry.second, 1);
+  // the converted entries count further updates and removes
+  const theta_sketch_dup_key key{(*b.begin()).first, b.get_seed_hash()};
+  b.remove(key);
+  EXPECT_EQ(b.get_num_retained(), a.get_num_retained() - 1);
+  EXPECT_THROW(b.remove(key), std::logic_error);
+  b.update(key);
+  b.update(key);
+  EXPECT_EQ(b.get_num_retained(), a.get_num_retained());
+  for (const auto& entry : b)
+    EXPECT_EQ(entry.second, entry.first == key.hash ? 2 : 1);
+
+  // a smaller sketch rebuilds to its nominal size
+  auto d = theta_sketch_dup_converter::from_theta(
+      a, update_theta_sketch_dup::builder().set_lg_k(6));
+  EXPECT_LT(d.get_theta64(), a.get_theta64());
+  EXPECT_NEAR(d.get_estimate(), 5000, 5000 * 0.5);
+
+  auto e = update_theta_sketch::builder().set_seed(1).build();
+  EXPECT_THROW(theta_sketch_dup_converter::from_theta(e),
+               std::invalid_argument);
+}
+
+}  // namespace datasketches
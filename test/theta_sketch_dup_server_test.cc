@@ -0,0 +1,95 @@
+#include "theta_sketch_dup_server.h"
+#include <gtest/gtest.h>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace datasketches {
+
+// @return a path for a socket under the test temporary directory
+static std::string make_socket_path() {
+  const char* tmp = std::getenv("TEST_TMPDIR");
+  std::string path = std::string(tmp ? tmp : "/tmp") + "/server_XXXXXX";
+  if (mkdtemp(&path[0]) == nullptr) throw std::runtime_error("mkdtemp");
+  return path + "/sketches.sock";
+}
+
+TEST(ThetaSketchDupServer, TestUpdateRemove) {
+  theta_sketch_dup_server server(
+      update_theta_sketch_dup::builder().set_lg_k(10), 2);
+  const std::string path = make_socket_path();
+  server.listen_unix(path);
+  theta_sketch_dup_client client;
+  client.connect_unix(path);
+
+  auto users = update_theta_sketch_dup::builder().set_lg_k(10).build();
+  std::vector<theta_sketch_dup_key> keys;
+  for (int i = 0; i < 5000; i++) keys.push_back(client.get_hasher().hash(i));
+  client.update("users", keys.data(), keys.size());
+  users.update(keys.data(), keys.size());
+  client.remove("users", keys.data(), 1000);
+  users.remove(keys.data(), 1000);
+
+  double lower_bound, upper_bound;
+  EXPECT_EQ(client.get_estimate("users", 2, &lower_bound, &upper_bound),
+            users.get_estimate());
+  EXPECT_EQ(lower_bound, users.get_lower_bound(2));
+  EXPECT_EQ(upper_bound, users.get_upper_bound(2));
+  const auto bytes = client.get_serialized("users");
+  EXPECT_EQ(update_theta_sketch_dup::deserialize(bytes.data(), bytes.size()),
+            users);
+
+  // a refused remove keeps the removes before it
+  client.update("pair", keys.data(), 2);
+  const theta_sketch_dup_key twice[2] = {keys[0], keys[0]};
+  EXPECT_THROW(client.remove("pair", twice, 2), std::logic_error);
+  EXPECT_EQ(client.get_estimate("pair"), 1);
+
+  EXPECT_THROW(client.get_estimate("missing"), std::out_of_range);
+  EXPECT_THROW(client.remove("missing", keys.data(), 1), std::out_of_range);
+  EXPECT_THROW(client.get_estimate("users", 4), std::invalid_argument);
+  theta_sketch_dup_client other_seed(DEFAULT_SEED + 1);
+  other_seed.connect_unix(path);
+  const auto key = other_seed.get_hasher().hash(1);
+  EXPECT_THROW(other_seed.update("users", &key, 1), std::invalid_argument);
+}
+
+TEST(ThetaSketchDupServer, TestClients) {
+  theta_sketch_dup_server server(
+      update_theta_sketch_dup::builder().set_lg_k(14), 4);
+  const uint16_t port = server.listen_tcp(0);
+  const int num_clients = 4;
+  const int num_keys = 1000;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < num_clients; t++) {
+    threads.emplace_back([port, t]() {
+      theta_sketch_dup_client client;
+      client.connect_tcp(port);
+      std::vector<theta_sketch_dup_key> keys;
+      for (int i = 0; i < num_keys; i++)
+        keys.push_back(client.get_hasher().hash(t * num_keys + i));
+      // one sketch of the client and one shared by all the clients
+      client.update("client" + std::to_string(t), keys.data(), keys.size());
+      for (int i = 0; i < num_keys; i += 100)
+        client.update("all", keys.data() + i, 100);
+    });
+  }
+  for (auto& thread : threads) thread.join();
+  // short connections, closed ones are joined by the ones that follow
+  for (int i = 0; i < 100; i++) {
+    theta_sketch_dup_client client;
+    client.connect_tcp(port);
+    EXPECT_EQ(client.get_estimate("all"), num_clients * num_keys);
+  }
+
+  theta_sketch_dup_client client;
+  client.connect_tcp(port);
+  for (int t = 0; t < num_clients; t++)
+    EXPECT_EQ(client.get_estimate("client" + std::to_string(t)), num_keys);
+  EXPECT_EQ(client.get_estimate("all"), num_clients * num_keys);
+  server.stop();
+  EXPECT_THROW(client.get_estimate("all"), std::exception);
+}
+
+}  // namespace datasketches
@@ -0,0 +1,137 @@
+#include "theta_sketch_dup_snapshot.h"
+#include <gtest/gtest.h>
+#include <atomic>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+namespace datasketches {
+
+TEST(ThetaSketchDupSnapshot, TestCopyOnWrite) {
+  // @a: sketch at its full size of 2^11 slots, so 8 pages
+  auto a = update_theta_sketch_dup::builder()
+               .set_lg_k(10)
+               .set_expected_cardinality(5000)
+               .build();
+  for (int i = 0; i < 500; i++) a.update(i);
+  const size_t untracked_bytes = a.get_memory_usage_bytes();
+  theta_sketch_dup_snapshot s1(a);
+  EXPECT_EQ(s1.get_num_pages(), 8);
+  // the tracking is counted with the sketch, the page copies are not
+  EXPECT_GT(a.get_memory_usage_bytes(), untracked_bytes);
+  EXPECT_LT(a.get_memory_usage_bytes(), 2 * untracked_bytes - sizeof(a));
+  EXPECT_EQ(s1.get_estimate(), 500);
+
+  // one update dirties one page, the other pages are shared
+  a.update(0);
+  theta_sketch_dup_snapshot s2(a);
+  EXPECT_EQ(s2.get_num_shared_pages(s1), 7);
+  theta_sketch_dup_snapshot s3(a);
+  EXPECT_EQ(s3.get_num_shared_pages(s2), 8);
+
+  // the snapshots keep their contents while the sketch changes
+  for (int i = 0; i < 500; i++) a.remove(i);
+  EXPECT_EQ(a.get_estimate(), 1);
+  EXPECT_EQ(s1.get_estimate(), 500);
+  theta_sketch_dup_snapshot s4(a);
+  EXPECT_EQ(s4.get_estimate(), 1);
+  int num_live = 0;
+  s4.for_each_live([&num_live](const std::pair<uint64_t, int64_t>& entry) {
+    EXPECT_EQ(entry.second, 1);
+    num_live++;
+  });
+  EXPECT_EQ(num_live, 1);
+
+  // snapshots serialize like the sketch
+  EXPECT_EQ(s4.serialize(), a.serialize());
+  std::stringstream ss1, ss2;
+  s4.serialize(ss1);
+  a.serialize(ss2);
+  EXPECT_EQ(ss1.str(), ss2.str());
+  EXPECT_EQ(s1.to_sketch().get_estimate(), 500);
+
+  // a rebuild copies all the pages
+  for (int i = 0; i < 5000; i++) a.update(i);
+  theta_sketch_dup_snapshot s5(a);
+  EXPECT_EQ(s5.get_num_shared_pages(s4), 0);
+  EXPECT_EQ(s5.get_estimate(), a.get_estimate());
+  EXPECT_EQ(s5.get_lower_bound(2), a.get_lower_bound(2));
+  EXPECT_EQ(s5.get_upper_bound(2), a.get_upper_bound(2));
+}
+
+// bytes allocated by counting_allocator and not yet freed
+static size_t live_bytes = 0;
+
+template <typename T>
+struct counting_allocator {
+  typedef T value_type;
+  counting_allocator() {}
+  template <typename U>
+  counting_allocator(const counting_allocator<U>&) {}
+  T* allocate(size_t n) {
+    live_bytes += n * sizeof(T);
+    return std::allocator<T>().allocate(n);
+  }
+  void deallocate(T* ptr, size_t n) {
+    live_bytes -= n * sizeof(T);
+    std::allocator<T>().deallocate(ptr, n);
+  }
+};
+
+template <typename T, typename U>
+bool operator==(const counting_allocator<T>&, const counting_allocator<U>&) {
+  return true;
+}
+
+template <typename T, typename U>
+bool operator!=(const counting_allocator<T>&, const counting_allocator<U>&) {
+  return false;
+}
+
+TEST(ThetaSketchDupSnapshot, TestReleasedPages) {
+  // the page copies of @a live as long as a snapshot has them
+  typedef update_theta_sketch_dup_alloc<counting_allocator<void>> sketch_type;
+  auto a = sketch_type::builder().set_lg_k(10).build();
+  for (int i = 0; i < 500; i++) a.update(i);
+  const size_t sketch_bytes = live_bytes;
+  {
+    theta_sketch_dup_snapshot_alloc<counting_allocator<void>> s1(a);
+    EXPECT_GE(live_bytes, sketch_bytes + a.get_serialized_size_bytes() - 32);
+    EXPECT_EQ(s1.get_estimate(), 500);
+  }
+  const size_t tracking_bytes = live_bytes;
+  EXPECT_LT(tracking_bytes, sketch_bytes + a.get_serialized_size_bytes() / 2);
+  // the next snapshot copies the table again
+  a.update(1000);
+  theta_sketch_dup_snapshot_alloc<counting_allocator<void>> s2(a);
+  EXPECT_EQ(s2.get_estimate(), 501);
+  EXPECT_GE(live_bytes, tracking_bytes + a.get_serialized_size_bytes() - 32);
+}
+
+TEST(ThetaSketchDupSnapshot, TestConcurrentReaders) {
+  // a writer updates @a and publishes snapshots that readers estimate from
+  auto a = update_theta_sketch_dup::builder().set_lg_k(12).build();
+  std::vector<theta_sketch_dup_snapshot> snapshots;
+  snapshots.reserve(100);
+  for (int i = 0; i < 100; i++) {
+    for (int j = 0; j < 100; j++) a.update(i * 100 + j);
+    snapshots.emplace_back(a);
+  }
+  std::atomic<int> num_checked(0);
+  std::vector<std::thread> readers;
+  for (int t = 0; t < 4; t++) {
+    readers.emplace_back([&snapshots, &num_checked] {
+      for (size_t i = 0; i < snapshots.size(); i++) {
+        const double estimate = snapshots[i].get_estimate();
+        EXPECT_EQ(estimate, snapshots[i].to_sketch().get_estimate());
+        num_checked++;
+      }
+    });
+  }
+  for (int i = 0; i < 10000; i++) a.remove(i);
+  for (auto& reader : readers) reader.join();
+  EXPECT_EQ(num_checked, 400);
+  EXPECT_EQ(snapshots[0].get_estimate(), 100);
+}
+
+}  // namespace datasketches
@@ -0,0 +1,51 @@
+#include "theta_sketch_dup.h"
+#include <gtest/gtest.h>
+#include <vector>
+
+namespace datasketches {
+
+TEST(ThetaSketchDupStats, TestCounters) {
+  // @a: sketch with lg_k 10 and 5000 distinct elements, with the default
+  // resize factor x8 it resizes from lg size 5 to 8 to 11 and then rebuilds
+  update_theta_sketch_dup a = update_theta_sketch_dup::builder().set_lg_k(10).build();
+  update_theta_sketch_dup_stats stats = a.get_stats();
+  EXPECT_TRUE(stats.enabled);
+  EXPECT_EQ(stats.load_factor, 0);
+  EXPECT_EQ(stats.zeros_ratio, 0);
+  for (int i = 0; i < 5000; i++) a.update(i);
+  stats = a.get_stats();
+  EXPECT_EQ(stats.num_resizes, 2);
+  EXPECT_GT(stats.num_rebuilds, 0);
+  EXPECT_GT(stats.num_theta_rejected, 0);
+  uint64_t num_inserts = 0;
+  for (uint64_t n : stats.insert_probes) num_inserts += n;
+  EXPECT_EQ(num_inserts + stats.num_theta_rejected, 5000);
+  EXPECT_GT(stats.insert_probes[0], 0);
+  EXPECT_GT(stats.load_factor, 0);
+  EXPECT_LT(stats.load_factor, 15.0 / 16);
+
+  // remove half of the retained elements, they are kept with count 0
+  uint32_t num_removed = 0;
+  std::vector<uint64_t> hashes;
+  for (const auto& entry : a) hashes.push_back(entry.first);
+  const uint32_t num_retained = a.get_num_retained();
+  for (uint32_t i = 0; i < hashes.size(); i += 2) {
+    a.remove(theta_sketch_dup_key{hashes[i], a.get_seed_hash()});
+    num_removed++;
+  }
+  stats = a.get_stats();
+  uint64_t num_removes = 0;
+  for (uint64_t n : stats.remove_probes) num_removes += n;
+  EXPECT_EQ(num_removes, num_removed);
+  EXPECT_NEAR(stats.zeros_ratio,
+              static_cast<double>(num_removed) / num_retained, 0.01);
+  EXPECT_NE(a.stats_to_string().find("num rebuilds"), std::string::npos);
+
+  a.reset_stats();
+  stats = a.get_stats();
+  EXPECT_EQ(stats.num_resizes, 0);
+  EXPECT_EQ(stats.num_theta_rejected, 0);
+  EXPECT_GT(stats.load_factor, 0);
+}
+
+}  // namespace datasketches
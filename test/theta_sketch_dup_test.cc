@@ -1,8 +1,13 @@
 #include "theta_sketch_dup.h"
 #include <gtest/gtest.h>
+#include <atomic>
+#include <cmath>
 #include <random>
 #include <set>
+#include <sstream>
 #include <string>
+#include <thread>
+#include <vector>
 #include "gen_string.h"
 
 namespace datasketches {
@@ -96,4 +101,556 @@ TEST(ThetaSketchDup, TestGaussianInput) {
   EXPECT_NEAR(a.get_estimate(), current_distinct_elements.size(), 2000);
 }
 
+TEST(ThetaSketchDup, TestHashedKeys) {
+  // @a: theta sketch updated with the elements
+  // @b, @c: theta sketches updated with the elements hashed once
+  auto a = update_theta_sketch_dup::builder().set_lg_k(10).build();
+  auto b = update_theta_sketch_dup::builder().set_lg_k(10).build();
+  auto c = update_theta_sketch_dup::builder().set_lg_k(12).build();
+  theta_sketch_dup_fanout fanout;
+  fanout.add(b);
+  fanout.add(c);
+  std::vector<theta_sketch_dup_key> keys;
+  for (int i = 0; i < 10000; i++) {
+    a.update(i);
+    keys.push_back(fanout.get_hasher().hash(i));
+  }
+  fanout.update(keys.data(), keys.size());
+  for (int i = 0; i < 100; i++) {
+    a.remove(i);
+    fanout.remove(keys[i]);
+  }
+  EXPECT_EQ(a, b);
+  EXPECT_EQ(a.get_estimate(), b.get_estimate());
+  EXPECT_NEAR(c.get_estimate(), 9900, 9900 * 0.02);
+
+  // elements hashed with another seed are rejected
+  theta_sketch_dup_hasher other_hasher(1);
+  EXPECT_THROW(a.update(other_hasher.hash(1)), std::invalid_argument);
+  EXPECT_THROW(fanout.update(other_hasher.hash(1)), std::invalid_argument);
+  auto d = update_theta_sketch_dup::builder().set_seed(1).build();
+  EXPECT_THROW(fanout.add(d), std::invalid_argument);
+  keys[5000] = other_hasher.hash(5000);
+  EXPECT_THROW(fanout.update(keys.data(), keys.size()),
+               std::invalid_argument);
+  EXPECT_THROW(b.remove(keys.data(), keys.size()), std::invalid_argument);
+}
+
+TEST(ThetaSketchDup, TestIgnoredKeys) {
+  // an empty string is ignored, as the sketch ignores it
+  auto a = update_theta_sketch_dup::builder().build();
+  theta_sketch_dup_hasher hasher;
+  const theta_sketch_dup_key empty = hasher.hash(std::string());
+  a.update(empty);
+  a.update(&empty, 1);
+  EXPECT_TRUE(a.is_empty());
+  EXPECT_THROW(a.remove(1), std::logic_error);
+
+  // an element hashed to 0 is not retained, but the sketch is not empty, as
+  // with any element at or above theta
+  a.update(theta_sketch_dup_key{0, hasher.get_seed_hash()});
+  EXPECT_FALSE(a.is_empty());
+  EXPECT_EQ(a.get_num_retained(), 0u);
+  EXPECT_EQ(a.get_estimate(), 0);
+  auto b = update_theta_sketch_dup::builder().build();
+  const theta_sketch_dup_key zero{0, hasher.get_seed_hash()};
+  b.update(&zero, 1);
+  EXPECT_FALSE(b.is_empty());
+  b.remove(zero);
+  EXPECT_EQ(a, b);
+}
+
+TEST(ThetaSketchDup, TestEightByteHash) {
+  // the inlined hash of 8 bytes is MurmurHash3_x64_128 of the 8 bytes
+  std::mt19937_64 gen(7);
+  for (uint64_t seed : {uint64_t(0), uint64_t(DEFAULT_SEED), gen()}) {
+    for (int i = 0; i < 10000; i++) {
+      const uint64_t value = i < 100 ? i : gen();
+      EXPECT_EQ(theta_sketch_dup_hasher::compute_hash64(value, seed),
+                theta_sketch_dup_hasher::compute_hash(&value, 8, seed));
+    }
+  }
+
+  // the fast paths of update and remove hash as the generic one
+  auto a = update_theta_sketch_dup::builder().set_lg_k(10).build();
+  auto b = update_theta_sketch_dup::builder().set_lg_k(10).build();
+  const double doubles[] = {0.0, -0.0, 1.5, -2.25, std::nan(""), -std::nan(""),
+                            INFINITY, -INFINITY, 1e300};
+  for (double value : doubles) {
+    a.update(value);
+    const int64_t bits = theta_sketch_dup_hasher::canonical_bits(value);
+    b.update(&bits, sizeof(bits));
+  }
+  a.update(2.5f);
+  const double widened = 2.5;
+  b.update(&widened, sizeof(widened));
+  for (int i = -5000; i < 5000; i++) {
+    a.update(i);
+    a.update(static_cast<uint64_t>(i) * 977);
+    const int64_t value = i;
+    b.update(&value, sizeof(value));
+    const uint64_t product = static_cast<uint64_t>(i) * 977;
+    b.update(&product, sizeof(product));
+  }
+  for (int i = 0; i < 100; i++) {
+    a.remove(static_cast<int16_t>(i));
+    const int64_t value = i;
+    b.remove(&value, sizeof(value));
+  }
+  a.remove(-0.0);
+  const double zero = 0.0;
+  b.remove(&zero, sizeof(zero));
+  EXPECT_EQ(a, b);
+  EXPECT_EQ(a.get_num_retained(), b.get_num_retained());
+
+  theta_sketch_dup_hasher hasher;
+  EXPECT_EQ(hasher.hash(std::nan("")).hash, hasher.hash(-std::nan("")).hash);
+  EXPECT_EQ(hasher.hash(0.0f).hash, hasher.hash(-0.0).hash);
+  EXPECT_EQ(hasher.hash(int8_t(-3)).hash, hasher.hash(int64_t(-3)).hash);
+}
+
+TEST(ThetaSketchDup, TestListener) {
+  // @events: maintenance events of @a, a sketch with lg_k 10 and 5000
+  // distinct elements, which resizes twice and then rebuilds
+  struct recorder : public update_theta_sketch_dup_listener {
+    std::vector<update_theta_sketch_dup_event> events;
+    void on_event(const update_theta_sketch_dup_event& event) override {
+      events.push_back(event);
+    }
+  } events;
+  auto a = update_theta_sketch_dup::builder().set_lg_k(10).build();
+  a.set_listener(&events);
+  EXPECT_EQ(a.get_listener(), &events);
+  for (int i = 0; i < 5000; i++) a.update(i);
+  ASSERT_GT(events.events.size(), 2);
+  EXPECT_EQ(events.events[0].type, update_theta_sketch_dup_event::RESIZE);
+  EXPECT_EQ(events.events[0].lg_size_before, 5);
+  EXPECT_EQ(events.events[0].lg_size_after, 8);
+  EXPECT_EQ(events.events[0].num_dropped, 0);
+  EXPECT_EQ(events.events[1].type, update_theta_sketch_dup_event::RESIZE);
+  EXPECT_EQ(events.events[1].lg_size_after, 11);
+  for (size_t i = 2; i < events.events.size(); i++) {
+    const update_theta_sketch_dup_event& event = events.events[i];
+    EXPECT_EQ(event.type, update_theta_sketch_dup_event::REBUILD);
+    EXPECT_LT(event.theta_after, event.theta_before);
+    EXPECT_GT(event.num_dropped, 0);
+    EXPECT_EQ(event.num_moved, 1 << 10);
+  }
+
+  // a copy does not report to the listener of the original, an assignment
+  // keeps the listener of the target and a move takes it along
+  auto b = a;
+  EXPECT_EQ(b.get_listener(), nullptr);
+  b = update_theta_sketch_dup::builder().build();
+  EXPECT_EQ(b.get_listener(), nullptr);
+  auto c = update_theta_sketch_dup::builder().build();
+  c.set_listener(&events);
+  c = a;
+  EXPECT_EQ(c.get_listener(), &events);
+  auto d = std::move(c);
+  EXPECT_EQ(d.get_listener(), &events);
+  events.events.clear();
+  for (int i = 5000; i < 10000; i++) b.update(i);
+  EXPECT_TRUE(events.events.empty());
+
+  a.set_listener(nullptr);
+  for (int i = 5000; i < 10000; i++) a.update(i);
+  EXPECT_TRUE(events.events.empty());
+}
+
+TEST(ThetaSketchDup, TestSizes) {
+  // the sizes computed from @a match its serialized sizes
+  auto a = update_theta_sketch_dup::builder().set_lg_k(10).build();
+  for (int n : {0, 100, 5000}) {
+    for (int i = 0; i < n; i++) a.update(i);
+    for (int i = 0; i < n / 10; i++) a.remove(i);
+    EXPECT_EQ(a.get_serialized_size_bytes(), a.serialize().size());
+    EXPECT_EQ(a.get_serialized_size_bytes(update_theta_sketch_dup::BYTES, 8),
+              a.serialize(8).size());
+    std::stringstream ss;
+    a.serialize(ss);
+    EXPECT_EQ(a.get_serialized_size_bytes(update_theta_sketch_dup::STREAM),
+              ss.str().size());
+    datasketches_pb::ThetaSketchDup pb;
+    a.serialize(&pb);
+    EXPECT_GE(a.get_serialized_size_bytes(update_theta_sketch_dup::PROTO),
+              pb.ByteSizeLong());
+    EXPECT_GE(a.get_memory_usage_bytes(),
+              sizeof(a) + a.get_serialized_size_bytes() - 32);
+    EXPECT_LE(a.get_memory_usage_bytes(),
+              update_theta_sketch_dup::get_max_memory_bytes(10));
+  }
+}
+
+TEST(ThetaSketchDup, TestPresizing) {
+  // @a: sketch built for 5000 elements starts at its full size, @b grows to it
+  auto a = update_theta_sketch_dup::builder()
+               .set_lg_k(10)
+               .set_expected_cardinality(5000)
+               .build();
+  auto b = update_theta_sketch_dup::builder().set_lg_k(10).build();
+  EXPECT_EQ(a.get_serialized_size_bytes(), 32 + (16 << 11));
+  EXPECT_LT(b.get_serialized_size_bytes(), a.get_serialized_size_bytes());
+  b.reserve(300);
+  EXPECT_EQ(b.get_serialized_size_bytes(), 32 + (16 << 10));
+  for (int i = 0; i < 5000; i++) {
+    a.update(i);
+    b.update(i);
+  }
+  EXPECT_EQ(a, b);
+
+  // @c: sketch with 1000 elements, 990 of them removed
+  auto c = update_theta_sketch_dup::builder().set_lg_k(10).build();
+  for (int i = 0; i < 1000; i++) c.update(i);
+  for (int i = 0; i < 990; i++) c.remove(i);
+  const double estimate = c.get_estimate();
+  const size_t memory_bytes = c.get_memory_usage_bytes();
+  c.shrink_to_fit();
+  EXPECT_EQ(c.get_estimate(), estimate);
+  EXPECT_LT(c.get_memory_usage_bytes(), memory_bytes / 16);
+  for (int i = 990; i < 1000; i++) c.remove(i);
+  EXPECT_EQ(c.get_estimate(), 0);
+}
+
+TEST(ThetaSketchDup, TestBounds) {
+  // the bounds of @a follow its updates and match the batched bounds
+  auto a = update_theta_sketch_dup::builder().set_lg_k(10).build();
+  std::vector<uint32_t> num_retained;
+  std::vector<uint64_t> thetas;
+  std::vector<double> lower_bounds;
+  std::vector<double> upper_bounds;
+  int num_updates = 0;
+  for (int n : {100, 5000, 20000}) {
+    for (; num_updates < n; num_updates++) a.update(num_updates);
+    const double lower_bound = a.get_lower_bound(2);
+    const double upper_bound = a.get_upper_bound(2);
+    EXPECT_EQ(a.get_lower_bound(2), lower_bound);
+    EXPECT_LE(a.get_lower_bound(3), lower_bound);
+    EXPECT_GE(a.get_upper_bound(3), upper_bound);
+    EXPECT_LE(lower_bound, a.get_estimate());
+    EXPECT_GE(upper_bound, a.get_estimate());
+    num_retained.push_back(a.get_num_retained());
+    thetas.push_back(a.get_theta64());
+    lower_bounds.push_back(lower_bound);
+    upper_bounds.push_back(upper_bound);
+  }
+  // removing a retained entry changes the bounds
+  a.remove(theta_sketch_dup_key{(*a.begin()).first, a.get_seed_hash()});
+  EXPECT_NE(a.get_lower_bound(2), lower_bounds.back());
+  EXPECT_THROW(a.get_lower_bound(4), std::invalid_argument);
+
+  std::vector<double> estimates(3), lower(3), upper(3);
+  update_theta_sketch_dup::get_bounds(num_retained.data(), thetas.data(), 3, 2,
+                                      estimates.data(), lower.data(),
+                                      upper.data());
+  EXPECT_EQ(estimates[0], 100);
+  EXPECT_EQ(lower, lower_bounds);
+  EXPECT_EQ(upper, upper_bounds);
+}
+
+TEST(ThetaSketchDup, TestBoundsConcurrentReaders) {
+  // readers of @a share its memoized bounds, and a copy of @a computes its own
+  auto a = update_theta_sketch_dup::builder().set_lg_k(10).build();
+  for (int i = 0; i < 20000; i++) a.update(i);
+  const update_theta_sketch_dup b = a;
+  const double lower_bound = binomial_bounds::get_lower_bound(
+      a.get_num_retained(), a.get_theta(), 2);
+  const double upper_bound = binomial_bounds::get_upper_bound(
+      a.get_num_retained(), a.get_theta(), 2);
+  std::vector<std::thread> readers;
+  std::atomic<int> num_mismatches(0);
+  for (int t = 0; t < 4; t++) {
+    readers.emplace_back([&a, &b, &num_mismatches, lower_bound, upper_bound]() {
+      for (int i = 0; i < 10000; i++) {
+        const update_theta_sketch_dup& s = i % 2 ? a : b;
+        if (s.get_lower_bound(2) != lower_bound ||
+            s.get_upper_bound(2) != upper_bound)
+          num_mismatches++;
+      }
+    });
+  }
+  for (auto& reader : readers) reader.join();
+  EXPECT_EQ(num_mismatches, 0);
+
+  // a mutation changes the state the bounds are published for
+  a.update(-1);
+  a.update(-2);
+  EXPECT_EQ(a.get_lower_bound(1),
+            binomial_bounds::get_lower_bound(a.get_num_retained(),
+                                             a.get_theta(), 1));
+}
+
+TEST(ThetaSketchDup, TestEstimateFromBytes) {
+  // @blobs: serialized sketches with 0 to 4999 * 10 distinct elements
+  std::vector<update_theta_sketch_dup::vector_bytes> blobs;
+  std::vector<const void*> pointers;
+  std::vector<size_t> sizes;
+  std::vector<double> expected;
+  for (int n = 0; n < 5000; n++) {
+    auto a = update_theta_sketch_dup::builder().set_lg_k(5).build();
+    for (int i = 0; i < n * 10; i++) a.update(i);
+    if (n % 2 == 1) a.remove(0);
+    blobs.push_back(a.serialize());
+    expected.push_back(a.get_estimate());
+    if (n == 4999) {
+      double lower_bound, upper_bound;
+      EXPECT_EQ(update_theta_sketch_dup::bounds_from_bytes(
+                    blobs.back().data(), blobs.back().size(), 2, &lower_bound,
+                    &upper_bound),
+                a.get_estimate());
+      EXPECT_EQ(lower_bound, a.get_lower_bound(2));
+      EXPECT_EQ(upper_bound, a.get_upper_bound(2));
+      std::stringstream ss;
+      a.serialize(ss);
+      EXPECT_EQ(update_theta_sketch_dup::estimate_from_bytes(
+                    ss.str().data(), ss.str().size()),
+                a.get_estimate());
+    }
+  }
+  for (const auto& blob : blobs) {
+    pointers.push_back(blob.data());
+    sizes.push_back(blob.size());
+  }
+  std::vector<double> estimates(blobs.size());
+  std::vector<double> upper_bounds(blobs.size());
+  update_theta_sketch_dup::bounds_from_bytes(
+      pointers.data(), sizes.data(), blobs.size(), 2, estimates.data(),
+      nullptr, upper_bounds.data(), 4);
+  EXPECT_EQ(estimates, expected);
+  EXPECT_GE(upper_bounds[4999], estimates[4999]);
+
+  // invalid headers are rejected
+  EXPECT_THROW(update_theta_sketch_dup::estimate_from_bytes(pointers[1], 10),
+               std::out_of_range);
+  EXPECT_THROW(
+      update_theta_sketch_dup::estimate_from_bytes(pointers[1], sizes[1], 1),
+      std::invalid_argument);
+  sizes[3000] = 0;
+  EXPECT_THROW(update_theta_sketch_dup::bounds_from_bytes(
+                   pointers.data(), sizes.data(), blobs.size(), 2,
+                   estimates.data(), nullptr, nullptr, 4),
+               std::out_of_range);
+}
+
+TEST(ThetaSketchDup, TestFingerprint) {
+  // @a, @b: same elements and counts inserted in different orders and table
+  // sizes, @c: one count differs
+  auto a = update_theta_sketch_dup::builder().set_lg_k(10).build();
+  auto b = update_theta_sketch_dup::builder()
+               .set_lg_k(10)
+               .set_expected_cardinality(500)
+               .build();
+  auto c = update_theta_sketch_dup::builder().set_lg_k(10).build();
+  for (int i = 0; i < 500; i++) {
+    a.update(i);
+    b.update(499 - i);
+    c.update(i);
+  }
+  a.update(7);
+  b.update(7);
+  b.update(8);
+  b.remove(8);
+  c.update(8);
+  EXPECT_NE(a.get_fingerprint(), 0);
+  EXPECT_EQ(a.get_fingerprint(), b.get_fingerprint());
+  EXPECT_EQ(a, b);
+  EXPECT_NE(a.get_fingerprint(), c.get_fingerprint());
+  EXPECT_FALSE(a == c);
+
+  // removed entries do not count, and the fingerprint survives serialization
+  // and resizes
+  for (int i = 0; i < 500; i++) a.update(1000 + i);
+  for (int i = 0; i < 500; i++) a.remove(1000 + i);
+  EXPECT_EQ(a.get_fingerprint(), b.get_fingerprint());
+  EXPECT_EQ(a, b);
+  auto d = update_theta_sketch_dup::deserialize(a.serialize().data(),
+                                                a.serialize().size());
+  EXPECT_EQ(d.get_fingerprint(), a.get_fingerprint());
+  a.shrink_to_fit();
+  EXPECT_EQ(a.get_fingerprint(), b.get_fingerprint());
+  a.reset();
+  EXPECT_EQ(a.get_fingerprint(), 0);
+}
+
+TEST(ThetaSketchDup, TestForEachLive) {
+  // @a: sketch in estimation mode with a third of its entries removed
+  auto a = update_theta_sketch_dup::builder().set_lg_k(10).build();
+  for (int i = 0; i < 5000; i++) a.update(i);
+  std::vector<uint64_t> hashes;
+  for (const auto& entry : a) hashes.push_back(entry.first);
+  for (size_t i = 0; i < hashes.size(); i += 3)
+    a.remove(theta_sketch_dup_key{hashes[i], a.get_seed_hash()});
+  std::set<uint64_t> expected;
+  for (const auto& entry : a)
+    if (entry.second != 0) expected.insert(entry.first);
+  EXPECT_EQ(expected.size(), a.get_num_retained());
+
+  std::set<uint64_t> live;
+  a.for_each_live([&live](const std::pair<uint64_t, int64_t>& entry) {
+    EXPECT_GT(entry.second, 0);
+    EXPECT_TRUE(live.insert(entry.first).second);
+  });
+  EXPECT_EQ(live, expected);
+
+  for (uint32_t num_chunks : {1, 3, 8, 5000}) {
+    live.clear();
+    for (uint32_t chunk = 0; chunk < num_chunks; chunk++) {
+      a.for_each_live(
+          [&live](const std::pair<uint64_t, int64_t>& entry) {
+            EXPECT_TRUE(live.insert(entry.first).second);
+          },
+          chunk, num_chunks);
+    }
+    EXPECT_EQ(live, expected);
+  }
+}
+
+TEST(ThetaSketchDup, TestDelta) {
+  auto a = update_theta_sketch_dup::builder()
+               .set_lg_k(10)
+               .set_expected_cardinality(1000)
+               .build();
+  auto replica = update_theta_sketch_dup::builder().set_lg_k(10).build();
+  for (int i = 0; i < 500; i++) a.update(i);
+  uint64_t checkpoint = a.take_checkpoint();
+  const auto full = a.serialize_delta();
+  EXPECT_EQ(replica.apply_delta(full.data(), full.size()), checkpoint);
+  EXPECT_EQ(replica.get_checkpoint(), checkpoint);
+  EXPECT_EQ(replica, a);
+
+  // a few writes only send the pages they touched, serializing does not
+  // start a checkpoint
+  a.update(7);
+  a.remove(8);
+  a.update(10000);
+  const uint64_t next = a.take_checkpoint();
+  EXPECT_GT(next, checkpoint);
+  const auto partial = a.serialize_delta(checkpoint);
+  EXPECT_EQ(a.serialize_delta(checkpoint), partial);
+  EXPECT_LT(partial.size(), full.size() / 2);
+  replica.apply_delta(partial.data(), partial.size());
+  EXPECT_EQ(replica, a);
+  EXPECT_EQ(replica.get_fingerprint(), a.get_fingerprint());
+  // the replica is at next now, not at checkpoint
+  EXPECT_THROW(replica.apply_delta(partial.data(), partial.size()),
+               std::invalid_argument);
+
+  // no write, no page
+  const auto empty = a.serialize_delta(next);
+  EXPECT_EQ(empty.size(), sizeof(uint64_t) * 6);
+
+  // the rebuilds of the estimation mode change theta: full delta
+  for (int i = 0; i < 5000; i++) a.update(20000 + i);
+  EXPECT_TRUE(a.is_estimation_mode());
+  checkpoint = a.take_checkpoint();
+  const auto rebuilt = a.serialize_delta(next);
+  EXPECT_EQ(rebuilt.size(), a.serialize_delta().size());
+  replica.apply_delta(rebuilt.data(), rebuilt.size());
+  EXPECT_EQ(replica, a);
+  EXPECT_EQ(replica.get_estimate(), a.get_estimate());
+
+  // a partial delta needs a table of the same size
+  auto small = update_theta_sketch_dup::builder().set_lg_k(10).build();
+  a.update(7);
+  a.take_checkpoint();
+  const auto last = a.serialize_delta(checkpoint);
+  EXPECT_THROW(small.apply_delta(last.data(), last.size()),
+               std::invalid_argument);
+  EXPECT_THROW(small.apply_delta(a.serialize().data(), a.serialize().size()),
+               std::invalid_argument);
+}
+
+TEST(ThetaSketchDup, TestRobinHood) {
+  auto a = update_theta_sketch_dup::builder()
+               .set_lg_k(10)
+               .set_probing(update_theta_sketch_dup::ROBIN_HOOD)
+               .build();
+  auto b = update_theta_sketch_dup::builder().set_lg_k(10).build();
+  EXPECT_EQ(a.get_probing(), update_theta_sketch_dup::ROBIN_HOOD);
+  EXPECT_EQ(b.get_probing(), update_theta_sketch_dup::DOUBLE_HASHING);
+
+  // a mix of updates and removes of the elements present
+  std::mt19937 gen(7);
+  std::vector<int> counts(1000, 0);
+  for (int i = 0; i < 50000; i++) {
+    const int value = gen() % counts.size();
+    if (counts[value] > 0 && gen() % 2 == 0) {
+      a.remove(value);
+      b.remove(value);
+      counts[value]--;
+    } else {
+      a.update(value);
+      b.update(value);
+      counts[value]++;
+    }
+  }
+  EXPECT_EQ(a, b);
+  EXPECT_EQ(a.get_estimate(), b.get_estimate());
+  // the entries whose count reached 0 left the table
+  for (const auto& entry : a) EXPECT_NE(entry.second, 0);
+  for (size_t value = 0; value < counts.size(); value++) {
+    if (counts[value] == 0) {
+      EXPECT_THROW(a.remove(value), std::logic_error);
+      break;
+    }
+  }
+  EXPECT_THROW(a.remove(5000), std::logic_error);
+
+  // the probing is kept by serialization
+  const auto bytes = a.serialize();
+  auto c = update_theta_sketch_dup::deserialize(bytes.data(), bytes.size());
+  EXPECT_EQ(c.get_probing(), update_theta_sketch_dup::ROBIN_HOOD);
+  std::stringstream s;
+  a.serialize(s);
+  auto d = update_theta_sketch_dup::deserialize(s);
+  EXPECT_EQ(d.get_probing(), update_theta_sketch_dup::ROBIN_HOOD);
+  EXPECT_EQ(d, a);
+  for (size_t value = 0; value < counts.size(); value++) {
+    for (int i = 0; i < counts[value]; i++) c.remove(value);
+  }
+  EXPECT_EQ(c.get_num_retained(), 0u);
+
+  // a full delta brings the probing, a partial one must match it
+  auto replica = update_theta_sketch_dup::builder().set_lg_k(10).build();
+  const uint64_t checkpoint = a.take_checkpoint();
+  const auto full = a.serialize_delta();
+  replica.apply_delta(full.data(), full.size());
+  EXPECT_EQ(replica.get_probing(), update_theta_sketch_dup::ROBIN_HOOD);
+  a.update(3);
+  a.update(10000);
+  a.take_checkpoint();
+  const auto partial = a.serialize_delta(checkpoint);
+  replica.apply_delta(partial.data(), partial.size());
+  EXPECT_EQ(replica, a);
+  // e is at the checkpoint of the partial delta, with the probing of b
+  auto e = update_theta_sketch_dup::builder().set_lg_k(10).build();
+  b.take_checkpoint();
+  const auto b_full = b.serialize_delta();
+  e.apply_delta(b_full.data(), b_full.size());
+  ASSERT_EQ(e.get_checkpoint(), checkpoint);
+  EXPECT_THROW(e.apply_delta(partial.data(), partial.size()),
+               std::invalid_argument);
+
+  // estimation mode: the rebuilds keep the same entries
+  auto f = update_theta_sketch_dup::builder()
+               .set_lg_k(9)
+               .set_probing(update_theta_sketch_dup::ROBIN_HOOD)
+               .build();
+  auto g = update_theta_sketch_dup::builder().set_lg_k(9).build();
+  for (int i = 0; i < 20000; i++) {
+    f.update(i % 15000);
+    g.update(i % 15000);
+  }
+  EXPECT_TRUE(f.is_estimation_mode());
+  EXPECT_EQ(f, g);
+  for (int i = 0; i < 15000; i += 2) {
+    if (g.get_theta64() > theta_sketch_dup_hasher().hash(i).hash) {
+      f.remove(i);
+      g.remove(i);
+    }
+  }
+  EXPECT_EQ(f, g);
+  EXPECT_EQ(f.get_estimate(), g.get_estimate());
+}
+
 }  // namespace datasketches
@@ -0,0 +1,81 @@
+#include "theta_sketch_dup_thread_pool.h"
+#include <gtest/gtest.h>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "fixed_theta_sketch_dup.h"
+
+namespace datasketches {
+
+TEST(ThetaSketchDupThreadPool, TestRun) {
+  theta_sketch_dup_thread_pool pool(4);
+  EXPECT_EQ(pool.get_concurrency(), 4u);
+  for (uint32_t num_tasks : {0, 1, 3, 100}) {
+    std::vector<std::atomic<int>> calls(num_tasks);
+    for (auto& c : calls) c = 0;
+    pool.run(num_tasks, [&calls](uint32_t task) { calls[task]++; });
+    for (const auto& c : calls) EXPECT_EQ(c.load(), 1);
+  }
+  theta_sketch_dup_thread_pool single(1);
+  int sum = 0;
+  single.run(10, [&sum](uint32_t task) { sum += task; });
+  EXPECT_EQ(sum, 45);
+}
+
+TEST(ThetaSketchDupThreadPool, TestDeterministicMaintenance) {
+  theta_sketch_dup_thread_pool pool(4);
+  theta_sketch_dup_thread_pool other_pool(3);
+  for (auto probing : {update_theta_sketch_dup::DOUBLE_HASHING,
+                       update_theta_sketch_dup::ROBIN_HOOD}) {
+    // tables of 2^18 slots: 4 regions
+    const auto builder =
+        update_theta_sketch_dup::builder().set_lg_k(17).set_probing(probing);
+    auto sequential = builder.build();
+    auto parallel = builder.build();
+    parallel.set_executor(&pool);
+    auto other = builder.build();
+    other.set_executor(&other_pool);
+    EXPECT_EQ(other.get_executor(), &other_pool);
+    std::unique_ptr<fixed_theta_sketch_dup<17>> fixed(
+        new fixed_theta_sketch_dup<17>());
+    theta_sketch_dup_hasher hasher;
+    std::vector<theta_sketch_dup_key> keys;
+    for (int i = 0; i < 600000; i++) keys.push_back(hasher.hash(i % 500000));
+    for (const auto& key : keys) {
+      sequential.update(key);
+      parallel.update(key);
+      other.update(key);
+      fixed->update(key);
+    }
+    for (int i = 0; i < 100000; i += 3) {
+      const theta_sketch_dup_key key = hasher.hash(i);
+      if (key.hash >= sequential.get_theta64()) continue;
+      sequential.remove(key);
+      parallel.remove(key);
+      other.remove(key);
+      fixed->remove(key);
+    }
+
+    // the same hash table whatever the executor
+    EXPECT_TRUE(sequential.is_estimation_mode());
+    const auto bytes = sequential.serialize();
+    EXPECT_EQ(parallel.serialize(), bytes);
+    EXPECT_EQ(other.serialize(), bytes);
+    // the same theta and entries as the rebuilds of nth_element
+    EXPECT_EQ(fixed->to_sketch(), sequential);
+
+    // every entry is found after the region by region rehashes
+    std::vector<std::pair<uint64_t, int64_t>> entries;
+    parallel.for_each_live([&entries](const std::pair<uint64_t, int64_t>& e) {
+      entries.push_back(e);
+    });
+    for (const auto& entry : entries) {
+      const theta_sketch_dup_key key{entry.first, parallel.get_seed_hash()};
+      for (int64_t i = 0; i < entry.second; i++) parallel.remove(key);
+    }
+    EXPECT_EQ(parallel.get_num_retained(), 0u);
+    EXPECT_THROW(parallel.remove(keys[0]), std::logic_error);
+  }
+}
+
+}  // namespace datasketches
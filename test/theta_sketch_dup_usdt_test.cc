@@ -0,0 +1,42 @@
+#include "theta_sketch_dup.h"
+#include <gtest/gtest.h>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+namespace datasketches {
+
+#ifndef THETA_SKETCH_DUP_USDT
+#error "this test is built with THETA_SKETCH_DUP_USDT defined"
+#endif
+
+TEST(ThetaSketchDupUsdt, TestProbes) {
+  // the probes are emitted with the listener events: @a resizes twice and
+  // then rebuilds
+  struct counter : public update_theta_sketch_dup_listener {
+    int num_events = 0;
+    void on_event(const update_theta_sketch_dup_event&) override {
+      num_events++;
+    }
+  } events;
+  auto a = update_theta_sketch_dup::builder().set_lg_k(10).build();
+  a.set_listener(&events);
+  for (int i = 0; i < 5000; i++) a.update(i);
+  EXPECT_GT(events.num_events, 2);
+
+  // each probe is described by a note of the binary with its provider and
+  // name, which tracing tools look up
+  std::ifstream binary("/proc/self/exe", std::ios::binary);
+  ASSERT_TRUE(binary.good());
+  const std::string image((std::istreambuf_iterator<char>(binary)),
+                          std::istreambuf_iterator<char>());
+  EXPECT_NE(image.find(".note.stapsdt"), std::string::npos);
+  for (const char* name : {"resize", "rebuild", "theta_change"}) {
+    const std::string note =
+        std::string("theta_sketch_dup") + '\0' + name + '\0';
+    EXPECT_NE(image.find(note), std::string::npos) << name;
+  }
+}
+
+}  // namespace datasketches
@@ -0,0 +1,127 @@
+#include "theta_sketch_dup_wal.h"
+#include <gtest/gtest.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace datasketches {
+
+// @return a new empty directory under the test temporary directory
+static std::string make_dir() {
+  const char* tmp = std::getenv("TEST_TMPDIR");
+  std::string path = std::string(tmp ? tmp : "/tmp") + "/wal_XXXXXX";
+  if (mkdtemp(&path[0]) == nullptr) throw std::runtime_error("mkdtemp");
+  return path;
+}
+
+TEST(ThetaSketchDupWal, TestRecovery) {
+  const std::string dir = make_dir();
+  auto users = update_theta_sketch_dup::builder().build();
+  auto items = update_theta_sketch_dup::builder().build();
+  {
+    theta_sketch_dup_wal wal(dir, update_theta_sketch_dup::builder(), 1024);
+    for (int i = 0; i < 1000; i++) {
+      wal.update("users", i);
+      users.update(i);
+      wal.update("items", i % 100);
+      items.update(i % 100);
+    }
+    for (int i = 0; i < 300; i++) {
+      wal.remove("users", i);
+      users.remove(i);
+    }
+    // a rejected remove is not logged
+    EXPECT_THROW(wal.remove("users", 5000), std::logic_error);
+    wal.sync();
+    EXPECT_EQ(wal.get_durable_lsn(), wal.get_last_lsn());
+    EXPECT_EQ(wal.get_estimate("users"), 700);
+  }
+  theta_sketch_dup_wal wal(dir);
+  EXPECT_EQ(wal.size(), 2);
+  EXPECT_EQ(wal.get_result("users"), users);
+  EXPECT_EQ(wal.get_result("items"), items);
+  EXPECT_EQ(wal.get_last_lsn(), 2 + 2000 + 300);
+  EXPECT_THROW(wal.get_result("missing"), std::out_of_range);
+
+  // a torn frame at the end of the log is cut off
+  const size_t log_size = wal.get_log_size_bytes();
+  const int fd = open((dir + "/wal.log").c_str(), O_WRONLY | O_APPEND);
+  const char garbage[40] = {7};
+  EXPECT_EQ(write(fd, garbage, sizeof(garbage)), sizeof(garbage));
+  close(fd);
+  theta_sketch_dup_wal reopened(dir);
+  EXPECT_EQ(reopened.get_log_size_bytes(), log_size);
+  EXPECT_EQ(reopened.get_result("users"), users);
+  reopened.sync(reopened.update("users", 5000));
+  users.update(5000);
+  theta_sketch_dup_wal appended(dir);
+  EXPECT_EQ(appended.get_result("users"), users);
+}
+
+TEST(ThetaSketchDupWal, TestCheckpoint) {
+  const std::string dir = make_dir();
+  auto users = update_theta_sketch_dup::builder().set_lg_k(10).build();
+  {
+    theta_sketch_dup_wal wal(dir,
+                             update_theta_sketch_dup::builder().set_lg_k(10));
+    for (int i = 0; i < 5000; i++) {
+      wal.update("users", i);
+      users.update(i);
+    }
+    wal.checkpoint();
+    EXPECT_EQ(wal.get_log_size_bytes(), 0);
+    // the elements over theta are ignored by the remove
+    for (int i = 0; i < 5000; i += 2) {
+      const auto key = wal.get_hasher().hash(i);
+      wal.remove("users", key);
+      users.remove(key);
+    }
+    wal.update("items", 1);
+    wal.sync();
+  }
+  theta_sketch_dup_wal wal(dir, update_theta_sketch_dup::builder().set_lg_k(10));
+  EXPECT_EQ(wal.get_result("users"), users);
+  EXPECT_TRUE(wal.contains("items"));
+
+  // a checkpoint interrupted before the truncation of the log: the records
+  // already in the snapshot are skipped
+  wal.update("items", 2);
+  wal.sync();
+  std::vector<char> log(wal.get_log_size_bytes());
+  int fd = open((dir + "/wal.log").c_str(), O_RDONLY);
+  EXPECT_EQ(read(fd, log.data(), log.size()), log.size());
+  close(fd);
+  wal.checkpoint();
+  fd = open((dir + "/wal.log").c_str(), O_WRONLY | O_APPEND);
+  EXPECT_EQ(write(fd, log.data(), log.size()), log.size());
+  close(fd);
+  theta_sketch_dup_wal replayed(dir,
+                                update_theta_sketch_dup::builder().set_lg_k(10));
+  EXPECT_EQ(replayed.get_estimate("items"), 2);
+}
+
+TEST(ThetaSketchDupWal, TestGroupCommit) {
+  const std::string dir = make_dir();
+  const int num_threads = 4;
+  const int num_updates = 500;
+  {
+    theta_sketch_dup_wal wal(dir,
+                             update_theta_sketch_dup::builder().set_lg_k(14));
+    std::vector<std::thread> threads;
+    for (int t = 0; t < num_threads; t++) {
+      threads.emplace_back([&wal, t]() {
+        for (int i = 0; i < num_updates; i++)
+          wal.sync(wal.update("users", t * num_updates + i));
+      });
+    }
+    for (auto& thread : threads) thread.join();
+    EXPECT_EQ(wal.get_durable_lsn(), 1 + num_threads * num_updates);
+  }
+  theta_sketch_dup_wal wal(dir, update_theta_sketch_dup::builder().set_lg_k(14));
+  EXPECT_EQ(wal.get_estimate("users"), num_threads * num_updates);
+}
+
+}  // namespace datasketches
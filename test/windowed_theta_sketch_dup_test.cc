@@ -0,0 +1,53 @@
+#include "windowed_theta_sketch_dup.h"
+#include <gtest/gtest.h>
+
+namespace datasketches {
+
+TEST(WindowedThetaSketchDup, TestExpiration) {
+  // @a: window of 3 buckets, bucket b gets the elements [100 * b, 100 * b + 50)
+  // and the element 0, so at most 150 + 1 distinct elements are live
+  windowed_theta_sketch_dup a(3);
+  EXPECT_EQ(a.get_estimate(), 0);
+  for (int b = 0; b < 10; b++) {
+    if (b > 0) a.advance();
+    for (int i = 0; i < 50; i++) a.update(100 * b + i);
+    a.update(0);
+    const int num_live = std::min(b + 1, 3);
+    EXPECT_EQ(a.get_num_live_buckets(), num_live);
+    EXPECT_EQ(a.get_estimate(), 50 * num_live + (b >= 3 ? 1 : 0));
+  }
+  // the element 0 was added to each live bucket, remove it twice
+  a.remove(0);
+  a.remove(0);
+  EXPECT_EQ(a.get_estimate(), 151);
+  a.remove(0);
+  EXPECT_EQ(a.get_estimate(), 150);
+  // elements of expired buckets are already gone
+  a.remove(0);
+  a.remove(1);
+  EXPECT_EQ(a.get_estimate(), 150);
+  // elements of sealed buckets are removed
+  a.remove(800);
+  EXPECT_EQ(a.get_estimate(), 149);
+  a.advance(3);
+  EXPECT_EQ(a.get_estimate(), 0);
+}
+
+TEST(WindowedThetaSketchDup, TestEstimation) {
+  // @a: window of 4 buckets of sketches with lg_k 10, 5000 elements per bucket
+  // @b: sketch of the elements of the last 4 buckets
+  auto builder = update_theta_sketch_dup::builder().set_lg_k(10);
+  windowed_theta_sketch_dup a(4, builder);
+  for (int b = 0; b < 10; b++) {
+    if (b > 0) a.advance();
+    for (int i = 0; i < 5000; i++) a.update(5000 * b + i);
+    auto expected = builder.build();
+    for (int i = 5000 * std::max(0, b - 3); i < 5000 * (b + 1); i++)
+      expected.update(i);
+    EXPECT_TRUE(a.get_result().is_estimation_mode());
+    EXPECT_NEAR(a.get_estimate(), expected.get_estimate(),
+                expected.get_estimate() * 0.1);
+  }
+}
+
+}  // namespace datasketches
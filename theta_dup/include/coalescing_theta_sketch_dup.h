@@ -0,0 +1,511 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef COALESCING_THETA_SKETCH_DUP_H_
+#define COALESCING_THETA_SKETCH_DUP_H_
+
+#include <cmath>
+#include <exception>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "theta_sketch_dup.h"
+
+namespace datasketches {
+
+/*
+ * coalescing_theta_sketch_dup is a small direct-mapped cache in front of
+ * update_theta_sketch_dup. For skewed streams most updates hit a few hot keys,
+ * so instead of probing the (possibly large) hash table of the sketch on every
+ * update/remove, the counts of recently seen hash values are accumulated in
+ * the cache and applied to the sketch in one step when:
+ *   - the cache slot is taken by another hash value (eviction)
+ *   - any query is made (estimate, bounds, iteration, equality, to_string)
+ *   - the sketch is serialized
+ * All queries see the sketch after the cache is flushed. In exact mode the
+ * results are the same as the results of the update_theta_sketch_dup fed with
+ * the same stream. In estimation mode the sketch receives the hash values in
+ * another order, so it lowers theta at other points and may retain other
+ * hash values: the estimate has the same error bounds, but is not equal.
+ * Note: pending updates of a hash value are applied before its pending
+ * removes, so a remove that comes before the matching update in the stream
+ * is not reported as long as both are still in the cache. A remove of more
+ * than was inserted is refused when it is flushed, as the sketch refuses it,
+ * and the rest of the cache is still applied before the error is rethrown.
+ */
+template <typename A>
+class coalescing_theta_sketch_dup_alloc {
+ public:
+  static const uint8_t MAX_LG_CACHE_SIZE = 16;
+  // 256 slots of 24 bytes each, fits into L1 cache
+  static const uint8_t DEFAULT_LG_CACHE_SIZE = 8;
+
+  /**
+   * Creates a cache in front of the given sketch
+   * @param sketch the sketch to be updated through the cache
+   * @param lg_cache_size base 2 logarithm of the number of cache slots
+   */
+  explicit coalescing_theta_sketch_dup_alloc(
+      update_theta_sketch_dup_alloc<A>&& sketch,
+      uint8_t lg_cache_size = DEFAULT_LG_CACHE_SIZE);
+
+  /**
+   * Update this sketch with a given string.
+   * @param value string to update the sketch with
+   */
+  void update(const std::string& value);
+  void update(uint64_t value);
+  void update(int64_t value);
+  void update(uint32_t value);
+  void update(int32_t value);
+  void update(uint16_t value);
+  void update(int16_t value);
+  void update(uint8_t value);
+  void update(int8_t value);
+  void update(double value);
+  void update(float value);
+
+  /**
+   * Update this sketch with given data of any type.
+   * See update_theta_sketch_dup_alloc<A>::update(const void*, unsigned)
+   * @param data pointer to the data
+   * @param length of the data in bytes
+   */
+  void update(const void* data, unsigned length);
+
+  /**
+   * Remove one string from the sketch.
+   * @param value string to be removed from the sketch
+   */
+  void remove(const std::string& value);
+  void remove(uint64_t value);
+  void remove(int64_t value);
+  void remove(uint32_t value);
+  void remove(int32_t value);
+  void remove(uint16_t value);
+  void remove(int16_t value);
+  void remove(uint8_t value);
+  void remove(int8_t value);
+  void remove(double value);
+  void remove(float value);
+
+  /**
+   * Remove one element of any type from this sketch.
+   * See update_theta_sketch_dup_alloc<A>::remove(const void*, unsigned)
+   * @param data pointer to the data
+   * @param length of the data in bytes
+   */
+  void remove(const void* data, unsigned length);
+
+  /**
+   * Apply all the pending counts in the cache to the sketch
+   */
+  void flush() const;
+
+  /**
+   * @return the underlying sketch after flushing the cache
+   */
+  const update_theta_sketch_dup_alloc<A>& get_sketch() const;
+
+  bool is_empty() const;
+  double get_estimate() const;
+  double get_lower_bound(uint8_t num_std_devs) const;
+  double get_upper_bound(uint8_t num_std_devs) const;
+  bool is_estimation_mode() const;
+  double get_theta() const;
+  uint64_t get_theta64() const;
+  uint32_t get_num_retained() const;
+  uint16_t get_seed_hash() const;
+  string<A> to_string(bool print_items = false) const;
+
+  // serialize to output stream
+  void serialize(std::ostream& os) const;
+  // serialize to protobuf
+  void serialize(datasketches_pb::ThetaSketchDup* pb) const;
+  // serialize to bytes
+  vector_u8_dup<A> serialize(unsigned header_size_bytes = 0) const;
+
+  typename theta_sketch_dup_alloc<A>::const_iterator begin() const;
+  typename theta_sketch_dup_alloc<A>::const_iterator end() const;
+
+  /**
+   * @return true if *this equals r
+   */
+  bool is_equal(const coalescing_theta_sketch_dup_alloc& r) const;
+
+ private:
+  /**
+   * @hash hash value cached in this slot, 0 marks an empty slot
+   * @adds number of pending updates of the hash value
+   * @removes number of pending removes of the hash value
+   */
+  struct cache_entry {
+    uint64_t hash;
+    int64_t adds;
+    int64_t removes;
+  };
+  typedef typename std::allocator_traits<A>::template rebind_alloc<cache_entry>
+      AllocEntry;
+
+  mutable update_theta_sketch_dup_alloc<A> sketch_;
+  mutable std::vector<cache_entry, AllocEntry> cache_;
+  uint32_t cache_mask_;
+  // number of occupied slots, lets queries skip the flush if there is nothing
+  mutable uint32_t num_pending_;
+
+  // apply the counts of an entry that is no longer in the cache
+  void apply_entry(const cache_entry& entry) const;
+  // count a hashed update or remove in the cache
+  void update_hash(uint64_t hash);
+  void remove_hash(uint64_t hash);
+};
+
+/*
+ * The following are implementations
+ */
+
+template <typename A>
+coalescing_theta_sketch_dup_alloc<A>::coalescing_theta_sketch_dup_alloc(
+    update_theta_sketch_dup_alloc<A>&& sketch, uint8_t lg_cache_size)
+    : sketch_(std::move(sketch)),
+      cache_(),
+      cache_mask_((1 << lg_cache_size) - 1),
+      num_pending_(0) {
+  if (lg_cache_size > MAX_LG_CACHE_SIZE) {
+    throw std::invalid_argument("lg_cache_size must not be greater than " +
+                                std::to_string(MAX_LG_CACHE_SIZE) + ": " +
+                                std::to_string(lg_cache_size));
+  }
+  cache_.assign(1 << lg_cache_size, cache_entry{0, 0, 0});
+}
+
+template <typename A>
+void coalescing_theta_sketch_dup_alloc<A>::update(const void* data,
+                                                  unsigned length) {
+  update_hash(
+      theta_sketch_dup_hasher::compute_hash(data, length, sketch_.seed_));
+}
+
+template <typename A>
+void coalescing_theta_sketch_dup_alloc<A>::update_hash(uint64_t hash) {
+  if (hash >= sketch_.theta_ || hash == 0) {
+    // nothing to cache, only marks the sketch as not empty
+    sketch_.internal_update(hash, 1);
+    return;
+  }
+  cache_entry& entry = cache_[hash & cache_mask_];
+  if (entry.hash == hash) {
+    entry.adds++;
+    return;
+  }
+  // the slot is taken over before the evicted counts are applied, so that
+  // the cache stays consistent if the sketch refuses them
+  const cache_entry evicted = entry;
+  entry = cache_entry{hash, 1, 0};
+  if (evicted.hash == 0) {
+    num_pending_++;
+  } else {
+    apply_entry(evicted);
+  }
+}
+
+template <typename A>
+void coalescing_theta_sketch_dup_alloc<A>::remove(const void* data,
+                                                  unsigned length) {
+  remove_hash(
+      theta_sketch_dup_hasher::compute_hash(data, length, sketch_.seed_));
+}
+
+template <typename A>
+void coalescing_theta_sketch_dup_alloc<A>::remove_hash(uint64_t hash) {
+  // removing from an empty set is reported right away as in the sketch
+  if (sketch_.is_empty_) flush();
+  if (sketch_.is_empty_ || hash >= sketch_.theta_ || hash == 0) {
+    sketch_.internal_remove(hash);
+    return;
+  }
+  cache_entry& entry = cache_[hash & cache_mask_];
+  if (entry.hash == hash) {
+    entry.removes++;
+    return;
+  }
+  const cache_entry evicted = entry;
+  entry = cache_entry{hash, 0, 1};
+  if (evicted.hash == 0) {
+    num_pending_++;
+  } else {
+    apply_entry(evicted);
+  }
+}
+
+template <typename A>
+void coalescing_theta_sketch_dup_alloc<A>::apply_entry(
+    const cache_entry& entry) const {
+  // theta may have been lowered since the hash value got into the cache, the
+  // sketch checks it again
+  if (entry.adds > 0) sketch_.internal_update(entry.hash, entry.adds);
+  // a refused remove leaves the sketch unchanged
+  if (entry.removes > 0) sketch_.internal_remove(entry.hash, entry.removes);
+}
+
+template <typename A>
+void coalescing_theta_sketch_dup_alloc<A>::flush() const {
+  if (num_pending_ == 0) return;
+  // every entry leaves the cache, the first refused one is rethrown at the end
+  std::exception_ptr error;
+  for (auto& entry : cache_) {
+    if (entry.hash != 0) {
+      const cache_entry pending = entry;
+      entry = cache_entry{0, 0, 0};
+      num_pending_--;
+      try {
+        apply_entry(pending);
+      } catch (...) {
+        if (!error) error = std::current_exception();
+      }
+    }
+  }
+  if (error) std::rethrow_exception(error);
+}
+
+template <typename A>
+const update_theta_sketch_dup_alloc<A>&
+coalescing_theta_sketch_dup_alloc<A>::get_sketch() const {
+  flush();
+  return sketch_;
+}
+
+template <typename A>
+bool coalescing_theta_sketch_dup_alloc<A>::is_empty() const {
+  return get_sketch().is_empty();
+}
+
+template <typename A>
+double coalescing_theta_sketch_dup_alloc<A>::get_estimate() const {
+  return get_sketch().get_estimate();
+}
+
+template <typename A>
+double coalescing_theta_sketch_dup_alloc<A>::get_lower_bound(
+    uint8_t num_std_devs) const {
+  return get_sketch().get_lower_bound(num_std_devs);
+}
+
+template <typename A>
+double coalescing_theta_sketch_dup_alloc<A>::get_upper_bound(
+    uint8_t num_std_devs) const {
+  return get_sketch().get_upper_bound(num_std_devs);
+}
+
+template <typename A>
+bool coalescing_theta_sketch_dup_alloc<A>::is_estimation_mode() const {
+  return get_sketch().is_estimation_mode();
+}
+
+template <typename A>
+double coalescing_theta_sketch_dup_alloc<A>::get_theta() const {
+  return get_sketch().get_theta();
+}
+
+template <typename A>
+uint64_t coalescing_theta_sketch_dup_alloc<A>::get_theta64() const {
+  return get_sketch().get_theta64();
+}
+
+template <typename A>
+uint32_t coalescing_theta_sketch_dup_alloc<A>::get_num_retained() const {
+  return get_sketch().get_num_retained();
+}
+
+template <typename A>
+uint16_t coalescing_theta_sketch_dup_alloc<A>::get_seed_hash() const {
+  return sketch_.get_seed_hash();
+}
+
+template <typename A>
+string<A> coalescing_theta_sketch_dup_alloc<A>::to_string(
+    bool print_items) const {
+  return get_sketch().to_string(print_items);
+}
+
+template <typename A>
+void coalescing_theta_sketch_dup_alloc<A>::serialize(std::ostream& os) const {
+  get_sketch().serialize(os);
+}
+
+template <typename A>
+void coalescing_theta_sketch_dup_alloc<A>::serialize(
+    datasketches_pb::ThetaSketchDup* pb) const {
+  get_sketch().serialize(pb);
+}
+
+template <typename A>
+vector_u8_dup<A> coalescing_theta_sketch_dup_alloc<A>::serialize(
+    unsigned header_size_bytes) const {
+  return get_sketch().serialize(header_size_bytes);
+}
+
+template <typename A>
+typename theta_sketch_dup_alloc<A>::const_iterator
+coalescing_theta_sketch_dup_alloc<A>::begin() const {
+  return get_sketch().begin();
+}
+
+template <typename A>
+typename theta_sketch_dup_alloc<A>::const_iterator
+coalescing_theta_sketch_dup_alloc<A>::end() const {
+  return get_sketch().end();
+}
+
+template <typename A>
+bool coalescing_theta_sketch_dup_alloc<A>::is_equal(
+    const coalescing_theta_sketch_dup_alloc<A>& r) const {
+  return get_sketch().is_equal(r.get_sketch());
+}
+
+template <typename A>
+void coalescing_theta_sketch_dup_alloc<A>::update(const std::string& value) {
+  if (value.empty()) return;
+  update(value.c_str(), value.length());
+}
+
+template <typename A>
+void coalescing_theta_sketch_dup_alloc<A>::update(uint64_t value) {
+  update_hash(theta_sketch_dup_hasher::compute_hash64(value, sketch_.seed_));
+}
+
+template <typename A>
+void coalescing_theta_sketch_dup_alloc<A>::update(int64_t value) {
+  update(static_cast<uint64_t>(value));
+}
+
+template <typename A>
+void coalescing_theta_sketch_dup_alloc<A>::update(uint32_t value) {
+  update(static_cast<int32_t>(value));
+}
+
+template <typename A>
+void coalescing_theta_sketch_dup_alloc<A>::update(int32_t value) {
+  update(static_cast<int64_t>(value));
+}
+
+template <typename A>
+void coalescing_theta_sketch_dup_alloc<A>::update(uint16_t value) {
+  update(static_cast<int16_t>(value));
+}
+
+template <typename A>
+void coalescing_theta_sketch_dup_alloc<A>::update(int16_t value) {
+  update(static_cast<int64_t>(value));
+}
+
+template <typename A>
+void coalescing_theta_sketch_dup_alloc<A>::update(uint8_t value) {
+  update(static_cast<int8_t>(value));
+}
+
+template <typename A>
+void coalescing_theta_sketch_dup_alloc<A>::update(int8_t value) {
+  update(static_cast<int64_t>(value));
+}
+
+template <typename A>
+void coalescing_theta_sketch_dup_alloc<A>::update(double value) {
+  update(theta_sketch_dup_hasher::canonical_bits(value));
+}
+
+template <typename A>
+void coalescing_theta_sketch_dup_alloc<A>::update(float value) {
+  update(static_cast<double>(value));
+}
+
+template <typename A>
+void coalescing_theta_sketch_dup_alloc<A>::remove(const std::string& value) {
+  if (value.empty()) return;
+  remove(value.c_str(), value.length());
+}
+
+template <typename A>
+void coalescing_theta_sketch_dup_alloc<A>::remove(uint64_t value) {
+  remove_hash(theta_sketch_dup_hasher::compute_hash64(value, sketch_.seed_));
+}
+
+template <typename A>
+void coalescing_theta_sketch_dup_alloc<A>::remove(int64_t value) {
+  remove(static_cast<uint64_t>(value));
+}
+
+template <typename A>
+void coalescing_theta_sketch_dup_alloc<A>::remove(uint32_t value) {
+  remove(static_cast<int32_t>(value));
+}
+
+template <typename A>
+void coalescing_theta_sketch_dup_alloc<A>::remove(int32_t value) {
+  remove(static_cast<int64_t>(value));
+}
+
+template <typename A>
+void coalescing_theta_sketch_dup_alloc<A>::remove(uint16_t value) {
+  remove(static_cast<int16_t>(value));
+}
+
+template <typename A>
+void coalescing_theta_sketch_dup_alloc<A>::remove(int16_t value) {
+  remove(static_cast<int64_t>(value));
+}
+
+template <typename A>
+void coalescing_theta_sketch_dup_alloc<A>::remove(uint8_t value) {
+  remove(static_cast<int8_t>(value));
+}
+
+template <typename A>
+void coalescing_theta_sketch_dup_alloc<A>::remove(int8_t value) {
+  remove(static_cast<int64_t>(value));
+}
+
+template <typename A>
+void coalescing_theta_sketch_dup_alloc<A>::remove(double value) {
+  remove(theta_sketch_dup_hasher::canonical_bits(value));
+}
+
+template <typename A>
+void coalescing_theta_sketch_dup_alloc<A>::remove(float value) {
+  remove(static_cast<double>(value));
+}
+
+/*
+ * alias with default allocator for convenience
+ */
+typedef coalescing_theta_sketch_dup_alloc<std::allocator<void>>
+    coalescing_theta_sketch_dup;
+
+// overload ==
+template <typename A>
+bool operator==(coalescing_theta_sketch_dup_alloc<A> const& l,
+                coalescing_theta_sketch_dup_alloc<A> const& r) {
+  return l.is_equal(r);
+}
+
+} /* namespace datasketches */
+
+#endif
@@ -0,0 +1,709 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef CONCURRENT_THETA_SKETCH_DUP_H_
+#define CONCURRENT_THETA_SKETCH_DUP_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "theta_sketch_dup.h"
+
+namespace datasketches {
+
+/*
+ * concurrent_theta_sketch_dup is an update_theta_sketch_dup that many threads
+ * of a process update directly, for streams with so much key reuse that
+ * buffering the updates per thread saves little.
+ * A new hash claims an empty slot with a compare-and-swap on the hash word,
+ * and counts are changed with atomic fetch_add and compare-and-swap, without
+ * locks. The numbers of keys and zero entries are kept in per-thread stripes
+ * of cache line size, summed when the capacity is checked.
+ * A resize or a rebuild is a cooperative phase: the thread that finds the
+ * table over capacity waits for the threads in the middle of an operation,
+ * then the table is split into chunks that every arriving thread helps to
+ * move into the new table. The old table is freed once no thread can see it.
+ * The capacity is checked every few insertions of a stripe, so the table may
+ * hold slightly more keys than update_theta_sketch_dup before a rebuild, and
+ * theta may differ from the theta of a sketch fed with the same stream.
+ * The table is always probed with DOUBLE_HASHING, a builder set to ROBIN_HOOD
+ * is rejected.
+ * Example:
+ *   concurrent_theta_sketch_dup sketch(builder);
+ *   // in any thread
+ *   sketch.update(value);
+ *   sketch.get_estimate();
+ */
+template <typename A>
+class concurrent_theta_sketch_dup_alloc {
+ public:
+  typedef typename update_theta_sketch_dup_alloc<A>::builder builder;
+  typedef vector_u8_dup<A> vector_bytes;
+
+  // number of counter stripes, threads beyond it share stripes
+  static const uint32_t NUM_STRIPES = 32;
+  // number of slots moved by a thread at a time in a resize or a rebuild
+  static const uint32_t MIGRATION_CHUNK_SLOTS = 1024;
+
+  /**
+   * Creates an empty sketch
+   * @param sketch_builder parameters of the sketch, with DOUBLE_HASHING
+   * probing
+   */
+  explicit concurrent_theta_sketch_dup_alloc(
+      const builder& sketch_builder = builder());
+
+  ~concurrent_theta_sketch_dup_alloc();
+
+  concurrent_theta_sketch_dup_alloc(const concurrent_theta_sketch_dup_alloc&) =
+      delete;
+  concurrent_theta_sketch_dup_alloc& operator=(
+      const concurrent_theta_sketch_dup_alloc&) = delete;
+
+  /**
+   * Update this sketch with a given value, from any thread.
+   * @param value value to update the sketch with
+   */
+  template <typename T>
+  void update(const T& value);
+  void update(const theta_sketch_dup_key& key);
+  void update(const theta_sketch_dup_key* keys, size_t num_keys);
+
+  /**
+   * Remove a given value from this sketch, from any thread.
+   * @param value value to remove from the sketch, which must have been added
+   */
+  template <typename T>
+  void remove(const T& value);
+  void remove(const theta_sketch_dup_key& key);
+
+  bool is_empty() const;
+  bool is_estimation_mode() const;
+  double get_theta() const;
+  uint64_t get_theta64() const;
+  uint32_t get_num_retained() const;
+  uint16_t get_seed_hash() const;
+  double get_estimate() const;
+  double get_lower_bound(uint8_t num_std_devs) const;
+  double get_upper_bound(uint8_t num_std_devs) const;
+
+  /**
+   * @return a copy of this sketch. Every entry is read atomically, the copy is
+   * exact if no thread updates the sketch meanwhile.
+   */
+  update_theta_sketch_dup_alloc<A> get_result() const;
+
+  /**
+   * @return this sketch in the format of update_theta_sketch_dup::serialize()
+   */
+  vector_bytes serialize() const;
+
+  const theta_sketch_dup_hasher& get_hasher() const;
+
+  /**
+   * @return the number of resizes and rebuilds so far
+   */
+  uint64_t get_num_migrations() const;
+
+ private:
+  typedef typename update_theta_sketch_dup_alloc<A>::resize_factor
+      resize_factor;
+
+  struct slot {
+    std::atomic<uint64_t> hash;
+    std::atomic<int64_t> count;
+  };
+  typedef typename std::allocator_traits<A>::template rebind_alloc<slot>
+      AllocSlot;
+
+  struct alignas(64) stripe {
+    std::atomic<uint32_t> num_active{0};
+    std::atomic<int64_t> num_keys{0};
+    std::atomic<int64_t> num_zeros{0};
+  };
+
+  struct table {
+    uint8_t lg_size;
+    uint64_t theta;
+    uint32_t capacity;
+    // the stripe sums the keys every check_mask + 1 insertions
+    uint32_t check_mask;
+    std::vector<slot, AllocSlot> slots;
+    stripe stripes[NUM_STRIPES];
+    table(uint8_t lg_size, uint8_t lg_nom_size, uint64_t theta);
+  };
+
+  enum insert_result { UPDATED, INSERTED, FULL };
+
+  // an operation on the current table, holds a stripe of the sketch active
+  class operation {
+   public:
+    explicit operation(const concurrent_theta_sketch_dup_alloc* sketch);
+    ~operation();
+    table* get_table() const { return table_; }
+    uint64_t get_phase() const { return phase_; }
+    stripe& get_stripe() const { return *stripe_; }
+
+   private:
+    const concurrent_theta_sketch_dup_alloc* sketch_;
+    stripe* stripe_;
+    table* table_;
+    uint64_t phase_;
+  };
+
+  theta_sketch_dup_hasher hasher_;
+  uint8_t lg_nom_size_;
+  resize_factor rf_;
+  float p_;
+  std::atomic<bool> is_empty_;
+  std::atomic<table*> table_;
+  // even while the table is in use, odd while it is resized or rebuilt
+  mutable std::atomic<uint64_t> phase_;
+  // the stripes of the threads in the middle of an operation
+  mutable stripe active_[NUM_STRIPES];
+  // the migration of the odd phase migrating_phase_
+  std::atomic<uint64_t> migrating_phase_;
+  table* migration_source_;
+  table* migration_target_;
+  mutable std::atomic<uint32_t> migration_cursor_;
+  mutable std::atomic<uint32_t> migration_done_;
+  mutable std::atomic<uint32_t> num_helpers_;
+
+  static stripe& get_thread_stripe(stripe* stripes);
+  void internal_update(uint64_t hash, int64_t count);
+  void internal_remove(uint64_t hash, int64_t count);
+  insert_result hash_add(table* t, stripe& s, uint64_t hash, int64_t count);
+  // @return true if the table t is over capacity
+  bool is_over_capacity(const table* t) const;
+  static int64_t sum_keys(const table* t);
+  static int64_t sum_zeros(const table* t);
+  /**
+   * resize or rebuild the table of the even phase if it is still needed
+   * @param phase phase seen by the caller when it found the table full or
+   * over capacity
+   * @param is_full the table had no empty slot for a new hash
+   */
+  void migrate(uint64_t phase, bool is_full);
+  // move chunks of the current migration until none is left
+  void help_migrate(uint64_t phase) const;
+  void move_chunks(table* from, table* to) const;
+  void get_bounds(uint8_t num_std_devs, double* estimate, double* lower_bound,
+                  double* upper_bound) const;
+};
+
+/*
+ * The following are implementations
+ */
+
+template <typename A>
+concurrent_theta_sketch_dup_alloc<A>::table::table(uint8_t lg_size,
+                                                   uint8_t lg_nom_size,
+                                                   uint64_t theta)
+    : lg_size(lg_size),
+      theta(theta),
+      capacity(update_theta_sketch_dup_alloc<A>::get_capacity(lg_size,
+                                                              lg_nom_size)),
+      check_mask(0),
+      slots(1 << lg_size) {
+  // the stripes may insert this many keys past the capacity before it is
+  // noticed, keep a quarter of the free slots for them
+  const uint32_t slack = ((1u << lg_size) - capacity) / (4 * NUM_STRIPES);
+  while (check_mask * 2 + 1 <= slack) check_mask = check_mask * 2 + 1;
+}
+
+template <typename A>
+concurrent_theta_sketch_dup_alloc<A>::operation::operation(
+    const concurrent_theta_sketch_dup_alloc* sketch)
+    : sketch_(sketch), stripe_(&get_thread_stripe(sketch->active_)) {
+  while (true) {
+    // seq_cst pairs with migrate(): either the migration sees this thread
+    // active, or this thread sees the odd phase
+    stripe_->num_active.fetch_add(1);
+    phase_ = sketch_->phase_.load();
+    if (phase_ % 2 == 0) break;
+    stripe_->num_active.fetch_sub(1);
+    sketch_->help_migrate(phase_);
+  }
+  table_ = sketch_->table_.load();
+}
+
+template <typename A>
+concurrent_theta_sketch_dup_alloc<A>::operation::~operation() {
+  stripe_->num_active.fetch_sub(1);
+}
+
+template <typename A>
+typename concurrent_theta_sketch_dup_alloc<A>::stripe&
+concurrent_theta_sketch_dup_alloc<A>::get_thread_stripe(stripe* stripes) {
+  static std::atomic<uint32_t> next_index(0);
+  static thread_local const uint32_t index = next_index.fetch_add(1);
+  return stripes[index % NUM_STRIPES];
+}
+
+template <typename A>
+concurrent_theta_sketch_dup_alloc<A>::concurrent_theta_sketch_dup_alloc(
+    const builder& sketch_builder)
+    : hasher_(DEFAULT_SEED),
+      lg_nom_size_(0),
+      rf_(),
+      p_(1),
+      is_empty_(true),
+      table_(nullptr),
+      phase_(0),
+      active_(),
+      migrating_phase_(0),
+      migration_source_(nullptr),
+      migration_target_(nullptr),
+      migration_cursor_(0),
+      migration_done_(0),
+      num_helpers_(0) {
+  static_assert(std::atomic<uint64_t>::is_always_lock_free,
+                "the table needs lock-free atomics");
+  const auto prototype = sketch_builder.build();
+  if (prototype.probing_ !=
+      update_theta_sketch_dup_alloc<A>::DOUBLE_HASHING)
+    throw std::invalid_argument(
+        "concurrent sketches only support DOUBLE_HASHING probing");
+  hasher_ = theta_sketch_dup_hasher(prototype.seed_);
+  lg_nom_size_ = prototype.lg_nom_size_;
+  rf_ = prototype.rf_;
+  p_ = prototype.p_;
+  table_.store(
+      new table(prototype.lg_cur_size_, lg_nom_size_, prototype.theta_));
+}
+
+template <typename A>
+concurrent_theta_sketch_dup_alloc<A>::~concurrent_theta_sketch_dup_alloc() {
+  delete table_.load();
+}
+
+template <typename A>
+template <typename T>
+void concurrent_theta_sketch_dup_alloc<A>::update(const T& value) {
+  update(hasher_.hash(value));
+}
+
+template <typename A>
+void concurrent_theta_sketch_dup_alloc<A>::update(
+    const theta_sketch_dup_key& key) {
+  theta_sketch_dup_alloc<A>::check_seed_hash(key.seed_hash,
+                                             hasher_.get_seed_hash());
+  if (key.hash != theta_sketch_dup_key::IGNORED_HASH)
+    internal_update(key.hash, 1);
+}
+
+template <typename A>
+void concurrent_theta_sketch_dup_alloc<A>::update(
+    const theta_sketch_dup_key* keys, size_t num_keys) {
+  theta_sketch_dup_alloc<A>::check_seed_hash(keys, num_keys,
+                                             hasher_.get_seed_hash());
+  for (size_t i = 0; i < num_keys; i++)
+    if (keys[i].hash != theta_sketch_dup_key::IGNORED_HASH)
+      internal_update(keys[i].hash, 1);
+}
+
+template <typename A>
+template <typename T>
+void concurrent_theta_sketch_dup_alloc<A>::remove(const T& value) {
+  remove(hasher_.hash(value));
+}
+
+template <typename A>
+void concurrent_theta_sketch_dup_alloc<A>::remove(
+    const theta_sketch_dup_key& key) {
+  theta_sketch_dup_alloc<A>::check_seed_hash(key.seed_hash,
+                                             hasher_.get_seed_hash());
+  if (key.hash != theta_sketch_dup_key::IGNORED_HASH)
+    internal_remove(key.hash, 1);
+}
+
+template <typename A>
+void concurrent_theta_sketch_dup_alloc<A>::internal_update(uint64_t hash,
+                                                           int64_t count) {
+  // avoid writing the shared cache line once the sketch is not empty
+  if (is_empty_.load(std::memory_order_relaxed)) is_empty_.store(false);
+  if (hash == 0) return;  // hash == 0 is reserved to mark empty slots
+  while (true) {
+    insert_result result;
+    uint64_t phase;
+    bool is_over = false;
+    {
+      operation op(this);
+      table* t = op.get_table();
+      if (hash >= t->theta) return;
+      result = hash_add(t, op.get_stripe(), hash, count);
+      phase = op.get_phase();
+      if (result == INSERTED &&
+          (t->stripes[&op.get_stripe() - active_].num_keys.load(
+               std::memory_order_relaxed) &
+           t->check_mask) == 0)
+        is_over = is_over_capacity(t);
+    }
+    if (result == UPDATED) return;
+    if (result == INSERTED) {
+      if (is_over) migrate(phase, false);
+      return;
+    }
+    // no room for the hash: grow the table and try again
+    migrate(phase, true);
+  }
+}
+
+template <typename A>
+typename concurrent_theta_sketch_dup_alloc<A>::insert_result
+concurrent_theta_sketch_dup_alloc<A>::hash_add(table* t, stripe& active,
+                                               uint64_t hash, int64_t count) {
+  // the counters of the table use the stripe index of the active stripe
+  stripe& s = t->stripes[&active - active_];
+  const uint8_t lg_size = t->lg_size;
+  const uint32_t mask = (1 << lg_size) - 1;
+  const uint32_t stride =
+      update_theta_sketch_dup_alloc<A>::get_stride(hash, lg_size);
+  uint32_t cur_probe = static_cast<uint32_t>(hash) & mask;
+  const uint32_t loop_index = cur_probe;
+  do {
+    slot& e = t->slots[cur_probe];
+    uint64_t value = e.hash.load(std::memory_order_acquire);
+    if (value == 0) {
+      // a claimed slot counts as a zero entry until its count is added, so
+      // that a concurrent update of the same hash accounts for it alike
+      s.num_zeros.fetch_add(1, std::memory_order_relaxed);
+      if (e.hash.compare_exchange_strong(value, hash,
+                                         std::memory_order_acq_rel)) {
+        s.num_keys.fetch_add(1, std::memory_order_relaxed);
+        if (e.count.fetch_add(count, std::memory_order_relaxed) == 0)
+          s.num_zeros.fetch_sub(1, std::memory_order_relaxed);
+        return INSERTED;
+      }
+      s.num_zeros.fetch_sub(1, std::memory_order_relaxed);
+      // value is now the hash of the thread that claimed the slot first
+    }
+    if (value == hash) {
+      if (e.count.fetch_add(count, std::memory_order_relaxed) == 0)
+        s.num_zeros.fetch_sub(1, std::memory_order_relaxed);
+      return UPDATED;
+    }
+    cur_probe = (cur_probe + stride) & mask;
+  } while (cur_probe != loop_index);
+  return FULL;
+}
+
+template <typename A>
+void concurrent_theta_sketch_dup_alloc<A>::internal_remove(uint64_t hash,
+                                                           int64_t count) {
+  if (is_empty_.load())
+    throw std::logic_error(
+        "Can't remove an element from an empty set: no data yet");
+  if (hash == 0) return;  // hash == 0 is reserved to mark empty slots
+  operation op(this);
+  table* t = op.get_table();
+  if (hash >= t->theta) return;
+  stripe& s = t->stripes[&op.get_stripe() - active_];
+  const uint32_t mask = (1 << t->lg_size) - 1;
+  const uint32_t stride =
+      update_theta_sketch_dup_alloc<A>::get_stride(hash, t->lg_size);
+  uint32_t cur_probe = static_cast<uint32_t>(hash) & mask;
+  const uint32_t loop_index = cur_probe;
+  do {
+    slot& e = t->slots[cur_probe];
+    const uint64_t value = e.hash.load(std::memory_order_acquire);
+    // slots are only emptied by a migration, an empty slot ends the search
+    if (value == 0) break;
+    if (value == hash) {
+      int64_t current = e.count.load(std::memory_order_relaxed);
+      do {
+        // check before decreasing so that a failed remove leaves the table
+        // intact
+        if (current < count)
+          throw std::logic_error("this element doesn't exist");
+      } while (!e.count.compare_exchange_weak(current, current - count,
+                                              std::memory_order_relaxed));
+      if (current == count) s.num_zeros.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    cur_probe = (cur_probe + stride) & mask;
+  } while (cur_probe != loop_index);
+  throw std::logic_error("this element doesn't exist");
+}
+
+template <typename A>
+int64_t concurrent_theta_sketch_dup_alloc<A>::sum_keys(const table* t) {
+  int64_t sum = 0;
+  for (const auto& s : t->stripes)
+    sum += s.num_keys.load(std::memory_order_relaxed);
+  return sum;
+}
+
+template <typename A>
+int64_t concurrent_theta_sketch_dup_alloc<A>::sum_zeros(const table* t) {
+  int64_t sum = 0;
+  for (const auto& s : t->stripes)
+    sum += s.num_zeros.load(std::memory_order_relaxed);
+  return sum;
+}
+
+template <typename A>
+bool concurrent_theta_sketch_dup_alloc<A>::is_over_capacity(
+    const table* t) const {
+  return sum_keys(t) > t->capacity;
+}
+
+template <typename A>
+void concurrent_theta_sketch_dup_alloc<A>::migrate(uint64_t phase,
+                                                   bool is_full) {
+  // one thread starts the migration of a phase, the others help
+  if (!phase_.compare_exchange_strong(phase, phase + 1)) {
+    // phase is now the current phase, the caller retries after a migration
+    if (phase % 2 == 1) help_migrate(phase);
+    return;
+  }
+  const uint64_t odd_phase = phase + 1;
+  // wait for the operations on the table, the new ones help the migration
+  for (const auto& s : active_)
+    while (s.num_active.load() != 0) std::this_thread::yield();
+
+  table* from = table_.load();
+  const int64_t num_keys = sum_keys(from);
+  table* to = nullptr;
+  if (num_keys > from->capacity ||
+      (is_full && num_keys >= (int64_t(1) << from->lg_size))) {
+    if (from->lg_size <= lg_nom_size_) {
+      // resize as update_theta_sketch_dup::resize()
+      const uint8_t lg_tgt_size = lg_nom_size_ + 1;
+      const uint8_t factor = std::max(
+          1, std::min(static_cast<int>(rf_), lg_tgt_size - from->lg_size));
+      to = new table(from->lg_size + factor, lg_nom_size_, from->theta);
+    } else {
+      // rebuild as update_theta_sketch_dup::rebuild(): theta becomes the
+      // (k+1)-th smallest hash of the table, zero entries included
+      std::vector<uint64_t> hashes;
+      hashes.reserve(num_keys);
+      for (const auto& e : from->slots) {
+        const uint64_t hash = e.hash.load(std::memory_order_relaxed);
+        if (hash != 0) hashes.push_back(hash);
+      }
+      const uint32_t pivot = 1 << lg_nom_size_;
+      std::nth_element(hashes.begin(), hashes.begin() + pivot, hashes.end());
+      to = new table(from->lg_size, lg_nom_size_, hashes[pivot]);
+    }
+  }
+  if (to != nullptr) {
+    migration_source_ = from;
+    migration_target_ = to;
+    migration_cursor_.store(0);
+    migration_done_.store(0);
+    // the helpers that arrived meanwhile start moving chunks
+    migrating_phase_.store(odd_phase, std::memory_order_release);
+    move_chunks(from, to);
+    while (migration_done_.load(std::memory_order_acquire) <
+           from->slots.size())
+      std::this_thread::yield();
+    table_.store(to);
+  }
+  phase_.store(odd_phase + 1);
+  // seq_cst pairs with help_migrate(): a helper either sees the new phase or
+  // is waited for
+  while (num_helpers_.load() != 0) std::this_thread::yield();
+  if (to != nullptr) delete from;
+}
+
+template <typename A>
+void concurrent_theta_sketch_dup_alloc<A>::help_migrate(uint64_t phase) const {
+  num_helpers_.fetch_add(1);
+  // the tables of the migration stay until the helpers leave
+  while (phase_.load() == phase) {
+    if (migrating_phase_.load(std::memory_order_acquire) == phase) {
+      move_chunks(migration_source_, migration_target_);
+      break;
+    }
+    std::this_thread::yield();
+  }
+  num_helpers_.fetch_sub(1);
+  while (phase_.load() == phase) std::this_thread::yield();
+}
+
+template <typename A>
+void concurrent_theta_sketch_dup_alloc<A>::move_chunks(table* from,
+                                                       table* to) const {
+  const uint32_t size = from->slots.size();
+  const uint32_t mask = (1 << to->lg_size) - 1;
+  stripe& s = to->stripes[&get_thread_stripe(active_) - active_];
+  while (true) {
+    const uint32_t begin = migration_cursor_.fetch_add(
+        MIGRATION_CHUNK_SLOTS, std::memory_order_relaxed);
+    if (begin >= size) return;
+    const uint32_t end = std::min(size, begin + MIGRATION_CHUNK_SLOTS);
+    int64_t num_moved = 0;
+    for (uint32_t i = begin; i < end; i++) {
+      const uint64_t hash = from->slots[i].hash.load(std::memory_order_relaxed);
+      const int64_t count =
+          from->slots[i].count.load(std::memory_order_relaxed);
+      if (hash == 0 || hash >= to->theta || count == 0) continue;
+      // hashes are unique, other movers only race for the empty slots
+      const uint32_t stride =
+          update_theta_sketch_dup_alloc<A>::get_stride(hash, to->lg_size);
+      uint32_t cur_probe = static_cast<uint32_t>(hash) & mask;
+      uint64_t empty = 0;
+      while (!to->slots[cur_probe].hash.compare_exchange_strong(
+          empty, hash, std::memory_order_relaxed)) {
+        empty = 0;
+        cur_probe = (cur_probe + stride) & mask;
+      }
+      to->slots[cur_probe].count.store(count, std::memory_order_relaxed);
+      num_moved++;
+    }
+    s.num_keys.fetch_add(num_moved, std::memory_order_relaxed);
+    migration_done_.fetch_add(end - begin, std::memory_order_release);
+  }
+}
+
+template <typename A>
+bool concurrent_theta_sketch_dup_alloc<A>::is_empty() const {
+  return is_empty_.load();
+}
+
+template <typename A>
+bool concurrent_theta_sketch_dup_alloc<A>::is_estimation_mode() const {
+  return get_theta64() < theta_sketch_dup_alloc<A>::MAX_THETA && !is_empty();
+}
+
+template <typename A>
+double concurrent_theta_sketch_dup_alloc<A>::get_theta() const {
+  return static_cast<double>(get_theta64()) /
+         theta_sketch_dup_alloc<A>::MAX_THETA;
+}
+
+template <typename A>
+uint64_t concurrent_theta_sketch_dup_alloc<A>::get_theta64() const {
+  operation op(this);
+  return op.get_table()->theta;
+}
+
+template <typename A>
+uint32_t concurrent_theta_sketch_dup_alloc<A>::get_num_retained() const {
+  operation op(this);
+  // the zeros may run ahead of the keys while a slot is claimed
+  return std::max<int64_t>(
+      0, sum_keys(op.get_table()) - sum_zeros(op.get_table()));
+}
+
+template <typename A>
+uint16_t concurrent_theta_sketch_dup_alloc<A>::get_seed_hash() const {
+  return hasher_.get_seed_hash();
+}
+
+template <typename A>
+const theta_sketch_dup_hasher& concurrent_theta_sketch_dup_alloc<A>::get_hasher()
+    const {
+  return hasher_;
+}
+
+template <typename A>
+uint64_t concurrent_theta_sketch_dup_alloc<A>::get_num_migrations() const {
+  return phase_.load() / 2;
+}
+
+template <typename A>
+void concurrent_theta_sketch_dup_alloc<A>::get_bounds(
+    uint8_t num_std_devs, double* estimate, double* lower_bound,
+    double* upper_bound) const {
+  uint32_t num_retained;
+  uint64_t theta;
+  {
+    operation op(this);
+    num_retained = std::max<int64_t>(
+        0, sum_keys(op.get_table()) - sum_zeros(op.get_table()));
+    theta = is_empty() ? theta_sketch_dup_alloc<A>::MAX_THETA
+                       : op.get_table()->theta;
+  }
+  theta_sketch_dup_alloc<A>::get_bounds(&num_retained, &theta, 1, num_std_devs,
+                                        estimate, lower_bound, upper_bound);
+}
+
+template <typename A>
+double concurrent_theta_sketch_dup_alloc<A>::get_estimate() const {
+  double estimate, lower_bound, upper_bound;
+  get_bounds(1, &estimate, &lower_bound, &upper_bound);
+  return estimate;
+}
+
+template <typename A>
+double concurrent_theta_sketch_dup_alloc<A>::get_lower_bound(
+    uint8_t num_std_devs) const {
+  double estimate, lower_bound, upper_bound;
+  get_bounds(num_std_devs, &estimate, &lower_bound, &upper_bound);
+  return lower_bound;
+}
+
+template <typename A>
+double concurrent_theta_sketch_dup_alloc<A>::get_upper_bound(
+    uint8_t num_std_devs) const {
+  double estimate, lower_bound, upper_bound;
+  get_bounds(num_std_devs, &estimate, &lower_bound, &upper_bound);
+  return upper_bound;
+}
+
+template <typename A>
+update_theta_sketch_dup_alloc<A>
+concurrent_theta_sketch_dup_alloc<A>::get_result() const {
+  auto sketch = builder()
+                    .set_lg_k(lg_nom_size_)
+                    .set_resize_factor(rf_)
+                    .set_p(p_)
+                    .set_seed(hasher_.get_seed())
+                    .build();
+  operation op(this);
+  const table* t = op.get_table();
+  sketch.is_empty_ = is_empty();
+  sketch.theta_ = t->theta;
+  // the copy rebuilds a table over its capacity at its next insertion
+  sketch.rehash(t->lg_size);
+  for (const auto& e : t->slots) {
+    const uint64_t hash = e.hash.load(std::memory_order_acquire);
+    const int64_t count = e.count.load(std::memory_order_relaxed);
+    // the entries with count 0 are kept, as the table of the sketch does
+    if (hash != 0) {
+      sketch.hash_insert(hash, count, sketch.keys_.data(), t->lg_size);
+      sketch.num_keys_++;
+      if (count == 0) sketch.num_zeros_++;
+    }
+  }
+  return sketch;
+}
+
+template <typename A>
+vector_u8_dup<A> concurrent_theta_sketch_dup_alloc<A>::serialize() const {
+  return get_result().serialize();
+}
+
+/*
+ * alias with default allocator for convenience
+ */
+typedef concurrent_theta_sketch_dup_alloc<std::allocator<void>>
+    concurrent_theta_sketch_dup;
+
+} /* namespace datasketches */
+
+#endif
@@ -0,0 +1,538 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef FIXED_THETA_SKETCH_DUP_H_
+#define FIXED_THETA_SKETCH_DUP_H_
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include "theta_sketch_dup.h"
+
+namespace datasketches {
+
+/*
+ * fixed_theta_sketch_dup is an update_theta_sketch_dup with a lg_k known at
+ * compile time. Its hash table is a std::array of the full size 2^(LgK+1)
+ * stored inside the object, so the sketch allocates nothing, the masks,
+ * strides and capacity of the probes are constants, and there is no resize:
+ * the table is rebuilt in place when it reaches its capacity, as the table of
+ * update_theta_sketch_dup at its full size.
+ * The sketch is trivially copyable, so it can be embedded in other structs
+ * and moved with memcpy. Its serialized form is the one of
+ * update_theta_sketch_dup, and both sketches deserialize each other.
+ * Example:
+ *   fixed_theta_sketch_dup<10> sketch;
+ *   sketch.update("element");
+ *   auto bytes = sketch.serialize();
+ *   auto copy = update_theta_sketch_dup::deserialize(bytes.data(),
+ *                                                    bytes.size());
+ */
+template <uint8_t LgK>
+class fixed_theta_sketch_dup {
+ public:
+  static_assert(LgK >= update_theta_sketch_dup::builder::MIN_LG_K,
+                "LgK is less than the minimum lg_k");
+  static_assert(LgK <= 26, "LgK is too large for inline storage");
+
+  static constexpr uint8_t LG_SIZE = LgK + 1;
+  static constexpr uint32_t SIZE = 1u << LG_SIZE;
+  static constexpr uint32_t MASK = SIZE - 1;
+  // the rebuild threshold of update_theta_sketch_dup: 15/16
+  static constexpr uint32_t CAPACITY = SIZE / 16 * 15;
+  static constexpr uint64_t MAX_THETA = update_theta_sketch_dup::MAX_THETA;
+
+  /**
+   * Creates an empty sketch
+   * @param seed the seed for the hash function
+   * @param p sampling probability (initial theta)
+   */
+  explicit fixed_theta_sketch_dup(uint64_t seed = DEFAULT_SEED, float p = 1);
+
+  /**
+   * Update this sketch with an element of any type hashed by
+   * theta_sketch_dup_hasher, the same as update_theta_sketch_dup::update
+   * @param value element to update the sketch with
+   */
+  template <typename T>
+  void update(const T& value);
+
+  /**
+   * Update this sketch with an element hashed by theta_sketch_dup_hasher.
+   * @param key hashed element, must be hashed with the seed of this sketch
+   */
+  void update(const theta_sketch_dup_key& key);
+
+  /**
+   * Update this sketch with a batch of elements hashed by
+   * theta_sketch_dup_hasher.
+   */
+  void update(const theta_sketch_dup_key* keys, size_t num_keys);
+
+  /**
+   * Remove one element of any type from this sketch.
+   * @throw std::logic_error if the sketch is empty or the element is not
+   * retained while its hash value is below theta
+   */
+  template <typename T>
+  void remove(const T& value);
+
+  void remove(const theta_sketch_dup_key& key);
+
+  void remove(const theta_sketch_dup_key* keys, size_t num_keys);
+
+  /**
+   * Reset the sketch to its initial state: empty, with the initial theta
+   */
+  void reset();
+
+  bool is_empty() const;
+  bool is_estimation_mode() const;
+  double get_theta() const;
+  uint64_t get_theta64() const;
+  uint32_t get_num_retained() const;
+  uint16_t get_seed_hash() const;
+  double get_estimate() const;
+  double get_lower_bound(uint8_t num_std_devs) const;
+  double get_upper_bound(uint8_t num_std_devs) const;
+
+  /**
+   * Call f on every live entry of the sketch: the entries with a non-zero
+   * count and a hash value below theta
+   * @param f function object called as f(uint64_t hash, int64_t count)
+   */
+  template <typename F>
+  void for_each_live(F f) const;
+
+  /**
+   * Serializes the sketch in the format of
+   * update_theta_sketch_dup::serialize(os)
+   */
+  void serialize(std::ostream& os) const;
+
+  /**
+   * Serializes the sketch in the format of
+   * update_theta_sketch_dup::serialize(header_size_bytes)
+   * @param header_size_bytes space to reserve in front of the sketch
+   */
+  std::vector<uint8_t> serialize(unsigned header_size_bytes = 0) const;
+
+  /**
+   * Deserializes a sketch serialized by update_theta_sketch_dup or by
+   * fixed_theta_sketch_dup with the same lg_k.
+   * @throw std::invalid_argument if the lg_k of the sketch is not LgK
+   */
+  static fixed_theta_sketch_dup deserialize(const void* bytes, size_t size,
+                                            uint64_t seed = DEFAULT_SEED);
+
+  static fixed_theta_sketch_dup deserialize(std::istream& is,
+                                            uint64_t seed = DEFAULT_SEED);
+
+  /**
+   * @return a fixed sketch with the live entries of an update sketch
+   * @throw std::invalid_argument if the lg_k of the sketch is not LgK
+   */
+  template <typename A>
+  static fixed_theta_sketch_dup from_sketch(
+      const update_theta_sketch_dup_alloc<A>& sketch);
+
+  /**
+   * @return an update sketch with the state of this sketch, at the full size
+   * of its hash table
+   */
+  template <typename A = std::allocator<void>>
+  update_theta_sketch_dup_alloc<A> to_sketch() const;
+
+ private:
+  // the layout of std::pair<uint64_t, int64_t>, trivially copyable
+  struct entry {
+    uint64_t hash;
+    int64_t count;
+  };
+
+  // marks the entries waiting to be moved by a rebuild, above every theta
+  static constexpr uint64_t UNPLACED = uint64_t(1) << 63;
+
+  std::array<entry, SIZE> keys_;
+  uint64_t theta_;
+  theta_sketch_dup_hasher hasher_;
+  uint32_t num_keys_;
+  uint32_t num_zeros_;
+  float p_;
+  bool is_empty_;
+
+  static constexpr uint32_t get_stride(uint64_t hash);
+  void get_bounds(uint8_t num_std_devs, double* lower_bound,
+                  double* upper_bound) const;
+  void internal_update(uint64_t hash);
+  void internal_remove(uint64_t hash);
+  // insert a hash value that is not in the table
+  void hash_insert(uint64_t hash, int64_t count);
+  /**
+   * lower theta to the hash value of rank 2^LgK and move the entries with a
+   * non-zero count below it to their slots without a second table
+   */
+  void rebuild();
+};
+
+/*
+ * The following are implementations
+ */
+
+template <uint8_t LgK>
+fixed_theta_sketch_dup<LgK>::fixed_theta_sketch_dup(uint64_t seed, float p)
+    : keys_(),
+      theta_(MAX_THETA),
+      hasher_(seed),
+      num_keys_(0),
+      num_zeros_(0),
+      p_(p),
+      is_empty_(true) {
+  static_assert(std::is_trivially_copyable<fixed_theta_sketch_dup>::value,
+                "fixed_theta_sketch_dup must be trivially copyable");
+  if (p < 1) theta_ *= p;
+}
+
+template <uint8_t LgK>
+template <typename T>
+void fixed_theta_sketch_dup<LgK>::update(const T& value) {
+  const uint64_t hash = hasher_.hash(value).hash;
+  if (hash != theta_sketch_dup_key::IGNORED_HASH) internal_update(hash);
+}
+
+template <uint8_t LgK>
+void fixed_theta_sketch_dup<LgK>::update(const theta_sketch_dup_key& key) {
+  update(&key, 1);
+}
+
+template <uint8_t LgK>
+void fixed_theta_sketch_dup<LgK>::update(const theta_sketch_dup_key* keys,
+                                         size_t num_keys) {
+  for (size_t i = 0; i < num_keys; i++)
+    if (keys[i].seed_hash != hasher_.get_seed_hash())
+      throw std::invalid_argument("Incompatible seed hashes: " +
+                                  std::to_string(keys[i].seed_hash) + ", " +
+                                  std::to_string(hasher_.get_seed_hash()));
+  for (size_t i = 0; i < num_keys; i++)
+    if (keys[i].hash != theta_sketch_dup_key::IGNORED_HASH)
+      internal_update(keys[i].hash);
+}
+
+template <uint8_t LgK>
+template <typename T>
+void fixed_theta_sketch_dup<LgK>::remove(const T& value) {
+  const uint64_t hash = hasher_.hash(value).hash;
+  if (hash != theta_sketch_dup_key::IGNORED_HASH) internal_remove(hash);
+}
+
+template <uint8_t LgK>
+void fixed_theta_sketch_dup<LgK>::remove(const theta_sketch_dup_key& key) {
+  remove(&key, 1);
+}
+
+template <uint8_t LgK>
+void fixed_theta_sketch_dup<LgK>::remove(const theta_sketch_dup_key* keys,
+                                         size_t num_keys) {
+  for (size_t i = 0; i < num_keys; i++)
+    if (keys[i].seed_hash != hasher_.get_seed_hash())
+      throw std::invalid_argument("Incompatible seed hashes: " +
+                                  std::to_string(keys[i].seed_hash) + ", " +
+                                  std::to_string(hasher_.get_seed_hash()));
+  for (size_t i = 0; i < num_keys; i++)
+    if (keys[i].hash != theta_sketch_dup_key::IGNORED_HASH)
+      internal_remove(keys[i].hash);
+}
+
+template <uint8_t LgK>
+void fixed_theta_sketch_dup<LgK>::reset() {
+  keys_.fill(entry{0, 0});
+  theta_ = MAX_THETA;
+  if (p_ < 1) theta_ *= p_;
+  num_keys_ = 0;
+  num_zeros_ = 0;
+  is_empty_ = true;
+}
+
+template <uint8_t LgK>
+bool fixed_theta_sketch_dup<LgK>::is_empty() const {
+  return is_empty_;
+}
+
+template <uint8_t LgK>
+bool fixed_theta_sketch_dup<LgK>::is_estimation_mode() const {
+  return theta_ < MAX_THETA && !is_empty_;
+}
+
+template <uint8_t LgK>
+double fixed_theta_sketch_dup<LgK>::get_theta() const {
+  return static_cast<double>(theta_) / MAX_THETA;
+}
+
+template <uint8_t LgK>
+uint64_t fixed_theta_sketch_dup<LgK>::get_theta64() const {
+  return theta_;
+}
+
+template <uint8_t LgK>
+uint32_t fixed_theta_sketch_dup<LgK>::get_num_retained() const {
+  return num_keys_ - num_zeros_;
+}
+
+template <uint8_t LgK>
+uint16_t fixed_theta_sketch_dup<LgK>::get_seed_hash() const {
+  return hasher_.get_seed_hash();
+}
+
+template <uint8_t LgK>
+double fixed_theta_sketch_dup<LgK>::get_estimate() const {
+  return get_num_retained() / get_theta();
+}
+
+template <uint8_t LgK>
+double fixed_theta_sketch_dup<LgK>::get_lower_bound(
+    uint8_t num_std_devs) const {
+  double lower_bound, upper_bound;
+  get_bounds(num_std_devs, &lower_bound, &upper_bound);
+  return lower_bound;
+}
+
+template <uint8_t LgK>
+double fixed_theta_sketch_dup<LgK>::get_upper_bound(
+    uint8_t num_std_devs) const {
+  double lower_bound, upper_bound;
+  get_bounds(num_std_devs, &lower_bound, &upper_bound);
+  return upper_bound;
+}
+
+template <uint8_t LgK>
+void fixed_theta_sketch_dup<LgK>::get_bounds(uint8_t num_std_devs,
+                                             double* lower_bound,
+                                             double* upper_bound) const {
+  const uint32_t num_retained = get_num_retained();
+  // an empty sketch with p < 1 is in exact mode
+  uint64_t theta = theta_;
+  if (!is_estimation_mode()) theta = MAX_THETA;
+  double estimate;
+  theta_sketch_dup::get_bounds(&num_retained, &theta, 1, num_std_devs,
+                               &estimate, lower_bound, upper_bound);
+}
+
+template <uint8_t LgK>
+template <typename F>
+void fixed_theta_sketch_dup<LgK>::for_each_live(F f) const {
+  for (const entry& e : keys_)
+    if (e.hash != 0 && e.hash < theta_ && e.count != 0) f(e.hash, e.count);
+}
+
+template <uint8_t LgK>
+void fixed_theta_sketch_dup<LgK>::serialize(std::ostream& os) const {
+  // the stream form of update_theta_sketch_dup has 3 preamble longs
+  uint8_t header[update_theta_sketch_dup::HEADER_BYTES];
+  update_theta_sketch_dup::write_header(
+      header, 3, update_theta_sketch_dup::builder::DEFAULT_RESIZE_FACTOR,
+      update_theta_sketch_dup::SKETCH_TYPE, LgK, LG_SIZE,
+      update_theta_sketch_dup::get_flags_byte(
+          is_empty_, update_theta_sketch_dup::DOUBLE_HASHING),
+      get_seed_hash(), num_keys_, num_zeros_, p_, theta_);
+  os.write((char*)header, sizeof(header));
+  os.write((char*)keys_.data(), sizeof(entry) * SIZE);
+}
+
+template <uint8_t LgK>
+std::vector<uint8_t> fixed_theta_sketch_dup<LgK>::serialize(
+    unsigned header_size_bytes) const {
+  const uint8_t preamble_longs = 4;
+  std::vector<uint8_t> bytes(header_size_bytes +
+                             sizeof(uint64_t) * preamble_longs +
+                             sizeof(entry) * SIZE);
+  uint8_t* ptr = update_theta_sketch_dup::write_header(
+      bytes.data() + header_size_bytes, preamble_longs,
+      update_theta_sketch_dup::builder::DEFAULT_RESIZE_FACTOR,
+      update_theta_sketch_dup::SKETCH_TYPE, LgK, LG_SIZE,
+      update_theta_sketch_dup::get_flags_byte(
+          is_empty_, update_theta_sketch_dup::DOUBLE_HASHING),
+      get_seed_hash(), num_keys_, num_zeros_, p_, theta_);
+  copy_to_mem(keys_.data(), ptr, sizeof(entry) * SIZE);
+  return bytes;
+}
+
+template <uint8_t LgK>
+fixed_theta_sketch_dup<LgK> fixed_theta_sketch_dup<LgK>::deserialize(
+    const void* bytes, size_t size, uint64_t seed) {
+  return from_sketch(update_theta_sketch_dup::deserialize(bytes, size, seed));
+}
+
+template <uint8_t LgK>
+fixed_theta_sketch_dup<LgK> fixed_theta_sketch_dup<LgK>::deserialize(
+    std::istream& is, uint64_t seed) {
+  return from_sketch(update_theta_sketch_dup::deserialize(is, seed));
+}
+
+template <uint8_t LgK>
+template <typename A>
+fixed_theta_sketch_dup<LgK> fixed_theta_sketch_dup<LgK>::from_sketch(
+    const update_theta_sketch_dup_alloc<A>& sketch) {
+  if (sketch.lg_nom_size_ != LgK)
+    throw std::invalid_argument("lg_k mismatch: " +
+                                std::to_string(sketch.lg_nom_size_) + ", " +
+                                std::to_string(LgK));
+  fixed_theta_sketch_dup result(sketch.seed_, sketch.p_);
+  result.theta_ = sketch.theta_;
+  result.is_empty_ = sketch.is_empty_;
+  // a table that is not at its full size, or not laid out by double hashing,
+  // is reinserted entry by entry
+  if (sketch.lg_cur_size_ == LG_SIZE &&
+      sketch.probing_ == update_theta_sketch_dup_alloc<A>::DOUBLE_HASHING) {
+    for (uint32_t i = 0; i < SIZE; i++)
+      result.keys_[i] = entry{sketch.keys_[i].first, sketch.keys_[i].second};
+    result.num_keys_ = sketch.num_keys_;
+    result.num_zeros_ = sketch.num_zeros_;
+  } else {
+    sketch.for_each_live([&result](const std::pair<uint64_t, int64_t>& key) {
+      result.hash_insert(key.first, key.second);
+      result.num_keys_++;
+    });
+  }
+  return result;
+}
+
+template <uint8_t LgK>
+template <typename A>
+update_theta_sketch_dup_alloc<A> fixed_theta_sketch_dup<LgK>::to_sketch()
+    const {
+  vector_u64_dup<A> keys(SIZE);
+  for (uint32_t i = 0; i < SIZE; i++)
+    keys[i] = std::make_pair(keys_[i].hash, keys_[i].count);
+  return update_theta_sketch_dup_alloc<A>(
+      is_empty_, theta_, LG_SIZE, LgK, std::move(keys), num_keys_, num_zeros_,
+      update_theta_sketch_dup_alloc<A>::builder::DEFAULT_RESIZE_FACTOR, p_,
+      hasher_.get_seed());
+}
+
+template <uint8_t LgK>
+constexpr uint32_t fixed_theta_sketch_dup<LgK>::get_stride(uint64_t hash) {
+  // the probe sequence of update_theta_sketch_dup at lg_size LG_SIZE
+  return 2 * static_cast<uint32_t>((hash >> LG_SIZE) & 0x7f) + 1;
+}
+
+template <uint8_t LgK>
+void fixed_theta_sketch_dup<LgK>::internal_update(uint64_t hash) {
+  is_empty_ = false;
+  // hash == 0 is reserved to mark empty slots in the table
+  if (hash >= theta_ || hash == 0) return;
+  const uint32_t stride = get_stride(hash);
+  uint32_t cur_probe = static_cast<uint32_t>(hash) & MASK;
+  // the table always has an empty slot, the search ends
+  while (true) {
+    entry& e = keys_[cur_probe];
+    if (e.hash == hash) {
+      if (e.count == 0) num_zeros_--;
+      e.count++;
+      return;
+    }
+    if (e.hash == 0) {
+      e.hash = hash;
+      e.count = 1;
+      if (++num_keys_ > CAPACITY) rebuild();
+      return;
+    }
+    cur_probe = (cur_probe + stride) & MASK;
+  }
+}
+
+template <uint8_t LgK>
+void fixed_theta_sketch_dup<LgK>::internal_remove(uint64_t hash) {
+  if (is_empty_)
+    throw std::logic_error(
+        "Can't remove an element from an empty set: no data yet");
+  if (hash >= theta_ || hash == 0) return;
+  const uint32_t stride = get_stride(hash);
+  uint32_t cur_probe = static_cast<uint32_t>(hash) & MASK;
+  // entries keep their slot until a rebuild, so an empty slot ends the search
+  while (keys_[cur_probe].hash != 0) {
+    entry& e = keys_[cur_probe];
+    if (e.hash == hash) {
+      if (e.count == 0) break;
+      if (--e.count == 0) num_zeros_++;
+      return;
+    }
+    cur_probe = (cur_probe + stride) & MASK;
+  }
+  throw std::logic_error("this element doesn't exist");
+}
+
+template <uint8_t LgK>
+void fixed_theta_sketch_dup<LgK>::hash_insert(uint64_t hash, int64_t count) {
+  const uint32_t stride = get_stride(hash);
+  uint32_t cur_probe = static_cast<uint32_t>(hash) & MASK;
+  while (keys_[cur_probe].hash != 0) cur_probe = (cur_probe + stride) & MASK;
+  keys_[cur_probe] = entry{hash, count};
+}
+
+template <uint8_t LgK>
+void fixed_theta_sketch_dup<LgK>::rebuild() {
+  // the same theta as update_theta_sketch_dup: the empty slots sort first
+  const uint32_t pivot = (1u << LgK) + SIZE - num_keys_;
+  std::nth_element(keys_.begin(), keys_.begin() + pivot, keys_.end(),
+                   [](const entry& a, const entry& b) {
+                     return a.hash < b.hash;
+                   });
+  theta_ = keys_[pivot].hash;
+  num_keys_ = 0;
+  num_zeros_ = 0;
+  for (entry& e : keys_) {
+    if (e.hash == 0) continue;
+    if (e.hash >= theta_ || e.count == 0) {
+      e = entry{0, 0};
+    } else {
+      e.hash |= UNPLACED;
+      num_keys_++;
+    }
+  }
+  // every unplaced entry goes to the first slot of its probe sequence that
+  // is empty or unplaced, the entry found there is moved next, so the slots
+  // before a placed entry are never emptied again
+  for (uint32_t i = 0; i < SIZE; i++) {
+    while (keys_[i].hash & UNPLACED) {
+      entry moving = keys_[i];
+      keys_[i] = entry{0, 0};
+      while (true) {
+        const uint64_t hash = moving.hash & ~UNPLACED;
+        const uint32_t stride = get_stride(hash);
+        uint32_t cur_probe = static_cast<uint32_t>(hash) & MASK;
+        while (keys_[cur_probe].hash != 0 && !(keys_[cur_probe].hash & UNPLACED))
+          cur_probe = (cur_probe + stride) & MASK;
+        const entry displaced = keys_[cur_probe];
+        keys_[cur_probe] = entry{hash, moving.count};
+        if (displaced.hash == 0) break;
+        moving = displaced;
+      }
+    }
+  }
+}
+
+} /* namespace datasketches */
+
+#endif
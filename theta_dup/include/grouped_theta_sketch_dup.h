@@ -0,0 +1,635 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef GROUPED_THETA_SKETCH_DUP_H_
+#define GROUPED_THETA_SKETCH_DUP_H_
+
+#include <climits>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "theta_sketch_dup.h"
+
+namespace datasketches {
+
+/*
+ * grouped_theta_sketch_dup keeps one update_theta_sketch_dup per group key,
+ * e.g. the distinct users with deletions per (country, campaign).
+ * Compared with std::unordered_map<K, update_theta_sketch_dup>:
+ *   - groups are found through a flat open addressing index of
+ *     (hash fragment, group id) pairs, without a node allocation per group
+ *   - a group with at most COMPACT_CAPACITY distinct elements keeps them
+ *     inline in exact form, and is promoted to a full sketch when it gets one
+ *     more. Elements removed down to count 0 stay in the group, as they stay
+ *     in the hash table of a full sketch, unless the sketches probe with
+ *     ROBIN_HOOD, which drops them, so a group behaves the same in both forms
+ *   - the total memory is bounded by a budget: a full sketch is accounted for
+ *     with the maximum size of its hash table, so promoted groups never grow
+ *     over the budget
+ * All the sketches are created by the builder given to the container, so they
+ * share lg_k, p and seed.
+ * @K type of the group keys
+ * @H hash function of the group keys
+ * @E equality of the group keys
+ */
+template <typename K, typename A, typename H = std::hash<K>,
+          typename E = std::equal_to<K>>
+class grouped_theta_sketch_dup_alloc {
+ public:
+  typedef typename update_theta_sketch_dup_alloc<A>::builder builder;
+  // number of distinct elements a group keeps before it gets a full sketch
+  static constexpr uint8_t COMPACT_CAPACITY = 4;
+
+  /**
+   * Creates an empty container
+   * @param sketch_builder builder of the sketches of the groups
+   * @param max_memory_bytes memory budget of the container
+   */
+  explicit grouped_theta_sketch_dup_alloc(
+      const builder& sketch_builder = builder(),
+      size_t max_memory_bytes = std::numeric_limits<size_t>::max());
+
+  /**
+   * Update the sketch of a group with a given value, creating the group if
+   * needed. If the memory budget does not allow creating or promoting the
+   * group, std::length_error is thrown and the update is not applied.
+   * @param group key of the group
+   * @param value value of any type accepted by update_theta_sketch_dup
+   */
+  template <typename T>
+  void update(const K& group, const T& value);
+
+  /**
+   * Update the sketch of a group with an element hashed by
+   * theta_sketch_dup_hasher with the seed of the container.
+   * @param group key of the group
+   * @param key hashed element
+   */
+  void update(const K& group, const theta_sketch_dup_key& key);
+
+  /**
+   * Update the sketches of a batch of groups, the i-th value goes to the i-th
+   * group. The values are hashed before any sketch is touched.
+   * @param groups pointer to the group keys
+   * @param values pointer to the values
+   * @param num_values number of values
+   */
+  template <typename T>
+  void update(const K* groups, const T* values, size_t num_values);
+
+  /**
+   * Remove one value from the sketch of a group.
+   * Throws std::logic_error if the group is empty or the value is not there,
+   * as update_theta_sketch_dup does.
+   * @param group key of the group
+   * @param value value of any type accepted by update_theta_sketch_dup
+   */
+  template <typename T>
+  void remove(const K& group, const T& value);
+
+  /**
+   * Remove one element hashed by theta_sketch_dup_hasher from a group.
+   * @param group key of the group
+   * @param key hashed element
+   */
+  void remove(const K& group, const theta_sketch_dup_key& key);
+
+  /**
+   * Remove a batch of values, the i-th value from the i-th group.
+   * @param groups pointer to the group keys
+   * @param values pointer to the values
+   * @param num_values number of values
+   */
+  template <typename T>
+  void remove(const K* groups, const T* values, size_t num_values);
+
+  /**
+   * @return the number of groups
+   */
+  size_t size() const;
+
+  /**
+   * @return true if the group exists
+   */
+  bool contains(const K& group) const;
+
+  /**
+   * @return estimate of the distinct count of a group, 0 for a missing group
+   */
+  double get_estimate(const K& group) const;
+
+  /**
+   * @return the approximate lower error bound of a group
+   * @param num_std_devs number of Standard Deviations (1, 2 or 3)
+   */
+  double get_lower_bound(const K& group, uint8_t num_std_devs) const;
+
+  /**
+   * @return the approximate upper error bound of a group
+   * @param num_std_devs number of Standard Deviations (1, 2 or 3)
+   */
+  double get_upper_bound(const K& group, uint8_t num_std_devs) const;
+
+  /**
+   * @return a copy of the sketch of a group, an empty sketch for a missing
+   * group. A compact group is expanded into a full sketch.
+   */
+  update_theta_sketch_dup_alloc<A> get_result(const K& group) const;
+
+  /**
+   * Call f(group key, estimate) for each group
+   */
+  template <typename F>
+  void for_each(F f) const;
+
+  /**
+   * @return the memory accounted for against the budget, in bytes
+   */
+  size_t get_memory_usage_bytes() const;
+
+  /**
+   * @return the memory budget, in bytes
+   */
+  size_t get_max_memory_bytes() const;
+
+ private:
+  static const uint32_t NO_SKETCH = UINT32_MAX;
+  // resize the group index at this load factor
+  static constexpr double INDEX_LOAD_FACTOR = 0.5;
+  static const uint8_t MIN_LG_INDEX_SIZE = 4;
+
+  /**
+   * @key key of the group
+   * @sketch_index index of the full sketch of the group in sketches_, or
+   * NO_SKETCH if the group is still compact
+   * @num_entries number of (hash, count) pairs of a compact group
+   * @is_empty true if no data has been processed for the group yet
+   * @entries (hash, count) pairs of a compact group, including the ones with
+   * count 0 that a full sketch keeps
+   */
+  struct group_entry {
+    K key;
+    uint32_t sketch_index;
+    uint8_t num_entries;
+    bool is_empty;
+    std::pair<uint64_t, int64_t> entries[COMPACT_CAPACITY];
+  };
+
+  /**
+   * slot of the group index
+   * @fragment high bits of the hash of the group key, to skip most key
+   * comparisons
+   * @id index of the group in groups_ plus 1, 0 marks an empty slot
+   */
+  struct index_slot {
+    uint32_t fragment;
+    uint32_t id;
+  };
+
+  typedef typename std::allocator_traits<A>::template rebind_alloc<group_entry>
+      AllocGroup;
+  typedef typename std::allocator_traits<A>::template rebind_alloc<index_slot>
+      AllocSlot;
+  typedef typename std::allocator_traits<A>::template rebind_alloc<
+      update_theta_sketch_dup_alloc<A>>
+      AllocSketch;
+  typedef typename std::allocator_traits<A>::template rebind_alloc<
+      theta_sketch_dup_key>
+      AllocKey;
+
+  H hash_;
+  E equal_;
+  // empty sketch built once, copied when a group is promoted
+  update_theta_sketch_dup_alloc<A> prototype_;
+  theta_sketch_dup_hasher hasher_;
+  size_t max_memory_bytes_;
+  size_t max_sketch_bytes_;
+  uint8_t lg_index_size_;
+  std::vector<index_slot, AllocSlot> index_;
+  std::vector<group_entry, AllocGroup> groups_;
+  std::vector<update_theta_sketch_dup_alloc<A>, AllocSketch> sketches_;
+
+  static uint64_t mix(uint64_t h);
+  // @return the index of the group in groups_ plus 1, 0 if it is missing
+  uint32_t find(const K& group) const;
+  group_entry& find_or_insert(const K& group);
+  void grow_index();
+  void reserve_groups();
+  void check_memory(size_t extra_bytes) const;
+  void promote(group_entry& g);
+  // insert the entries of a compact group into a sketch
+  static void expand(const group_entry& g,
+                     update_theta_sketch_dup_alloc<A>& sketch);
+  void internal_update(group_entry& g, uint64_t hash);
+  void internal_remove(group_entry& g, uint64_t hash);
+  uint32_t get_num_retained(const group_entry& g) const;
+  uint64_t get_theta64(const group_entry& g) const;
+  double get_estimate(const group_entry& g) const;
+};
+
+template <typename K, typename A, typename H, typename E>
+constexpr uint8_t grouped_theta_sketch_dup_alloc<K, A, H, E>::COMPACT_CAPACITY;
+
+/*
+ * The following are implementations
+ */
+
+template <typename K, typename A, typename H, typename E>
+grouped_theta_sketch_dup_alloc<K, A, H, E>::grouped_theta_sketch_dup_alloc(
+    const builder& sketch_builder, size_t max_memory_bytes)
+    : hash_(),
+      equal_(),
+      prototype_(sketch_builder.build()),
+      hasher_(prototype_.seed_),
+      max_memory_bytes_(max_memory_bytes),
+      max_sketch_bytes_(update_theta_sketch_dup_alloc<A>::get_max_memory_bytes(
+          prototype_.lg_nom_size_)),
+      lg_index_size_(MIN_LG_INDEX_SIZE),
+      index_(1 << MIN_LG_INDEX_SIZE, index_slot{0, 0}),
+      groups_(),
+      sketches_() {
+  check_memory(0);
+}
+
+template <typename K, typename A, typename H, typename E>
+uint64_t grouped_theta_sketch_dup_alloc<K, A, H, E>::mix(uint64_t h) {
+  // finalizer of MurmurHash3, std::hash of integers is often the identity
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+template <typename K, typename A, typename H, typename E>
+uint32_t grouped_theta_sketch_dup_alloc<K, A, H, E>::find(
+    const K& group) const {
+  const uint64_t h = mix(hash_(group));
+  const uint32_t fragment = static_cast<uint32_t>(h >> 32);
+  const uint32_t mask = (1 << lg_index_size_) - 1;
+  uint32_t cur_probe = static_cast<uint32_t>(h) & mask;
+  while (index_[cur_probe].id != 0) {
+    if (index_[cur_probe].fragment == fragment &&
+        equal_(groups_[index_[cur_probe].id - 1].key, group))
+      return index_[cur_probe].id;
+    cur_probe = (cur_probe + 1) & mask;
+  }
+  return 0;
+}
+
+template <typename K, typename A, typename H, typename E>
+typename grouped_theta_sketch_dup_alloc<K, A, H, E>::group_entry&
+grouped_theta_sketch_dup_alloc<K, A, H, E>::find_or_insert(const K& group) {
+  const uint64_t h = mix(hash_(group));
+  const uint32_t fragment = static_cast<uint32_t>(h >> 32);
+  uint32_t mask = (1 << lg_index_size_) - 1;
+  uint32_t cur_probe = static_cast<uint32_t>(h) & mask;
+  while (index_[cur_probe].id != 0) {
+    if (index_[cur_probe].fragment == fragment &&
+        equal_(groups_[index_[cur_probe].id - 1].key, group))
+      return groups_[index_[cur_probe].id - 1];
+    cur_probe = (cur_probe + 1) & mask;
+  }
+  // new group, make room for it first so that a failure leaves no trace
+  reserve_groups();
+  if (groups_.size() + 1 > INDEX_LOAD_FACTOR * index_.size()) {
+    grow_index();
+    mask = (1 << lg_index_size_) - 1;
+    cur_probe = static_cast<uint32_t>(h) & mask;
+    while (index_[cur_probe].id != 0) cur_probe = (cur_probe + 1) & mask;
+  }
+  groups_.push_back(group_entry{group, NO_SKETCH, 0, true, {}});
+  index_[cur_probe] = index_slot{fragment, static_cast<uint32_t>(groups_.size())};
+  return groups_.back();
+}
+
+template <typename K, typename A, typename H, typename E>
+void grouped_theta_sketch_dup_alloc<K, A, H, E>::reserve_groups() {
+  if (groups_.size() < groups_.capacity()) return;
+  // grow by half at most, less if only that fits into the budget
+  const size_t used = get_memory_usage_bytes();
+  const size_t room = max_memory_bytes_ > used ? max_memory_bytes_ - used : 0;
+  size_t extra = std::max<size_t>(groups_.capacity() / 2, 16);
+  extra = std::min(extra, room / sizeof(group_entry));
+  if (extra == 0) check_memory(sizeof(group_entry));
+  groups_.reserve(groups_.capacity() + extra);
+}
+
+template <typename K, typename A, typename H, typename E>
+void grouped_theta_sketch_dup_alloc<K, A, H, E>::grow_index() {
+  const uint8_t lg_new_size = lg_index_size_ + 1;
+  check_memory((sizeof(index_slot) << lg_new_size) -
+               sizeof(index_slot) * index_.capacity());
+  std::vector<index_slot, AllocSlot> new_index(1 << lg_new_size,
+                                               index_slot{0, 0});
+  const uint32_t mask = (1 << lg_new_size) - 1;
+  for (uint32_t id = 1; id <= groups_.size(); id++) {
+    const uint64_t h = mix(hash_(groups_[id - 1].key));
+    uint32_t cur_probe = static_cast<uint32_t>(h) & mask;
+    while (new_index[cur_probe].id != 0) cur_probe = (cur_probe + 1) & mask;
+    new_index[cur_probe] = index_slot{static_cast<uint32_t>(h >> 32), id};
+  }
+  index_ = std::move(new_index);
+  lg_index_size_ = lg_new_size;
+}
+
+template <typename K, typename A, typename H, typename E>
+void grouped_theta_sketch_dup_alloc<K, A, H, E>::check_memory(
+    size_t extra_bytes) const {
+  const size_t used = get_memory_usage_bytes();
+  if (used + extra_bytes > max_memory_bytes_) {
+    throw std::length_error("memory budget exceeded: budget " +
+                            std::to_string(max_memory_bytes_) + ", needed " +
+                            std::to_string(used + extra_bytes));
+  }
+}
+
+template <typename K, typename A, typename H, typename E>
+void grouped_theta_sketch_dup_alloc<K, A, H, E>::promote(group_entry& g) {
+  size_t extra_bytes =
+      max_sketch_bytes_ - sizeof(update_theta_sketch_dup_alloc<A>);
+  // push_back doubles the capacity of a full vector
+  if (sketches_.size() == sketches_.capacity())
+    extra_bytes += sizeof(update_theta_sketch_dup_alloc<A>) *
+                   std::max<size_t>(sketches_.capacity(), 1);
+  check_memory(extra_bytes);
+  sketches_.push_back(prototype_);
+  expand(g, sketches_.back());
+  g.sketch_index = sketches_.size() - 1;
+  g.num_entries = 0;
+}
+
+template <typename K, typename A, typename H, typename E>
+void grouped_theta_sketch_dup_alloc<K, A, H, E>::expand(
+    const group_entry& g, update_theta_sketch_dup_alloc<A>& sketch) {
+  sketch.is_empty_ = g.is_empty;
+  for (uint8_t i = 0; i < g.num_entries; i++) {
+    const uint64_t hash = g.entries[i].first;
+    if (g.entries[i].second != 0) {
+      sketch.internal_update(hash, g.entries[i].second);
+    } else {
+      // leaves the entry with count 0 as the removes of the sketch do
+      sketch.internal_update(hash, 1);
+      sketch.internal_remove(hash, 1);
+    }
+  }
+}
+
+template <typename K, typename A, typename H, typename E>
+void grouped_theta_sketch_dup_alloc<K, A, H, E>::internal_update(
+    group_entry& g, uint64_t hash) {
+  if (g.sketch_index != NO_SKETCH) {
+    sketches_[g.sketch_index].internal_update(hash, 1);
+    return;
+  }
+  if (hash >= prototype_.theta_ || hash == 0) {
+    g.is_empty = false;
+    return;  // hash == 0 is reserved to mark empty slots in the table
+  }
+  for (uint8_t i = 0; i < g.num_entries; i++) {
+    if (g.entries[i].first == hash) {
+      g.entries[i].second++;
+      g.is_empty = false;
+      return;
+    }
+  }
+  if (g.num_entries == COMPACT_CAPACITY) {
+    promote(g);
+    sketches_[g.sketch_index].internal_update(hash, 1);
+    return;
+  }
+  g.entries[g.num_entries++] = std::make_pair(hash, 1);
+  g.is_empty = false;
+}
+
+template <typename K, typename A, typename H, typename E>
+void grouped_theta_sketch_dup_alloc<K, A, H, E>::internal_remove(
+    group_entry& g, uint64_t hash) {
+  if (g.sketch_index != NO_SKETCH) {
+    sketches_[g.sketch_index].internal_remove(hash);
+    return;
+  }
+  if (g.is_empty)
+    throw std::logic_error(
+        "Can't remove an element from an empty set: no data yet");
+  if (hash >= prototype_.theta_ || hash == 0)
+    return;  // hash == 0 is reserved to mark empty slots in the table
+  for (uint8_t i = 0; i < g.num_entries; i++) {
+    if (g.entries[i].first == hash) {
+      if (g.entries[i].second == 0)
+        throw std::logic_error("this element doesn't exist");
+      if (--g.entries[i].second == 0 &&
+          prototype_.probing_ == update_theta_sketch_dup_alloc<A>::ROBIN_HOOD)
+        g.entries[i] = g.entries[--g.num_entries];
+      return;
+    }
+  }
+  throw std::logic_error("this element doesn't exist");
+}
+
+template <typename K, typename A, typename H, typename E>
+template <typename T>
+void grouped_theta_sketch_dup_alloc<K, A, H, E>::update(const K& group,
+                                                        const T& value) {
+  const theta_sketch_dup_key key = hasher_.hash(value);
+  // an empty string is ignored, as update_theta_sketch_dup does
+  if (key.hash == theta_sketch_dup_key::IGNORED_HASH) return;
+  internal_update(find_or_insert(group), key.hash);
+}
+
+template <typename K, typename A, typename H, typename E>
+void grouped_theta_sketch_dup_alloc<K, A, H, E>::update(
+    const K& group, const theta_sketch_dup_key& key) {
+  theta_sketch_dup_alloc<A>::check_seed_hash(key.seed_hash,
+                                             hasher_.get_seed_hash());
+  if (key.hash == theta_sketch_dup_key::IGNORED_HASH) return;
+  internal_update(find_or_insert(group), key.hash);
+}
+
+template <typename K, typename A, typename H, typename E>
+template <typename T>
+void grouped_theta_sketch_dup_alloc<K, A, H, E>::update(const K* groups,
+                                                        const T* values,
+                                                        size_t num_values) {
+  std::vector<theta_sketch_dup_key, AllocKey> keys(num_values);
+  for (size_t i = 0; i < num_values; i++) keys[i] = hasher_.hash(values[i]);
+  for (size_t i = 0; i < num_values; i++)
+    if (keys[i].hash != theta_sketch_dup_key::IGNORED_HASH)
+      internal_update(find_or_insert(groups[i]), keys[i].hash);
+}
+
+template <typename K, typename A, typename H, typename E>
+template <typename T>
+void grouped_theta_sketch_dup_alloc<K, A, H, E>::remove(const K& group,
+                                                        const T& value) {
+  remove(group, hasher_.hash(value));
+}
+
+template <typename K, typename A, typename H, typename E>
+void grouped_theta_sketch_dup_alloc<K, A, H, E>::remove(
+    const K& group, const theta_sketch_dup_key& key) {
+  theta_sketch_dup_alloc<A>::check_seed_hash(key.seed_hash,
+                                             hasher_.get_seed_hash());
+  if (key.hash == theta_sketch_dup_key::IGNORED_HASH) return;
+  const uint32_t id = find(group);
+  if (id == 0)
+    throw std::logic_error(
+        "Can't remove an element from an empty set: no data yet");
+  internal_remove(groups_[id - 1], key.hash);
+}
+
+template <typename K, typename A, typename H, typename E>
+template <typename T>
+void grouped_theta_sketch_dup_alloc<K, A, H, E>::remove(const K* groups,
+                                                        const T* values,
+                                                        size_t num_values) {
+  std::vector<theta_sketch_dup_key, AllocKey> keys(num_values);
+  for (size_t i = 0; i < num_values; i++) keys[i] = hasher_.hash(values[i]);
+  for (size_t i = 0; i < num_values; i++) remove(groups[i], keys[i]);
+}
+
+template <typename K, typename A, typename H, typename E>
+size_t grouped_theta_sketch_dup_alloc<K, A, H, E>::size() const {
+  return groups_.size();
+}
+
+template <typename K, typename A, typename H, typename E>
+bool grouped_theta_sketch_dup_alloc<K, A, H, E>::contains(
+    const K& group) const {
+  return find(group) != 0;
+}
+
+template <typename K, typename A, typename H, typename E>
+uint32_t grouped_theta_sketch_dup_alloc<K, A, H, E>::get_num_retained(
+    const group_entry& g) const {
+  if (g.sketch_index != NO_SKETCH)
+    return sketches_[g.sketch_index].get_num_retained();
+  uint32_t num_retained = 0;
+  for (uint8_t i = 0; i < g.num_entries; i++)
+    if (g.entries[i].second != 0) num_retained++;
+  return num_retained;
+}
+
+template <typename K, typename A, typename H, typename E>
+uint64_t grouped_theta_sketch_dup_alloc<K, A, H, E>::get_theta64(
+    const group_entry& g) const {
+  if (g.sketch_index != NO_SKETCH)
+    return sketches_[g.sketch_index].get_theta64();
+  return prototype_.get_theta64();
+}
+
+template <typename K, typename A, typename H, typename E>
+double grouped_theta_sketch_dup_alloc<K, A, H, E>::get_estimate(
+    const group_entry& g) const {
+  return get_num_retained(g) / (static_cast<double>(get_theta64(g)) /
+                                theta_sketch_dup_alloc<A>::MAX_THETA);
+}
+
+template <typename K, typename A, typename H, typename E>
+double grouped_theta_sketch_dup_alloc<K, A, H, E>::get_estimate(
+    const K& group) const {
+  const uint32_t id = find(group);
+  if (id == 0) return 0;
+  return get_estimate(groups_[id - 1]);
+}
+
+template <typename K, typename A, typename H, typename E>
+double grouped_theta_sketch_dup_alloc<K, A, H, E>::get_lower_bound(
+    const K& group, uint8_t num_std_devs) const {
+  const uint32_t id = find(group);
+  if (id == 0) return 0;
+  const group_entry* g = &groups_[id - 1];
+  if (g->sketch_index != NO_SKETCH)
+    return sketches_[g->sketch_index].get_lower_bound(num_std_devs);
+  const uint64_t theta = get_theta64(*g);
+  if (theta == theta_sketch_dup_alloc<A>::MAX_THETA || g->is_empty)
+    return get_num_retained(*g);
+  return binomial_bounds::get_lower_bound(
+      get_num_retained(*g),
+      static_cast<double>(theta) / theta_sketch_dup_alloc<A>::MAX_THETA,
+      num_std_devs);
+}
+
+template <typename K, typename A, typename H, typename E>
+double grouped_theta_sketch_dup_alloc<K, A, H, E>::get_upper_bound(
+    const K& group, uint8_t num_std_devs) const {
+  const uint32_t id = find(group);
+  if (id == 0) return 0;
+  const group_entry* g = &groups_[id - 1];
+  if (g->sketch_index != NO_SKETCH)
+    return sketches_[g->sketch_index].get_upper_bound(num_std_devs);
+  const uint64_t theta = get_theta64(*g);
+  if (theta == theta_sketch_dup_alloc<A>::MAX_THETA || g->is_empty)
+    return get_num_retained(*g);
+  return binomial_bounds::get_upper_bound(
+      get_num_retained(*g),
+      static_cast<double>(theta) / theta_sketch_dup_alloc<A>::MAX_THETA,
+      num_std_devs);
+}
+
+template <typename K, typename A, typename H, typename E>
+update_theta_sketch_dup_alloc<A>
+grouped_theta_sketch_dup_alloc<K, A, H, E>::get_result(const K& group) const {
+  const uint32_t id = find(group);
+  if (id == 0) return prototype_;
+  const group_entry* g = &groups_[id - 1];
+  if (g->sketch_index != NO_SKETCH) return sketches_[g->sketch_index];
+  update_theta_sketch_dup_alloc<A> sketch(prototype_);
+  expand(*g, sketch);
+  return sketch;
+}
+
+template <typename K, typename A, typename H, typename E>
+template <typename F>
+void grouped_theta_sketch_dup_alloc<K, A, H, E>::for_each(F f) const {
+  for (const auto& g : groups_) f(g.key, get_estimate(g));
+}
+
+template <typename K, typename A, typename H, typename E>
+size_t grouped_theta_sketch_dup_alloc<K, A, H, E>::get_memory_usage_bytes()
+    const {
+  return sizeof(*this) + sizeof(index_slot) * index_.capacity() +
+         sizeof(group_entry) * groups_.capacity() +
+         sizeof(update_theta_sketch_dup_alloc<A>) * sketches_.capacity() +
+         (max_sketch_bytes_ - sizeof(update_theta_sketch_dup_alloc<A>)) *
+             sketches_.size();
+}
+
+template <typename K, typename A, typename H, typename E>
+size_t grouped_theta_sketch_dup_alloc<K, A, H, E>::get_max_memory_bytes()
+    const {
+  return max_memory_bytes_;
+}
+
+/*
+ * alias with default allocator for convenience
+ */
+template <typename K, typename H = std::hash<K>,
+          typename E = std::equal_to<K>>
+using grouped_theta_sketch_dup =
+    grouped_theta_sketch_dup_alloc<K, std::allocator<void>, H, E>;
+
+} /* namespace datasketches */
+
+#endif
@@ -0,0 +1,222 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef HUGE_PAGE_ALLOCATOR_H_
+#define HUGE_PAGE_ALLOCATOR_H_
+
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace datasketches {
+
+/*
+ * huge_page_stats counts the bytes mapped by the huge_page_allocator of every
+ * type, by the kind of pages that back them.
+ */
+class huge_page_stats {
+ public:
+  enum backing {
+    GIGANTIC,     // reserved 1 GB pages (MAP_HUGETLB)
+    HUGE,         // reserved 2 MB pages (MAP_HUGETLB)
+    TRANSPARENT,  // transparent huge pages requested with madvise
+    NUM_BACKINGS
+  };
+
+  /**
+   * @return the bytes mapped with a backing since the start of the process
+   */
+  static uint64_t get_mapped_bytes(backing b) {
+    return counters()[b].load(std::memory_order_relaxed);
+  }
+
+  static void add_mapped_bytes(backing b, uint64_t bytes) {
+    counters()[b].fetch_add(bytes, std::memory_order_relaxed);
+  }
+
+ private:
+  static std::atomic<uint64_t>* counters() {
+    static std::atomic<uint64_t> values[NUM_BACKINGS] = {};
+    return values;
+  }
+};
+
+/*
+ * gigantic_page_blocks records the blocks mapped on 1 GB pages, whose length
+ * is rounded to 1 GB, so that they are unmapped with that length. There are
+ * few of them, each of at least 1 GB.
+ */
+class gigantic_page_blocks {
+ public:
+  static void add(void* ptr) {
+    std::lock_guard<std::mutex> lock(mutex());
+    blocks().push_back(ptr);
+  }
+
+  // @return true if ptr was recorded, and forget it
+  static bool remove(void* ptr) {
+    std::lock_guard<std::mutex> lock(mutex());
+    auto& b = blocks();
+    auto it = std::find(b.begin(), b.end(), ptr);
+    if (it == b.end()) return false;
+    *it = b.back();
+    b.pop_back();
+    return true;
+  }
+
+ private:
+  static std::mutex& mutex() {
+    static std::mutex m;
+    return m;
+  }
+  static std::vector<void*>& blocks() {
+    static std::vector<void*> b;
+    return b;
+  }
+};
+
+/*
+ * huge_page_allocator maps the blocks of at least HUGE_PAGE_BYTES on huge
+ * pages, so that the random probes of a large hash table hit the TLB. A block
+ * of at least GIGANTIC_PAGE_BYTES is tried on the 1 GB pages reserved in
+ * the system, then on the 2 MB pages reserved, and a smaller block on the
+ * 2 MB pages. When no reserved page is free, the block is mapped on regular
+ * pages aligned to 2 MB and marked with MADV_HUGEPAGE, so the kernel backs it
+ * with transparent huge pages when it can. Smaller blocks come from operator
+ * new. A block is mapped with its size rounded to the pages that back it:
+ * to 1 GB on 1 GB pages, which gigantic_page_blocks records, and to 2 MB
+ * otherwise, so a fallback from 1 GB pages does not map up to 1 GB more.
+ * It can be used as the allocator of the sketches:
+ *   update_theta_sketch_dup_alloc<huge_page_allocator<void>>
+ */
+template <typename T>
+class huge_page_allocator {
+ public:
+  typedef T value_type;
+  static const size_t HUGE_PAGE_BYTES = size_t(1) << 21;
+  static const size_t GIGANTIC_PAGE_BYTES = size_t(1) << 30;
+
+  huge_page_allocator() noexcept {}
+  template <typename U>
+  huge_page_allocator(const huge_page_allocator<U>&) noexcept {}
+
+  T* allocate(size_t n) {
+    if (n > static_cast<size_t>(-1) / sizeof(T)) throw std::bad_alloc();
+    const size_t size = n * sizeof(T);
+    if (size < HUGE_PAGE_BYTES) return static_cast<T*>(::operator new(size));
+    const size_t length = get_mapped_length(size, HUGE_PAGE_BYTES);
+    void* ptr = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    if (size >= GIGANTIC_PAGE_BYTES) {
+      const size_t gigantic_length =
+          get_mapped_length(size, GIGANTIC_PAGE_BYTES);
+      ptr = map_reserved(gigantic_length, 30);
+      if (ptr != MAP_FAILED) {
+        try {
+          gigantic_page_blocks::add(ptr);
+        } catch (...) {
+          ::munmap(ptr, gigantic_length);
+          throw std::bad_alloc();
+        }
+        huge_page_stats::add_mapped_bytes(huge_page_stats::GIGANTIC,
+                                          gigantic_length);
+        return static_cast<T*>(ptr);
+      }
+    }
+    ptr = map_reserved(length, 21);
+    if (ptr != MAP_FAILED)
+      huge_page_stats::add_mapped_bytes(huge_page_stats::HUGE, length);
+#endif
+    if (ptr == MAP_FAILED) {
+      ptr = map_transparent(length);
+      huge_page_stats::add_mapped_bytes(huge_page_stats::TRANSPARENT, length);
+    }
+    return static_cast<T*>(ptr);
+  }
+
+  void deallocate(T* ptr, size_t n) noexcept {
+    const size_t size = n * sizeof(T);
+    if (size < HUGE_PAGE_BYTES) {
+      ::operator delete(ptr);
+    } else {
+#ifdef MAP_HUGETLB
+      if (size >= GIGANTIC_PAGE_BYTES && gigantic_page_blocks::remove(ptr)) {
+        ::munmap(ptr, get_mapped_length(size, GIGANTIC_PAGE_BYTES));
+        return;
+      }
+#endif
+      ::munmap(ptr, get_mapped_length(size, HUGE_PAGE_BYTES));
+    }
+  }
+
+ private:
+  // @return size rounded up to a multiple of page
+  static size_t get_mapped_length(size_t size, size_t page) {
+    return (size + page - 1) & ~(page - 1);
+  }
+
+#ifdef MAP_HUGETLB
+  // lg_page is encoded in the flags as in MAP_HUGE_2MB and MAP_HUGE_1GB,
+  // which older headers lack
+  static void* map_reserved(size_t length, int lg_page) {
+    return ::mmap(nullptr, length, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (lg_page << 26),
+                  -1, 0);
+  }
+#endif
+
+  // over-map by a huge page and trim the ends to align the block to 2 MB
+  static void* map_transparent(size_t length) {
+    void* ptr = ::mmap(nullptr, length + HUGE_PAGE_BYTES,
+                       PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                       -1, 0);
+    if (ptr == MAP_FAILED) throw std::bad_alloc();
+    const uintptr_t start = reinterpret_cast<uintptr_t>(ptr);
+    const uintptr_t aligned =
+        (start + HUGE_PAGE_BYTES - 1) & ~(uintptr_t(HUGE_PAGE_BYTES) - 1);
+    if (aligned > start) ::munmap(ptr, aligned - start);
+    const size_t tail = HUGE_PAGE_BYTES - (aligned - start);
+    if (tail > 0) ::munmap(reinterpret_cast<void*>(aligned + length), tail);
+#ifdef MADV_HUGEPAGE
+    // a refusal leaves the block on regular pages
+    ::madvise(reinterpret_cast<void*>(aligned), length, MADV_HUGEPAGE);
+#endif
+    return reinterpret_cast<void*>(aligned);
+  }
+};
+
+template <typename T, typename U>
+bool operator==(const huge_page_allocator<T>&, const huge_page_allocator<U>&) {
+  return true;
+}
+
+template <typename T, typename U>
+bool operator!=(const huge_page_allocator<T>&, const huge_page_allocator<U>&) {
+  return false;
+}
+
+} /* namespace datasketches */
+
+#endif
@@ -0,0 +1,285 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef NUMA_ALLOCATOR_H_
+#define NUMA_ALLOCATOR_H_
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace datasketches {
+
+/*
+ * numa_topology is the list of the NUMA nodes of the host and of their CPUs,
+ * read from sysfs. A host without NUMA information is one node with every
+ * CPU.
+ */
+class numa_topology {
+ public:
+  /**
+   * @return the topology of the host, read once
+   */
+  static const numa_topology& get() {
+    static const numa_topology topology;
+    return topology;
+  }
+
+  uint32_t get_num_nodes() const { return cpus_.size(); }
+
+  /**
+   * @return the number of a node for the system, which may differ from its
+   * index when some nodes have no CPU
+   */
+  uint32_t get_system_node(uint32_t node) const {
+    return system_nodes_.at(node);
+  }
+
+  /**
+   * @return the highest number of a node for the system
+   */
+  uint32_t get_max_system_node() const { return system_nodes_.back(); }
+
+  /**
+   * @return the CPUs of a node
+   */
+  const std::vector<uint32_t>& get_cpus(uint32_t node) const {
+    return cpus_.at(node);
+  }
+
+  /**
+   * @return the node of the CPU the calling thread runs on
+   */
+  uint32_t get_current_node() const {
+    const int cpu = sched_getcpu();
+    for (uint32_t node = 0; node < cpus_.size(); node++)
+      for (uint32_t c : cpus_[node])
+        if (static_cast<int>(c) == cpu) return node;
+    return 0;
+  }
+
+ private:
+  // the nodes with CPUs and their CPUs
+  std::vector<uint32_t> system_nodes_;
+  std::vector<std::vector<uint32_t>> cpus_;
+
+  numa_topology() {
+    const std::string root = "/sys/devices/system/node/";
+    for (uint32_t node : parse_list(read_line(root + "online"))) {
+      auto cpus = parse_list(
+          read_line(root + "node" + std::to_string(node) + "/cpulist"));
+      if (cpus.empty()) continue;
+      system_nodes_.push_back(node);
+      cpus_.push_back(std::move(cpus));
+    }
+    if (cpus_.empty()) {
+      system_nodes_.push_back(0);
+      cpus_.emplace_back();
+      const long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+      for (long cpu = 0; cpu < num_cpus; cpu++) cpus_[0].push_back(cpu);
+    }
+  }
+
+  static std::string read_line(const std::string& path) {
+    std::ifstream is(path);
+    std::string line;
+    std::getline(is, line);
+    return line;
+  }
+
+  // parse a list such as "0-3,8-11"
+  static std::vector<uint32_t> parse_list(const std::string& list) {
+    std::vector<uint32_t> values;
+    std::istringstream is(list);
+    std::string range;
+    while (std::getline(is, range, ',')) {
+      if (range.empty()) continue;
+      const size_t dash = range.find('-');
+      const uint32_t first = std::stoul(range.substr(0, dash));
+      const uint32_t last =
+          dash == std::string::npos ? first : std::stoul(range.substr(dash + 1));
+      for (uint32_t value = first; value <= last; value++)
+        values.push_back(value);
+    }
+    return values;
+  }
+};
+
+/*
+ * numa_placement sets where the numa_allocator of the calling thread puts
+ * the memory it maps, until the end of its scope. The sketches build their
+ * tables with default-constructed allocators, so the placement is a property
+ * of the thread rather than of the allocator.
+ * Example:
+ *   numa_placement placement(numa_placement::BIND, node);
+ *   auto sketch = update_theta_sketch_dup_alloc<numa_allocator<void>>::
+ *       builder().set_lg_k(24).build();
+ */
+class numa_placement {
+ public:
+  enum policy {
+    FIRST_TOUCH,  // the default of the system: the node that writes first
+    BIND,         // the node of the placement
+    INTERLEAVE    // the pages are spread over every node
+  };
+
+  numa_placement(policy p, uint32_t node = 0)
+      : previous_(current()), previous_node_(current_node()) {
+    current() = p;
+    current_node() = node;
+  }
+
+  ~numa_placement() {
+    current() = previous_;
+    current_node() = previous_node_;
+  }
+
+  numa_placement(const numa_placement&) = delete;
+  numa_placement& operator=(const numa_placement&) = delete;
+
+  static policy get_policy() { return current(); }
+  static uint32_t get_node() { return current_node(); }
+
+ private:
+  policy previous_;
+  uint32_t previous_node_;
+
+  static policy& current() {
+    static thread_local policy p = FIRST_TOUCH;
+    return p;
+  }
+  static uint32_t& current_node() {
+    static thread_local uint32_t node = 0;
+    return node;
+  }
+};
+
+/**
+ * Pin the calling thread to the CPUs of a node
+ * @return false if the system refused
+ */
+inline bool pin_thread_to_node(uint32_t node) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (uint32_t cpu : numa_topology::get().get_cpus(node)) CPU_SET(cpu, &set);
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+/*
+ * numa_allocator maps the blocks of at least MIN_MAPPED_BYTES with mmap and
+ * applies the numa_placement of the calling thread to them with mbind, so
+ * that a large hash table lands on the node of the thread that owns it
+ * instead of the node that touches it first. Smaller blocks come from
+ * operator new. When the kernel has no NUMA support or refuses mbind (as in
+ * some containers), the pages are placed by first touch.
+ * It can be used as the allocator of the sketches:
+ *   update_theta_sketch_dup_alloc<numa_allocator<void>>
+ */
+template <typename T>
+class numa_allocator {
+ public:
+  typedef T value_type;
+  static const size_t MIN_MAPPED_BYTES = 1 << 20;
+
+  numa_allocator() noexcept {}
+  template <typename U>
+  numa_allocator(const numa_allocator<U>&) noexcept {}
+
+  T* allocate(size_t n) {
+    const size_t size = n * sizeof(T);
+    if (size < MIN_MAPPED_BYTES) return static_cast<T*>(::operator new(size));
+    void* ptr = ::mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) throw std::bad_alloc();
+    place(ptr, size);
+    return static_cast<T*>(ptr);
+  }
+
+  void deallocate(T* ptr, size_t n) noexcept {
+    const size_t size = n * sizeof(T);
+    if (size < MIN_MAPPED_BYTES) {
+      ::operator delete(ptr);
+    } else {
+      ::munmap(ptr, size);
+    }
+  }
+
+ private:
+  // memory policies of mbind(2), not all systems have numaif.h
+  static const int MPOL_BIND_MODE = 2;
+  static const int MPOL_INTERLEAVE_MODE = 3;
+
+  static void place(void* ptr, size_t size) {
+#ifdef SYS_mbind
+    const numa_topology& topology = numa_topology::get();
+    if (topology.get_num_nodes() < 2) return;
+    // one bit per node number, in as many words as the highest node needs
+    const size_t word_bits = sizeof(unsigned long) * 8;
+    std::vector<unsigned long> mask(
+        topology.get_max_system_node() / word_bits + 1, 0);
+    int mode;
+    if (numa_placement::get_policy() == numa_placement::BIND) {
+      mode = MPOL_BIND_MODE;
+      set_node(mask, topology.get_system_node(numa_placement::get_node()));
+    } else if (numa_placement::get_policy() == numa_placement::INTERLEAVE) {
+      mode = MPOL_INTERLEAVE_MODE;
+      for (uint32_t node = 0; node < topology.get_num_nodes(); node++)
+        set_node(mask, topology.get_system_node(node));
+    } else {
+      return;
+    }
+    // the kernel reads maxnode - 1 bits of the mask. A failure leaves the
+    // pages to first touch.
+    syscall(SYS_mbind, ptr, size, mode, mask.data(),
+            mask.size() * word_bits + 1, 0);
+#else
+    (void)ptr;
+    (void)size;
+#endif
+  }
+
+  static void set_node(std::vector<unsigned long>& mask, uint32_t node) {
+    const size_t word_bits = sizeof(unsigned long) * 8;
+    mask[node / word_bits] |= 1UL << (node % word_bits);
+  }
+};
+
+template <typename T, typename U>
+bool operator==(const numa_allocator<T>&, const numa_allocator<U>&) {
+  return true;
+}
+
+template <typename T, typename U>
+bool operator!=(const numa_allocator<T>&, const numa_allocator<U>&) {
+  return false;
+}
+
+} /* namespace datasketches */
+
+#endif
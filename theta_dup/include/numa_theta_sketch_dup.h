@@ -0,0 +1,376 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef NUMA_THETA_SKETCH_DUP_H_
+#define NUMA_THETA_SKETCH_DUP_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "numa_allocator.h"
+#include "theta_sketch_dup.h"
+
+namespace datasketches {
+
+/*
+ * numa_theta_sketch_dup splits one logical sketch into shards spread over the
+ * NUMA nodes of the host. Each shard is an update_theta_sketch_dup owned by a
+ * worker thread pinned to the CPUs of its node, and its table is allocated by
+ * that thread under a numa_placement, so the random probes of the table stay
+ * on the memory of the node that runs them.
+ * A hash goes to the shard given by a remix of its bits, so the shards see
+ * disjoint parts of the stream and their union is the sketch of the whole
+ * stream. The batches of update() and remove() are split by shard and queued
+ * to the workers; queries wait for the batches queued before them and merge
+ * copies of the shards.
+ * With the numa_allocator the placement is applied with mbind; with another
+ * allocator the tables are still placed by the first touch of the pinned
+ * worker.
+ * Example:
+ *   numa_theta_sketch_dup sketch(
+ *       numa_theta_sketch_dup::builder().set_lg_k(24), 2);
+ *   sketch.update(keys, num_keys);
+ *   sketch.get_result().get_estimate();
+ */
+template <typename A>
+class numa_theta_sketch_dup_alloc {
+ public:
+  typedef typename update_theta_sketch_dup_alloc<A>::builder builder;
+
+  /**
+   * Creates the shards and starts their workers
+   * @param sketch_builder parameters of the shards and of the result
+   * @param shards_per_node number of shards of every node
+   * @param policy placement of the tables of the shards: BIND for the node of
+   * the shard, INTERLEAVE to spread them over all nodes, FIRST_TOUCH to leave
+   * it to the system
+   */
+  explicit numa_theta_sketch_dup_alloc(
+      const builder& sketch_builder = builder(), uint32_t shards_per_node = 1,
+      numa_placement::policy policy = numa_placement::BIND);
+
+  /**
+   * Applies the queued batches and stops the workers
+   */
+  ~numa_theta_sketch_dup_alloc();
+
+  numa_theta_sketch_dup_alloc(const numa_theta_sketch_dup_alloc&) = delete;
+  numa_theta_sketch_dup_alloc& operator=(const numa_theta_sketch_dup_alloc&) =
+      delete;
+
+  /**
+   * Queue a batch of hashed elements to the shards
+   * @param keys hashed elements
+   * @param num_keys number of hashed elements
+   */
+  void update(const theta_sketch_dup_key* keys, size_t num_keys);
+
+  /**
+   * Queue the removes of a batch of hashed elements to the shards. A remove
+   * refused by a shard is skipped, the rest of the batch is applied, and the
+   * refused removes are reported by the next flush() or get_result().
+   */
+  void remove(const theta_sketch_dup_key* keys, size_t num_keys);
+
+  /**
+   * Wait until the queued batches are applied
+   * @throw the error of a shard since the last flush if there is one, or
+   * std::logic_error with the number of errors and the first of them if
+   * there are more
+   */
+  void flush();
+
+  /**
+   * @return the union of the shards after the queued batches
+   */
+  update_theta_sketch_dup_alloc<A> get_result();
+
+  uint32_t get_num_shards() const;
+
+  /**
+   * @return the node of a shard
+   */
+  uint32_t get_node(uint32_t shard) const;
+
+  /**
+   * @return the shard of a hash
+   */
+  uint32_t get_shard(uint64_t hash) const;
+
+  const theta_sketch_dup_hasher& get_hasher() const;
+
+ private:
+  typedef std::vector<std::pair<uint64_t, int64_t>> ops_vector;
+
+  // a batch of operations, or a request for a copy of the shard
+  struct task {
+    ops_vector ops;
+    std::promise<update_theta_sketch_dup_alloc<A>>* copy;
+  };
+
+  struct shard {
+    uint32_t node;
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::condition_variable idle;
+    std::deque<task> queue;
+    bool busy = false;
+    bool stopping = false;
+    // the first error since the last flush, and the number of errors
+    std::exception_ptr error;
+    size_t num_errors = 0;
+  };
+
+  builder builder_;
+  theta_sketch_dup_hasher hasher_;
+  std::vector<std::unique_ptr<shard>> shards_;
+
+  void run(shard* s, numa_placement::policy policy,
+           std::promise<void>* started);
+  // stop and join the workers that were started
+  void stop();
+  void enqueue(const theta_sketch_dup_key* keys, size_t num_keys,
+               int64_t count);
+};
+
+/*
+ * The following are implementations
+ */
+
+template <typename A>
+numa_theta_sketch_dup_alloc<A>::numa_theta_sketch_dup_alloc(
+    const builder& sketch_builder, uint32_t shards_per_node,
+    numa_placement::policy policy)
+    : builder_(sketch_builder),
+      hasher_(sketch_builder.build().seed_),
+      shards_() {
+  if (shards_per_node == 0)
+    throw std::invalid_argument("shards_per_node must be positive");
+  const uint32_t num_nodes = numa_topology::get().get_num_nodes();
+  for (uint32_t node = 0; node < num_nodes; node++) {
+    for (uint32_t i = 0; i < shards_per_node; i++) {
+      shards_.emplace_back(new shard());
+      shards_.back()->node = node;
+    }
+  }
+  // the shards are built by their workers, on their nodes
+  for (auto& s : shards_) {
+    std::promise<void> started;
+    s->thread = std::thread(&numa_theta_sketch_dup_alloc::run, this, s.get(),
+                            policy, &started);
+    try {
+      started.get_future().get();
+    } catch (...) {
+      stop();
+      throw;
+    }
+  }
+}
+
+template <typename A>
+numa_theta_sketch_dup_alloc<A>::~numa_theta_sketch_dup_alloc() {
+  stop();
+}
+
+template <typename A>
+void numa_theta_sketch_dup_alloc<A>::stop() {
+  for (auto& s : shards_) {
+    if (!s->thread.joinable()) continue;
+    {
+      std::lock_guard<std::mutex> lock(s->mutex);
+      s->stopping = true;
+    }
+    s->ready.notify_one();
+    s->thread.join();
+  }
+}
+
+template <typename A>
+void numa_theta_sketch_dup_alloc<A>::run(shard* s,
+                                         numa_placement::policy policy,
+                                         std::promise<void>* started) {
+  pin_thread_to_node(s->node);
+  numa_placement placement(policy, s->node);
+  std::unique_ptr<update_theta_sketch_dup_alloc<A>> shard_sketch;
+  try {
+    shard_sketch.reset(
+        new update_theta_sketch_dup_alloc<A>(builder_.build()));
+  } catch (...) {
+    // the constructor rethrows it
+    started->set_exception(std::current_exception());
+    return;
+  }
+  update_theta_sketch_dup_alloc<A>& sketch = *shard_sketch;
+  started->set_value();
+  std::unique_lock<std::mutex> lock(s->mutex);
+  while (true) {
+    s->ready.wait(lock, [s]() { return s->stopping || !s->queue.empty(); });
+    if (s->queue.empty()) return;
+    task t = std::move(s->queue.front());
+    s->queue.pop_front();
+    s->busy = true;
+    lock.unlock();
+    if (t.copy != nullptr) {
+      try {
+        t.copy->set_value(sketch);
+      } catch (...) {
+        // the caller waiting on the copy rethrows it
+        t.copy->set_exception(std::current_exception());
+      }
+    } else {
+      // an operation that throws is skipped and the rest of the batch applied
+      size_t next = 0;
+      while (next < t.ops.size()) {
+        size_t failed = 0;
+        try {
+          sketch.internal_apply(t.ops.data() + next, t.ops.size() - next,
+                                &failed);
+          break;
+        } catch (...) {
+          std::lock_guard<std::mutex> error_lock(s->mutex);
+          if (!s->error) s->error = std::current_exception();
+          s->num_errors++;
+        }
+        next += failed + 1;
+      }
+    }
+    lock.lock();
+    s->busy = false;
+    if (s->queue.empty()) s->idle.notify_all();
+  }
+}
+
+template <typename A>
+void numa_theta_sketch_dup_alloc<A>::update(const theta_sketch_dup_key* keys,
+                                            size_t num_keys) {
+  enqueue(keys, num_keys, 1);
+}
+
+template <typename A>
+void numa_theta_sketch_dup_alloc<A>::remove(const theta_sketch_dup_key* keys,
+                                            size_t num_keys) {
+  enqueue(keys, num_keys, -1);
+}
+
+template <typename A>
+void numa_theta_sketch_dup_alloc<A>::enqueue(const theta_sketch_dup_key* keys,
+                                             size_t num_keys, int64_t count) {
+  theta_sketch_dup_alloc<A>::check_seed_hash(keys, num_keys,
+                                             hasher_.get_seed_hash());
+  std::vector<ops_vector> split(shards_.size());
+  for (size_t i = 0; i < num_keys; i++)
+    if (keys[i].hash != theta_sketch_dup_key::IGNORED_HASH)
+      split[get_shard(keys[i].hash)].emplace_back(keys[i].hash, count);
+  for (uint32_t i = 0; i < shards_.size(); i++) {
+    if (split[i].empty()) continue;
+    shard& s = *shards_[i];
+    {
+      std::lock_guard<std::mutex> lock(s.mutex);
+      s.queue.push_back(task{std::move(split[i]), nullptr});
+    }
+    s.ready.notify_one();
+  }
+}
+
+template <typename A>
+void numa_theta_sketch_dup_alloc<A>::flush() {
+  std::exception_ptr error;
+  size_t num_errors = 0;
+  for (auto& s : shards_) {
+    std::unique_lock<std::mutex> lock(s->mutex);
+    s->idle.wait(lock, [&s]() { return s->queue.empty() && !s->busy; });
+    if (s->error && !error) error = s->error;
+    num_errors += s->num_errors;
+    s->error = nullptr;
+    s->num_errors = 0;
+  }
+  if (num_errors == 1) std::rethrow_exception(error);
+  if (num_errors > 1) {
+    std::string what;
+    try {
+      std::rethrow_exception(error);
+    } catch (const std::exception& e) {
+      what = e.what();
+    }
+    throw std::logic_error(std::to_string(num_errors) +
+                           " operations failed, the first: " + what);
+  }
+}
+
+template <typename A>
+update_theta_sketch_dup_alloc<A> numa_theta_sketch_dup_alloc<A>::get_result() {
+  std::vector<std::promise<update_theta_sketch_dup_alloc<A>>> copies(
+      shards_.size());
+  for (uint32_t i = 0; i < shards_.size(); i++) {
+    shard& s = *shards_[i];
+    {
+      std::lock_guard<std::mutex> lock(s.mutex);
+      s.queue.push_back(task{ops_vector(), &copies[i]});
+    }
+    s.ready.notify_one();
+  }
+  auto result = builder_.build();
+  for (auto& copy : copies) result.internal_merge(copy.get_future().get());
+  flush();
+  return result;
+}
+
+template <typename A>
+uint32_t numa_theta_sketch_dup_alloc<A>::get_num_shards() const {
+  return shards_.size();
+}
+
+template <typename A>
+uint32_t numa_theta_sketch_dup_alloc<A>::get_node(uint32_t shard) const {
+  return shards_.at(shard)->node;
+}
+
+template <typename A>
+uint32_t numa_theta_sketch_dup_alloc<A>::get_shard(uint64_t hash) const {
+  // the bits of the hash decide its slot and theta, remix them so that every
+  // shard sees a uniform sample of the hash space
+  return fmix64(hash) % shards_.size();
+}
+
+template <typename A>
+const theta_sketch_dup_hasher& numa_theta_sketch_dup_alloc<A>::get_hasher()
+    const {
+  return hasher_;
+}
+
+/*
+ * alias with the NUMA allocator for convenience
+ */
+typedef numa_theta_sketch_dup_alloc<numa_allocator<void>>
+    numa_theta_sketch_dup;
+
+} /* namespace datasketches */
+
+#endif
@@ -0,0 +1,777 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef SHARED_THETA_SKETCH_DUP_H_
+#define SHARED_THETA_SKETCH_DUP_H_
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "theta_sketch_dup.h"
+
+namespace datasketches {
+
+/*
+ * shared_theta_sketch_dup is an update_theta_sketch_dup whose header and hash
+ * table live in a POSIX shared memory segment, so that the processes of a
+ * host update one sketch instead of merging sketches of their own.
+ * The first process to open a name creates the segment with the parameters of
+ * its builder, the others attach to it and must use the same parameters. The
+ * table is always probed with DOUBLE_HASHING, a builder set to ROBIN_HOOD is
+ * rejected. The segment is sized for the largest table of the sketch, 2^(lg_k+1) slots, but
+ * the system only backs the pages the table has reached.
+ * Updates and removes hold a process-shared lock in shared mode: a new hash
+ * claims its slot with a compare-and-swap and counts are changed with atomic
+ * additions, so writers of all the processes run concurrently. A resize or a
+ * rebuild takes the lock in exclusive mode, and the first writer that finds
+ * the table over capacity does it for everyone.
+ * A process that dies while it holds the lock leaves the segment locked, the
+ * segment must then be removed with unlink(). A creator that dies before the
+ * segment is initialized is detected by the processes that attach to it, as
+ * it no longer holds the flock() it keeps during the initialization, and the
+ * segment is created again.
+ * Example:
+ *   // in every worker process
+ *   shared_theta_sketch_dup users("/active_users", builder);
+ *   users.update(user_id);
+ *   // in any process
+ *   users.get_estimate();
+ *   shared_theta_sketch_dup::unlink("/active_users");
+ */
+template <typename A>
+class shared_theta_sketch_dup_alloc {
+ public:
+  typedef typename update_theta_sketch_dup_alloc<A>::builder builder;
+  typedef vector_u8_dup<A> vector_bytes;
+
+  /**
+   * Attaches to the shared sketch of a name, creating it if needed
+   * @param name name of the shared memory segment, starting with a slash
+   * @param sketch_builder parameters of the sketch, checked against the
+   * segment if it exists, with DOUBLE_HASHING probing
+   */
+  explicit shared_theta_sketch_dup_alloc(
+      const std::string& name, const builder& sketch_builder = builder());
+
+  /**
+   * Detaches from the segment, which stays until unlink()
+   */
+  ~shared_theta_sketch_dup_alloc();
+
+  shared_theta_sketch_dup_alloc(const shared_theta_sketch_dup_alloc&) = delete;
+  shared_theta_sketch_dup_alloc& operator=(
+      const shared_theta_sketch_dup_alloc&) = delete;
+
+  /**
+   * Removes the segment of a name. The processes attached to it keep it
+   * until they detach.
+   * @return false if there is no segment of the name
+   */
+  static bool unlink(const std::string& name);
+
+  /**
+   * Update this sketch with a given value.
+   * @param value value to update the sketch with
+   */
+  template <typename T>
+  void update(const T& value);
+  void update(const theta_sketch_dup_key& key);
+  void update(const theta_sketch_dup_key* keys, size_t num_keys);
+
+  /**
+   * Remove a given value from this sketch.
+   * @param value value to remove from the sketch, which must have been added
+   */
+  template <typename T>
+  void remove(const T& value);
+  void remove(const theta_sketch_dup_key& key);
+
+  bool is_empty() const;
+  bool is_estimation_mode() const;
+  double get_theta() const;
+  uint64_t get_theta64() const;
+  uint32_t get_num_retained() const;
+  uint16_t get_seed_hash() const;
+  double get_estimate() const;
+  double get_lower_bound(uint8_t num_std_devs) const;
+  double get_upper_bound(uint8_t num_std_devs) const;
+
+  /**
+   * @return a copy of the shared sketch, taken with the writers excluded
+   */
+  update_theta_sketch_dup_alloc<A> get_result() const;
+
+  /**
+   * @return the shared sketch in the format of
+   * update_theta_sketch_dup::serialize()
+   */
+  vector_bytes serialize() const;
+
+  /**
+   * @return the hasher of the elements of the sketch
+   */
+  const theta_sketch_dup_hasher& get_hasher() const;
+
+  /**
+   * @return the size of the shared memory segment in bytes
+   */
+  size_t get_segment_size_bytes() const;
+
+ private:
+  typedef typename update_theta_sketch_dup_alloc<A>::resize_factor
+      resize_factor;
+
+  static const uint32_t MAGIC = 0x54445348;  // "HSDT"
+  static const uint8_t SEGMENT_VERSION = 1;
+  // an uninitialized segment is only taken for the remains of a dead creator
+  // when it is older than this, as its creator takes the flock() right after
+  // creating it
+  static const unsigned STALE_SEGMENT_MS = 100;
+  // attempts to attach to a segment that keeps being created again
+  static const unsigned MAX_OPEN_ATTEMPTS = 3;
+
+  struct slot {
+    std::atomic<uint64_t> hash;
+    std::atomic<int64_t> count;
+  };
+
+  // the parameters are written once by the creator, before ready
+  struct segment_header {
+    std::atomic<uint32_t> ready;
+    uint8_t version;
+    uint8_t lg_nom_size;
+    uint8_t rf;
+    float p;
+    uint64_t seed;
+    pthread_rwlock_t lock;
+    // changed under the exclusive lock only
+    std::atomic<uint64_t> theta;
+    std::atomic<uint8_t> lg_cur_size;
+    // changed under the shared lock
+    std::atomic<bool> is_empty;
+    std::atomic<uint32_t> num_keys;
+    std::atomic<uint32_t> num_zeros;
+  };
+
+  enum insert_result { UPDATED, INSERTED, FULL };
+
+  // holds the lock of the segment for a scope
+  class lock_guard {
+   public:
+    lock_guard(pthread_rwlock_t* lock, bool exclusive);
+    ~lock_guard();
+
+   private:
+    pthread_rwlock_t* lock_;
+  };
+
+  std::string name_;
+  theta_sketch_dup_hasher hasher_;
+  int fd_;
+  size_t size_;
+  void* segment_;
+  segment_header* header_;
+  slot* table_;
+
+  static size_t get_header_size();
+  static size_t get_segment_size(uint8_t lg_nom_size);
+  // map the segment of an open descriptor, waiting for its creator if needed
+  // @return false if the creator died and the segment was unlinked
+  bool attach(const update_theta_sketch_dup_alloc<A>& prototype);
+  // @return false if the segment was unlinked as stale before it got ready
+  bool create(const update_theta_sketch_dup_alloc<A>& prototype);
+  // @return true if name_ still refers to the segment of fd_
+  bool is_linked() const;
+  void internal_update(uint64_t hash, int64_t count);
+  void internal_remove(uint64_t hash, int64_t count);
+  insert_result hash_add(uint64_t hash, int64_t count);
+  // resize or rebuild if still needed once the writers are excluded
+  void maintain(bool is_full);
+  void rehash(uint8_t lg_new_size);
+  // @return the number of entries with non-zero count, call with the lock held
+  uint32_t load_num_retained() const;
+  void get_bounds(uint8_t num_std_devs, double* estimate, double* lower_bound,
+                  double* upper_bound) const;
+  void unmap();
+};
+
+/*
+ * The following are implementations
+ */
+
+template <typename A>
+shared_theta_sketch_dup_alloc<A>::lock_guard::lock_guard(pthread_rwlock_t* lock,
+                                                         bool exclusive)
+    : lock_(lock) {
+  const int error =
+      exclusive ? pthread_rwlock_wrlock(lock) : pthread_rwlock_rdlock(lock);
+  if (error != 0)
+    throw std::system_error(error, std::generic_category(), "pthread_rwlock");
+}
+
+template <typename A>
+shared_theta_sketch_dup_alloc<A>::lock_guard::~lock_guard() {
+  pthread_rwlock_unlock(lock_);
+}
+
+template <typename A>
+size_t shared_theta_sketch_dup_alloc<A>::get_header_size() {
+  // the table starts on its own cache line
+  return (sizeof(segment_header) + 63) / 64 * 64;
+}
+
+template <typename A>
+size_t shared_theta_sketch_dup_alloc<A>::get_segment_size(uint8_t lg_nom_size) {
+  return get_header_size() + (sizeof(slot) << (lg_nom_size + 1));
+}
+
+template <typename A>
+shared_theta_sketch_dup_alloc<A>::shared_theta_sketch_dup_alloc(
+    const std::string& name, const builder& sketch_builder)
+    : name_(name),
+      hasher_(DEFAULT_SEED),
+      fd_(-1),
+      size_(0),
+      segment_(nullptr),
+      header_(nullptr),
+      table_(nullptr) {
+  static_assert(std::atomic<uint64_t>::is_always_lock_free,
+                "shared memory needs lock-free atomics");
+  const auto prototype = sketch_builder.build();
+  if (prototype.probing_ !=
+      update_theta_sketch_dup_alloc<A>::DOUBLE_HASHING)
+    throw std::invalid_argument(
+        "shared sketches only support DOUBLE_HASHING probing");
+  hasher_ = theta_sketch_dup_hasher(prototype.seed_);
+  for (unsigned i = 0; i < MAX_OPEN_ATTEMPTS; i++) {
+    fd_ = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC,
+                     0600);
+    if (fd_ >= 0) {
+      if (create(prototype)) return;
+      continue;
+    }
+    if (errno != EEXIST)
+      throw std::system_error(errno, std::generic_category(),
+                              "shm_open " + name);
+    fd_ = ::shm_open(name.c_str(), O_RDWR | O_CLOEXEC, 0);
+    if (fd_ < 0) {
+      // unlinked in the meantime
+      if (errno == ENOENT) continue;
+      throw std::system_error(errno, std::generic_category(),
+                              "shm_open " + name);
+    }
+    if (attach(prototype)) return;
+  }
+  throw std::runtime_error("shared sketch " + name +
+                           " keeps being created again");
+}
+
+template <typename A>
+bool shared_theta_sketch_dup_alloc<A>::is_linked() const {
+  const int fd = ::shm_open(name_.c_str(), O_RDONLY | O_CLOEXEC, 0);
+  if (fd < 0) return false;
+  struct stat named, own;
+  const bool is_same = ::fstat(fd, &named) == 0 && ::fstat(fd_, &own) == 0 &&
+                       named.st_dev == own.st_dev && named.st_ino == own.st_ino;
+  ::close(fd);
+  return is_same;
+}
+
+template <typename A>
+bool shared_theta_sketch_dup_alloc<A>::create(
+    const update_theta_sketch_dup_alloc<A>& prototype) {
+  // held until the segment is ready, so that a crash before is detected
+  if (::flock(fd_, LOCK_EX) != 0) {
+    const int error = errno;
+    ::shm_unlink(name_.c_str());
+    unmap();
+    throw std::system_error(error, std::generic_category(), "flock " + name_);
+  }
+  if (!is_linked()) {
+    // taken for stale by a process that attached before the flock()
+    unmap();
+    return false;
+  }
+  size_ = get_segment_size(prototype.lg_nom_size_);
+  if (::ftruncate(fd_, size_) != 0 ||
+      (segment_ = ::mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED,
+                         fd_, 0)) == MAP_FAILED) {
+    const int error = errno;
+    segment_ = nullptr;
+    ::shm_unlink(name_.c_str());
+    unmap();
+    throw std::system_error(error, std::generic_category(), "create " + name_);
+  }
+  // the segment is zero-filled: the table is empty and ready is 0
+  header_ = new (segment_) segment_header();
+  table_ = reinterpret_cast<slot*>(static_cast<uint8_t*>(segment_) +
+                                   get_header_size());
+  header_->version = SEGMENT_VERSION;
+  header_->lg_nom_size = prototype.lg_nom_size_;
+  header_->rf = prototype.rf_;
+  header_->p = prototype.p_;
+  header_->seed = prototype.seed_;
+  pthread_rwlockattr_t attr;
+  pthread_rwlockattr_init(&attr);
+  pthread_rwlockattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+#ifdef __GLIBC__
+  // the writers hold the lock in shared mode all the time, do not starve a
+  // resize
+  pthread_rwlockattr_setkind_np(&attr,
+                                PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+  pthread_rwlock_init(&header_->lock, &attr);
+  pthread_rwlockattr_destroy(&attr);
+  header_->theta.store(prototype.theta_);
+  header_->lg_cur_size.store(prototype.lg_cur_size_);
+  header_->is_empty.store(true);
+  header_->num_keys.store(0);
+  header_->num_zeros.store(0);
+  header_->ready.store(MAGIC, std::memory_order_release);
+  ::flock(fd_, LOCK_UN);
+  return true;
+}
+
+template <typename A>
+bool shared_theta_sketch_dup_alloc<A>::attach(
+    const update_theta_sketch_dup_alloc<A>& prototype) {
+  // the creator may not have sized or initialized the segment yet
+  const auto start = std::chrono::steady_clock::now();
+  const auto deadline = start + std::chrono::seconds(10);
+  while (true) {
+    struct stat st;
+    if (::fstat(fd_, &st) != 0) {
+      const int error = errno;
+      unmap();
+      throw std::system_error(error, std::generic_category(), "fstat " + name_);
+    }
+    if (static_cast<size_t>(st.st_size) >= sizeof(segment_header)) {
+      if (segment_ == nullptr) {
+        size_ = st.st_size;
+        segment_ = ::mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED,
+                          fd_, 0);
+        if (segment_ == MAP_FAILED) {
+          const int error = errno;
+          segment_ = nullptr;
+          unmap();
+          throw std::system_error(error, std::generic_category(),
+                                  "mmap " + name_);
+        }
+        header_ = static_cast<segment_header*>(segment_);
+      }
+      if (header_->ready.load(std::memory_order_acquire) == MAGIC) break;
+    }
+    const auto now = std::chrono::steady_clock::now();
+    if (now > start + std::chrono::milliseconds(STALE_SEGMENT_MS) &&
+        ::flock(fd_, LOCK_EX | LOCK_NB) == 0) {
+      // the creator released the flock(): it is ready now, or it died
+      const bool is_ready =
+          header_ != nullptr &&
+          header_->ready.load(std::memory_order_acquire) == MAGIC;
+      if (!is_ready) {
+        if (is_linked()) ::shm_unlink(name_.c_str());
+        unmap();
+        return false;
+      }
+      ::flock(fd_, LOCK_UN);
+      continue;
+    }
+    if (now > deadline) {
+      unmap();
+      throw std::runtime_error("shared sketch " + name_ + " is not initialized");
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  if (header_->version != SEGMENT_VERSION ||
+      size_ != get_segment_size(header_->lg_nom_size)) {
+    unmap();
+    throw std::runtime_error("shared sketch " + name_ + " has another layout");
+  }
+  if (header_->lg_nom_size != prototype.lg_nom_size_ ||
+      header_->rf != prototype.rf_ || header_->p != prototype.p_ ||
+      header_->seed != prototype.seed_) {
+    unmap();
+    throw std::invalid_argument("shared sketch " + name_ +
+                                " was created with other parameters");
+  }
+  table_ = reinterpret_cast<slot*>(static_cast<uint8_t*>(segment_) +
+                                   get_header_size());
+  return true;
+}
+
+template <typename A>
+shared_theta_sketch_dup_alloc<A>::~shared_theta_sketch_dup_alloc() {
+  unmap();
+}
+
+template <typename A>
+void shared_theta_sketch_dup_alloc<A>::unmap() {
+  if (segment_ != nullptr) ::munmap(segment_, size_);
+  if (fd_ >= 0) ::close(fd_);
+  segment_ = nullptr;
+  header_ = nullptr;
+  fd_ = -1;
+}
+
+template <typename A>
+bool shared_theta_sketch_dup_alloc<A>::unlink(const std::string& name) {
+  if (::shm_unlink(name.c_str()) == 0) return true;
+  if (errno == ENOENT) return false;
+  throw std::system_error(errno, std::generic_category(), "shm_unlink " + name);
+}
+
+template <typename A>
+template <typename T>
+void shared_theta_sketch_dup_alloc<A>::update(const T& value) {
+  update(hasher_.hash(value));
+}
+
+template <typename A>
+void shared_theta_sketch_dup_alloc<A>::update(const theta_sketch_dup_key& key) {
+  theta_sketch_dup_alloc<A>::check_seed_hash(key.seed_hash, hasher_.get_seed_hash());
+  if (key.hash != theta_sketch_dup_key::IGNORED_HASH)
+    internal_update(key.hash, 1);
+}
+
+template <typename A>
+void shared_theta_sketch_dup_alloc<A>::update(const theta_sketch_dup_key* keys,
+                                              size_t num_keys) {
+  theta_sketch_dup_alloc<A>::check_seed_hash(keys, num_keys,
+                                             hasher_.get_seed_hash());
+  for (size_t i = 0; i < num_keys; i++)
+    if (keys[i].hash != theta_sketch_dup_key::IGNORED_HASH)
+      internal_update(keys[i].hash, 1);
+}
+
+template <typename A>
+template <typename T>
+void shared_theta_sketch_dup_alloc<A>::remove(const T& value) {
+  remove(hasher_.hash(value));
+}
+
+template <typename A>
+void shared_theta_sketch_dup_alloc<A>::remove(const theta_sketch_dup_key& key) {
+  theta_sketch_dup_alloc<A>::check_seed_hash(key.seed_hash, hasher_.get_seed_hash());
+  if (key.hash != theta_sketch_dup_key::IGNORED_HASH)
+    internal_remove(key.hash, 1);
+}
+
+template <typename A>
+void shared_theta_sketch_dup_alloc<A>::internal_update(uint64_t hash,
+                                                       int64_t count) {
+  insert_result result;
+  {
+    lock_guard lock(&header_->lock, false);
+    // avoid writing the shared cache line once the sketch is not empty
+    if (header_->is_empty.load(std::memory_order_relaxed))
+      header_->is_empty.store(false);
+    // hash == 0 is reserved to mark empty slots in the table
+    if (hash >= header_->theta.load() || hash == 0) return;
+    result = hash_add(hash, count);
+    if (result == UPDATED) return;
+    if (result == INSERTED &&
+        header_->num_keys.load() <=
+            update_theta_sketch_dup_alloc<A>::get_capacity(
+                header_->lg_cur_size.load(), header_->lg_nom_size))
+      return;
+  }
+  maintain(result == FULL);
+  // the table had no room for the hash, try again in the new table
+  if (result == FULL) internal_update(hash, count);
+}
+
+template <typename A>
+typename shared_theta_sketch_dup_alloc<A>::insert_result
+shared_theta_sketch_dup_alloc<A>::hash_add(uint64_t hash, int64_t count) {
+  const uint8_t lg_size = header_->lg_cur_size.load();
+  const uint32_t mask = (1 << lg_size) - 1;
+  const uint32_t stride =
+      update_theta_sketch_dup_alloc<A>::get_stride(hash, lg_size);
+  uint32_t cur_probe = static_cast<uint32_t>(hash) & mask;
+  const uint32_t loop_index = cur_probe;
+  do {
+    slot& s = table_[cur_probe];
+    uint64_t value = s.hash.load();
+    if (value == 0) {
+      // a claimed slot counts as a zero entry until its count is added, so
+      // that a concurrent update of the same hash accounts for it alike
+      header_->num_zeros.fetch_add(1);
+      if (s.hash.compare_exchange_strong(value, hash)) {
+        header_->num_keys.fetch_add(1);
+        if (s.count.fetch_add(count) == 0) header_->num_zeros.fetch_sub(1);
+        return INSERTED;
+      }
+      header_->num_zeros.fetch_sub(1);
+      // value is now the hash of the writer that claimed the slot first
+    }
+    if (value == hash) {
+      if (s.count.fetch_add(count) == 0) header_->num_zeros.fetch_sub(1);
+      return UPDATED;
+    }
+    cur_probe = (cur_probe + stride) & mask;
+  } while (cur_probe != loop_index);
+  return FULL;
+}
+
+template <typename A>
+void shared_theta_sketch_dup_alloc<A>::internal_remove(uint64_t hash,
+                                                       int64_t count) {
+  lock_guard lock(&header_->lock, false);
+  if (header_->is_empty.load())
+    throw std::logic_error(
+        "Can't remove an element from an empty set: no data yet");
+  if (hash >= header_->theta.load() || hash == 0) return;
+  const uint8_t lg_size = header_->lg_cur_size.load();
+  const uint32_t mask = (1 << lg_size) - 1;
+  const uint32_t stride =
+      update_theta_sketch_dup_alloc<A>::get_stride(hash, lg_size);
+  uint32_t cur_probe = static_cast<uint32_t>(hash) & mask;
+  const uint32_t loop_index = cur_probe;
+  do {
+    slot& s = table_[cur_probe];
+    const uint64_t value = s.hash.load();
+    // slots are only emptied by a rehash, an empty slot ends the search
+    if (value == 0) break;
+    if (value == hash) {
+      int64_t current = s.count.load();
+      do {
+        // check before decreasing so that a failed remove leaves the table
+        // intact
+        if (current < count)
+          throw std::logic_error("this element doesn't exist");
+      } while (!s.count.compare_exchange_weak(current, current - count));
+      if (current == count) header_->num_zeros.fetch_add(1);
+      return;
+    }
+    cur_probe = (cur_probe + stride) & mask;
+  } while (cur_probe != loop_index);
+  throw std::logic_error("this element doesn't exist");
+}
+
+template <typename A>
+void shared_theta_sketch_dup_alloc<A>::maintain(bool is_full) {
+  lock_guard lock(&header_->lock, true);
+  const uint8_t lg_cur_size = header_->lg_cur_size.load();
+  const uint8_t lg_nom_size = header_->lg_nom_size;
+  // another writer may have done it while this one waited for the lock
+  const uint32_t num_keys = header_->num_keys.load();
+  if (num_keys <= update_theta_sketch_dup_alloc<A>::get_capacity(lg_cur_size,
+                                                                 lg_nom_size) &&
+      (!is_full || num_keys < (1u << lg_cur_size)))
+    return;
+  if (lg_cur_size <= lg_nom_size) {
+    // resize as update_theta_sketch_dup::resize()
+    const uint8_t lg_tgt_size = lg_nom_size + 1;
+    const uint8_t factor = std::max(
+        1, std::min(static_cast<int>(header_->rf), lg_tgt_size - lg_cur_size));
+    rehash(lg_cur_size + factor);
+  } else {
+    // rebuild as update_theta_sketch_dup::rebuild(): theta becomes the
+    // (k+1)-th smallest hash of the table, zero entries included
+    std::vector<uint64_t> hashes;
+    hashes.reserve(num_keys);
+    for (uint32_t i = 0; i < (1u << lg_cur_size); i++) {
+      const uint64_t hash = table_[i].hash.load(std::memory_order_relaxed);
+      if (hash != 0) hashes.push_back(hash);
+    }
+    const uint32_t pivot = 1 << lg_nom_size;
+    if (hashes.size() > pivot) {
+      std::nth_element(hashes.begin(), hashes.begin() + pivot, hashes.end());
+      header_->theta.store(hashes[pivot]);
+    }
+    rehash(lg_cur_size);
+  }
+}
+
+template <typename A>
+void shared_theta_sketch_dup_alloc<A>::rehash(uint8_t lg_new_size) {
+  // the writers are excluded: the table is moved aside and reinserted
+  const uint8_t lg_cur_size = header_->lg_cur_size.load();
+  const uint64_t theta = header_->theta.load();
+  std::vector<std::pair<uint64_t, int64_t>> entries;
+  entries.reserve(header_->num_keys.load());
+  for (uint32_t i = 0; i < (1u << lg_cur_size); i++) {
+    const uint64_t hash = table_[i].hash.load(std::memory_order_relaxed);
+    const int64_t count = table_[i].count.load(std::memory_order_relaxed);
+    if (hash != 0 && hash < theta && count != 0)
+      entries.emplace_back(hash, count);
+    table_[i].hash.store(0, std::memory_order_relaxed);
+    table_[i].count.store(0, std::memory_order_relaxed);
+  }
+  const uint32_t mask = (1 << lg_new_size) - 1;
+  for (const auto& entry : entries) {
+    const uint32_t stride =
+        update_theta_sketch_dup_alloc<A>::get_stride(entry.first, lg_new_size);
+    uint32_t cur_probe = static_cast<uint32_t>(entry.first) & mask;
+    while (table_[cur_probe].hash.load(std::memory_order_relaxed) != 0)
+      cur_probe = (cur_probe + stride) & mask;
+    table_[cur_probe].hash.store(entry.first, std::memory_order_relaxed);
+    table_[cur_probe].count.store(entry.second, std::memory_order_relaxed);
+  }
+  header_->num_keys.store(entries.size());
+  header_->num_zeros.store(0);
+  // published to the writers by the release of the lock
+  header_->lg_cur_size.store(lg_new_size);
+}
+
+template <typename A>
+bool shared_theta_sketch_dup_alloc<A>::is_empty() const {
+  return header_->is_empty.load();
+}
+
+template <typename A>
+bool shared_theta_sketch_dup_alloc<A>::is_estimation_mode() const {
+  return get_theta64() < theta_sketch_dup_alloc<A>::MAX_THETA && !is_empty();
+}
+
+template <typename A>
+double shared_theta_sketch_dup_alloc<A>::get_theta() const {
+  return static_cast<double>(get_theta64()) /
+         theta_sketch_dup_alloc<A>::MAX_THETA;
+}
+
+template <typename A>
+uint64_t shared_theta_sketch_dup_alloc<A>::get_theta64() const {
+  return header_->theta.load();
+}
+
+template <typename A>
+uint32_t shared_theta_sketch_dup_alloc<A>::get_num_retained() const {
+  lock_guard lock(&header_->lock, false);
+  return load_num_retained();
+}
+
+template <typename A>
+uint32_t shared_theta_sketch_dup_alloc<A>::load_num_retained() const {
+  // the zeros may run ahead of the keys while a slot is claimed
+  const uint32_t num_keys = header_->num_keys.load();
+  const uint32_t num_zeros = header_->num_zeros.load();
+  return num_keys > num_zeros ? num_keys - num_zeros : 0;
+}
+
+template <typename A>
+void shared_theta_sketch_dup_alloc<A>::get_bounds(uint8_t num_std_devs,
+                                                  double* estimate,
+                                                  double* lower_bound,
+                                                  double* upper_bound) const {
+  lock_guard lock(&header_->lock, false);
+  const uint32_t num_retained = load_num_retained();
+  const uint64_t theta =
+      is_empty() ? theta_sketch_dup_alloc<A>::MAX_THETA : header_->theta.load();
+  theta_sketch_dup_alloc<A>::get_bounds(&num_retained, &theta, 1, num_std_devs,
+                                        estimate, lower_bound, upper_bound);
+}
+
+template <typename A>
+uint16_t shared_theta_sketch_dup_alloc<A>::get_seed_hash() const {
+  return hasher_.get_seed_hash();
+}
+
+template <typename A>
+const theta_sketch_dup_hasher& shared_theta_sketch_dup_alloc<A>::get_hasher()
+    const {
+  return hasher_;
+}
+
+template <typename A>
+size_t shared_theta_sketch_dup_alloc<A>::get_segment_size_bytes() const {
+  return size_;
+}
+
+template <typename A>
+double shared_theta_sketch_dup_alloc<A>::get_estimate() const {
+  double estimate, lower_bound, upper_bound;
+  get_bounds(1, &estimate, &lower_bound, &upper_bound);
+  return estimate;
+}
+
+template <typename A>
+double shared_theta_sketch_dup_alloc<A>::get_lower_bound(
+    uint8_t num_std_devs) const {
+  double estimate, lower_bound, upper_bound;
+  get_bounds(num_std_devs, &estimate, &lower_bound, &upper_bound);
+  return lower_bound;
+}
+
+template <typename A>
+double shared_theta_sketch_dup_alloc<A>::get_upper_bound(
+    uint8_t num_std_devs) const {
+  double estimate, lower_bound, upper_bound;
+  get_bounds(num_std_devs, &estimate, &lower_bound, &upper_bound);
+  return upper_bound;
+}
+
+template <typename A>
+update_theta_sketch_dup_alloc<A> shared_theta_sketch_dup_alloc<A>::get_result()
+    const {
+  auto sketch = builder()
+                    .set_lg_k(header_->lg_nom_size)
+                    .set_resize_factor(static_cast<resize_factor>(header_->rf))
+                    .set_p(header_->p)
+                    .set_seed(header_->seed)
+                    .build();
+  lock_guard lock(&header_->lock, true);
+  const uint8_t lg_cur_size = header_->lg_cur_size.load();
+  sketch.is_empty_ = header_->is_empty.load();
+  sketch.theta_ = header_->theta.load();
+  sketch.rehash(lg_cur_size);
+  for (uint32_t i = 0; i < (1u << lg_cur_size); i++) {
+    const uint64_t hash = table_[i].hash.load(std::memory_order_relaxed);
+    const int64_t count = table_[i].count.load(std::memory_order_relaxed);
+    // the entries with count 0 are kept, as the table of the sketch does
+    if (hash != 0) {
+      sketch.hash_insert(hash, count, sketch.keys_.data(), lg_cur_size);
+      sketch.num_keys_++;
+      if (count == 0) sketch.num_zeros_++;
+    }
+  }
+  return sketch;
+}
+
+template <typename A>
+vector_u8_dup<A> shared_theta_sketch_dup_alloc<A>::serialize() const {
+  return get_result().serialize();
+}
+
+/*
+ * alias with default allocator for convenience
+ */
+typedef shared_theta_sketch_dup_alloc<std::allocator<void>>
+    shared_theta_sketch_dup;
+
+} /* namespace datasketches */
+
+#endif
@@ -21,16 +21,21 @@
 #define THETA_SKETCH_DUP_H_
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <climits>
 #include <cmath>
 #include <cstring>
 #include <functional>
+#include <iomanip>
 #include <istream>
 #include <memory>
 #include <ostream>
 #include <sstream>
 #include <vector>
 #include <bitset>
+#include <exception>
+#include <thread>
 
 #include "utils.h"
 
@@ -42,6 +47,14 @@
 
 #include "theta_dup/include/theta_sketch_dup.pb.h"
 
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#ifdef THETA_SKETCH_DUP_USDT
+#include <sys/sdt.h>
+#endif
+
 namespace datasketches {
 
 /*
@@ -60,6 +73,30 @@ template <typename A>
 class theta_sketch_dup_alloc;
 template <typename A>
 class update_theta_sketch_dup_alloc;
+template <typename A>
+class coalescing_theta_sketch_dup_alloc;
+template <typename A>
+class theta_sketch_dup_fanout_alloc;
+template <typename K, typename A, typename H, typename E>
+class grouped_theta_sketch_dup_alloc;
+template <typename A>
+class windowed_theta_sketch_dup_alloc;
+template <typename A>
+class theta_sketch_dup_converter_alloc;
+template <typename A>
+class theta_sketch_dup_snapshot_alloc;
+template <typename A>
+class theta_sketch_dup_wal_alloc;
+template <typename A>
+class theta_sketch_dup_server_alloc;
+template <typename A>
+class shared_theta_sketch_dup_alloc;
+template <typename A>
+class concurrent_theta_sketch_dup_alloc;
+template <typename A>
+class numa_theta_sketch_dup_alloc;
+template <uint8_t LgK>
+class fixed_theta_sketch_dup;
 
 /* TODO: support set operations
  * template<typename A> class theta_union_dup_alloc;
@@ -69,10 +106,176 @@ class update_theta_sketch_dup_alloc;
 
 // for serialization as raw bytes
 template <typename A>
-using AllocU8 =
+using AllocU8Dup =
     typename std::allocator_traits<A>::template rebind_alloc<uint8_t>;
 template <typename A>
-using vector_u8 = std::vector<uint8_t, AllocU8<A>>;
+using vector_u8_dup = std::vector<uint8_t, AllocU8Dup<A>>;
+
+/*
+ * theta_sketch_dup_key is an element hashed once with the seed of the
+ * sketches, so that it can be applied to many sketches without hashing the
+ * element again.
+ * @hash the hash value of the element as used by the sketches
+ * @seed_hash the hash of the seed used to compute the hash value
+ */
+struct theta_sketch_dup_key {
+  // the hash value of an ignored element, the hash values of the elements
+  // are below 2^63
+  static const uint64_t IGNORED_HASH = UINT64_MAX;
+
+  uint64_t hash;
+  uint16_t seed_hash;
+};
+
+/*
+ * theta_sketch_dup_hasher computes theta_sketch_dup_key of elements with a
+ * given seed. The hash values are the same as the ones computed by the update
+ * and remove methods of update_theta_sketch_dup with the same seed.
+ * Example: updating 2 sketches with an element hashed once.
+ *   theta_sketch_dup_hasher hasher;
+ *   auto key = hasher.hash("element");
+ *   sketch1.update(key);
+ *   sketch2.update(key);
+ */
+class theta_sketch_dup_hasher {
+ public:
+  explicit theta_sketch_dup_hasher(uint64_t seed = DEFAULT_SEED)
+      : seed_(seed), seed_hash_(compute_seed_hash(seed)) {}
+
+  uint64_t get_seed() const { return seed_; }
+  uint16_t get_seed_hash() const { return seed_hash_; }
+
+  /**
+   * Hash a given string, an empty string is hashed into IGNORED_HASH, which
+   * is ignored by update(key) and remove(key) as empty strings are ignored by
+   * update(string) and remove(string).
+   * @param value string to be hashed
+   */
+  theta_sketch_dup_key hash(const std::string& value) const {
+    if (value.empty())
+      return theta_sketch_dup_key{theta_sketch_dup_key::IGNORED_HASH,
+                                  seed_hash_};
+    return hash(value.c_str(), value.length());
+  }
+
+  theta_sketch_dup_key hash(uint64_t value) const {
+    return theta_sketch_dup_key{compute_hash64(value, seed_), seed_hash_};
+  }
+
+  theta_sketch_dup_key hash(int64_t value) const {
+    return hash(static_cast<uint64_t>(value));
+  }
+
+  theta_sketch_dup_key hash(uint32_t value) const {
+    return hash(static_cast<int32_t>(value));
+  }
+
+  theta_sketch_dup_key hash(int32_t value) const {
+    return hash(static_cast<int64_t>(value));
+  }
+
+  theta_sketch_dup_key hash(uint16_t value) const {
+    return hash(static_cast<int16_t>(value));
+  }
+
+  theta_sketch_dup_key hash(int16_t value) const {
+    return hash(static_cast<int64_t>(value));
+  }
+
+  theta_sketch_dup_key hash(uint8_t value) const {
+    return hash(static_cast<int8_t>(value));
+  }
+
+  theta_sketch_dup_key hash(int8_t value) const {
+    return hash(static_cast<int64_t>(value));
+  }
+
+  theta_sketch_dup_key hash(double value) const {
+    return hash(canonical_bits(value));
+  }
+
+  theta_sketch_dup_key hash(float value) const {
+    return hash(static_cast<double>(value));
+  }
+
+  /**
+   * Hash given data of any type, see update_theta_sketch_dup_alloc<A>::update
+   * @param data pointer to the data
+   * @param length of the data in bytes
+   */
+  theta_sketch_dup_key hash(const void* data, unsigned length) const {
+    return theta_sketch_dup_key{compute_hash(data, length, seed_), seed_hash_};
+  }
+
+  /**
+   * @return the hash value of the given data as used by the sketches
+   */
+  static uint64_t compute_hash(const void* data, unsigned length,
+                               uint64_t seed) {
+    HashState hashes;
+    MurmurHash3_x64_128(data, length, seed, hashes);
+    return hashes.h1 >> 1;  // Java implementation does logical shift >>> to
+                            // make values positive
+  }
+
+  /**
+   * @return the hash value of the 8 bytes of value as used by the sketches,
+   * the same as compute_hash(&value, 8, seed) with MurmurHash3_x64_128
+   * reduced to a single tail block, so that it is inlined into the update
+   * and remove of integers and floating point values
+   */
+  FORCE_INLINE static uint64_t compute_hash64(uint64_t value, uint64_t seed) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    // MurmurHash3 reads the tail bytes in little-endian order
+    value = __builtin_bswap64(value);
+#endif
+    uint64_t k1 = value * BIG_CONSTANT(0x87c37b91114253d5);
+    k1 = ROTL64(k1, 31);
+    k1 *= BIG_CONSTANT(0x4cf5ad432745937f);
+    uint64_t h1 = (seed ^ k1) ^ sizeof(value);
+    uint64_t h2 = seed ^ sizeof(value);
+    h1 += h2;
+    h2 += h1;
+    h1 = fmix64(h1);
+    h2 = fmix64(h2);
+    return (h1 + h2) >> 1;
+  }
+
+  /**
+   * @return the bits of a double as hashed by the sketches: -0.0 as 0.0 and
+   * NaN as the value of Java's Double.doubleToLongBits()
+   */
+  static int64_t canonical_bits(double value) {
+    union {
+      int64_t long_value;
+      double double_value;
+    } long_double_union;
+
+    if (value == 0.0) {
+      long_double_union.double_value = 0.0;  // canonicalize -0.0 to 0.0
+    } else if (std::isnan(value)) {
+      long_double_union.long_value =
+          0x7ff8000000000000L;  // canonicalize NaN using value from Java's
+                                // Double.doubleToLongBits()
+    } else {
+      long_double_union.double_value = value;
+    }
+    return long_double_union.long_value;
+  }
+
+  /**
+   * @return the hash of the seed stored in the serialized sketches
+   */
+  static uint16_t compute_seed_hash(uint64_t seed) {
+    HashState hashes;
+    MurmurHash3_x64_128(&seed, sizeof(seed), 0, hashes);
+    return hashes.h1;
+  }
+
+ private:
+  uint64_t seed_;
+  uint16_t seed_hash_;
+};
 
 template <typename A>
 class theta_sketch_dup_alloc {
@@ -115,6 +318,26 @@ class theta_sketch_dup_alloc {
    */
   double get_upper_bound(uint8_t num_std_devs) const;
 
+  /**
+   * Computes the estimates and the bounds of a batch of sketches given by
+   * their number of retained entries and theta, e.g. read from their
+   * serialized headers, without the sketches themselves.
+   * A sketch with theta == MAX_THETA is in exact mode.
+   * The estimates are computed in one branch-free loop that the compiler can
+   * vectorize; the bounds of the sketches in estimation mode are computed one
+   * by one by binomial_bounds.
+   * @param num_retained number of retained entries of each sketch
+   * @param thetas theta of each sketch as a positive integer
+   * @param n number of sketches
+   * @param num_std_devs number of Standard Deviations (1, 2 or 3)
+   * @param estimates output array of n estimates
+   * @param lower_bounds output array of n lower bounds
+   * @param upper_bounds output array of n upper bounds
+   */
+  static void get_bounds(const uint32_t* num_retained, const uint64_t* thetas,
+                         size_t n, uint8_t num_std_devs, double* estimates,
+                         double* lower_bounds, double* upper_bounds);
+
   /**
    * @return true if the sketch is in estimation mode (as opposed to exact mode)
    */
@@ -158,7 +381,7 @@ class theta_sketch_dup_alloc {
 
   // This is a convenience alias for users
   // The type returned by the following serialize method
-  typedef vector_u8<A> vector_bytes;
+  typedef vector_u8_dup<A> vector_bytes;
 
   /**
    * This method serializes the sketch as a vector of bytes.
@@ -237,7 +460,14 @@ class theta_sketch_dup_alloc {
    * IS_COMPACT: position of the bit that represents whether the sketch is in
    * compact form.
    */
-  enum flags { IS_BIG_ENDIAN, IS_READ_ONLY, IS_EMPTY, IS_COMPACT, IS_ORDERED };
+  enum flags {
+    IS_BIG_ENDIAN,
+    IS_READ_ONLY,
+    IS_EMPTY,
+    IS_COMPACT,
+    IS_ORDERED,
+    IS_ROBIN_HOOD
+  };
 
   bool is_empty_;
   /**
@@ -260,32 +490,214 @@ class theta_sketch_dup_alloc {
    */
   static void check_serial_version(uint8_t actual, uint8_t expected);
   static void check_seed_hash(uint16_t actual, uint16_t expected);
+  // check the seed hashes of a batch of keys with a single branch
+  static void check_seed_hash(const theta_sketch_dup_key* keys,
+                              size_t num_keys, uint16_t expected);
 
   /* TODO: support set operations
    * friend theta_intersection_alloc<A>;
    * friend theta_a_not_b_alloc<A>;
    */
+
+ private:
+  /**
+   * The bounds in estimation mode for the num_retained and theta they were
+   * computed for, so mutations invalidate them without any work on the update
+   * path. Readers of a sketch share it through a sequence lock: a reader
+   * publishes the bounds it computed unless another one is publishing, and a
+   * read that overlaps a publication misses. A copy starts empty.
+   */
+  class bounds_memo {
+   public:
+    bounds_memo() : seq_(0), num_retained_(0), theta_(0) {
+      for (uint8_t i = 0; i < 3; i++) {
+        lower_bounds_[i].store(0, std::memory_order_relaxed);
+        upper_bounds_[i].store(0, std::memory_order_relaxed);
+      }
+    }
+    bounds_memo(const bounds_memo&) : bounds_memo() {}
+    // the memo of the target stays valid for the state it was published for
+    bounds_memo& operator=(const bounds_memo&) { return *this; }
+
+    // @return true and the bounds if they were published for this state
+    bool get(uint32_t num_retained, uint64_t theta, uint8_t num_std_devs,
+             double* lower_bound, double* upper_bound) const {
+      const uint32_t seq = seq_.load(std::memory_order_acquire);
+      if (seq == 0 || (seq & 1)) return false;
+      const bool same_state =
+          num_retained_.load(std::memory_order_relaxed) == num_retained &&
+          theta_.load(std::memory_order_relaxed) == theta;
+      const double lower =
+          lower_bounds_[num_std_devs - 1].load(std::memory_order_relaxed);
+      const double upper =
+          upper_bounds_[num_std_devs - 1].load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (!same_state || seq_.load(std::memory_order_relaxed) != seq)
+        return false;
+      *lower_bound = lower;
+      *upper_bound = upper;
+      return true;
+    }
+
+    // publish the bounds for 1, 2 and 3 standard deviations of a state
+    void publish(uint32_t num_retained, uint64_t theta,
+                 const double* lower_bounds, const double* upper_bounds) {
+      uint32_t seq = seq_.load(std::memory_order_relaxed);
+      if ((seq & 1) || !seq_.compare_exchange_strong(
+                           seq, seq + 1, std::memory_order_relaxed))
+        return;
+      std::atomic_thread_fence(std::memory_order_release);
+      num_retained_.store(num_retained, std::memory_order_relaxed);
+      theta_.store(theta, std::memory_order_relaxed);
+      for (uint8_t i = 0; i < 3; i++) {
+        lower_bounds_[i].store(lower_bounds[i], std::memory_order_relaxed);
+        upper_bounds_[i].store(upper_bounds[i], std::memory_order_relaxed);
+      }
+      seq_.store(seq + 2, std::memory_order_release);
+    }
+
+   private:
+    // odd while a reader publishes, 0 before the first publication
+    std::atomic<uint32_t> seq_;
+    std::atomic<uint32_t> num_retained_;
+    std::atomic<uint64_t> theta_;
+    std::atomic<double> lower_bounds_[3];
+    std::atomic<double> upper_bounds_[3];
+  };
+  mutable bounds_memo bounds_memo_;
+
+  // the bounds of the sketch in estimation mode, from the memo if published
+  void get_memoized_bounds(uint8_t num_std_devs, double* lower_bound,
+                           double* upper_bound) const;
 };
 
 // update sketch
 
 template <typename A>
-using AllocU64 = typename std::allocator_traits<A>::template rebind_alloc<
+using AllocU64Dup = typename std::allocator_traits<A>::template rebind_alloc<
     std::pair<uint64_t, int64_t>>;
 template <typename A>
-using vector_u64 = std::vector<std::pair<uint64_t, int64_t>, AllocU64<A>>;
+using vector_u64_dup =
+    std::vector<std::pair<uint64_t, int64_t>, AllocU64Dup<A>>;
+
+/*
+ * update_theta_sketch_dup_stats is a snapshot of the statistics of the hot
+ * path of update_theta_sketch_dup. The counters are maintained only if the
+ * code is compiled with THETA_SKETCH_DUP_STATS defined, e.g.
+ *   bazel build --copt=-DTHETA_SKETCH_DUP_STATS ...
+ * otherwise they are always 0 and the sketch does no extra work. The sketch
+ * has the counters either way, so its layout is the same with and without
+ * the macro.
+ * load_factor and zeros_ratio are computed when the snapshot is taken, so
+ * they are always available.
+ */
+struct update_theta_sketch_dup_stats {
+  // probe length histogram bucket i counts the searches that probed
+  // [2^i, 2^(i+1)) slots, the last bucket counts all the longer ones
+  static const uint8_t NUM_PROBE_BUCKETS = 8;
+
+  // true if the counters are maintained
+  bool enabled;
+  // probe lengths of the searches in hash_search_or_insert
+  uint64_t insert_probes[NUM_PROBE_BUCKETS];
+  // probe lengths of the searches in hash_search_or_remove
+  uint64_t remove_probes[NUM_PROBE_BUCKETS];
+  uint64_t num_resizes;
+  uint64_t resize_nanos;
+  uint64_t num_rebuilds;
+  uint64_t rebuild_nanos;
+  // number of updates ignored because the hash value is not less than theta
+  uint64_t num_theta_rejected;
+  // num_keys / hash table size
+  double load_factor;
+  // num_zeros / num_keys, 0 if there are no keys
+  double zeros_ratio;
+};
+
+/*
+ * update_theta_sketch_dup_event describes a maintenance of the hash table of
+ * update_theta_sketch_dup:
+ *   - RESIZE: the table grew, theta is unchanged
+ *   - REBUILD: the table reached its capacity and theta was lowered
+ *   - THETA_CHANGE: theta was lowered by merging a sketch with a lower theta
+ * Entries with count 0 and entries not less than the new theta are dropped,
+ * the others are moved into the new table.
+ */
+struct update_theta_sketch_dup_event {
+  enum event_type { RESIZE, REBUILD, THETA_CHANGE };
+
+  event_type type;
+  uint8_t lg_size_before;
+  uint8_t lg_size_after;
+  uint64_t theta_before;
+  uint64_t theta_after;
+  uint32_t num_moved;
+  uint32_t num_dropped;
+  // wall time of the maintenance, in nanoseconds
+  uint64_t nanos;
+};
+
+/*
+ * update_theta_sketch_dup_listener receives the maintenance events of the
+ * sketches it is attached to with set_listener(). It is called synchronously
+ * on the thread that updates the sketch, so it should be cheap, e.g. record
+ * the event into a tracing buffer.
+ * If the code is compiled with THETA_SKETCH_DUP_USDT defined, the same events
+ * are also emitted as the USDT probes theta_sketch_dup:resize,
+ * theta_sketch_dup:rebuild and theta_sketch_dup:theta_change with arguments
+ * (sketch, lg_size_after, theta_after, num_moved, num_dropped, nanos).
+ */
+class update_theta_sketch_dup_listener {
+ public:
+  virtual ~update_theta_sketch_dup_listener() = default;
+  virtual void on_event(const update_theta_sketch_dup_event& event) = 0;
+};
+
+/*
+ * update_theta_sketch_dup_executor runs the tasks of the resizes and rebuilds
+ * of the sketches it is attached to with set_executor(), so that the large
+ * hash tables are rehashed by several threads. theta_sketch_dup_thread_pool
+ * (see theta_sketch_dup_thread_pool.h) is an implementation, or it can hand
+ * the tasks to the thread pool of the application.
+ */
+class update_theta_sketch_dup_executor {
+ public:
+  virtual ~update_theta_sketch_dup_executor() = default;
+  // @return the number of tasks that can run at the same time
+  virtual uint32_t get_concurrency() const = 0;
+  /**
+   * Call task(0) .. task(num_tasks - 1), concurrently or not, and return once
+   * all of them have returned. The tasks do not throw.
+   */
+  virtual void run(uint32_t num_tasks,
+                   const std::function<void(uint32_t)>& task) = 0;
+};
 
 template <typename A>
 class update_theta_sketch_dup_alloc : public theta_sketch_dup_alloc<A> {
  public:
   class builder;
   enum resize_factor { X1, X2, X4, X8 };
+  // collision resolution of the hash table, see builder::set_probing()
+  enum probing { DOUBLE_HASHING, ROBIN_HOOD };
+  // serialization paths: serialize(header_size_bytes), serialize(os) and
+  // serialize(pb)
+  enum serialized_format { BYTES, STREAM, PROTO };
   // @SKETCH_TYPE=2 corresponding to update_theta_sketch_dup
   static const uint8_t SKETCH_TYPE = 2;
+  // @DELTA_TYPE=4 corresponding to the deltas of serialize_delta()
+  static const uint8_t DELTA_TYPE = 4;
 
   // No constructor here. Use builder instead.
 
   virtual ~update_theta_sketch_dup_alloc() = default;
+  // the destructor would otherwise turn moves into copies
+  update_theta_sketch_dup_alloc(const update_theta_sketch_dup_alloc&) = default;
+  update_theta_sketch_dup_alloc(update_theta_sketch_dup_alloc&&) = default;
+  update_theta_sketch_dup_alloc& operator=(
+      const update_theta_sketch_dup_alloc&) = default;
+  update_theta_sketch_dup_alloc& operator=(update_theta_sketch_dup_alloc&&) =
+      default;
 
   virtual uint32_t get_num_retained() const;
   virtual uint16_t get_seed_hash() const;
@@ -296,7 +708,7 @@ class update_theta_sketch_dup_alloc : public theta_sketch_dup_alloc<A> {
   // serialize to protobuf
   virtual void serialize(datasketches_pb::ThetaSketchDup* pb) const;
   // serialize to bytes
-  typedef vector_u8<A> vector_bytes;  // alias for users
+  typedef vector_u8_dup<A> vector_bytes;  // alias for users
   // header space is reserved, but not initialized
   virtual vector_bytes serialize(unsigned header_size_bytes = 0) const;
 
@@ -390,6 +802,20 @@ class update_theta_sketch_dup_alloc : public theta_sketch_dup_alloc<A> {
    */
   void update(const void* data, unsigned length);
 
+  /**
+   * Update this sketch with an element hashed by theta_sketch_dup_hasher.
+   * @param key hashed element, must be hashed with the seed of this sketch
+   */
+  void update(const theta_sketch_dup_key& key);
+
+  /**
+   * Update this sketch with a batch of elements hashed by
+   * theta_sketch_dup_hasher.
+   * @param keys pointer to the hashed elements
+   * @param num_keys number of the hashed elements
+   */
+  void update(const theta_sketch_dup_key* keys, size_t num_keys);
+
   /**
    * Remove one string from the theta-sketch.
    * @param value string to be removed from the sketch
@@ -472,11 +898,45 @@ class update_theta_sketch_dup_alloc : public theta_sketch_dup_alloc<A> {
    */
   void remove(const void* data, unsigned length);
 
+  /**
+   * Remove one element hashed by theta_sketch_dup_hasher from the sketch.
+   * @param key hashed element, must be hashed with the seed of this sketch
+   */
+  void remove(const theta_sketch_dup_key& key);
+
+  /**
+   * Remove a batch of elements hashed by theta_sketch_dup_hasher.
+   * @param keys pointer to the hashed elements
+   * @param num_keys number of the hashed elements
+   */
+  void remove(const theta_sketch_dup_key* keys, size_t num_keys);
+
   /**
    * Remove retained entries in excess of the nominal size k (if any)
    */
   void trim();
 
+  /**
+   * Reset the sketch to the initial state of the builder: empty, with the
+   * initial theta. The hash table is cleared in place and keeps its size, so
+   * no memory is allocated.
+   */
+  void reset();
+
+  /**
+   * Grow the hash table, if needed, so that n retained entries fit without a
+   * resize. The table never grows beyond its full size 2^(lg_k+1).
+   * @param n number of retained entries to make room for
+   */
+  void reserve(uint32_t n);
+
+  /**
+   * Shrink the hash table to the smallest size that fits the entries with a
+   * non-zero count, dropping the entries with count 0. Meant for long-lived
+   * sketches after mass deletions.
+   */
+  void shrink_to_fit();
+
   virtual typename theta_sketch_dup_alloc<A>::const_iterator begin() const;
   virtual typename theta_sketch_dup_alloc<A>::const_iterator end() const;
 
@@ -512,16 +972,221 @@ class update_theta_sketch_dup_alloc : public theta_sketch_dup_alloc<A> {
       const void* bytes, size_t size, uint64_t seed = DEFAULT_SEED);
 
   /**
-   * @return true if *this equals r
+   * Computes the estimate of a sketch serialized by serialize(header_size_bytes)
+   * or serialize(os) from its header only, without reading the hash table.
+   * @param bytes pointer to the serialized sketch, after the reserved header
+   * @param size the size of the array
+   * @param seed the seed for the hash function that was used to create the
+   * sketch
+   * @return estimate of the distinct count of the serialized sketch
+   */
+  static double estimate_from_bytes(const void* bytes, size_t size,
+                                    uint64_t seed = DEFAULT_SEED);
+
+  /**
+   * Computes the estimate and the bounds of a serialized sketch from its
+   * header only, see estimate_from_bytes()
+   * @param num_std_devs number of Standard Deviations (1, 2 or 3)
+   * @param lower_bound output lower bound
+   * @param upper_bound output upper bound
+   * @return estimate of the distinct count of the serialized sketch
+   */
+  static double bounds_from_bytes(const void* bytes, size_t size,
+                                  uint8_t num_std_devs, double* lower_bound,
+                                  double* upper_bound,
+                                  uint64_t seed = DEFAULT_SEED);
+
+  /**
+   * Computes the estimates and the bounds of many serialized sketches from
+   * their headers, splitting the blobs between num_threads threads. If a
+   * header is invalid, the exception of the first invalid blob is thrown
+   * after all the threads finish.
+   * @param blobs pointers to the serialized sketches
+   * @param sizes sizes of the serialized sketches
+   * @param n number of serialized sketches
+   * @param num_std_devs number of Standard Deviations (1, 2 or 3)
+   * @param estimates output array of n estimates
+   * @param lower_bounds output array of n lower bounds, may be nullptr
+   * @param upper_bounds output array of n upper bounds, may be nullptr
+   * @param num_threads number of threads, 0 for the hardware concurrency
+   */
+  static void bounds_from_bytes(const void* const* blobs, const size_t* sizes,
+                                size_t n, uint8_t num_std_devs,
+                                double* estimates, double* lower_bounds,
+                                double* upper_bounds, unsigned num_threads = 0,
+                                uint64_t seed = DEFAULT_SEED);
+
+  /**
+   * @return true if *this and r have the same parameters, theta and entries
+   * with non-zero count, wherever the entries are in the hash tables
    */
   virtual bool is_equal(const update_theta_sketch_dup_alloc& r) const;
 
+  /**
+   * @return a hash of the entries with non-zero count of this sketch that
+   * does not depend on their order, maintained on every update, so that
+   * sketches with different fingerprints are different
+   */
+  uint64_t get_fingerprint() const;
+
+  /**
+   * @return the collision resolution of the hash table of this sketch
+   */
+  probing get_probing() const;
+
+  /**
+   * Call f on every live entry of the sketch: the entries with a non-zero
+   * count and a hash value below theta. Unlike the iterator, the entries with
+   * count 0 are skipped, and the table is scanned 4 slots at a time with AVX2
+   * if the code is compiled with it.
+   * @param f function object called as f(const std::pair<uint64_t, int64_t>&)
+   */
+  template <typename F>
+  void for_each_live(F f) const;
+
+  /**
+   * Call f on the live entries of one chunk of the hash table, so that
+   * num_chunks consumers can visit the entries in parallel, the chunks of
+   * 0 .. num_chunks - 1 cover every live entry exactly once.
+   * @param f function object called as f(const std::pair<uint64_t, int64_t>&)
+   * @param chunk index of the chunk, less than num_chunks
+   * @param num_chunks number of chunks
+   */
+  template <typename F>
+  void for_each_live(F f, uint32_t chunk, uint32_t num_chunks) const;
+
+  /**
+   * @return the number of bytes used by this sketch: the object, the
+   * allocated hash table, including its unused capacity, and the write
+   * tracking of snapshots and checkpoints. The page copies of the snapshots
+   * belong to the snapshots and are not counted.
+   */
+  size_t get_memory_usage_bytes() const;
+
+  /**
+   * Computes the size of the serialized sketch without serializing it
+   * @param format serialization path
+   * @param header_size_bytes space reserved in front of the sketch, only used
+   * by the BYTES format
+   * @return the exact size in bytes for BYTES and STREAM, an upper bound of
+   * the size of the message for PROTO since varints have variable length
+   */
+  size_t get_serialized_size_bytes(serialized_format format = BYTES,
+                                   unsigned header_size_bytes = 0) const;
+
+  /**
+   * @param lg_k log of the nominal number of entries of the sketch
+   * @return the number of bytes used by a sketch with the given lg_k once
+   * its hash table has reached its full size, not counting the transient
+   * copy of the table made by a resize nor the write tracking of snapshots
+   * and checkpoints
+   */
+  static size_t get_max_memory_bytes(uint8_t lg_k);
+
+  /**
+   * @return the statistics of the hot path of this sketch
+   */
+  update_theta_sketch_dup_stats get_stats() const;
+
+  /**
+   * Set all the counters of the statistics to 0
+   */
+  void reset_stats();
+
+  /**
+   * Writes a human-readable summary of the statistics of this sketch
+   */
+  string<A> stats_to_string() const;
+
+  /**
+   * Attach a listener to the maintenance events of this sketch. The sketch
+   * does not own the listener. A copy of the sketch has no listener, an
+   * assignment keeps the listener of the target, and a moved-from sketch
+   * passes its listener to the new one.
+   * @param listener the listener, or nullptr to detach the current one
+   */
+  void set_listener(update_theta_sketch_dup_listener* listener);
+
+  /**
+   * @return the listener attached to this sketch, nullptr if there is none
+   */
+  update_theta_sketch_dup_listener* get_listener() const;
+
+  /**
+   * Attach an executor to run the resizes and rebuilds of the hash tables
+   * larger than 2^LG_REGION_SLOTS slots in parallel. The sketch does not own
+   * the executor, and copies of the sketch share it. The hash table is the
+   * same with or without an executor, whatever its concurrency.
+   * @param executor the executor, or nullptr to run them on the updating
+   * thread
+   */
+  void set_executor(update_theta_sketch_dup_executor* executor);
+
+  /**
+   * @return the executor attached to this sketch, nullptr if there is none
+   */
+  update_theta_sketch_dup_executor* get_executor() const;
+
+  /**
+   * Starts a new checkpoint: the deltas serialized from now on carry it, and
+   * the writes after it go to the deltas made since it. The first checkpoint
+   * starts the tracking of the writes.
+   * @return the checkpoint, to pass to serialize_delta() later
+   */
+  uint64_t take_checkpoint();
+
+  /**
+   * @return the last checkpoint taken by take_checkpoint(), or the checkpoint
+   * of the last delta applied by apply_delta(), 0 if there is none
+   */
+  uint64_t get_checkpoint() const;
+
+  /**
+   * Serializes the entries written since a checkpoint, so that a replica
+   * holding the sketch at that checkpoint can catch up with apply_delta()
+   * without receiving the whole hash table. The delta carries the checkpoint
+   * it was made from and the last checkpoint taken, which the replica is at
+   * once it has applied the delta.
+   * The delta holds the pages of the hash table written since the checkpoint,
+   * or the whole table if there is no such checkpoint or if the table has
+   * been rebuilt since then, which includes every change of theta. A page
+   * holds 2^LG_PAGE_SLOTS slots and is sent whole for any write to it, so the
+   * delta grows with the number of distinct pages written, up to the size of
+   * the table once the writes since the checkpoint reach about as many as
+   * there are pages: deltas pay off when checkpoints are taken often enough
+   * for the writes in between to touch a small part of the table.
+   * @param since checkpoint returned by take_checkpoint(), 0 for a full delta
+   * @return the delta as a vector of bytes
+   */
+  vector_bytes serialize_delta(uint64_t since = 0) const;
+
+  /**
+   * Applies a delta made by serialize_delta(). A partial delta must be
+   * applied to the sketch at the checkpoint it was made from, as returned by
+   * get_checkpoint(), a full delta can be applied to any sketch with the
+   * same parameters.
+   * @param bytes pointer to the delta
+   * @param size size of the delta in bytes
+   * @return the checkpoint of the delta, which this sketch is now at
+   */
+  uint64_t apply_delta(const void* bytes, size_t size);
+
  private:
   // resize threshold = 0.5 tuned for speed
   static constexpr double RESIZE_THRESHOLD = 0.5;
   // hash table rebuild threshold = 15/16
   static constexpr double REBUILD_THRESHOLD = 15.0 / 16.0;
 
+  /**
+   * tables larger than 2^LG_REGION_SLOTS slots are rehashed region by region:
+   * the entries are inserted into the region of their home slot in the new
+   * table, independently of the other regions, and the ones that would leave
+   * it are inserted afterwards
+   */
+  static constexpr uint8_t LG_REGION_SLOTS = 16;
+  // number of buckets of the histograms of the parallel selection of theta
+  static constexpr uint8_t LG_SELECT_BUCKETS = 16;
+
   static constexpr uint8_t STRIDE_HASH_BITS = 7;
   static constexpr uint32_t STRIDE_MASK = (1 << STRIDE_HASH_BITS) - 1;
 
@@ -535,32 +1200,167 @@ class update_theta_sketch_dup_alloc : public theta_sketch_dup_alloc<A> {
    * @num_keys_ number of retained elements in the hash table
    * @num_zeros_ number of retained elements in the hash table that has count 0
    */
-  vector_u64<A> keys_;
+  vector_u64_dup<A> keys_;
   uint32_t num_keys_;
   uint32_t num_zeros_;
+  // sum of fingerprint_term() over the entries of keys_
+  uint64_t fingerprint_;
   resize_factor rf_;
   float p_;
   uint64_t seed_;
+  // cached hash of seed_, checked against hashed elements
+  uint16_t seed_hash_;
   uint32_t capacity_;
+  probing probing_;
+  /**
+   * listener_ptr holds the listener of one sketch object: a copy of the
+   * sketch starts without a listener and an assignment keeps the listener of
+   * the target, only a move constructor takes the listener along.
+   */
+  struct listener_ptr {
+    update_theta_sketch_dup_listener* ptr;
+
+    listener_ptr() : ptr(nullptr) {}
+    listener_ptr(const listener_ptr&) : ptr(nullptr) {}
+    listener_ptr(listener_ptr&& other) noexcept : ptr(other.ptr) {
+      other.ptr = nullptr;
+    }
+    listener_ptr& operator=(const listener_ptr&) { return *this; }
+    listener_ptr& operator=(listener_ptr&&) noexcept { return *this; }
+  };
+  listener_ptr listener_;
+  update_theta_sketch_dup_executor* executor_;
+
+  /**
+   * write tracking for snapshots (see theta_sketch_dup_snapshot.h) and delta
+   * checkpoints: keys_ is split into pages of 2^LG_PAGE_SLOTS slots (one page
+   * if the table is smaller), and each snapshot or checkpoint starts a new
+   * write epoch
+   * @page_epochs_ epoch of the last write of each page, empty until the first
+   * snapshot or checkpoint so that other sketches do not track their writes
+   * @write_epoch_ epoch of the current writes
+   * @rehash_epoch_ epoch of the last write of the whole table: rehash or reset
+   * @snapshot_epoch_ last epoch included in the last snapshot
+   * @checkpoint_ last checkpoint taken, or of the last delta applied
+   * @snapshot_pages_ immutable copies of the pages made by the last snapshot,
+   * owned by the snapshots: a page is freed with the last snapshot that has
+   * it, and copied again by the next snapshot
+   */
+  static const uint8_t LG_PAGE_SLOTS = 8;
+  typedef std::shared_ptr<const vector_u64_dup<A>> page_ptr;
+  typedef std::vector<
+      page_ptr, typename std::allocator_traits<A>::template rebind_alloc<page_ptr>>
+      vector_page_ptr;
+  typedef std::weak_ptr<const vector_u64_dup<A>> weak_page_ptr;
+  typedef std::vector<weak_page_ptr,
+                      typename std::allocator_traits<A>::template rebind_alloc<
+                          weak_page_ptr>>
+      vector_weak_page_ptr;
+  typedef std::vector<
+      uint64_t, typename std::allocator_traits<A>::template rebind_alloc<uint64_t>>
+      vector_epoch;
+  vector_epoch page_epochs_;
+  uint64_t write_epoch_;
+  uint64_t rehash_epoch_;
+  uint64_t snapshot_epoch_;
+  uint64_t checkpoint_;
+  vector_weak_page_ptr snapshot_pages_;
+  // kept without THETA_SKETCH_DUP_STATS too, so that the layout of the sketch
+  // does not depend on the macro in the translation units that share it
+  update_theta_sketch_dup_stats stats_;
 
   // for builder
   update_theta_sketch_dup_alloc(uint8_t lg_cur_size, uint8_t lg_nom_size,
-                                resize_factor rf, float p, uint64_t seed);
+                                resize_factor rf, float p, uint64_t seed,
+                                probing policy);
 
   // for deserialize
   update_theta_sketch_dup_alloc(bool is_empty, uint64_t theta,
                                 uint8_t lg_cur_size, uint8_t lg_nom_size,
-                                vector_u64<A>&& keys, uint32_t num_keys,
+                                vector_u64_dup<A>&& keys, uint32_t num_keys,
                                 uint32_t num_zeros_, resize_factor rf, float p,
-                                uint64_t seed);
+                                uint64_t seed, probing policy = DOUBLE_HASHING);
 
   void resize();
   void rebuild();
+  /**
+   * move the entries with non-zero count and hash < theta_ into a new hash
+   * table of size 2^lg_new_size
+   */
+  void rehash(uint8_t lg_new_size);
+  // rehash of a new table of more than one region
+  void rehash_regions(vector_u64_dup<A>& new_keys, uint8_t lg_new_size);
+  /**
+   * @return the hash value of rank rank (from 0) among the entries of keys_,
+   * found with histograms of the hash values split between the tasks
+   */
+  uint64_t select_hash(uint32_t rank) const;
+  // @return the number of tasks that split a scan of keys_
+  uint32_t get_num_scan_tasks() const;
+  // call f(0) .. f(num_tasks - 1) on the executor if there is one
+  template <typename F>
+  void run_tasks(uint32_t num_tasks, F f) const;
+  /**
+   * insert an entry into table without leaving the region of its home slot
+   * @return false if the probe sequence leaves the region, the table is
+   * unchanged
+   */
+  static bool double_hashing_insert_in_region(
+      const std::pair<uint64_t, int64_t>& entry,
+      std::pair<uint64_t, int64_t>* table, uint8_t lg_size);
+  /**
+   * insert an entry into table without leaving the region of its home slot
+   * @return the entry displaced out of the last slot of the region, with
+   * hash 0 if none
+   */
+  static std::pair<uint64_t, int64_t> robin_hood_insert_in_region(
+      std::pair<uint64_t, int64_t> entry, std::pair<uint64_t, int64_t>* table,
+      uint8_t lg_size);
+  // @return the start time of a maintenance, only read if it is observed
+  inline std::chrono::steady_clock::time_point maintenance_start() const;
+  /**
+   * report a maintenance that started at start to the statistics, the
+   * listener and the tracepoints
+   */
+  void maintenance_end(update_theta_sketch_dup_event::event_type type,
+                       std::chrono::steady_clock::time_point start,
+                       uint8_t lg_size_before, uint64_t theta_before,
+                       uint32_t num_keys_before);
 
   // TODO: support union
   // friend theta_union_alloc<A>;
   void internal_update(uint64_t hash, int64_t count);
-  void internal_remove(uint64_t hash);
+  void internal_remove(uint64_t hash, int64_t count = 1);
+  /**
+   * apply a batch of pre-hashed operations in order: an update of the hash
+   * for a positive count, a remove for a negative count. The home slots of
+   * the next operations are prefetched while the current one probes.
+   * If an operation throws, the ones before it are applied and
+   * *num_applied, if given, is set to its index.
+   */
+  void internal_apply(const std::pair<uint64_t, int64_t>* ops, size_t num_ops,
+                      size_t* num_applied = nullptr);
+  /**
+   * add the retained entries of other with their counts to this sketch,
+   * theta becomes the minimum of both thetas
+   */
+  void internal_merge(const update_theta_sketch_dup_alloc& other);
+  // @return the count of the hash value, 0 if it is not retained
+  int64_t get_count(uint64_t hash) const;
+  friend coalescing_theta_sketch_dup_alloc<A>;
+  friend windowed_theta_sketch_dup_alloc<A>;
+  friend theta_sketch_dup_fanout_alloc<A>;
+  friend theta_sketch_dup_converter_alloc<A>;
+  friend theta_sketch_dup_snapshot_alloc<A>;
+  friend theta_sketch_dup_wal_alloc<A>;
+  friend theta_sketch_dup_server_alloc<A>;
+  friend shared_theta_sketch_dup_alloc<A>;
+  friend concurrent_theta_sketch_dup_alloc<A>;
+  friend numa_theta_sketch_dup_alloc<A>;
+  template <uint8_t LgK>
+  friend class fixed_theta_sketch_dup;
+  template <typename K, typename A2, typename H, typename E>
+  friend class grouped_theta_sketch_dup_alloc;
 
   // TODO: support intersection
   // friend theta_intersection_alloc<A>;
@@ -568,6 +1368,38 @@ class update_theta_sketch_dup_alloc : public theta_sketch_dup_alloc<A> {
   // friend theta_a_not_b_alloc<A>;
   static inline uint32_t get_capacity(uint8_t lg_cur_size, uint8_t lg_nom_size);
   static inline uint32_t get_stride(uint64_t hash, uint8_t lg_size);
+  // @return the flags byte of the serialized forms
+  static inline uint8_t get_flags_byte(bool is_empty, probing policy);
+  // @return the probing recorded in a flags byte
+  static inline probing probing_from_flags(uint8_t flags_byte);
+  // bytes written by write_header(): the preamble long, num_keys, num_zeros,
+  // p and theta
+  static const size_t HEADER_BYTES = 28;
+  // write the header shared by the serialized forms and the deltas
+  // @return the pointer past the header
+  static uint8_t* write_header(uint8_t* ptr, uint8_t preamble_longs,
+                               resize_factor rf, uint8_t type,
+                               uint8_t lg_nom_size, uint8_t lg_cur_size,
+                               uint8_t flags_byte, uint16_t seed_hash,
+                               uint32_t num_keys, uint32_t num_zeros, float p,
+                               uint64_t theta);
+  // @return the number of pages of keys_ for snapshots
+  uint32_t get_num_pages() const;
+  // record a write to a slot of table for the next snapshot
+  inline void mark_dirty(const std::pair<uint64_t, int64_t>* table,
+                         uint32_t slot);
+  // record a write to every slot of keys_
+  void touch_all_pages();
+  // start the write tracking if it has not started yet
+  void start_tracking();
+  // call f on the live entries in the slots [begin, end) of keys_
+  template <typename F>
+  void for_each_live_in(F f, uint32_t begin, uint32_t end) const;
+  // @return the contribution of an entry to the fingerprint, 0 if count is 0
+  static inline uint64_t fingerprint_term(uint64_t hash, int64_t count);
+  // @return the lg size of the smallest table that fits n entries without a
+  // resize, at most lg_nom_size + 1
+  static uint8_t lg_size_from_count(uint64_t n, uint8_t lg_nom_size);
 
   /**
    * search hash values, if exists increase the count and return true, otherwise
@@ -585,15 +1417,59 @@ class update_theta_sketch_dup_alloc : public theta_sketch_dup_alloc<A> {
    * if the count==0, remove the element from hash table and return true else
    * return false
    * @param hash: the hash value
+   * @param count: count to be removed from the hash value in the hash table
    * @param table: the pointer to the hash table
    * @param table: lg_size of the current hash table
    */
-  bool hash_search_or_remove(uint64_t hash,
-                                    std::pair<uint64_t, int64_t>* table,
-                                    uint8_t lg_size);
-  static bool hash_search(uint64_t hash,
-                          const std::pair<uint64_t, int64_t>* table,
-                          uint8_t lg_size);
+  bool hash_search_or_remove(uint64_t hash, int64_t count,
+                             std::pair<uint64_t, int64_t>* table,
+                             uint8_t lg_size);
+  // record the number of slots probed by a search in the statistics
+  inline void record_probes(bool is_insert,
+                            const std::pair<uint64_t, int64_t>* table,
+                            uint32_t num_probes);
+  /**
+   * insert a hash value that is known not to be in the table into the first
+   * empty slot of its probe sequence, without comparing with the retained
+   * hash values
+   * @param hash: the hash value
+   * @param count: count of the hash value
+   * @param table: the pointer to the hash table
+   * @param lg_size: lg_size of the hash table
+   */
+  void hash_insert(uint64_t hash, int64_t count,
+                   std::pair<uint64_t, int64_t>* table, uint8_t lg_size);
+
+  /**
+   * Robin Hood variants of the searches above: linear probing where an
+   * insertion takes the slot of a resident that is closer to its home slot,
+   * so a search stops at the first resident closer to its home than the
+   * searched value is. An entry whose count reaches 0 is removed and the
+   * following entries of its cluster are shifted back by one slot, so the
+   * table never holds entries with count 0.
+   */
+  bool robin_hood_search_or_insert(uint64_t hash, uint64_t count,
+                                   std::pair<uint64_t, int64_t>* table,
+                                   uint8_t lg_size);
+  bool robin_hood_search_or_remove(uint64_t hash, int64_t count,
+                                   std::pair<uint64_t, int64_t>* table,
+                                   uint8_t lg_size);
+  // @return the slot of hash in keys_, or keys_.size() if it is not there
+  uint32_t robin_hood_find(uint64_t hash) const;
+  /**
+   * place an entry that is not in the table at slot, dist slots from its
+   * home slot, moving the residents it displaces further along
+   * @return the number of slots probed
+   */
+  uint32_t robin_hood_place(std::pair<uint64_t, int64_t> entry,
+                            std::pair<uint64_t, int64_t>* table,
+                            uint32_t mask, uint32_t slot, uint32_t dist);
+  // remove the entry at slot and shift the rest of its cluster back
+  void robin_hood_erase(std::pair<uint64_t, int64_t>* table, uint32_t mask,
+                        uint32_t slot);
+  // @return the distance of slot from the home slot of hash
+  static inline uint32_t get_displacement(uint64_t hash, uint32_t slot,
+                                          uint32_t mask);
 
   friend theta_sketch_dup_alloc<A>;
   static update_theta_sketch_dup_alloc<A> internal_deserialize(
@@ -606,6 +1482,13 @@ class update_theta_sketch_dup_alloc : public theta_sketch_dup_alloc<A> {
   static update_theta_sketch_dup_alloc<A> internal_deserialize(
       const void* bytes, size_t size, resize_factor rf, uint8_t lg_cur_size,
       uint8_t lg_nom_size, uint8_t flags_byte, uint64_t seed);
+  /**
+   * validate the header of a serialized sketch and read the fields the
+   * estimate depends on
+   * @return the number of retained entries with a non-zero count
+   */
+  static uint32_t read_header(const void* bytes, size_t size, uint64_t seed,
+                              uint64_t* theta, bool* is_empty);
 };
 
 // builder
@@ -655,6 +1538,32 @@ class update_theta_sketch_dup_alloc<A>::builder {
    */
   builder& set_seed(uint64_t seed);
 
+  /**
+   * Set the expected number of distinct elements of the sketch, so that the
+   * hash table starts at the size it would reach with that many elements
+   * instead of growing through a chain of resizes. The default is 0, which
+   * starts with the smallest table.
+   * @param n expected number of distinct elements
+   * @return this builder
+   */
+  builder& set_expected_cardinality(uint64_t n);
+
+  /**
+   * Set the collision resolution of the hash table (defaults to
+   * DOUBLE_HASHING). ROBIN_HOOD probes linearly and keeps the probe lengths
+   * even, and a remove that brings a count to 0 takes the entry out of the
+   * table instead of leaving it with count 0, which suits streams that
+   * remove most of what they insert. With DOUBLE_HASHING the entries with
+   * count 0 stay in the table until the next rebuild: they count toward the
+   * load that triggers a resize or a rebuild, and toward the pivot that sets
+   * theta on a rebuild, so once the sketch is in estimation mode the two
+   * policies can give different estimates of the same stream. In exact mode
+   * they give the same results. The choice is kept by serialization.
+   * @param policy collision resolution
+   * @return this builder
+   */
+  builder& set_probing(probing policy);
+
   /**
    * This is to create an instance of the sketch with predefined parameters:
    * lg_cur_size_, lg_nom_size_, rf_, p_, seed_ in class
@@ -668,6 +1577,8 @@ class update_theta_sketch_dup_alloc<A>::builder {
   resize_factor rf_;
   float p_;
   uint64_t seed_;
+  uint64_t expected_cardinality_;
+  probing probing_;
 
   /**
    * getting initial lg(hash_table_size)
@@ -697,15 +1608,97 @@ class theta_sketch_dup_alloc<A>::const_iterator
   friend class update_theta_sketch_dup_alloc<A>;
 };
 
+// fan-out update
+
 /*
- * The following are implementations
+ * theta_sketch_dup_fanout applies elements hashed once to a group of update
+ * sketches sharing the same seed. The seed hash of a sketch is checked once
+ * when it joins the group, and the seed hash of the elements once per call.
+ * Example: updating 2 sketches with elements hashed once.
+ *   auto a = update_theta_sketch_dup::builder().build();
+ *   auto b = update_theta_sketch_dup::builder().set_lg_k(10).build();
+ *   theta_sketch_dup_fanout fanout;
+ *   fanout.add(a);
+ *   fanout.add(b);
+ *   fanout.update(fanout.get_hasher().hash("element"));
+ * The sketches are not owned by the group and must outlive it.
  */
 template <typename A>
-theta_sketch_dup_alloc<A>::theta_sketch_dup_alloc(bool is_empty, uint64_t theta)
-    : is_empty_(is_empty), theta_(theta) {}
+class theta_sketch_dup_fanout_alloc {
+ public:
+  /**
+   * Creates an empty group of sketches
+   * @param seed the seed of the sketches in the group
+   */
+  explicit theta_sketch_dup_fanout_alloc(uint64_t seed = DEFAULT_SEED);
 
-template <typename A>
-bool theta_sketch_dup_alloc<A>::is_empty() const {
+  /**
+   * Add a sketch to the group
+   * @param sketch the sketch to be updated by the group
+   */
+  void add(update_theta_sketch_dup_alloc<A>& sketch);
+
+  /**
+   * @return the number of sketches in the group
+   */
+  size_t size() const;
+
+  /**
+   * @return the hasher computing the keys with the seed of the group
+   */
+  const theta_sketch_dup_hasher& get_hasher() const;
+
+  /**
+   * Update all the sketches in the group with a hashed element
+   * @param key hashed element
+   */
+  void update(const theta_sketch_dup_key& key);
+
+  /**
+   * Update all the sketches in the group with a batch of hashed elements
+   * The batch is applied to one sketch after another to keep the hash table of
+   * the sketch in cache.
+   * @param keys pointer to the hashed elements
+   * @param num_keys number of the hashed elements
+   */
+  void update(const theta_sketch_dup_key* keys, size_t num_keys);
+
+  /**
+   * Remove a hashed element from all the sketches in the group
+   * If a sketch throws, the sketches before it in the group are already
+   * updated.
+   * @param key hashed element
+   */
+  void remove(const theta_sketch_dup_key& key);
+
+  /**
+   * Remove a batch of hashed elements from all the sketches in the group
+   * @param keys pointer to the hashed elements
+   * @param num_keys number of the hashed elements
+   */
+  void remove(const theta_sketch_dup_key* keys, size_t num_keys);
+
+ private:
+  typedef typename std::allocator_traits<A>::template rebind_alloc<
+      update_theta_sketch_dup_alloc<A>*>
+      AllocSketchPtr;
+
+  theta_sketch_dup_hasher hasher_;
+  std::vector<update_theta_sketch_dup_alloc<A>*, AllocSketchPtr> sketches_;
+
+  void check_seed_hash(const theta_sketch_dup_key* keys,
+                       size_t num_keys) const;
+};
+
+/*
+ * The following are implementations
+ */
+template <typename A>
+theta_sketch_dup_alloc<A>::theta_sketch_dup_alloc(bool is_empty, uint64_t theta)
+    : is_empty_(is_empty), theta_(theta) {}
+
+template <typename A>
+bool theta_sketch_dup_alloc<A>::is_empty() const {
   return is_empty_;
 }
 
@@ -717,15 +1710,64 @@ double theta_sketch_dup_alloc<A>::get_estimate() const {
 template <typename A>
 double theta_sketch_dup_alloc<A>::get_lower_bound(uint8_t num_std_devs) const {
   if (!is_estimation_mode()) return get_num_retained();
-  return binomial_bounds::get_lower_bound(get_num_retained(), get_theta(),
-                                          num_std_devs);
+  double lower_bound, upper_bound;
+  get_memoized_bounds(num_std_devs, &lower_bound, &upper_bound);
+  return lower_bound;
 }
 
 template <typename A>
 double theta_sketch_dup_alloc<A>::get_upper_bound(uint8_t num_std_devs) const {
   if (!is_estimation_mode()) return get_num_retained();
-  return binomial_bounds::get_upper_bound(get_num_retained(), get_theta(),
-                                          num_std_devs);
+  double lower_bound, upper_bound;
+  get_memoized_bounds(num_std_devs, &lower_bound, &upper_bound);
+  return upper_bound;
+}
+
+template <typename A>
+void theta_sketch_dup_alloc<A>::get_memoized_bounds(
+    uint8_t num_std_devs, double* lower_bound, double* upper_bound) const {
+  if (num_std_devs < 1 || num_std_devs > 3)
+    throw std::invalid_argument("num_std_devs must be 1, 2 or 3");
+  const uint32_t num_retained = get_num_retained();
+  const uint64_t theta = get_theta64();
+  if (bounds_memo_.get(num_retained, theta, num_std_devs, lower_bound,
+                       upper_bound))
+    return;
+  double lower_bounds[3];
+  double upper_bounds[3];
+  for (uint8_t i = 0; i < 3; i++) {
+    lower_bounds[i] =
+        binomial_bounds::get_lower_bound(num_retained, get_theta(), i + 1);
+    upper_bounds[i] =
+        binomial_bounds::get_upper_bound(num_retained, get_theta(), i + 1);
+  }
+  bounds_memo_.publish(num_retained, theta, lower_bounds, upper_bounds);
+  *lower_bound = lower_bounds[num_std_devs - 1];
+  *upper_bound = upper_bounds[num_std_devs - 1];
+}
+
+template <typename A>
+void theta_sketch_dup_alloc<A>::get_bounds(
+    const uint32_t* num_retained, const uint64_t* thetas, size_t n,
+    uint8_t num_std_devs, double* estimates, double* lower_bounds,
+    double* upper_bounds) {
+  if (num_std_devs < 1 || num_std_devs > 3)
+    throw std::invalid_argument("num_std_devs must be 1, 2 or 3");
+  // branch-free so that the compiler vectorizes it
+  for (size_t i = 0; i < n; i++)
+    estimates[i] = num_retained[i] / (static_cast<double>(thetas[i]) / MAX_THETA);
+  for (size_t i = 0; i < n; i++) {
+    if (thetas[i] < MAX_THETA) {
+      const double theta = static_cast<double>(thetas[i]) / MAX_THETA;
+      lower_bounds[i] =
+          binomial_bounds::get_lower_bound(num_retained[i], theta, num_std_devs);
+      upper_bounds[i] =
+          binomial_bounds::get_upper_bound(num_retained[i], theta, num_std_devs);
+    } else {
+      lower_bounds[i] = num_retained[i];
+      upper_bounds[i] = num_retained[i];
+    }
+  }
 }
 
 template <typename A>
@@ -877,9 +1919,7 @@ bool theta_sketch_dup_alloc<A>::is_equal(
 
 template <typename A>
 uint16_t theta_sketch_dup_alloc<A>::get_seed_hash(uint64_t seed) {
-  HashState hashes;
-  MurmurHash3_x64_128(&seed, sizeof(seed), 0, hashes);
-  return hashes.h1;
+  return theta_sketch_dup_hasher::compute_seed_hash(seed);
 }
 
 template <typename A>
@@ -912,40 +1952,78 @@ void theta_sketch_dup_alloc<A>::check_seed_hash(uint16_t actual,
   }
 }
 
+template <typename A>
+void theta_sketch_dup_alloc<A>::check_seed_hash(const theta_sketch_dup_key* keys,
+                                                size_t num_keys,
+                                                uint16_t expected) {
+  uint16_t mismatch = 0;
+  for (size_t i = 0; i < num_keys; i++) mismatch |= keys[i].seed_hash ^ expected;
+  if (mismatch == 0) return;
+  for (size_t i = 0; i < num_keys; i++)
+    check_seed_hash(keys[i].seed_hash, expected);
+}
+
 // update sketch
 
 template <typename A>
 update_theta_sketch_dup_alloc<A>::update_theta_sketch_dup_alloc(
     uint8_t lg_cur_size, uint8_t lg_nom_size, resize_factor rf, float p,
-    uint64_t seed)
+    uint64_t seed, probing policy)
     : theta_sketch_dup_alloc<A>(true, theta_sketch_dup_alloc<A>::MAX_THETA),
       lg_cur_size_(lg_cur_size),
       lg_nom_size_(lg_nom_size),
       keys_(1 << lg_cur_size_, std::make_pair(0, 0)),
       num_keys_(0),
       num_zeros_(0),
+      fingerprint_(0),
       rf_(rf),
       p_(p),
       seed_(seed),
-      capacity_(get_capacity(lg_cur_size, lg_nom_size)) {
+      seed_hash_(theta_sketch_dup_hasher::compute_seed_hash(seed)),
+      capacity_(get_capacity(lg_cur_size, lg_nom_size)),
+      probing_(policy),
+      listener_(),
+      executor_(nullptr),
+      page_epochs_(),
+      write_epoch_(1),
+      rehash_epoch_(1),
+      snapshot_epoch_(0),
+      checkpoint_(0),
+      snapshot_pages_(),
+      stats_() {
   if (p < 1) this->theta_ *= p;
 }
 
 template <typename A>
 update_theta_sketch_dup_alloc<A>::update_theta_sketch_dup_alloc(
     bool is_empty, uint64_t theta, uint8_t lg_cur_size, uint8_t lg_nom_size,
-    vector_u64<A>&& keys, uint32_t num_keys, uint32_t num_zeros,
-    resize_factor rf, float p, uint64_t seed)
+    vector_u64_dup<A>&& keys, uint32_t num_keys, uint32_t num_zeros,
+    resize_factor rf, float p, uint64_t seed, probing policy)
     : theta_sketch_dup_alloc<A>(is_empty, theta),
       lg_cur_size_(lg_cur_size),
       lg_nom_size_(lg_nom_size),
       keys_(std::move(keys)),
       num_keys_(num_keys),
       num_zeros_(num_zeros),
+      fingerprint_(0),
       rf_(rf),
       p_(p),
       seed_(seed),
-      capacity_(get_capacity(lg_cur_size, lg_nom_size)) {}
+      seed_hash_(theta_sketch_dup_hasher::compute_seed_hash(seed)),
+      capacity_(get_capacity(lg_cur_size, lg_nom_size)),
+      probing_(policy),
+      listener_(),
+      executor_(nullptr),
+      page_epochs_(),
+      write_epoch_(1),
+      rehash_epoch_(1),
+      snapshot_epoch_(0),
+      checkpoint_(0),
+      snapshot_pages_(),
+      stats_() {
+  for (const auto& key : keys_)
+    if (key.first != 0) fingerprint_ += fingerprint_term(key.first, key.second);
+}
 
 template <typename A>
 uint32_t update_theta_sketch_dup_alloc<A>::get_num_retained() const {
@@ -954,7 +2032,7 @@ uint32_t update_theta_sketch_dup_alloc<A>::get_num_retained() const {
 
 template <typename A>
 uint16_t update_theta_sketch_dup_alloc<A>::get_seed_hash() const {
-  return theta_sketch_dup_alloc<A>::get_seed_hash(seed_);
+  return seed_hash_;
 }
 
 template <typename A>
@@ -971,6 +2049,7 @@ string<A> update_theta_sketch_dup_alloc<A>::to_string(bool print_items) const {
   os << "   num retained keys                  : " << num_keys_ << std::endl;
   os << "   num retained keys that has count 0 : " << num_zeros_<< std::endl;
   os << "   resize factor                      : " << (1 << rf_) << std::endl;
+  os << "   probing                            : " << (probing_ == ROBIN_HOOD ? "robin hood" : "double hashing") << std::endl;
   os << "   sampling probability               : " << p_ << std::endl;
   os << "   seed hash                          : " << this->get_seed_hash() << std::endl;
   os << "   empty?                             : " << (this->is_empty() ? "true" : "false") << std::endl;
@@ -991,57 +2070,91 @@ string<A> update_theta_sketch_dup_alloc<A>::to_string(bool print_items) const {
 }
 
 template <typename A>
-void update_theta_sketch_dup_alloc<A>::serialize(std::ostream& os) const {
-  const uint8_t preamble_longs_and_rf = 3 | (rf_ << 6);
-  os.write((char*)&preamble_longs_and_rf, sizeof(preamble_longs_and_rf));
-  const uint8_t serial_version = theta_sketch_dup_alloc<A>::SERIAL_VERSION;
-  os.write((char*)&serial_version, sizeof(serial_version));
-  const uint8_t type = SKETCH_TYPE;
-  os.write((char*)&type, sizeof(type));
-  os.write((char*)&lg_nom_size_, sizeof(lg_nom_size_));
-  os.write((char*)&lg_cur_size_, sizeof(lg_cur_size_));
-  const uint8_t flags_byte(
-      (this->is_empty() ? 1 << theta_sketch_dup_alloc<A>::flags::IS_EMPTY : 0));
-  os.write((char*)&flags_byte, sizeof(flags_byte));
-  const uint16_t seed_hash = get_seed_hash();
-  os.write((char*)&seed_hash, sizeof(seed_hash));
-  os.write((char*)&num_keys_, sizeof(num_keys_));
-  os.write((char*)&num_zeros_, sizeof(num_zeros_));
-  os.write((char*)&p_, sizeof(p_));
-  os.write((char*)&(this->theta_), sizeof(uint64_t));
-  os.write((char*)keys_.data(),
-           sizeof(std::pair<uint64_t, int64_t>) * keys_.size());
+size_t update_theta_sketch_dup_alloc<A>::get_memory_usage_bytes() const {
+  return sizeof(*this) +
+         sizeof(std::pair<uint64_t, int64_t>) * keys_.capacity() +
+         sizeof(uint64_t) * page_epochs_.capacity() +
+         sizeof(weak_page_ptr) * snapshot_pages_.capacity();
+}
+
+template <typename A>
+size_t update_theta_sketch_dup_alloc<A>::get_serialized_size_bytes(
+    serialized_format format, unsigned header_size_bytes) const {
+  const size_t table_bytes = sizeof(std::pair<uint64_t, int64_t>)
+                             << lg_cur_size_;
+  switch (format) {
+    case BYTES:
+      return header_size_bytes + sizeof(uint64_t) * 4 + table_bytes;
+    case STREAM:
+      // preamble, num_keys_, num_zeros_, p_ and theta_
+      return sizeof(uint64_t) + sizeof(num_keys_) + sizeof(num_zeros_) +
+             sizeof(p_) + sizeof(uint64_t) + table_bytes;
+    case PROTO: {
+      // the 10 uint32 fields take a tag and a varint of at most 5 bytes, p a
+      // tag and 8 bytes, theta a tag and a varint of at most 10 bytes
+      const size_t max_fields_bytes = 10 * 6 + 9 + 11;
+      // every slot is a nested message: a tag and a length byte, an empty slot
+      // has no field, an entry has 2 tagged varints of at most 10 bytes
+      const size_t num_slots = size_t(1) << lg_cur_size_;
+      return max_fields_bytes + 2 * num_slots + 22 * num_keys_;
+    }
+  }
+  throw std::invalid_argument("unknown serialized format");
 }
 
 template <typename A>
-vector_u8<A> update_theta_sketch_dup_alloc<A>::serialize(
-    unsigned header_size_bytes) const {
-  const uint8_t preamble_longs = 4;
-  const size_t size = header_size_bytes + sizeof(uint64_t) * preamble_longs +
-                      sizeof(std::pair<uint64_t, int64_t>) * keys_.size();
-  vector_u8<A> bytes(size);
-  uint8_t* ptr = bytes.data() + header_size_bytes;
+size_t update_theta_sketch_dup_alloc<A>::get_max_memory_bytes(uint8_t lg_k) {
+  return sizeof(update_theta_sketch_dup_alloc<A>) +
+         (sizeof(std::pair<uint64_t, int64_t>) << (lg_k + 1));
+}
 
-  const uint8_t preamble_longs_and_rf = preamble_longs | (rf_ << 6);
+template <typename A>
+uint8_t* update_theta_sketch_dup_alloc<A>::write_header(
+    uint8_t* ptr, uint8_t preamble_longs, resize_factor rf, uint8_t type,
+    uint8_t lg_nom_size, uint8_t lg_cur_size, uint8_t flags_byte,
+    uint16_t seed_hash, uint32_t num_keys, uint32_t num_zeros, float p,
+    uint64_t theta) {
+  const uint8_t preamble_longs_and_rf = preamble_longs | (rf << 6);
   ptr +=
       copy_to_mem(&preamble_longs_and_rf, ptr, sizeof(preamble_longs_and_rf));
   const uint8_t serial_version = theta_sketch_dup_alloc<A>::SERIAL_VERSION;
   ptr += copy_to_mem(&serial_version, ptr, sizeof(serial_version));
-  const uint8_t type = SKETCH_TYPE;
   ptr += copy_to_mem(&type, ptr, sizeof(type));
-  ptr += copy_to_mem(&lg_nom_size_, ptr, sizeof(lg_nom_size_));
-  ptr += copy_to_mem(&lg_cur_size_, ptr, sizeof(lg_cur_size_));
-  const uint8_t flags_byte(
-      (this->is_empty() ? 1 << theta_sketch_dup_alloc<A>::flags::IS_EMPTY : 0));
+  ptr += copy_to_mem(&lg_nom_size, ptr, sizeof(lg_nom_size));
+  ptr += copy_to_mem(&lg_cur_size, ptr, sizeof(lg_cur_size));
   ptr += copy_to_mem(&flags_byte, ptr, sizeof(flags_byte));
-  const uint16_t seed_hash = get_seed_hash();
   ptr += copy_to_mem(&seed_hash, ptr, sizeof(seed_hash));
-  ptr += copy_to_mem(&num_keys_, ptr, sizeof(num_keys_));
-  ptr += copy_to_mem(&num_zeros_, ptr, sizeof(num_zeros_));
-  ptr += copy_to_mem(&p_, ptr, sizeof(p_));
-  ptr += copy_to_mem(&(this->theta_), ptr, sizeof(uint64_t));
-  ptr += copy_to_mem(keys_.data(), ptr,
-                     sizeof(std::pair<uint64_t, int64_t>) * keys_.size());
+  ptr += copy_to_mem(&num_keys, ptr, sizeof(num_keys));
+  ptr += copy_to_mem(&num_zeros, ptr, sizeof(num_zeros));
+  ptr += copy_to_mem(&p, ptr, sizeof(p));
+  ptr += copy_to_mem(&theta, ptr, sizeof(theta));
+  return ptr;
+}
+
+template <typename A>
+void update_theta_sketch_dup_alloc<A>::serialize(std::ostream& os) const {
+  uint8_t header[HEADER_BYTES];
+  write_header(header, 3, rf_, SKETCH_TYPE, lg_nom_size_, lg_cur_size_,
+               get_flags_byte(this->is_empty(), probing_), get_seed_hash(),
+               num_keys_, num_zeros_, p_, this->theta_);
+  os.write((char*)header, sizeof(header));
+  os.write((char*)keys_.data(),
+           sizeof(std::pair<uint64_t, int64_t>) * keys_.size());
+}
+
+template <typename A>
+vector_u8_dup<A> update_theta_sketch_dup_alloc<A>::serialize(
+    unsigned header_size_bytes) const {
+  const uint8_t preamble_longs = 4;
+  const size_t size = header_size_bytes + sizeof(uint64_t) * preamble_longs +
+                      sizeof(std::pair<uint64_t, int64_t>) * keys_.size();
+  vector_u8_dup<A> bytes(size);
+  uint8_t* ptr = bytes.data() + header_size_bytes;
+  ptr = write_header(ptr, preamble_longs, rf_, SKETCH_TYPE, lg_nom_size_,
+                     lg_cur_size_, get_flags_byte(this->is_empty(), probing_),
+                     get_seed_hash(), num_keys_, num_zeros_, p_, this->theta_);
+  copy_to_mem(keys_.data(), ptr,
+              sizeof(std::pair<uint64_t, int64_t>) * keys_.size());
 
   return bytes;
 }
@@ -1054,8 +2167,7 @@ void update_theta_sketch_dup_alloc<A>::serialize(
   pb->set_rf(rf_);
   pb->set_lg_nom_size(lg_nom_size_);
   pb->set_lg_cur_size(lg_cur_size_);
-  const uint8_t flags_byte(
-      (this->is_empty() ? 1 << theta_sketch_dup_alloc<A>::flags::IS_EMPTY : 0));
+  const uint8_t flags_byte = get_flags_byte(this->is_empty(), probing_);
   pb->set_flags_byte(flags_byte);
   pb->set_seed_hash(get_seed_hash());
   pb->set_num_keys(num_keys_);
@@ -1111,15 +2223,15 @@ update_theta_sketch_dup_alloc<A>::internal_deserialize(
   is.read((char*)&p, sizeof(p));
   uint64_t theta;
   is.read((char*)&theta, sizeof(theta));
-  vector_u64<A> keys(1 << lg_cur_size);
+  vector_u64_dup<A> keys(1 << lg_cur_size);
   is.read((char*)keys.data(),
           sizeof(std::pair<uint64_t, int64_t>) * keys.size());
   const bool is_empty =
       flags_byte & (1 << theta_sketch_dup_alloc<A>::flags::IS_EMPTY);
   if (!is.good()) throw std::runtime_error("error reading from std::istream");
-  return update_theta_sketch_dup_alloc<A>(is_empty, theta, lg_cur_size,
-                                          lg_nom_size, std::move(keys),
-                                          num_keys, num_zeros, rf, p, seed);
+  return update_theta_sketch_dup_alloc<A>(
+      is_empty, theta, lg_cur_size, lg_nom_size, std::move(keys), num_keys,
+      num_zeros, rf, p, seed, probing_from_flags(flags_byte));
 }
 
 template <typename A>
@@ -1150,14 +2262,14 @@ update_theta_sketch_dup_alloc<A>::internal_deserialize(
   uint32_t num_zeros = pb.num_zeros();
   float p = pb.p();
   uint64_t theta = pb.theta();
-  vector_u64<A> keys(1 << lg_cur_size);
+  vector_u64_dup<A> keys(1 << lg_cur_size);
   for (int i = 0; i < pb.keys_size(); i++)
     keys[i] = std::make_pair(pb.keys(i).hash_val(), pb.keys(i).count());
   const bool is_empty =
       flags_byte & (1 << theta_sketch_dup_alloc<A>::flags::IS_EMPTY);
-  return update_theta_sketch_dup_alloc<A>(is_empty, theta, lg_cur_size,
-                                          lg_nom_size, std::move(keys),
-                                          num_keys, num_zeros, rf, p, seed);
+  return update_theta_sketch_dup_alloc<A>(
+      is_empty, theta, lg_cur_size, lg_nom_size, std::move(keys), num_keys,
+      num_zeros, rf, p, seed, probing_from_flags(flags_byte));
 }
 
 template <typename A>
@@ -1191,6 +2303,254 @@ update_theta_sketch_dup_alloc<A> update_theta_sketch_dup_alloc<A>::deserialize(
                               rf, lg_cur_size, lg_nom_size, flags_byte, seed);
 }
 
+template <typename A>
+uint64_t update_theta_sketch_dup_alloc<A>::take_checkpoint() {
+  start_tracking();
+  checkpoint_ = write_epoch_++;
+  return checkpoint_;
+}
+
+template <typename A>
+uint64_t update_theta_sketch_dup_alloc<A>::get_checkpoint() const {
+  return checkpoint_;
+}
+
+/*
+ * The delta has the header of serialize(header_size_bytes) with DELTA_TYPE,
+ * followed by the checkpoint it was made from (0 for a full delta), its own
+ * checkpoint and the number of pages, then every page as its index and its
+ * slots.
+ */
+template <typename A>
+vector_u8_dup<A> update_theta_sketch_dup_alloc<A>::serialize_delta(
+    uint64_t since) const {
+  // no tracking, a checkpoint older than the last rebuild, or unknown to this
+  // sketch
+  if (page_epochs_.empty() || since < rehash_epoch_ || since >= write_epoch_)
+    since = 0;
+  const uint32_t num_pages = get_num_pages();
+  const uint32_t page_slots = keys_.size() / num_pages;
+  uint32_t num_delta_pages = 0;
+  for (uint32_t i = 0; i < num_pages; i++)
+    if (since == 0 || page_epochs_[i] > since) num_delta_pages++;
+
+  const uint8_t preamble_longs = 6;
+  const size_t page_bytes =
+      sizeof(uint32_t) + sizeof(std::pair<uint64_t, int64_t>) * page_slots;
+  vector_u8_dup<A> bytes(sizeof(uint64_t) * preamble_longs +
+                         page_bytes * num_delta_pages);
+  uint8_t* ptr = write_header(
+      bytes.data(), preamble_longs, rf_, DELTA_TYPE, lg_nom_size_,
+      lg_cur_size_, get_flags_byte(this->is_empty(), probing_),
+      get_seed_hash(), num_keys_, num_zeros_, p_, this->theta_);
+  ptr += copy_to_mem(&since, ptr, sizeof(since));
+  ptr += copy_to_mem(&checkpoint_, ptr, sizeof(checkpoint_));
+  ptr += copy_to_mem(&num_delta_pages, ptr, sizeof(num_delta_pages));
+  for (uint32_t i = 0; i < num_pages; i++) {
+    if (since != 0 && page_epochs_[i] <= since) continue;
+    ptr += copy_to_mem(&i, ptr, sizeof(i));
+    ptr += copy_to_mem(keys_.data() + i * page_slots, ptr,
+                       sizeof(std::pair<uint64_t, int64_t>) * page_slots);
+  }
+  return bytes;
+}
+
+template <typename A>
+uint64_t update_theta_sketch_dup_alloc<A>::apply_delta(const void* bytes,
+                                                       size_t size) {
+  const size_t header_bytes = sizeof(uint64_t) * 6;
+  ensure_minimum_memory(size, header_bytes);
+  const char* ptr = static_cast<const char*>(bytes);
+  const uint8_t preamble_longs_and_rf = ptr[0];
+  const uint8_t serial_version = ptr[1];
+  const uint8_t type = ptr[2];
+  const uint8_t lg_nom_size = ptr[3];
+  const uint8_t lg_cur_size = ptr[4];
+  const uint8_t flags_byte = ptr[5];
+  uint16_t seed_hash;
+  copy_from_mem(ptr + 6, &seed_hash, sizeof(seed_hash));
+  theta_sketch_dup_alloc<A>::check_sketch_type(type, DELTA_TYPE);
+  theta_sketch_dup_alloc<A>::check_serial_version(
+      serial_version, theta_sketch_dup_alloc<A>::SERIAL_VERSION);
+  theta_sketch_dup_alloc<A>::check_seed_hash(seed_hash, get_seed_hash());
+  if (lg_nom_size != lg_nom_size_)
+    throw std::invalid_argument("delta of a sketch with a different lg_k");
+  uint32_t num_keys;
+  copy_from_mem(ptr + 8, &num_keys, sizeof(num_keys));
+  uint32_t num_zeros;
+  copy_from_mem(ptr + 12, &num_zeros, sizeof(num_zeros));
+  float p;
+  copy_from_mem(ptr + 16, &p, sizeof(p));
+  uint64_t theta;
+  copy_from_mem(ptr + 20, &theta, sizeof(theta));
+  uint64_t since;
+  copy_from_mem(ptr + 28, &since, sizeof(since));
+  uint64_t checkpoint;
+  copy_from_mem(ptr + 36, &checkpoint, sizeof(checkpoint));
+  uint32_t num_delta_pages;
+  copy_from_mem(ptr + 44, &num_delta_pages, sizeof(num_delta_pages));
+  if (lg_cur_size >= 32 || num_keys > (uint64_t(1) << lg_cur_size) ||
+      num_zeros > num_keys)
+    throw std::invalid_argument("corrupted delta header");
+  if (since != 0 && lg_cur_size != lg_cur_size_)
+    throw std::invalid_argument(
+        "partial delta of a hash table of a different size");
+  if (since != 0 && probing_from_flags(flags_byte) != probing_)
+    throw std::invalid_argument(
+        "partial delta of a hash table with a different probing");
+  if (since != 0 && since != checkpoint_)
+    throw std::invalid_argument(
+        "partial delta made from another checkpoint than this sketch is at");
+
+  const uint32_t table_size = 1 << lg_cur_size;
+  const uint32_t num_pages =
+      std::max<uint32_t>(1, table_size >> LG_PAGE_SLOTS);
+  const uint32_t page_slots = table_size / num_pages;
+  const size_t page_bytes = sizeof(std::pair<uint64_t, int64_t>) * page_slots;
+  if (since == 0 && num_delta_pages != num_pages)
+    throw std::invalid_argument("full delta without every page");
+  ensure_minimum_memory(size, header_bytes + (sizeof(uint32_t) + page_bytes) *
+                                                 uint64_t(num_delta_pages));
+  ptr += header_bytes;
+
+  if (since == 0) {
+    vector_u64_dup<A> keys(table_size);
+    for (uint32_t i = 0; i < num_delta_pages; i++) {
+      uint32_t page;
+      ptr += copy_from_mem(ptr, &page, sizeof(page));
+      if (page >= num_pages) throw std::invalid_argument("corrupted delta");
+      ptr += copy_from_mem(ptr, keys.data() + page * page_slots, page_bytes);
+    }
+    keys_ = std::move(keys);
+    lg_cur_size_ = lg_cur_size;
+    probing_ = probing_from_flags(flags_byte);
+    fingerprint_ = 0;
+    for (const auto& key : keys_)
+      if (key.first != 0)
+        fingerprint_ += fingerprint_term(key.first, key.second);
+    touch_all_pages();
+  } else {
+    for (uint32_t i = 0; i < num_delta_pages; i++) {
+      uint32_t page;
+      ptr += copy_from_mem(ptr, &page, sizeof(page));
+      if (page >= num_pages) throw std::invalid_argument("corrupted delta");
+      std::pair<uint64_t, int64_t>* begin = keys_.data() + page * page_slots;
+      for (uint32_t j = 0; j < page_slots; j++)
+        if (begin[j].first != 0)
+          fingerprint_ -= fingerprint_term(begin[j].first, begin[j].second);
+      ptr += copy_from_mem(ptr, begin, page_bytes);
+      for (uint32_t j = 0; j < page_slots; j++)
+        if (begin[j].first != 0)
+          fingerprint_ += fingerprint_term(begin[j].first, begin[j].second);
+      if (!page_epochs_.empty()) page_epochs_[page] = write_epoch_;
+    }
+  }
+  rf_ = static_cast<resize_factor>(preamble_longs_and_rf >> 6);
+  p_ = p;
+  this->theta_ = theta;
+  this->is_empty_ =
+      flags_byte & (1 << theta_sketch_dup_alloc<A>::flags::IS_EMPTY);
+  num_keys_ = num_keys;
+  num_zeros_ = num_zeros;
+  capacity_ = get_capacity(lg_cur_size_, lg_nom_size_);
+  checkpoint_ = checkpoint;
+  return checkpoint;
+}
+
+template <typename A>
+uint32_t update_theta_sketch_dup_alloc<A>::read_header(const void* bytes,
+                                                       size_t size,
+                                                       uint64_t seed,
+                                                       uint64_t* theta,
+                                                       bool* is_empty) {
+  // preamble, num_keys, num_zeros, p and theta
+  ensure_minimum_memory(size, 28);
+  const char* ptr = static_cast<const char*>(bytes);
+  const uint8_t serial_version = ptr[1];
+  const uint8_t type = ptr[2];
+  const uint8_t lg_cur_size = ptr[4];
+  const uint8_t flags_byte = ptr[5];
+  uint16_t seed_hash;
+  copy_from_mem(ptr + 6, &seed_hash, sizeof(seed_hash));
+  theta_sketch_dup_alloc<A>::check_sketch_type(type, SKETCH_TYPE);
+  theta_sketch_dup_alloc<A>::check_serial_version(
+      serial_version, theta_sketch_dup_alloc<A>::SERIAL_VERSION);
+  theta_sketch_dup_alloc<A>::check_seed_hash(
+      seed_hash, theta_sketch_dup_alloc<A>::get_seed_hash(seed));
+  uint32_t num_keys;
+  copy_from_mem(ptr + 8, &num_keys, sizeof(num_keys));
+  uint32_t num_zeros;
+  copy_from_mem(ptr + 12, &num_zeros, sizeof(num_zeros));
+  copy_from_mem(ptr + 20, theta, sizeof(*theta));
+  if (lg_cur_size >= 32 || num_keys > (uint64_t(1) << lg_cur_size) ||
+      num_zeros > num_keys)
+    throw std::invalid_argument("corrupted sketch header");
+  *is_empty = flags_byte & (1 << theta_sketch_dup_alloc<A>::flags::IS_EMPTY);
+  return num_keys - num_zeros;
+}
+
+template <typename A>
+double update_theta_sketch_dup_alloc<A>::estimate_from_bytes(const void* bytes,
+                                                             size_t size,
+                                                             uint64_t seed) {
+  uint64_t theta;
+  bool is_empty;
+  const uint32_t num_retained = read_header(bytes, size, seed, &theta, &is_empty);
+  return num_retained /
+         (static_cast<double>(theta) / theta_sketch_dup_alloc<A>::MAX_THETA);
+}
+
+template <typename A>
+double update_theta_sketch_dup_alloc<A>::bounds_from_bytes(
+    const void* bytes, size_t size, uint8_t num_std_devs, double* lower_bound,
+    double* upper_bound, uint64_t seed) {
+  uint64_t theta;
+  bool is_empty;
+  const uint32_t num_retained = read_header(bytes, size, seed, &theta, &is_empty);
+  // an empty sketch with p < 1 is in exact mode
+  if (is_empty) theta = theta_sketch_dup_alloc<A>::MAX_THETA;
+  double estimate;
+  theta_sketch_dup_alloc<A>::get_bounds(&num_retained, &theta, 1, num_std_devs,
+                                        &estimate, lower_bound, upper_bound);
+  return estimate;
+}
+
+template <typename A>
+void update_theta_sketch_dup_alloc<A>::bounds_from_bytes(
+    const void* const* blobs, const size_t* sizes, size_t n,
+    uint8_t num_std_devs, double* estimates, double* lower_bounds,
+    double* upper_bounds, unsigned num_threads, uint64_t seed) {
+  if (num_threads == 0)
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  // small batches are not worth a thread
+  const size_t MIN_BLOBS_PER_THREAD = 1024;
+  num_threads = std::max<size_t>(
+      1, std::min<size_t>(num_threads, n / MIN_BLOBS_PER_THREAD));
+  std::vector<std::exception_ptr> errors(num_threads);
+  auto read_range = [&](unsigned t) {
+    const size_t begin = n * t / num_threads;
+    const size_t end = n * (t + 1) / num_threads;
+    try {
+      for (size_t i = begin; i < end; i++) {
+        double lower_bound;
+        double upper_bound;
+        estimates[i] = bounds_from_bytes(blobs[i], sizes[i], num_std_devs,
+                                         &lower_bound, &upper_bound, seed);
+        if (lower_bounds != nullptr) lower_bounds[i] = lower_bound;
+        if (upper_bounds != nullptr) upper_bounds[i] = upper_bound;
+      }
+    } catch (...) {
+      errors[t] = std::current_exception();
+    }
+  };
+  std::vector<std::thread> threads;
+  for (unsigned t = 1; t < num_threads; t++) threads.emplace_back(read_range, t);
+  read_range(0);
+  for (auto& thread : threads) thread.join();
+  for (const auto& error : errors)
+    if (error) std::rethrow_exception(error);
+}
+
 template <typename A>
 update_theta_sketch_dup_alloc<A>
 update_theta_sketch_dup_alloc<A>::internal_deserialize(
@@ -1207,14 +2567,14 @@ update_theta_sketch_dup_alloc<A>::internal_deserialize(
   ptr += copy_from_mem(ptr, &p, sizeof(p));
   uint64_t theta;
   ptr += copy_from_mem(ptr, &theta, sizeof(theta));
-  vector_u64<A> keys(table_size);
+  vector_u64_dup<A> keys(table_size);
   ptr += copy_from_mem(ptr, keys.data(),
                        sizeof(std::pair<uint64_t, int64_t>) * table_size);
   const bool is_empty =
       flags_byte & (1 << theta_sketch_dup_alloc<A>::flags::IS_EMPTY);
-  return update_theta_sketch_dup_alloc<A>(is_empty, theta, lg_cur_size,
-                                          lg_nom_size, std::move(keys),
-                                          num_keys, num_zeros, rf, p, seed);
+  return update_theta_sketch_dup_alloc<A>(
+      is_empty, theta, lg_cur_size, lg_nom_size, std::move(keys), num_keys,
+      num_zeros, rf, p, seed, probing_from_flags(flags_byte));
 }
 
 
@@ -1222,16 +2582,45 @@ template <typename A>
 bool update_theta_sketch_dup_alloc<A>::is_equal(
     const update_theta_sketch_dup_alloc<A>& r) const {
   if (!theta_sketch_dup_alloc<A>::is_equal(r)) return false;
-  if (this->lg_cur_size_ != r.lg_cur_size_) return false;
   if (this->lg_nom_size_ != r.lg_nom_size_) return false;
-  // TODO: change the comparison mechanism to be comparing the sorted keys
-  for (unsigned int i = 0; i < this->num_keys_; i++)
-    if (this->keys_[i] != r.keys_[i]) return false;
-  if (this->num_keys_ != r.num_keys_) return false;
   if (this->rf_ != r.rf_) return false;
   if (this->p_ != r.p_) return false;
   if (this->seed_ != r.seed_) return false;
-  return true;
+  if (get_num_retained() != r.get_num_retained()) return false;
+  if (fingerprint_ != r.fingerprint_) return false;
+  // equal fingerprints are almost always equal entries, confirm it
+  vector_u64_dup<A> entries;
+  vector_u64_dup<A> other_entries;
+  entries.reserve(get_num_retained());
+  other_entries.reserve(get_num_retained());
+  for_each_live([&entries](const std::pair<uint64_t, int64_t>& key) {
+    entries.push_back(key);
+  });
+  r.for_each_live([&other_entries](const std::pair<uint64_t, int64_t>& key) {
+    other_entries.push_back(key);
+  });
+  std::sort(entries.begin(), entries.end());
+  std::sort(other_entries.begin(), other_entries.end());
+  return entries == other_entries;
+}
+
+template <typename A>
+uint64_t update_theta_sketch_dup_alloc<A>::get_fingerprint() const {
+  return fingerprint_;
+}
+
+template <typename A>
+typename update_theta_sketch_dup_alloc<A>::probing
+update_theta_sketch_dup_alloc<A>::get_probing() const {
+  return probing_;
+}
+
+template <typename A>
+uint64_t update_theta_sketch_dup_alloc<A>::fingerprint_term(uint64_t hash,
+                                                           int64_t count) {
+  if (count == 0) return 0;
+  // the hash values are already uniform, mixing in the count is enough
+  return fmix64(hash ^ fmix64(static_cast<uint64_t>(count)));
 }
 
 template <typename A>
@@ -1242,12 +2631,12 @@ void update_theta_sketch_dup_alloc<A>::update(const std::string& value) {
 
 template <typename A>
 void update_theta_sketch_dup_alloc<A>::update(uint64_t value) {
-  update(&value, sizeof(value));
+  internal_update(theta_sketch_dup_hasher::compute_hash64(value, seed_), 1);
 }
 
 template <typename A>
 void update_theta_sketch_dup_alloc<A>::update(int64_t value) {
-  update(&value, sizeof(value));
+  update(static_cast<uint64_t>(value));
 }
 
 template <typename A>
@@ -1282,21 +2671,7 @@ void update_theta_sketch_dup_alloc<A>::update(int8_t value) {
 
 template <typename A>
 void update_theta_sketch_dup_alloc<A>::update(double value) {
-  union {
-    int64_t long_value;
-    double double_value;
-  } long_double_union;
-
-  if (value == 0.0) {
-    long_double_union.double_value = 0.0;  // canonicalize -0.0 to 0.0
-  } else if (std::isnan(value)) {
-    long_double_union.long_value =
-        0x7ff8000000000000L;  // canonicalize NaN using value from Java's
-                              // Double.doubleToLongBits()
-  } else {
-    long_double_union.double_value = value;
-  }
-  update(&long_double_union, sizeof(long_double_union));
+  update(theta_sketch_dup_hasher::canonical_bits(value));
 }
 
 template <typename A>
@@ -1307,19 +2682,35 @@ void update_theta_sketch_dup_alloc<A>::update(float value) {
 template <typename A>
 void update_theta_sketch_dup_alloc<A>::update(const void* data,
                                               unsigned length) {
-  HashState hashes;
-  MurmurHash3_x64_128(data, length, seed_, hashes);
-  const uint64_t hash =
-      hashes.h1 >>
-      1;  // Java implementation does logical shift >>> to make values positive
-  internal_update(hash, 1);
+  internal_update(theta_sketch_dup_hasher::compute_hash(data, length, seed_),
+                  1);
+}
+
+template <typename A>
+void update_theta_sketch_dup_alloc<A>::update(const theta_sketch_dup_key& key) {
+  theta_sketch_dup_alloc<A>::check_seed_hash(key.seed_hash, seed_hash_);
+  if (key.hash != theta_sketch_dup_key::IGNORED_HASH)
+    internal_update(key.hash, 1);
+}
+
+template <typename A>
+void update_theta_sketch_dup_alloc<A>::update(const theta_sketch_dup_key* keys,
+                                              size_t num_keys) {
+  theta_sketch_dup_alloc<A>::check_seed_hash(keys, num_keys, seed_hash_);
+  for (size_t i = 0; i < num_keys; i++)
+    if (keys[i].hash != theta_sketch_dup_key::IGNORED_HASH)
+      internal_update(keys[i].hash, 1);
 }
 
 template <typename A>
 void update_theta_sketch_dup_alloc<A>::internal_update(uint64_t hash, int64_t count) {
   this->is_empty_ = false;
-  if (hash >= this->theta_ || hash == 0)
+  if (hash >= this->theta_ || hash == 0) {
+#ifdef THETA_SKETCH_DUP_STATS
+    if (hash != 0) stats_.num_theta_rejected++;
+#endif
     return;  // hash == 0 is reserved to mark empty slots in the table
+  }
   if (hash_search_or_insert(hash, count, keys_.data(), lg_cur_size_)) {
     num_keys_++;
     if (num_keys_ > capacity_) {
@@ -1337,45 +2728,533 @@ void update_theta_sketch_dup_alloc<A>::trim() {
   if (num_keys_ > static_cast<uint32_t>(1 << lg_nom_size_)) rebuild();
 }
 
+template <typename A>
+void update_theta_sketch_dup_alloc<A>::reserve(uint32_t n) {
+  const uint8_t lg_new_size = lg_size_from_count(n, lg_nom_size_);
+  if (lg_new_size > lg_cur_size_) rehash(lg_new_size);
+}
+
+template <typename A>
+void update_theta_sketch_dup_alloc<A>::shrink_to_fit() {
+  const uint8_t lg_new_size =
+      lg_size_from_count(num_keys_ - num_zeros_, lg_nom_size_);
+  if (lg_new_size < lg_cur_size_ || num_zeros_ > 0) rehash(lg_new_size);
+}
+
+template <typename A>
+void update_theta_sketch_dup_alloc<A>::reset() {
+  this->is_empty_ = true;
+  this->theta_ = theta_sketch_dup_alloc<A>::MAX_THETA;
+  if (p_ < 1) this->theta_ *= p_;
+  std::fill(keys_.begin(), keys_.end(), std::make_pair(0, 0));
+  num_keys_ = 0;
+  num_zeros_ = 0;
+  fingerprint_ = 0;
+  touch_all_pages();
+}
+
 template <typename A>
 void update_theta_sketch_dup_alloc<A>::resize() {
+  const auto start = maintenance_start();
+  const uint8_t lg_size_before = lg_cur_size_;
+  const uint32_t num_keys_before = num_keys_;
   const uint8_t lg_tgt_size = lg_nom_size_ + 1;
   const uint8_t factor =
       std::max(1, std::min(static_cast<int>(rf_), lg_tgt_size - lg_cur_size_));
-  const uint8_t lg_new_size = lg_cur_size_ + factor;
-  const uint32_t new_size = 1 << lg_new_size;
-  vector_u64<A> new_keys(new_size, std::make_pair(0, 0));
+  rehash(lg_cur_size_ + factor);
+  maintenance_end(update_theta_sketch_dup_event::RESIZE, start, lg_size_before,
+                  this->theta_, num_keys_before);
+}
+
+template <typename A>
+void update_theta_sketch_dup_alloc<A>::rebuild() {
+  const auto start = maintenance_start();
+  const uint64_t theta_before = this->theta_;
+  const uint32_t num_keys_before = num_keys_;
+  if (lg_cur_size_ <= LG_REGION_SLOTS) {
+    const uint32_t pivot = (1 << lg_nom_size_) + keys_.size() - num_keys_;
+    std::nth_element(&keys_[0], &keys_[pivot], &keys_[keys_.size()]);
+    this->theta_ = keys_[pivot].first;
+  } else {
+    // leaves keys_ in place, so the rehash sees the entries in slot order
+    this->theta_ = select_hash(1 << lg_nom_size_);
+  }
+  rehash(lg_cur_size_);
+  maintenance_end(update_theta_sketch_dup_event::REBUILD, start, lg_cur_size_,
+                  theta_before, num_keys_before);
+}
+
+template <typename A>
+std::chrono::steady_clock::time_point
+update_theta_sketch_dup_alloc<A>::maintenance_start() const {
+#if defined(THETA_SKETCH_DUP_STATS) || defined(THETA_SKETCH_DUP_USDT)
+  return std::chrono::steady_clock::now();
+#else
+  if (listener_.ptr == nullptr)
+    return std::chrono::steady_clock::time_point();
+  return std::chrono::steady_clock::now();
+#endif
+}
+
+template <typename A>
+void update_theta_sketch_dup_alloc<A>::maintenance_end(
+    update_theta_sketch_dup_event::event_type type,
+    std::chrono::steady_clock::time_point start, uint8_t lg_size_before,
+    uint64_t theta_before, uint32_t num_keys_before) {
+#if !defined(THETA_SKETCH_DUP_STATS) && !defined(THETA_SKETCH_DUP_USDT)
+  if (listener_.ptr == nullptr) return;
+#endif
+  update_theta_sketch_dup_event event;
+  event.type = type;
+  event.lg_size_before = lg_size_before;
+  event.lg_size_after = lg_cur_size_;
+  event.theta_before = theta_before;
+  event.theta_after = this->theta_;
+  event.num_moved = num_keys_;
+  event.num_dropped = num_keys_before - num_keys_;
+  event.nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start)
+                    .count();
+#ifdef THETA_SKETCH_DUP_STATS
+  if (type == update_theta_sketch_dup_event::RESIZE) {
+    stats_.num_resizes++;
+    stats_.resize_nanos += event.nanos;
+  } else if (type == update_theta_sketch_dup_event::REBUILD) {
+    stats_.num_rebuilds++;
+    stats_.rebuild_nanos += event.nanos;
+  }
+#endif
+#ifdef THETA_SKETCH_DUP_USDT
+  switch (type) {
+    case update_theta_sketch_dup_event::RESIZE:
+      DTRACE_PROBE6(theta_sketch_dup, resize, this, event.lg_size_after,
+                    event.theta_after, event.num_moved, event.num_dropped,
+                    event.nanos);
+      break;
+    case update_theta_sketch_dup_event::REBUILD:
+      DTRACE_PROBE6(theta_sketch_dup, rebuild, this, event.lg_size_after,
+                    event.theta_after, event.num_moved, event.num_dropped,
+                    event.nanos);
+      break;
+    case update_theta_sketch_dup_event::THETA_CHANGE:
+      DTRACE_PROBE6(theta_sketch_dup, theta_change, this, event.lg_size_after,
+                    event.theta_after, event.num_moved, event.num_dropped,
+                    event.nanos);
+      break;
+  }
+#endif
+  if (listener_.ptr != nullptr) listener_.ptr->on_event(event);
+}
+
+template <typename A>
+void update_theta_sketch_dup_alloc<A>::set_listener(
+    update_theta_sketch_dup_listener* listener) {
+  listener_.ptr = listener;
+}
+
+template <typename A>
+update_theta_sketch_dup_listener*
+update_theta_sketch_dup_alloc<A>::get_listener() const {
+  return listener_.ptr;
+}
+
+template <typename A>
+void update_theta_sketch_dup_alloc<A>::set_executor(
+    update_theta_sketch_dup_executor* executor) {
+  executor_ = executor;
+}
+
+template <typename A>
+update_theta_sketch_dup_executor*
+update_theta_sketch_dup_alloc<A>::get_executor() const {
+  return executor_;
+}
+
+template <typename A>
+void update_theta_sketch_dup_alloc<A>::rehash(uint8_t lg_new_size) {
+  vector_u64_dup<A> new_keys(1 << lg_new_size, std::make_pair(0, 0));
   num_keys_ = 0;
   num_zeros_ = 0;
-  for (uint32_t i = 0; i < keys_.size(); i++) {
-    if (keys_[i].first != 0 && keys_[i].second != 0) {
-      hash_search_or_insert(keys_[i].first, keys_[i].second, new_keys.data(),
-                            lg_new_size);  // TODO hash_insert
-      num_keys_++;
+  // the fingerprint is rebuilt by the insertions into the new table
+  fingerprint_ = 0;
+  if (lg_new_size > LG_REGION_SLOTS) {
+    rehash_regions(new_keys, lg_new_size);
+  } else {
+    for (uint32_t i = 0; i < keys_.size(); i++) {
+      if (keys_[i].first != 0 && keys_[i].first < this->theta_ &&
+          keys_[i].second != 0) {
+        hash_insert(keys_[i].first, keys_[i].second, new_keys.data(),
+                    lg_new_size);
+        num_keys_++;
+      }
     }
   }
   keys_ = std::move(new_keys);
-  lg_cur_size_ += factor;
+  lg_cur_size_ = lg_new_size;
   capacity_ = get_capacity(lg_cur_size_, lg_nom_size_);
+  // every slot may have moved, the next snapshot copies the whole table
+  touch_all_pages();
 }
 
+/*
+ * The entries kept by the rehash are bucketed by the region of their home
+ * slot in the new table, in slot order, each task counting then copying the
+ * entries of a range of keys_. Then the tasks insert the entries of the
+ * regions, each region by one task, and keep the ones that would leave it at
+ * the front of its bucket. These are inserted last, region by region, so the
+ * table only depends on keys_ and not on the number of tasks.
+ */
 template <typename A>
-void update_theta_sketch_dup_alloc<A>::rebuild() {
-  const uint32_t pivot = (1 << lg_nom_size_) + keys_.size() - num_keys_;
-  std::nth_element(&keys_[0], &keys_[pivot], &keys_[keys_.size()]);
-  this->theta_ = keys_[pivot].first;
-  vector_u64<A> new_keys(keys_.size(), std::make_pair(0, 0));
-  num_keys_ = 0;
-  num_zeros_ = 0;
-  for (uint32_t i = 0; i < keys_.size(); i++) {
-    if (keys_[i].first != 0 && keys_[i].first < this->theta_ &&
-        keys_[i].second != 0) {
-      hash_search_or_insert(keys_[i].first, keys_[i].second, new_keys.data(),
-                            lg_cur_size_);  // TODO hash_insert
-      num_keys_++;
+void update_theta_sketch_dup_alloc<A>::rehash_regions(
+    vector_u64_dup<A>& new_keys, uint8_t lg_new_size) {
+  typedef std::vector<
+      uint32_t, typename std::allocator_traits<A>::template rebind_alloc<uint32_t>>
+      vector_u32;
+  typedef std::vector<
+      uint64_t, typename std::allocator_traits<A>::template rebind_alloc<uint64_t>>
+      vector_u64;
+  const uint32_t num_regions = 1 << (lg_new_size - LG_REGION_SLOTS);
+  const uint32_t num_tasks = get_num_scan_tasks();
+  const uint32_t mask = (1 << lg_new_size) - 1;
+  const uint64_t theta = this->theta_;
+  auto is_kept = [theta](const std::pair<uint64_t, int64_t>& key) {
+    return key.first != 0 && key.first < theta && key.second != 0;
+  };
+  auto get_region = [mask](uint64_t hash) {
+    return (static_cast<uint32_t>(hash) & mask) >> LG_REGION_SLOTS;
+  };
+  auto get_range = [this, num_tasks](uint32_t task, uint32_t* begin,
+                                     uint32_t* end) {
+    *begin = uint64_t(keys_.size()) * task / num_tasks;
+    *end = uint64_t(keys_.size()) * (task + 1) / num_tasks;
+  };
+
+  // offsets[task * num_regions + region]: where the task copies the next
+  // entry of the region
+  vector_u32 offsets(size_t(num_tasks) * num_regions, 0);
+  run_tasks(num_tasks, [&](uint32_t task) {
+    uint32_t begin, end;
+    get_range(task, &begin, &end);
+    uint32_t* counts = offsets.data() + size_t(task) * num_regions;
+    for (uint32_t i = begin; i < end; i++)
+      if (is_kept(keys_[i])) counts[get_region(keys_[i].first)]++;
+  });
+  vector_u32 region_begins(num_regions + 1, 0);
+  uint32_t total = 0;
+  for (uint32_t region = 0; region < num_regions; region++) {
+    region_begins[region] = total;
+    for (uint32_t task = 0; task < num_tasks; task++) {
+      const uint32_t count = offsets[size_t(task) * num_regions + region];
+      offsets[size_t(task) * num_regions + region] = total;
+      total += count;
     }
   }
-  keys_ = std::move(new_keys);
+  region_begins[num_regions] = total;
+  vector_u64_dup<A> entries(total);
+  run_tasks(num_tasks, [&](uint32_t task) {
+    uint32_t begin, end;
+    get_range(task, &begin, &end);
+    uint32_t* next = offsets.data() + size_t(task) * num_regions;
+    for (uint32_t i = begin; i < end; i++)
+      if (is_kept(keys_[i])) entries[next[get_region(keys_[i].first)]++] = keys_[i];
+  });
+
+  // num_left[region]: number of entries left at the front of the bucket
+  vector_u32 num_left(num_regions, 0);
+  vector_u64 fingerprints(num_regions, 0);
+  const bool is_robin_hood = probing_ == ROBIN_HOOD;
+  std::pair<uint64_t, int64_t>* table = new_keys.data();
+  run_tasks(num_regions, [&](uint32_t region) {
+    uint32_t left = region_begins[region];
+    uint64_t fingerprint = 0;
+    for (uint32_t i = region_begins[region]; i < region_begins[region + 1];
+         i++) {
+      const std::pair<uint64_t, int64_t> entry = entries[i];
+      fingerprint += fingerprint_term(entry.first, entry.second);
+      if (is_robin_hood) {
+        const std::pair<uint64_t, int64_t> out =
+            robin_hood_insert_in_region(entry, table, lg_new_size);
+        if (out.first != 0) entries[left++] = out;
+      } else if (!double_hashing_insert_in_region(entry, table,
+                                                  lg_new_size)) {
+        entries[left++] = entry;
+      }
+    }
+    num_left[region] = left - region_begins[region];
+    fingerprints[region] = fingerprint;
+  });
+
+  for (uint32_t region = 0; region < num_regions; region++) {
+    const uint32_t begin = region_begins[region];
+    for (uint32_t i = begin; i < begin + num_left[region]; i++)
+      hash_insert(entries[i].first, entries[i].second, table, lg_new_size);
+  }
+  // every entry kept is counted by the region of its home slot
+  fingerprint_ = 0;
+  for (uint32_t region = 0; region < num_regions; region++)
+    fingerprint_ += fingerprints[region];
+  num_keys_ = total;
+}
+
+template <typename A>
+bool update_theta_sketch_dup_alloc<A>::double_hashing_insert_in_region(
+    const std::pair<uint64_t, int64_t>& entry,
+    std::pair<uint64_t, int64_t>* table, uint8_t lg_size) {
+  const uint32_t mask = (1 << lg_size) - 1;
+  const uint32_t stride = get_stride(entry.first, lg_size);
+  uint32_t cur_probe = static_cast<uint32_t>(entry.first) & mask;
+  const uint32_t region = cur_probe >> LG_REGION_SLOTS;
+  // the probes only go up within the region, so they leave it
+  while ((cur_probe >> LG_REGION_SLOTS) == region) {
+    if (table[cur_probe].first == 0) {
+      table[cur_probe] = entry;
+      return true;
+    }
+    cur_probe = (cur_probe + stride) & mask;
+  }
+  return false;
+}
+
+template <typename A>
+std::pair<uint64_t, int64_t>
+update_theta_sketch_dup_alloc<A>::robin_hood_insert_in_region(
+    std::pair<uint64_t, int64_t> entry, std::pair<uint64_t, int64_t>* table,
+    uint8_t lg_size) {
+  const uint32_t mask = (1 << lg_size) - 1;
+  const uint32_t region_mask = (1 << LG_REGION_SLOTS) - 1;
+  uint32_t slot = static_cast<uint32_t>(entry.first) & mask;
+  uint32_t dist = 0;
+  for (;;) {
+    if (table[slot].first == 0) {
+      table[slot] = entry;
+      return std::make_pair(0, 0);
+    }
+    const uint32_t resident_dist =
+        get_displacement(table[slot].first, slot, mask);
+    if (resident_dist < dist) {
+      std::swap(entry, table[slot]);
+      dist = resident_dist;
+    }
+    slot = (slot + 1) & mask;
+    dist++;
+    // the entry carried past the region leaves a valid table behind it
+    if ((slot & region_mask) == 0) return entry;
+  }
+}
+
+/*
+ * The hash values of the entries are counted in LG_SELECT_BUCKETS buckets of
+ * equal width below the highest power of 2 of theta, each task counting a
+ * range of keys_. The bucket of the rank is then searched for the hash value
+ * of that rank among the values of the bucket only.
+ */
+template <typename A>
+uint64_t update_theta_sketch_dup_alloc<A>::select_hash(uint32_t rank) const {
+  typedef std::vector<
+      uint32_t, typename std::allocator_traits<A>::template rebind_alloc<uint32_t>>
+      vector_u32;
+  typedef std::vector<
+      uint64_t, typename std::allocator_traits<A>::template rebind_alloc<uint64_t>>
+      vector_u64;
+  const uint32_t num_buckets = 1 << LG_SELECT_BUCKETS;
+  uint8_t lg_theta = 0;
+  while (lg_theta < 64 && (this->theta_ >> lg_theta) != 0) lg_theta++;
+  const uint8_t shift =
+      lg_theta > LG_SELECT_BUCKETS ? lg_theta - LG_SELECT_BUCKETS : 0;
+  auto get_bucket = [shift, num_buckets](uint64_t hash) {
+    return static_cast<uint32_t>(
+        std::min<uint64_t>(hash >> shift, num_buckets - 1));
+  };
+  const uint32_t num_tasks = get_num_scan_tasks();
+  auto get_range = [this, num_tasks](uint32_t task, uint32_t* begin,
+                                     uint32_t* end) {
+    *begin = uint64_t(keys_.size()) * task / num_tasks;
+    *end = uint64_t(keys_.size()) * (task + 1) / num_tasks;
+  };
+
+  vector_u32 histograms(size_t(num_tasks) * num_buckets, 0);
+  run_tasks(num_tasks, [&](uint32_t task) {
+    uint32_t begin, end;
+    get_range(task, &begin, &end);
+    uint32_t* histogram = histograms.data() + size_t(task) * num_buckets;
+    for (uint32_t i = begin; i < end; i++)
+      if (keys_[i].first != 0) histogram[get_bucket(keys_[i].first)]++;
+  });
+  uint32_t bucket = 0;
+  for (;; bucket++) {
+    if (bucket == num_buckets)
+      throw std::logic_error("rank beyond the entries of the table");
+    uint32_t count = 0;
+    for (uint32_t task = 0; task < num_tasks; task++)
+      count += histograms[size_t(task) * num_buckets + bucket];
+    if (rank < count) break;
+    rank -= count;
+  }
+
+  // the values of the bucket are allocated here, the tasks do not throw: each
+  // one copies its values at the offset of its range
+  vector_u32 offsets(num_tasks + 1, 0);
+  for (uint32_t task = 0; task < num_tasks; task++)
+    offsets[task + 1] =
+        offsets[task] + histograms[size_t(task) * num_buckets + bucket];
+  vector_u64 values(offsets[num_tasks]);
+  run_tasks(num_tasks, [&](uint32_t task) {
+    uint32_t begin, end;
+    get_range(task, &begin, &end);
+    uint64_t* out = values.data() + offsets[task];
+    for (uint32_t i = begin; i < end; i++)
+      if (keys_[i].first != 0 && get_bucket(keys_[i].first) == bucket)
+        *out++ = keys_[i].first;
+  });
+  std::nth_element(values.begin(), values.begin() + rank, values.end());
+  return values[rank];
+}
+
+template <typename A>
+uint32_t update_theta_sketch_dup_alloc<A>::get_num_scan_tasks() const {
+  if (executor_ == nullptr) return 1;
+  // a task scans at least a region of keys_
+  return std::max<uint32_t>(
+      1, std::min<uint32_t>(executor_->get_concurrency(),
+                            keys_.size() >> LG_REGION_SLOTS));
+}
+
+template <typename A>
+template <typename F>
+void update_theta_sketch_dup_alloc<A>::run_tasks(uint32_t num_tasks,
+                                                 F f) const {
+  if (executor_ == nullptr || num_tasks == 1) {
+    for (uint32_t task = 0; task < num_tasks; task++) f(task);
+  } else {
+    executor_->run(num_tasks, std::function<void(uint32_t)>(f));
+  }
+}
+
+template <typename A>
+uint32_t update_theta_sketch_dup_alloc<A>::get_num_pages() const {
+  return std::max<uint32_t>(1, keys_.size() >> LG_PAGE_SLOTS);
+}
+
+template <typename A>
+void update_theta_sketch_dup_alloc<A>::mark_dirty(
+    const std::pair<uint64_t, int64_t>* table, uint32_t slot) {
+  if (!page_epochs_.empty() && table == keys_.data())
+    page_epochs_[slot >> LG_PAGE_SLOTS] = write_epoch_;
+}
+
+template <typename A>
+void update_theta_sketch_dup_alloc<A>::touch_all_pages() {
+  if (page_epochs_.empty()) return;
+  page_epochs_.assign(get_num_pages(), write_epoch_);
+  rehash_epoch_ = write_epoch_;
+}
+
+template <typename A>
+void update_theta_sketch_dup_alloc<A>::start_tracking() {
+  if (!page_epochs_.empty()) return;
+  page_epochs_.assign(get_num_pages(), write_epoch_);
+  rehash_epoch_ = write_epoch_;
+}
+
+template <typename A>
+void update_theta_sketch_dup_alloc<A>::internal_merge(
+    const update_theta_sketch_dup_alloc<A>& other) {
+  if (other.is_empty_) return;
+  this->is_empty_ = false;
+  if (other.theta_ < this->theta_) {
+    const auto start = maintenance_start();
+    const uint64_t theta_before = this->theta_;
+    const uint32_t num_keys_before = num_keys_;
+    this->theta_ = other.theta_;
+    rehash(lg_cur_size_);
+    maintenance_end(update_theta_sketch_dup_event::THETA_CHANGE, start,
+                    lg_cur_size_, theta_before, num_keys_before);
+  }
+  other.for_each_live([this](const std::pair<uint64_t, int64_t>& key) {
+    internal_update(key.first, key.second);
+  });
+}
+
+template <typename A>
+template <typename F>
+void update_theta_sketch_dup_alloc<A>::for_each_live(F f) const {
+  for_each_live_in(f, 0, keys_.size());
+}
+
+template <typename A>
+template <typename F>
+void update_theta_sketch_dup_alloc<A>::for_each_live(F f, uint32_t chunk,
+                                                     uint32_t num_chunks) const {
+  if (chunk >= num_chunks)
+    throw std::invalid_argument("chunk must be less than num_chunks");
+  // chunk bounds are multiples of 4 slots, the unit of the SIMD scan
+  const uint64_t num_blocks = (keys_.size() + 3) / 4;
+  const uint32_t begin = std::min<uint64_t>(
+      keys_.size(), 4 * (num_blocks * chunk / num_chunks));
+  const uint32_t end = std::min<uint64_t>(
+      keys_.size(), 4 * (num_blocks * (chunk + 1) / num_chunks));
+  for_each_live_in(f, begin, end);
+}
+
+template <typename A>
+template <typename F>
+void update_theta_sketch_dup_alloc<A>::for_each_live_in(F f, uint32_t begin,
+                                                        uint32_t end) const {
+  const std::pair<uint64_t, int64_t>* table = keys_.data();
+  uint32_t i = begin;
+#ifdef __AVX2__
+  // a register holds 2 slots {hash, count}, a slot is live if both lanes are
+  // positive and the hash lane is less than theta; hash values and theta are
+  // less than 2^63 and counts are not negative, so signed compares work
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i limit = _mm256_set_epi64x(
+      INT64_MAX, static_cast<int64_t>(this->theta_), INT64_MAX,
+      static_cast<int64_t>(this->theta_));
+  const __m256i count_lanes = _mm256_set_epi64x(-1, 0, -1, 0);
+  for (; i + 4 <= end; i += 4) {
+    const __m256i lo = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i*>(table + i));
+    const __m256i hi = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i*>(table + i + 2));
+    const __m256i live_lo = _mm256_and_si256(
+        _mm256_cmpgt_epi64(lo, zero),
+        _mm256_or_si256(_mm256_cmpgt_epi64(limit, lo), count_lanes));
+    const __m256i live_hi = _mm256_and_si256(
+        _mm256_cmpgt_epi64(hi, zero),
+        _mm256_or_si256(_mm256_cmpgt_epi64(limit, hi), count_lanes));
+    const int mask =
+        _mm256_movemask_pd(_mm256_castsi256_pd(live_lo)) |
+        (_mm256_movemask_pd(_mm256_castsi256_pd(live_hi)) << 4);
+    if (mask == 0) continue;
+    for (uint32_t j = 0; j < 4; j++)
+      if (((mask >> (2 * j)) & 3) == 3) f(table[i + j]);
+  }
+#endif
+  for (; i < end; i++) {
+    if (table[i].first != 0 && table[i].first < this->theta_ &&
+        table[i].second != 0)
+      f(table[i]);
+  }
+}
+
+template <typename A>
+int64_t update_theta_sketch_dup_alloc<A>::get_count(uint64_t hash) const {
+  if (hash >= this->theta_ || hash == 0) return 0;
+  if (probing_ == ROBIN_HOOD) {
+    const uint32_t slot = robin_hood_find(hash);
+    return slot < keys_.size() ? keys_[slot].second : 0;
+  }
+  const uint32_t mask = (1 << lg_cur_size_) - 1;
+  const uint32_t stride = get_stride(hash, lg_cur_size_);
+  uint32_t cur_probe = static_cast<uint32_t>(hash) & mask;
+  const uint32_t loop_index = cur_probe;
+  do {
+    const uint64_t value = keys_[cur_probe].first;
+    if (value == 0) return 0;
+    if (value == hash) return keys_[cur_probe].second;
+    cur_probe = (cur_probe + stride) & mask;
+  } while (cur_probe != loop_index);
+  return 0;
 }
 
 template <typename A>
@@ -1386,6 +3265,15 @@ uint32_t update_theta_sketch_dup_alloc<A>::get_capacity(uint8_t lg_cur_size,
   return std::floor(fraction * (1 << lg_cur_size));
 }
 
+template <typename A>
+uint8_t update_theta_sketch_dup_alloc<A>::lg_size_from_count(
+    uint64_t n, uint8_t lg_nom_size) {
+  uint8_t lg_size = builder::MIN_LG_K;
+  while (lg_size <= lg_nom_size && n > get_capacity(lg_size, lg_nom_size))
+    lg_size++;
+  return lg_size;
+}
+
 template <typename A>
 uint32_t update_theta_sketch_dup_alloc<A>::get_stride(uint64_t hash,
                                                       uint8_t lg_size) {
@@ -1397,6 +3285,8 @@ uint32_t update_theta_sketch_dup_alloc<A>::get_stride(uint64_t hash,
 template <typename A>
 bool update_theta_sketch_dup_alloc<A>::hash_search_or_insert(
     uint64_t hash, uint64_t count, std::pair<uint64_t, int64_t>* table, uint8_t lg_size) {
+  if (probing_ == ROBIN_HOOD)
+    return robin_hood_search_or_insert(hash, count, table, lg_size);
   const uint32_t mask = (1 << lg_size) - 1;
   // step size of linear probing
   const uint32_t stride = get_stride(hash, lg_size);
@@ -1404,15 +3294,24 @@ bool update_theta_sketch_dup_alloc<A>::hash_search_or_insert(
 
   // search for duplicate or zero
   const uint32_t loop_index = cur_probe;
+  uint32_t num_probes = 0;
   do {
+    num_probes++;
     const uint64_t value = table[cur_probe].first;
     if (value == 0) {
       table[cur_probe].first = hash;  // insert value
       table[cur_probe].second = count;    // set the initial count to be count
+      fingerprint_ += fingerprint_term(hash, count);
+      mark_dirty(table, cur_probe);
+      record_probes(true, table, num_probes);
       return true;
     } else if (value == hash) {
       if (table[cur_probe].second == 0) num_zeros_--;
+      fingerprint_ -= fingerprint_term(hash, table[cur_probe].second);
       table[cur_probe].second += count;  // add count to the current count 
+      fingerprint_ += fingerprint_term(hash, table[cur_probe].second);
+      mark_dirty(table, cur_probe);
+      record_probes(true, table, num_probes);
       return false;               // found a duplicate
     }
     cur_probe = (cur_probe + stride) & mask;
@@ -1421,23 +3320,234 @@ bool update_theta_sketch_dup_alloc<A>::hash_search_or_insert(
 }
 
 template <typename A>
-bool update_theta_sketch_dup_alloc<A>::hash_search(
-    uint64_t hash, const std::pair<uint64_t, int64_t>* table, uint8_t lg_size) {
+void update_theta_sketch_dup_alloc<A>::hash_insert(
+    uint64_t hash, int64_t count, std::pair<uint64_t, int64_t>* table,
+    uint8_t lg_size) {
   const uint32_t mask = (1 << lg_size) - 1;
-  const uint32_t stride =
-      update_theta_sketch_dup_alloc<A>::get_stride(hash, lg_size);
+  if (probing_ == ROBIN_HOOD) {
+    fingerprint_ += fingerprint_term(hash, count);
+    const uint32_t num_probes =
+        robin_hood_place(std::make_pair(hash, count), table, mask,
+                         static_cast<uint32_t>(hash) & mask, 0);
+    record_probes(true, table, num_probes);
+    return;
+  }
+  const uint32_t stride = get_stride(hash, lg_size);
   uint32_t cur_probe = static_cast<uint32_t>(hash) & mask;
   const uint32_t loop_index = cur_probe;
+  uint32_t num_probes = 0;
   do {
-    const uint64_t value = table[cur_probe].first;
-    if (value == 0) {
-      return false;
-    } else if (value == hash) {
-      return true;
+    num_probes++;
+    if (table[cur_probe].first == 0) {
+      table[cur_probe].first = hash;
+      table[cur_probe].second = count;
+      fingerprint_ += fingerprint_term(hash, count);
+      mark_dirty(table, cur_probe);
+      record_probes(true, table, num_probes);
+      return;
     }
     cur_probe = (cur_probe + stride) & mask;
   } while (cur_probe != loop_index);
-  throw std::logic_error("key not found and search wrapped");
+  throw std::logic_error("no empty slots!");
+}
+
+template <typename A>
+uint32_t update_theta_sketch_dup_alloc<A>::get_displacement(uint64_t hash,
+                                                            uint32_t slot,
+                                                            uint32_t mask) {
+  return (slot - static_cast<uint32_t>(hash)) & mask;
+}
+
+template <typename A>
+bool update_theta_sketch_dup_alloc<A>::robin_hood_search_or_insert(
+    uint64_t hash, uint64_t count, std::pair<uint64_t, int64_t>* table,
+    uint8_t lg_size) {
+  const uint32_t mask = (1 << lg_size) - 1;
+  uint32_t cur_probe = static_cast<uint32_t>(hash) & mask;
+  for (uint32_t dist = 0; dist <= mask; dist++) {
+    const uint64_t value = table[cur_probe].first;
+    // an empty slot or a resident closer to its home: hash is not retained
+    if (value == 0 || get_displacement(value, cur_probe, mask) < dist) {
+      fingerprint_ += fingerprint_term(hash, count);
+      record_probes(true, table, dist + 1);
+      robin_hood_place(std::make_pair(hash, count), table, mask, cur_probe,
+                       dist);
+      return true;
+    } else if (value == hash) {
+      fingerprint_ -= fingerprint_term(hash, table[cur_probe].second);
+      table[cur_probe].second += count;
+      fingerprint_ += fingerprint_term(hash, table[cur_probe].second);
+      mark_dirty(table, cur_probe);
+      record_probes(true, table, dist + 1);
+      return false;
+    }
+    cur_probe = (cur_probe + 1) & mask;
+  }
+  throw std::logic_error("key not found and no empty slots!");
+}
+
+template <typename A>
+uint32_t update_theta_sketch_dup_alloc<A>::robin_hood_place(
+    std::pair<uint64_t, int64_t> entry, std::pair<uint64_t, int64_t>* table,
+    uint32_t mask, uint32_t slot, uint32_t dist) {
+  for (uint32_t num_probes = 1; num_probes <= mask + 1; num_probes++) {
+    if (table[slot].first == 0) {
+      table[slot] = entry;
+      mark_dirty(table, slot);
+      return num_probes;
+    }
+    const uint32_t resident_dist =
+        get_displacement(table[slot].first, slot, mask);
+    if (resident_dist < dist) {
+      std::swap(entry, table[slot]);
+      mark_dirty(table, slot);
+      dist = resident_dist;
+    }
+    slot = (slot + 1) & mask;
+    dist++;
+  }
+  throw std::logic_error("no empty slots!");
+}
+
+template <typename A>
+bool update_theta_sketch_dup_alloc<A>::robin_hood_search_or_remove(
+    uint64_t hash, int64_t count, std::pair<uint64_t, int64_t>* table,
+    uint8_t lg_size) {
+  const uint32_t mask = (1 << lg_size) - 1;
+  uint32_t cur_probe = static_cast<uint32_t>(hash) & mask;
+  for (uint32_t dist = 0; dist <= mask; dist++) {
+    const uint64_t value = table[cur_probe].first;
+    if (value == 0 || get_displacement(value, cur_probe, mask) < dist) break;
+    if (value == hash) {
+      record_probes(false, table, dist + 1);
+      if (table[cur_probe].second < count)
+        throw std::logic_error("this element doesn't exist");
+      fingerprint_ -= fingerprint_term(hash, table[cur_probe].second);
+      table[cur_probe].second -= count;
+      fingerprint_ += fingerprint_term(hash, table[cur_probe].second);
+      mark_dirty(table, cur_probe);
+      if (table[cur_probe].second == 0) {
+        robin_hood_erase(table, mask, cur_probe);
+        num_keys_--;
+        return true;
+      }
+      return false;
+    }
+    cur_probe = (cur_probe + 1) & mask;
+  }
+  throw std::logic_error("this element doesn't exist");
+}
+
+template <typename A>
+void update_theta_sketch_dup_alloc<A>::robin_hood_erase(
+    std::pair<uint64_t, int64_t>* table, uint32_t mask, uint32_t slot) {
+  uint32_t next = (slot + 1) & mask;
+  // the cluster ends at an empty slot or at an entry in its home slot
+  while (table[next].first != 0 &&
+         get_displacement(table[next].first, next, mask) != 0) {
+    table[slot] = table[next];
+    mark_dirty(table, slot);
+    slot = next;
+    next = (next + 1) & mask;
+  }
+  table[slot] = std::make_pair(0, 0);
+  mark_dirty(table, slot);
+}
+
+template <typename A>
+uint32_t update_theta_sketch_dup_alloc<A>::robin_hood_find(
+    uint64_t hash) const {
+  const uint32_t mask = keys_.size() - 1;
+  uint32_t cur_probe = static_cast<uint32_t>(hash) & mask;
+  for (uint32_t dist = 0; dist <= mask; dist++) {
+    const uint64_t value = keys_[cur_probe].first;
+    if (value == hash) return cur_probe;
+    if (value == 0 || get_displacement(value, cur_probe, mask) < dist) break;
+    cur_probe = (cur_probe + 1) & mask;
+  }
+  return keys_.size();
+}
+
+template <typename A>
+uint8_t update_theta_sketch_dup_alloc<A>::get_flags_byte(bool is_empty,
+                                                         probing policy) {
+  return (is_empty ? 1 << theta_sketch_dup_alloc<A>::flags::IS_EMPTY : 0) |
+         (policy == ROBIN_HOOD
+              ? 1 << theta_sketch_dup_alloc<A>::flags::IS_ROBIN_HOOD
+              : 0);
+}
+
+template <typename A>
+typename update_theta_sketch_dup_alloc<A>::probing
+update_theta_sketch_dup_alloc<A>::probing_from_flags(uint8_t flags_byte) {
+  return flags_byte & (1 << theta_sketch_dup_alloc<A>::flags::IS_ROBIN_HOOD)
+             ? ROBIN_HOOD
+             : DOUBLE_HASHING;
+}
+
+template <typename A>
+void update_theta_sketch_dup_alloc<A>::record_probes(
+    bool is_insert, const std::pair<uint64_t, int64_t>* table,
+    uint32_t num_probes) {
+#ifdef THETA_SKETCH_DUP_STATS
+  // searches into a new table during resize/rebuild are not hot path
+  if (table != keys_.data()) return;
+  uint8_t bucket = 0;
+  while (bucket + 1 < update_theta_sketch_dup_stats::NUM_PROBE_BUCKETS &&
+         (num_probes >> (bucket + 1)) != 0)
+    bucket++;
+  (is_insert ? stats_.insert_probes : stats_.remove_probes)[bucket]++;
+#else
+  (void)is_insert;
+  (void)table;
+  (void)num_probes;
+#endif
+}
+
+template <typename A>
+update_theta_sketch_dup_stats update_theta_sketch_dup_alloc<A>::get_stats()
+    const {
+  update_theta_sketch_dup_stats stats = stats_;
+#ifdef THETA_SKETCH_DUP_STATS
+  stats.enabled = true;
+#else
+  stats.enabled = false;
+#endif
+  stats.load_factor = static_cast<double>(num_keys_) / keys_.size();
+  stats.zeros_ratio =
+      num_keys_ == 0 ? 0 : static_cast<double>(num_zeros_) / num_keys_;
+  return stats;
+}
+
+template <typename A>
+void update_theta_sketch_dup_alloc<A>::reset_stats() {
+  stats_ = update_theta_sketch_dup_stats();
+}
+
+template <typename A>
+string<A> update_theta_sketch_dup_alloc<A>::stats_to_string() const {
+  const update_theta_sketch_dup_stats stats = get_stats();
+  std::basic_ostringstream<char, std::char_traits<char>, AllocChar<A>> os;
+  os << "### Update Theta sketch stats:" << std::endl;
+  os << "   enabled?                           : " << (stats.enabled ? "true" : "false") << std::endl;
+  os << "   load factor                        : " << stats.load_factor << std::endl;
+  os << "   ratio of keys that has count 0     : " << stats.zeros_ratio << std::endl;
+  if (stats.enabled) {
+    os << "   num resizes                        : " << stats.num_resizes << std::endl;
+    os << "   resize time (ns)                   : " << stats.resize_nanos << std::endl;
+    os << "   num rebuilds                       : " << stats.num_rebuilds << std::endl;
+    os << "   rebuild time (ns)                  : " << stats.rebuild_nanos << std::endl;
+    os << "   num updates rejected by theta      : " << stats.num_theta_rejected << std::endl;
+    os << "   probe length  insert        remove" << std::endl;
+    for (uint8_t i = 0; i < update_theta_sketch_dup_stats::NUM_PROBE_BUCKETS; i++) {
+      os << "   " << (i + 1 < update_theta_sketch_dup_stats::NUM_PROBE_BUCKETS ? "< " : ">=")
+         << std::setw(10) << std::left
+         << (i + 1 < update_theta_sketch_dup_stats::NUM_PROBE_BUCKETS ? (1 << (i + 1)) : (1 << i))
+         << std::setw(14) << stats.insert_probes[i] << stats.remove_probes[i] << std::endl;
+    }
+  }
+  os << "### End sketch stats" << std::endl;
+  return os.str();
 }
 
 template <typename A>
@@ -1461,7 +3571,9 @@ update_theta_sketch_dup_alloc<A>::builder::builder()
     : lg_k_(DEFAULT_LG_K),
       rf_(DEFAULT_RESIZE_FACTOR),
       p_(1),
-      seed_(DEFAULT_SEED) {}
+      seed_(DEFAULT_SEED),
+      expected_cardinality_(0),
+      probing_(DOUBLE_HASHING) {}
 
 template <typename A>
 typename update_theta_sketch_dup_alloc<A>::builder&
@@ -1496,6 +3608,21 @@ update_theta_sketch_dup_alloc<A>::builder::set_seed(uint64_t seed) {
   return *this;
 }
 
+template <typename A>
+typename update_theta_sketch_dup_alloc<A>::builder&
+update_theta_sketch_dup_alloc<A>::builder::set_expected_cardinality(
+    uint64_t n) {
+  expected_cardinality_ = n;
+  return *this;
+}
+
+template <typename A>
+typename update_theta_sketch_dup_alloc<A>::builder&
+update_theta_sketch_dup_alloc<A>::builder::set_probing(probing policy) {
+  probing_ = policy;
+  return *this;
+}
+
 template <typename A>
 uint8_t update_theta_sketch_dup_alloc<A>::builder::starting_sub_multiple(
     uint8_t lg_tgt, uint8_t lg_min, uint8_t lg_rf) {
@@ -1507,9 +3634,12 @@ uint8_t update_theta_sketch_dup_alloc<A>::builder::starting_sub_multiple(
 template <typename A>
 update_theta_sketch_dup_alloc<A>
 update_theta_sketch_dup_alloc<A>::builder::build() const {
-  return update_theta_sketch_dup_alloc<A>(
+  // only about p of the elements are retained
+  const uint8_t lg_cur_size = std::max(
       starting_sub_multiple(lg_k_ + 1, MIN_LG_K, static_cast<uint8_t>(rf_)),
-      lg_k_, rf_, p_, seed_);
+      lg_size_from_count(std::ceil(expected_cardinality_ * p_), lg_k_));
+  return update_theta_sketch_dup_alloc<A>(lg_cur_size, lg_k_, rf_, p_, seed_,
+                                          probing_);
 }
 
 // iterator
@@ -1564,12 +3694,12 @@ void update_theta_sketch_dup_alloc<A>::remove(const std::string& value) {
 
 template <typename A>
 void update_theta_sketch_dup_alloc<A>::remove(uint64_t value) {
-  remove(&value, sizeof(value));
+  internal_remove(theta_sketch_dup_hasher::compute_hash64(value, seed_));
 }
 
 template <typename A>
 void update_theta_sketch_dup_alloc<A>::remove(int64_t value) {
-  remove(&value, sizeof(value));
+  remove(static_cast<uint64_t>(value));
 }
 
 template <typename A>
@@ -1604,21 +3734,7 @@ void update_theta_sketch_dup_alloc<A>::remove(int8_t value) {
 
 template <typename A>
 void update_theta_sketch_dup_alloc<A>::remove(double value) {
-  union {
-    int64_t long_value;
-    double double_value;
-  } long_double_union;
-
-  if (value == 0.0) {
-    long_double_union.double_value = 0.0;  // canonicalize -0.0 to 0.0
-  } else if (std::isnan(value)) {
-    long_double_union.long_value =
-        0x7ff8000000000000L;  // canonicalize NaN using value from Java's
-                              // Double.doubleToLongBits()
-  } else {
-    long_double_union.double_value = value;
-  }
-  remove(&long_double_union, sizeof(long_double_union));
+  remove(theta_sketch_dup_hasher::canonical_bits(value));
 }
 
 template <typename A>
@@ -1629,44 +3745,89 @@ void update_theta_sketch_dup_alloc<A>::remove(float value) {
 template <typename A>
 void update_theta_sketch_dup_alloc<A>::remove(const void* data,
                                               unsigned length) {
-  HashState hashes;
-  MurmurHash3_x64_128(data, length, seed_, hashes);
-  const uint64_t hash =
-      hashes.h1 >>
-      1;  // Java implementation does logical shift >>> to make values positive
-  internal_remove(hash);
+  internal_remove(theta_sketch_dup_hasher::compute_hash(data, length, seed_));
 }
 
 template <typename A>
-void update_theta_sketch_dup_alloc<A>::internal_remove(uint64_t hash) {
+void update_theta_sketch_dup_alloc<A>::remove(const theta_sketch_dup_key& key) {
+  theta_sketch_dup_alloc<A>::check_seed_hash(key.seed_hash, seed_hash_);
+  if (key.hash != theta_sketch_dup_key::IGNORED_HASH) internal_remove(key.hash);
+}
+
+template <typename A>
+void update_theta_sketch_dup_alloc<A>::remove(const theta_sketch_dup_key* keys,
+                                              size_t num_keys) {
+  theta_sketch_dup_alloc<A>::check_seed_hash(keys, num_keys, seed_hash_);
+  for (size_t i = 0; i < num_keys; i++)
+    if (keys[i].hash != theta_sketch_dup_key::IGNORED_HASH)
+      internal_remove(keys[i].hash);
+}
+
+template <typename A>
+void update_theta_sketch_dup_alloc<A>::internal_remove(uint64_t hash,
+                                                       int64_t count) {
   if (this->is_empty_)
     throw std::logic_error(
         "Can't remove an element from an empty set: no data yet");
   if (hash >= this->theta_ || hash == 0)
     return;  // hash == 0 is reserved to mark empty slots in the table
-  if (hash_search_or_remove(hash, keys_.data(), lg_cur_size_)) {
+  if (hash_search_or_remove(hash, count, keys_.data(), lg_cur_size_)) {
     // if (num_zeros_ / num_keys_ < ZERO_THRESHOLD) 
   }
 }
 
+template <typename A>
+void update_theta_sketch_dup_alloc<A>::internal_apply(
+    const std::pair<uint64_t, int64_t>* ops, size_t num_ops,
+    size_t* num_applied) {
+  const size_t PREFETCH_DISTANCE = 8;
+  for (size_t i = 0; i < num_ops; i++) {
+    if (num_applied != nullptr) *num_applied = i;
+#if defined(__GNUC__)
+    if (i + PREFETCH_DISTANCE < num_ops) {
+      // a resize in between only makes the prefetch useless
+      const uint32_t mask = (1 << lg_cur_size_) - 1;
+      __builtin_prefetch(
+          keys_.data() +
+          (static_cast<uint32_t>(ops[i + PREFETCH_DISTANCE].first) & mask));
+    }
+#endif
+    if (ops[i].second > 0) {
+      internal_update(ops[i].first, ops[i].second);
+    } else {
+      internal_remove(ops[i].first, -ops[i].second);
+    }
+  }
+}
+
 template <typename A>
 bool update_theta_sketch_dup_alloc<A>::hash_search_or_remove(
-    uint64_t hash, std::pair<uint64_t, int64_t>* table, uint8_t lg_size) {
+    uint64_t hash, int64_t count, std::pair<uint64_t, int64_t>* table,
+    uint8_t lg_size) {
+  if (probing_ == ROBIN_HOOD)
+    return robin_hood_search_or_remove(hash, count, table, lg_size);
   const uint32_t mask = (1 << lg_size) - 1;
   const uint32_t stride =
       update_theta_sketch_dup_alloc<A>::get_stride(hash, lg_size);
   uint32_t cur_probe = static_cast<uint32_t>(hash) & mask;
   const uint32_t loop_index = cur_probe;
+  uint32_t num_probes = 0;
   do {
+    num_probes++;
     const uint64_t value = table[cur_probe].first;
     if (value == hash) {
-      table[cur_probe].second--;
-      if (table[cur_probe].second==0) {
+      record_probes(false, table, num_probes);
+      // check before decreasing so that a failed remove leaves the table intact
+      if (table[cur_probe].second < count)
+        throw std::logic_error("this element doesn't exist");
+      fingerprint_ -= fingerprint_term(hash, table[cur_probe].second);
+      table[cur_probe].second -= count;
+      fingerprint_ += fingerprint_term(hash, table[cur_probe].second);
+      mark_dirty(table, cur_probe);
+      if (table[cur_probe].second == 0) {
         num_zeros_++;
         return true;
       }
-      if (table[cur_probe].second<0)
-      throw std::logic_error("this element doesn't exist");
       return false;
     }
     cur_probe = (cur_probe + stride) & mask;
@@ -1674,6 +3835,73 @@ bool update_theta_sketch_dup_alloc<A>::hash_search_or_remove(
   throw std::logic_error("key not found and search wrapped");
 }
 
+// fan-out update
+
+template <typename A>
+theta_sketch_dup_fanout_alloc<A>::theta_sketch_dup_fanout_alloc(uint64_t seed)
+    : hasher_(seed) {}
+
+template <typename A>
+void theta_sketch_dup_fanout_alloc<A>::add(
+    update_theta_sketch_dup_alloc<A>& sketch) {
+  theta_sketch_dup_alloc<A>::check_seed_hash(sketch.get_seed_hash(),
+                                             hasher_.get_seed_hash());
+  sketches_.push_back(&sketch);
+}
+
+template <typename A>
+size_t theta_sketch_dup_fanout_alloc<A>::size() const {
+  return sketches_.size();
+}
+
+template <typename A>
+const theta_sketch_dup_hasher& theta_sketch_dup_fanout_alloc<A>::get_hasher()
+    const {
+  return hasher_;
+}
+
+template <typename A>
+void theta_sketch_dup_fanout_alloc<A>::check_seed_hash(
+    const theta_sketch_dup_key* keys, size_t num_keys) const {
+  // the sketches of the group share the seed of the hasher
+  theta_sketch_dup_alloc<A>::check_seed_hash(keys, num_keys,
+                                             hasher_.get_seed_hash());
+}
+
+template <typename A>
+void theta_sketch_dup_fanout_alloc<A>::update(const theta_sketch_dup_key& key) {
+  check_seed_hash(&key, 1);
+  if (key.hash == theta_sketch_dup_key::IGNORED_HASH) return;
+  for (auto sketch : sketches_) sketch->internal_update(key.hash, 1);
+}
+
+template <typename A>
+void theta_sketch_dup_fanout_alloc<A>::update(const theta_sketch_dup_key* keys,
+                                              size_t num_keys) {
+  check_seed_hash(keys, num_keys);
+  for (auto sketch : sketches_)
+    for (size_t i = 0; i < num_keys; i++)
+      if (keys[i].hash != theta_sketch_dup_key::IGNORED_HASH)
+        sketch->internal_update(keys[i].hash, 1);
+}
+
+template <typename A>
+void theta_sketch_dup_fanout_alloc<A>::remove(const theta_sketch_dup_key& key) {
+  check_seed_hash(&key, 1);
+  if (key.hash == theta_sketch_dup_key::IGNORED_HASH) return;
+  for (auto sketch : sketches_) sketch->internal_remove(key.hash);
+}
+
+template <typename A>
+void theta_sketch_dup_fanout_alloc<A>::remove(const theta_sketch_dup_key* keys,
+                                              size_t num_keys) {
+  check_seed_hash(keys, num_keys);
+  for (auto sketch : sketches_)
+    for (size_t i = 0; i < num_keys; i++)
+      if (keys[i].hash != theta_sketch_dup_key::IGNORED_HASH)
+        sketch->internal_remove(keys[i].hash);
+}
+
 /*
  * aliases with default allocator for convenience (std::allocator<void> is no
  * longer supported in c++20)
@@ -1681,16 +3909,8 @@ bool update_theta_sketch_dup_alloc<A>::hash_search_or_remove(
 typedef theta_sketch_dup_alloc<std::allocator<void>> theta_sketch_dup;
 typedef update_theta_sketch_dup_alloc<std::allocator<void>>
     update_theta_sketch_dup;
-
-// common helping functions
-
-constexpr uint8_t log2(uint32_t n) { return (n > 1) ? 1 + log2(n >> 1) : 0; }
-
-constexpr uint8_t lg_size_from_count(uint32_t n, double load_factor) {
-  return log2(n) +
-         ((n > static_cast<uint32_t>((1 << (log2(n) + 1)) * load_factor)) ? 2
-                                                                          : 1);
-}
+typedef theta_sketch_dup_fanout_alloc<std::allocator<void>>
+    theta_sketch_dup_fanout;
 
 // overload ==
 template <typename A>
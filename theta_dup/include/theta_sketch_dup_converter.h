@@ -0,0 +1,128 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef THETA_SKETCH_DUP_CONVERTER_H_
+#define THETA_SKETCH_DUP_CONVERTER_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+
+#include "theta_sketch.hpp"
+#include "theta_sketch_dup.h"
+
+namespace datasketches {
+
+/*
+ * theta_sketch_dup_converter converts between update_theta_sketch_dup and the
+ * sketches of theta_sketch.hpp, so that both can be used in the same
+ * pipeline, e.g. a dup sketch can be passed to theta_union or
+ * theta_intersection after to_compact().
+ * Both sketches must use the same seed, checked with the seed hash.
+ *   - to_compact() keeps the hash values with a non-zero count and theta, the
+ *     counts are dropped
+ *   - from_theta() gives each retained hash value a count of 1 and keeps
+ *     theta; the hash values of a theta sketch are unique, so they are
+ *     inserted without searching for duplicates
+ * Example:
+ *   update_theta_sketch_dup a = update_theta_sketch_dup::builder().build();
+ *   theta_union u = theta_union::builder().build();
+ *   u.update(theta_sketch_dup_converter::to_compact(a));
+ */
+template <typename A>
+class theta_sketch_dup_converter_alloc {
+ public:
+  typedef typename update_theta_sketch_dup_alloc<A>::builder builder;
+
+  /**
+   * @param sketch the sketch to convert
+   * @param ordered if true the hash values of the result are sorted
+   * @return a compact theta sketch with the live hash values of sketch
+   */
+  static compact_theta_sketch_alloc<A> to_compact(
+      const update_theta_sketch_dup_alloc<A>& sketch, bool ordered = true);
+
+  /**
+   * @param sketch the sketch to convert
+   * @param sketch_builder builder of the result, with the seed of sketch
+   * @return a dup sketch with every retained hash value of sketch with count
+   * 1, and theta no greater than the theta of sketch
+   */
+  static update_theta_sketch_dup_alloc<A> from_theta(
+      const theta_sketch_alloc<A>& sketch,
+      const builder& sketch_builder = builder());
+};
+
+/*
+ * The following are implementations
+ */
+
+template <typename A>
+compact_theta_sketch_alloc<A> theta_sketch_dup_converter_alloc<A>::to_compact(
+    const update_theta_sketch_dup_alloc<A>& sketch, bool ordered) {
+  // the live hash values are copied once from keys_ into the compact sketch
+  vector_u64<A> keys(sketch.get_num_retained());
+  uint32_t i = 0;
+  sketch.for_each_live([&keys, &i](const std::pair<uint64_t, int64_t>& key) {
+    keys[i++] = key.first;
+  });
+  if (ordered) std::sort(keys.begin(), keys.end());
+  // an empty sketch with p < 1 is compacted in exact mode
+  const uint64_t theta = sketch.is_estimation_mode()
+                             ? sketch.theta_
+                             : theta_sketch_alloc<A>::MAX_THETA;
+  return compact_theta_sketch_alloc<A>(sketch.is_empty(), theta,
+                                       std::move(keys), sketch.get_seed_hash(),
+                                       ordered);
+}
+
+template <typename A>
+update_theta_sketch_dup_alloc<A>
+theta_sketch_dup_converter_alloc<A>::from_theta(
+    const theta_sketch_alloc<A>& sketch, const builder& sketch_builder) {
+  update_theta_sketch_dup_alloc<A> result = sketch_builder.build();
+  update_theta_sketch_dup_alloc<A>::check_seed_hash(sketch.get_seed_hash(),
+                                                    result.get_seed_hash());
+  if (sketch.is_empty()) return result;
+  result.is_empty_ = false;
+  result.theta_ = std::min(result.theta_, sketch.get_theta64());
+  result.reserve(sketch.get_num_retained());
+  for (const uint64_t hash : sketch) {
+    if (hash >= result.theta_) continue;
+    result.hash_insert(hash, 1, result.keys_.data(), result.lg_cur_size_);
+    if (++result.num_keys_ > result.capacity_) {
+      if (result.lg_cur_size_ <= result.lg_nom_size_) {
+        result.resize();
+      } else {
+        result.rebuild();
+      }
+    }
+  }
+  return result;
+}
+
+/*
+ * alias with default allocator for convenience
+ */
+typedef theta_sketch_dup_converter_alloc<std::allocator<void>>
+    theta_sketch_dup_converter;
+
+} /* namespace datasketches */
+
+#endif
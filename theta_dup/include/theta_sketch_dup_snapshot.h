@@ -0,0 +1,322 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef THETA_SKETCH_DUP_SNAPSHOT_H_
+#define THETA_SKETCH_DUP_SNAPSHOT_H_
+
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+#include "theta_sketch_dup.h"
+
+namespace datasketches {
+
+/*
+ * theta_sketch_dup_snapshot is an immutable view of an update_theta_sketch_dup
+ * at the time it was taken, for readers that run while a writer keeps
+ * updating the sketch.
+ * The hash table is split into pages. The first snapshot of a sketch copies
+ * every page; from then on the sketch marks the pages it writes, and the next
+ * snapshot copies only those pages and shares the others with the previous
+ * snapshot. A resize or a rebuild moves every entry, so the snapshot after it
+ * copies the whole table again. The sketch only keeps weak references to the
+ * pages: they are freed with the last snapshot that has them, and a sketch
+ * without live snapshots keeps no copy of its table.
+ * Taking a snapshot reads the sketch, so it must be done on the writer thread
+ * (or with the writer excluded). The snapshot can then be handed to any number
+ * of reader threads: its pages are never modified, and the snapshot can be
+ * read, iterated and serialized concurrently with the writer.
+ * Example:
+ *   // writer thread
+ *   theta_sketch_dup_snapshot snapshot(sketch);
+ *   publish(snapshot);
+ *   // reader thread
+ *   snapshot.get_estimate();
+ */
+template <typename A>
+class theta_sketch_dup_snapshot_alloc {
+ public:
+  typedef vector_u8_dup<A> vector_bytes;
+
+  /**
+   * Takes a snapshot of a sketch
+   * @param sketch the sketch, its dirty pages are copied and marked clean
+   */
+  explicit theta_sketch_dup_snapshot_alloc(
+      update_theta_sketch_dup_alloc<A>& sketch);
+
+  bool is_empty() const;
+  bool is_estimation_mode() const;
+  double get_theta() const;
+  uint64_t get_theta64() const;
+  uint32_t get_num_retained() const;
+  uint16_t get_seed_hash() const;
+  double get_estimate() const;
+  double get_lower_bound(uint8_t num_std_devs) const;
+  double get_upper_bound(uint8_t num_std_devs) const;
+
+  /**
+   * Call f on every entry of the snapshot with a non-zero count
+   * @param f function object called as f(const std::pair<uint64_t, int64_t>&)
+   */
+  template <typename F>
+  void for_each_live(F f) const;
+
+  /**
+   * Serializes the snapshot in the format of
+   * update_theta_sketch_dup::serialize(os)
+   */
+  void serialize(std::ostream& os) const;
+
+  /**
+   * Serializes the snapshot in the format of
+   * update_theta_sketch_dup::serialize(header_size_bytes)
+   */
+  vector_bytes serialize(unsigned header_size_bytes = 0) const;
+
+  /**
+   * @return an update sketch with the contents of the snapshot
+   */
+  update_theta_sketch_dup_alloc<A> to_sketch() const;
+
+  /**
+   * @return the number of pages of the snapshot
+   */
+  uint32_t get_num_pages() const;
+
+  /**
+   * @return the number of pages shared by this snapshot and other
+   */
+  uint32_t get_num_shared_pages(
+      const theta_sketch_dup_snapshot_alloc& other) const;
+
+ private:
+  typedef typename update_theta_sketch_dup_alloc<A>::resize_factor
+      resize_factor;
+  typedef typename update_theta_sketch_dup_alloc<A>::probing probing;
+  typedef typename update_theta_sketch_dup_alloc<A>::vector_page_ptr
+      vector_page_ptr;
+  typedef typename update_theta_sketch_dup_alloc<A>::weak_page_ptr
+      weak_page_ptr;
+
+  bool is_empty_;
+  uint64_t theta_;
+  uint8_t lg_cur_size_;
+  uint8_t lg_nom_size_;
+  uint32_t num_keys_;
+  uint32_t num_zeros_;
+  resize_factor rf_;
+  probing probing_;
+  float p_;
+  uint64_t seed_;
+  uint16_t seed_hash_;
+  vector_page_ptr pages_;
+
+  // writes the table of the snapshot page by page to ptr
+  void copy_table(uint8_t* ptr) const;
+};
+
+/*
+ * The following are implementations
+ */
+
+template <typename A>
+theta_sketch_dup_snapshot_alloc<A>::theta_sketch_dup_snapshot_alloc(
+    update_theta_sketch_dup_alloc<A>& sketch)
+    : is_empty_(sketch.is_empty_),
+      theta_(sketch.theta_),
+      lg_cur_size_(sketch.lg_cur_size_),
+      lg_nom_size_(sketch.lg_nom_size_),
+      num_keys_(sketch.num_keys_),
+      num_zeros_(sketch.num_zeros_),
+      rf_(sketch.rf_),
+      probing_(sketch.probing_),
+      p_(sketch.p_),
+      seed_(sketch.seed_),
+      seed_hash_(sketch.seed_hash_),
+      pages_() {
+  const uint32_t num_pages = sketch.get_num_pages();
+  const uint32_t page_slots = sketch.keys_.size() / num_pages;
+  // the first snapshot starts the tracking of the writes
+  sketch.start_tracking();
+  if (sketch.snapshot_pages_.size() != num_pages)
+    sketch.snapshot_pages_.assign(num_pages, weak_page_ptr());
+  typedef typename std::allocator_traits<A>::template rebind_alloc<
+      vector_u64_dup<A>>
+      AllocPage;
+  pages_.resize(num_pages);
+  for (uint32_t i = 0; i < num_pages; i++) {
+    // a clean page is shared if a live snapshot still has it
+    if (sketch.page_epochs_[i] <= sketch.snapshot_epoch_)
+      pages_[i] = sketch.snapshot_pages_[i].lock();
+    if (pages_[i]) continue;
+    const auto begin = sketch.keys_.begin() + i * page_slots;
+    pages_[i] = std::allocate_shared<vector_u64_dup<A>>(AllocPage(), begin,
+                                                        begin + page_slots);
+    sketch.snapshot_pages_[i] = pages_[i];
+  }
+  sketch.snapshot_epoch_ = sketch.write_epoch_++;
+}
+
+template <typename A>
+bool theta_sketch_dup_snapshot_alloc<A>::is_empty() const {
+  return is_empty_;
+}
+
+template <typename A>
+bool theta_sketch_dup_snapshot_alloc<A>::is_estimation_mode() const {
+  return theta_ < theta_sketch_dup_alloc<A>::MAX_THETA && !is_empty_;
+}
+
+template <typename A>
+double theta_sketch_dup_snapshot_alloc<A>::get_theta() const {
+  return static_cast<double>(theta_) / theta_sketch_dup_alloc<A>::MAX_THETA;
+}
+
+template <typename A>
+uint64_t theta_sketch_dup_snapshot_alloc<A>::get_theta64() const {
+  return theta_;
+}
+
+template <typename A>
+uint32_t theta_sketch_dup_snapshot_alloc<A>::get_num_retained() const {
+  return num_keys_ - num_zeros_;
+}
+
+template <typename A>
+uint16_t theta_sketch_dup_snapshot_alloc<A>::get_seed_hash() const {
+  return seed_hash_;
+}
+
+template <typename A>
+double theta_sketch_dup_snapshot_alloc<A>::get_estimate() const {
+  return get_num_retained() / get_theta();
+}
+
+template <typename A>
+double theta_sketch_dup_snapshot_alloc<A>::get_lower_bound(
+    uint8_t num_std_devs) const {
+  const uint32_t num_retained = get_num_retained();
+  const uint64_t theta =
+      is_empty_ ? theta_sketch_dup_alloc<A>::MAX_THETA : theta_;
+  double estimate, lower_bound, upper_bound;
+  theta_sketch_dup_alloc<A>::get_bounds(&num_retained, &theta, 1, num_std_devs,
+                                        &estimate, &lower_bound, &upper_bound);
+  return lower_bound;
+}
+
+template <typename A>
+double theta_sketch_dup_snapshot_alloc<A>::get_upper_bound(
+    uint8_t num_std_devs) const {
+  const uint32_t num_retained = get_num_retained();
+  const uint64_t theta =
+      is_empty_ ? theta_sketch_dup_alloc<A>::MAX_THETA : theta_;
+  double estimate, lower_bound, upper_bound;
+  theta_sketch_dup_alloc<A>::get_bounds(&num_retained, &theta, 1, num_std_devs,
+                                        &estimate, &lower_bound, &upper_bound);
+  return upper_bound;
+}
+
+template <typename A>
+template <typename F>
+void theta_sketch_dup_snapshot_alloc<A>::for_each_live(F f) const {
+  for (const auto& page : pages_)
+    for (const auto& key : *page)
+      if (key.first != 0 && key.first < theta_ && key.second != 0) f(key);
+}
+
+template <typename A>
+void theta_sketch_dup_snapshot_alloc<A>::copy_table(uint8_t* ptr) const {
+  for (const auto& page : pages_) {
+    ptr += copy_to_mem(page->data(), ptr,
+                       sizeof(std::pair<uint64_t, int64_t>) * page->size());
+  }
+}
+
+template <typename A>
+void theta_sketch_dup_snapshot_alloc<A>::serialize(std::ostream& os) const {
+  uint8_t header[update_theta_sketch_dup_alloc<A>::HEADER_BYTES];
+  update_theta_sketch_dup_alloc<A>::write_header(
+      header, 3, rf_, update_theta_sketch_dup_alloc<A>::SKETCH_TYPE,
+      lg_nom_size_, lg_cur_size_,
+      update_theta_sketch_dup_alloc<A>::get_flags_byte(is_empty_, probing_),
+      seed_hash_, num_keys_, num_zeros_, p_, theta_);
+  os.write((char*)header, sizeof(header));
+  for (const auto& page : pages_) {
+    os.write((char*)page->data(),
+             sizeof(std::pair<uint64_t, int64_t>) * page->size());
+  }
+}
+
+template <typename A>
+typename theta_sketch_dup_snapshot_alloc<A>::vector_bytes
+theta_sketch_dup_snapshot_alloc<A>::serialize(
+    unsigned header_size_bytes) const {
+  const uint8_t preamble_longs = 4;
+  const size_t size = header_size_bytes + sizeof(uint64_t) * preamble_longs +
+                      (sizeof(std::pair<uint64_t, int64_t>) << lg_cur_size_);
+  vector_bytes bytes(size);
+  uint8_t* ptr = update_theta_sketch_dup_alloc<A>::write_header(
+      bytes.data() + header_size_bytes, preamble_longs, rf_,
+      update_theta_sketch_dup_alloc<A>::SKETCH_TYPE, lg_nom_size_,
+      lg_cur_size_,
+      update_theta_sketch_dup_alloc<A>::get_flags_byte(is_empty_, probing_),
+      seed_hash_, num_keys_, num_zeros_, p_, theta_);
+  copy_table(ptr);
+  return bytes;
+}
+
+template <typename A>
+update_theta_sketch_dup_alloc<A> theta_sketch_dup_snapshot_alloc<A>::to_sketch()
+    const {
+  vector_u64_dup<A> keys;
+  keys.reserve(size_t(1) << lg_cur_size_);
+  for (const auto& page : pages_)
+    keys.insert(keys.end(), page->begin(), page->end());
+  return update_theta_sketch_dup_alloc<A>(is_empty_, theta_, lg_cur_size_,
+                                          lg_nom_size_, std::move(keys),
+                                          num_keys_, num_zeros_, rf_, p_,
+                                          seed_, probing_);
+}
+
+template <typename A>
+uint32_t theta_sketch_dup_snapshot_alloc<A>::get_num_pages() const {
+  return pages_.size();
+}
+
+template <typename A>
+uint32_t theta_sketch_dup_snapshot_alloc<A>::get_num_shared_pages(
+    const theta_sketch_dup_snapshot_alloc& other) const {
+  uint32_t num_shared = 0;
+  for (size_t i = 0; i < pages_.size() && i < other.pages_.size(); i++)
+    if (pages_[i] == other.pages_[i]) num_shared++;
+  return num_shared;
+}
+
+/*
+ * alias with default allocator for convenience
+ */
+typedef theta_sketch_dup_snapshot_alloc<std::allocator<void>>
+    theta_sketch_dup_snapshot;
+
+} /* namespace datasketches */
+
+#endif
@@ -0,0 +1,141 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef THETA_SKETCH_DUP_THREAD_POOL_H_
+#define THETA_SKETCH_DUP_THREAD_POOL_H_
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "theta_sketch_dup.h"
+
+namespace datasketches {
+
+/*
+ * theta_sketch_dup_thread_pool is an update_theta_sketch_dup_executor with
+ * num_threads - 1 threads of its own: the thread that calls run() takes
+ * tasks as well. Its threads wait for work between runs, so a resize does
+ * not start threads. One run executes at a time, so it can be shared by the
+ * sketches of several threads.
+ *   theta_sketch_dup_thread_pool pool(8);
+ *   sketch.set_executor(&pool);
+ */
+class theta_sketch_dup_thread_pool : public update_theta_sketch_dup_executor {
+ public:
+  /**
+   * @param num_threads number of threads running the tasks, including the
+   * caller of run(), 0 for the hardware concurrency
+   */
+  explicit theta_sketch_dup_thread_pool(uint32_t num_threads = 0)
+      : num_threads_(num_threads != 0
+                         ? num_threads
+                         : std::max(1u, std::thread::hardware_concurrency())),
+        task_(nullptr),
+        num_tasks_(0),
+        next_task_(0),
+        num_busy_(0),
+        generation_(0),
+        stop_(false) {
+    for (uint32_t i = 1; i < num_threads_; i++)
+      threads_.emplace_back(&theta_sketch_dup_thread_pool::work, this);
+  }
+
+  ~theta_sketch_dup_thread_pool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    work_cv_.notify_all();
+    for (auto& thread : threads_) thread.join();
+  }
+
+  theta_sketch_dup_thread_pool(const theta_sketch_dup_thread_pool&) = delete;
+  theta_sketch_dup_thread_pool& operator=(const theta_sketch_dup_thread_pool&) =
+      delete;
+
+  uint32_t get_concurrency() const override { return num_threads_; }
+
+  void run(uint32_t num_tasks,
+           const std::function<void(uint32_t)>& task) override {
+    std::lock_guard<std::mutex> run_lock(run_mutex_);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      task_ = &task;
+      num_tasks_ = num_tasks;
+      next_task_.store(0, std::memory_order_relaxed);
+      num_busy_ = threads_.size();
+      generation_++;
+    }
+    work_cv_.notify_all();
+    take_tasks();
+    // every thread is done with task before it goes out of scope
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cv_.wait(lock, [this] { return num_busy_ == 0; });
+    task_ = nullptr;
+  }
+
+ private:
+  const uint32_t num_threads_;
+  std::vector<std::thread> threads_;
+  std::mutex run_mutex_;
+  std::mutex mutex_;
+  std::condition_variable work_cv_;
+  std::condition_variable done_cv_;
+  // the run in progress, guarded by mutex_ except next_task_
+  const std::function<void(uint32_t)>* task_;
+  uint32_t num_tasks_;
+  std::atomic<uint32_t> next_task_;
+  size_t num_busy_;
+  uint64_t generation_;
+  bool stop_;
+
+  void take_tasks() {
+    for (;;) {
+      const uint32_t t = next_task_.fetch_add(1, std::memory_order_relaxed);
+      if (t >= num_tasks_) return;
+      (*task_)(t);
+    }
+  }
+
+  void work() {
+    uint64_t generation = 0;
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        work_cv_.wait(lock,
+                      [&] { return stop_ || generation_ != generation; });
+        if (stop_) return;
+        generation = generation_;
+      }
+      take_tasks();
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (--num_busy_ == 0) done_cv_.notify_one();
+    }
+  }
+};
+
+} /* namespace datasketches */
+
+#endif
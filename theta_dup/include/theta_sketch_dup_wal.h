@@ -0,0 +1,799 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef THETA_SKETCH_DUP_WAL_H_
+#define THETA_SKETCH_DUP_WAL_H_
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+#include "theta_sketch_dup.h"
+
+namespace datasketches {
+
+/*
+ * theta_sketch_dup_wal keeps named update_theta_sketch_dup sketches durable
+ * with a write-ahead log, so that no acknowledged update or remove is lost.
+ * The directory of the log holds 2 files:
+ *   - snapshot: every sketch serialized by serialize() at a checkpoint
+ *   - wal.log: the operations after the checkpoint, as frames of records
+ * An operation is applied to its sketch, then logged as a record of its
+ * pre-hashed element, so that replaying it does not hash again. A remove
+ * that the sketch rejects throws before anything is logged.
+ * Records are buffered and written as one frame by sync(), which makes them
+ * durable with a single fdatasync: this is a group commit, concurrent
+ * writers waiting for their records share the fsync of the first of them.
+ * An operation is acknowledged once sync() has returned for its sequence
+ * number.
+ * checkpoint() writes the snapshot and truncates the log. On opening, the
+ * snapshot is loaded and the log replayed through the batched internal
+ * update path of the sketches. A frame torn by a crash, which has never
+ * been acknowledged, is detected by its checksum and cut off.
+ * Example:
+ *   theta_sketch_dup_wal wal("/var/lib/sketches");
+ *   wal.sync(wal.update("active_users", user_id));
+ *   wal.sync(wal.remove("active_users", user_id));
+ *   wal.checkpoint();
+ */
+template <typename A>
+class theta_sketch_dup_wal_alloc {
+ public:
+  typedef typename update_theta_sketch_dup_alloc<A>::builder builder;
+  static const size_t DEFAULT_GROUP_COMMIT_BYTES = 1 << 20;
+
+  /**
+   * Opens the log in a directory, creating it if needed, and recovers the
+   * sketches from the snapshot and the log
+   * @param dir directory of the log
+   * @param sketch_builder builder of the new sketches, and seed of the
+   * sketches of the snapshot
+   * @param group_commit_bytes size of the buffered records at which they
+   * are written to the log without waiting for sync()
+   */
+  explicit theta_sketch_dup_wal_alloc(
+      const std::string& dir, const builder& sketch_builder = builder(),
+      size_t group_commit_bytes = DEFAULT_GROUP_COMMIT_BYTES);
+
+  /**
+   * Writes and syncs the buffered records, and closes the log
+   */
+  ~theta_sketch_dup_wal_alloc();
+
+  theta_sketch_dup_wal_alloc(const theta_sketch_dup_wal_alloc&) = delete;
+  theta_sketch_dup_wal_alloc& operator=(const theta_sketch_dup_wal_alloc&) =
+      delete;
+
+  /**
+   * Update a sketch with a given value, creating the sketch if needed
+   * @param name name of the sketch
+   * @param value value of any type accepted by update_theta_sketch_dup
+   * @return the sequence number of the operation, to pass to sync()
+   */
+  template <typename T>
+  uint64_t update(const std::string& name, const T& value);
+
+  /**
+   * Update a sketch with an element hashed by theta_sketch_dup_hasher with
+   * the seed of the log
+   * @param name name of the sketch
+   * @param key hashed element
+   * @return the sequence number of the operation
+   */
+  uint64_t update(const std::string& name, const theta_sketch_dup_key& key);
+
+  /**
+   * Remove one value from a sketch. Throws std::logic_error as
+   * update_theta_sketch_dup does if the value is not there, and logs nothing.
+   * @param name name of the sketch
+   * @param value value of any type accepted by update_theta_sketch_dup
+   * @return the sequence number of the operation
+   */
+  template <typename T>
+  uint64_t remove(const std::string& name, const T& value);
+
+  /**
+   * Remove an element hashed by theta_sketch_dup_hasher from a sketch
+   * @param name name of the sketch
+   * @param key hashed element
+   * @return the sequence number of the operation
+   */
+  uint64_t remove(const std::string& name, const theta_sketch_dup_key& key);
+
+  /**
+   * Make the operations up to a sequence number durable. The records of all
+   * the writers are committed together by whichever writer gets there first.
+   * @param lsn sequence number returned by update() or remove(), all the
+   * operations by default
+   */
+  void sync(uint64_t lsn = UINT64_MAX);
+
+  /**
+   * Write every sketch to the snapshot and truncate the log. The writers
+   * wait for the end of the checkpoint.
+   */
+  void checkpoint();
+
+  /**
+   * @return true if the sketch exists
+   */
+  bool contains(const std::string& name) const;
+
+  /**
+   * @return the number of sketches
+   */
+  size_t size() const;
+
+  /**
+   * @return a copy of a sketch, std::out_of_range if it does not exist
+   */
+  update_theta_sketch_dup_alloc<A> get_result(const std::string& name) const;
+
+  /**
+   * @return estimate of the distinct count of a sketch, 0 if it does not
+   * exist
+   */
+  double get_estimate(const std::string& name) const;
+
+  /**
+   * @return the sequence number of the last operation
+   */
+  uint64_t get_last_lsn() const;
+
+  /**
+   * @return the sequence number of the last durable operation
+   */
+  uint64_t get_durable_lsn() const;
+
+  /**
+   * @return the size of the log file in bytes
+   */
+  size_t get_log_size_bytes() const;
+
+  /**
+   * @return the hasher of the log, with the seed of its sketches
+   */
+  const theta_sketch_dup_hasher& get_hasher() const;
+
+ private:
+  typedef typename std::allocator_traits<A>::template rebind_alloc<
+      update_theta_sketch_dup_alloc<A>>
+      AllocSketch;
+  typedef std::vector<update_theta_sketch_dup_alloc<A>, AllocSketch>
+      vector_sketch;
+
+  static const uint8_t SERIAL_VERSION = 1;
+  /**
+   * A frame is a header of FRAME_HEADER_BYTES:
+   *   payload size (uint32), number of records (uint32), sequence number of
+   *   the first record (uint64), checksum of the payload (uint64)
+   * followed by the payload, a sequence of records:
+   *   DEFINE: op, id (uint32), name size (uint16), name
+   *   UPDATE and REMOVE: op, id (uint32), hash (uint64)
+   * Every record takes a sequence number, sketches get the ids 0, 1, ... in
+   * the order of their DEFINE records.
+   */
+  static const size_t FRAME_HEADER_BYTES = 24;
+  enum op_type { DEFINE, UPDATE, REMOVE };
+
+  std::string dir_;
+  update_theta_sketch_dup_alloc<A> prototype_;
+  theta_sketch_dup_hasher hasher_;
+  size_t group_commit_bytes_;
+  int log_fd_;
+
+  /**
+   * @mutex_ guards everything below, the sketches and the buffered records
+   * @synced_ signaled at the end of each group commit
+   * @buffer_ header space and records of the frame being built
+   * @syncing_ true while a writer commits a group outside of the mutex
+   * @failed_ true after an I/O error, the log no longer matches the sketches
+   */
+  mutable std::mutex mutex_;
+  std::condition_variable synced_;
+  vector_sketch sketches_;
+  std::vector<std::string> names_;
+  std::unordered_map<std::string, uint32_t> ids_;
+  vector_u8_dup<A> buffer_;
+  uint32_t buffer_records_;
+  uint64_t buffer_first_lsn_;
+  uint64_t last_lsn_;
+  uint64_t durable_lsn_;
+  bool syncing_;
+  bool failed_;
+
+  std::string log_path() const;
+  std::string snapshot_path() const;
+  uint64_t log_op(const std::string& name, op_type op, uint64_t hash);
+  uint32_t get_or_define(const std::string& name);
+  void append_record(op_type op, uint32_t id, const void* data, size_t size);
+  // move the buffered records to a frame, empty if there is none
+  void take_frame(vector_u8_dup<A>* frame);
+  void check_not_failed() const;
+  void recover();
+  void load_snapshot(uint64_t* snapshot_lsn);
+  void replay(uint64_t snapshot_lsn);
+  void write_snapshot();
+
+  static uint64_t checksum(const uint8_t* data, size_t size, uint64_t lsn);
+  static void write_all(int fd, const uint8_t* data, size_t size);
+  static size_t read_all(int fd, uint8_t* data, size_t size, off_t offset);
+  static void sync_fd(int fd);
+  static std::system_error io_error(const std::string& what);
+};
+
+/*
+ * The following are implementations
+ */
+
+template <typename A>
+theta_sketch_dup_wal_alloc<A>::theta_sketch_dup_wal_alloc(
+    const std::string& dir, const builder& sketch_builder,
+    size_t group_commit_bytes)
+    : dir_(dir),
+      prototype_(sketch_builder.build()),
+      hasher_(prototype_.seed_),
+      group_commit_bytes_(group_commit_bytes),
+      log_fd_(-1),
+      sketches_(),
+      names_(),
+      ids_(),
+      buffer_(FRAME_HEADER_BYTES),
+      buffer_records_(0),
+      buffer_first_lsn_(0),
+      last_lsn_(0),
+      durable_lsn_(0),
+      syncing_(false),
+      failed_(false) {
+  if (::mkdir(dir_.c_str(), 0755) != 0 && errno != EEXIST)
+    throw io_error("cannot create " + dir_);
+  log_fd_ = ::open(log_path().c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+  if (log_fd_ < 0) throw io_error("cannot open " + log_path());
+  try {
+    recover();
+  } catch (...) {
+    ::close(log_fd_);
+    throw;
+  }
+}
+
+template <typename A>
+theta_sketch_dup_wal_alloc<A>::~theta_sketch_dup_wal_alloc() {
+  try {
+    sync();
+  } catch (...) {
+    // the records that were not acknowledged are lost, as in a crash
+  }
+  ::close(log_fd_);
+}
+
+template <typename A>
+std::string theta_sketch_dup_wal_alloc<A>::log_path() const {
+  return dir_ + "/wal.log";
+}
+
+template <typename A>
+std::string theta_sketch_dup_wal_alloc<A>::snapshot_path() const {
+  return dir_ + "/snapshot";
+}
+
+template <typename A>
+template <typename T>
+uint64_t theta_sketch_dup_wal_alloc<A>::update(const std::string& name,
+                                               const T& value) {
+  return log_op(name, UPDATE, hasher_.hash(value).hash);
+}
+
+template <typename A>
+uint64_t theta_sketch_dup_wal_alloc<A>::update(
+    const std::string& name, const theta_sketch_dup_key& key) {
+  theta_sketch_dup_alloc<A>::check_seed_hash(key.seed_hash,
+                                             hasher_.get_seed_hash());
+  return log_op(name, UPDATE, key.hash);
+}
+
+template <typename A>
+template <typename T>
+uint64_t theta_sketch_dup_wal_alloc<A>::remove(const std::string& name,
+                                               const T& value) {
+  return log_op(name, REMOVE, hasher_.hash(value).hash);
+}
+
+template <typename A>
+uint64_t theta_sketch_dup_wal_alloc<A>::remove(
+    const std::string& name, const theta_sketch_dup_key& key) {
+  theta_sketch_dup_alloc<A>::check_seed_hash(key.seed_hash,
+                                             hasher_.get_seed_hash());
+  return log_op(name, REMOVE, key.hash);
+}
+
+template <typename A>
+uint64_t theta_sketch_dup_wal_alloc<A>::log_op(const std::string& name,
+                                               op_type op, uint64_t hash) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  check_not_failed();
+  // an empty string is ignored, as update_theta_sketch_dup does
+  if (hash == theta_sketch_dup_key::IGNORED_HASH) return last_lsn_;
+  const uint32_t id = get_or_define(name);
+  if (op == UPDATE) {
+    sketches_[id].internal_update(hash, 1);
+  } else {
+    sketches_[id].internal_remove(hash);
+  }
+  append_record(op, id, &hash, sizeof(hash));
+  // bound the buffer, the group commit still has to sync these records
+  if (buffer_.size() >= group_commit_bytes_ && !syncing_) {
+    vector_u8_dup<A> frame;
+    take_frame(&frame);
+    try {
+      write_all(log_fd_, frame.data(), frame.size());
+    } catch (...) {
+      failed_ = true;
+      throw;
+    }
+  }
+  return last_lsn_;
+}
+
+template <typename A>
+uint32_t theta_sketch_dup_wal_alloc<A>::get_or_define(const std::string& name) {
+  const auto it = ids_.find(name);
+  if (it != ids_.end()) return it->second;
+  if (name.size() > UINT16_MAX)
+    throw std::invalid_argument("sketch name is too long");
+  const uint32_t id = sketches_.size();
+  sketches_.push_back(prototype_);
+  names_.push_back(name);
+  ids_.emplace(name, id);
+  const uint16_t name_size = name.size();
+  vector_u8_dup<A> data(sizeof(name_size) + name.size());
+  copy_to_mem(&name_size, data.data(), sizeof(name_size));
+  copy_to_mem(name.data(), data.data() + sizeof(name_size), name.size());
+  append_record(DEFINE, id, data.data(), data.size());
+  return id;
+}
+
+template <typename A>
+void theta_sketch_dup_wal_alloc<A>::append_record(op_type op, uint32_t id,
+                                                  const void* data,
+                                                  size_t size) {
+  if (buffer_records_ == 0) buffer_first_lsn_ = last_lsn_ + 1;
+  const size_t offset = buffer_.size();
+  buffer_.resize(offset + 1 + sizeof(id) + size);
+  uint8_t* ptr = buffer_.data() + offset;
+  *ptr++ = op;
+  ptr += copy_to_mem(&id, ptr, sizeof(id));
+  copy_to_mem(data, ptr, size);
+  buffer_records_++;
+  last_lsn_++;
+}
+
+template <typename A>
+void theta_sketch_dup_wal_alloc<A>::take_frame(vector_u8_dup<A>* frame) {
+  frame->clear();
+  if (buffer_records_ == 0) return;
+  const uint32_t payload_size = buffer_.size() - FRAME_HEADER_BYTES;
+  uint8_t* ptr = buffer_.data();
+  ptr += copy_to_mem(&payload_size, ptr, sizeof(payload_size));
+  ptr += copy_to_mem(&buffer_records_, ptr, sizeof(buffer_records_));
+  ptr += copy_to_mem(&buffer_first_lsn_, ptr, sizeof(buffer_first_lsn_));
+  const uint64_t sum = checksum(buffer_.data() + FRAME_HEADER_BYTES,
+                                payload_size, buffer_first_lsn_);
+  copy_to_mem(&sum, ptr, sizeof(sum));
+  frame->swap(buffer_);
+  buffer_.resize(FRAME_HEADER_BYTES);
+  buffer_records_ = 0;
+}
+
+template <typename A>
+void theta_sketch_dup_wal_alloc<A>::sync(uint64_t lsn) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  check_not_failed();
+  if (lsn > last_lsn_) lsn = last_lsn_;
+  while (durable_lsn_ < lsn) {
+    if (syncing_) {
+      // another writer is committing, its group may include this lsn
+      synced_.wait(lock);
+      check_not_failed();
+      continue;
+    }
+    syncing_ = true;
+    const uint64_t group_lsn = last_lsn_;
+    vector_u8_dup<A> frame;
+    take_frame(&frame);
+    lock.unlock();
+    std::exception_ptr error;
+    try {
+      write_all(log_fd_, frame.data(), frame.size());
+      sync_fd(log_fd_);
+    } catch (...) {
+      error = std::current_exception();
+    }
+    lock.lock();
+    syncing_ = false;
+    if (error) {
+      failed_ = true;
+    } else {
+      durable_lsn_ = group_lsn;
+    }
+    synced_.notify_all();
+    if (error) std::rethrow_exception(error);
+  }
+}
+
+template <typename A>
+void theta_sketch_dup_wal_alloc<A>::checkpoint() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (syncing_) synced_.wait(lock);
+  check_not_failed();
+  try {
+    // the log stays complete until the snapshot has replaced it
+    vector_u8_dup<A> frame;
+    take_frame(&frame);
+    write_all(log_fd_, frame.data(), frame.size());
+    sync_fd(log_fd_);
+    durable_lsn_ = last_lsn_;
+    write_snapshot();
+    if (::ftruncate(log_fd_, 0) != 0) throw io_error("cannot truncate the log");
+    sync_fd(log_fd_);
+  } catch (...) {
+    failed_ = true;
+    throw;
+  }
+}
+
+/*
+ * The snapshot is: serial version (uint8), sequence number of the last
+ * operation it includes (uint64), number of sketches (uint32), then for each
+ * sketch in the order of the ids: name size (uint16), name, size of the
+ * serialized sketch (uint32), serialized sketch.
+ * It is written to a temporary file renamed over the previous snapshot, so a
+ * crash leaves either snapshot complete.
+ */
+template <typename A>
+void theta_sketch_dup_wal_alloc<A>::write_snapshot() {
+  vector_u8_dup<A> bytes(sizeof(uint8_t) + sizeof(uint64_t) +
+                         sizeof(uint32_t));
+  uint8_t* ptr = bytes.data();
+  const uint8_t serial_version = SERIAL_VERSION;
+  ptr += copy_to_mem(&serial_version, ptr, sizeof(serial_version));
+  ptr += copy_to_mem(&last_lsn_, ptr, sizeof(last_lsn_));
+  const uint32_t num_sketches = sketches_.size();
+  copy_to_mem(&num_sketches, ptr, sizeof(num_sketches));
+  for (uint32_t id = 0; id < num_sketches; id++) {
+    const auto sketch_bytes = sketches_[id].serialize();
+    const uint16_t name_size = names_[id].size();
+    const uint32_t sketch_size = sketch_bytes.size();
+    size_t offset = bytes.size();
+    bytes.resize(offset + sizeof(name_size) + name_size + sizeof(sketch_size) +
+                 sketch_size);
+    ptr = bytes.data() + offset;
+    ptr += copy_to_mem(&name_size, ptr, sizeof(name_size));
+    ptr += copy_to_mem(names_[id].data(), ptr, name_size);
+    ptr += copy_to_mem(&sketch_size, ptr, sizeof(sketch_size));
+    copy_to_mem(sketch_bytes.data(), ptr, sketch_size);
+  }
+
+  const std::string tmp_path = snapshot_path() + ".tmp";
+  const int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) throw io_error("cannot open " + tmp_path);
+  try {
+    write_all(fd, bytes.data(), bytes.size());
+    sync_fd(fd);
+  } catch (...) {
+    ::close(fd);
+    throw;
+  }
+  ::close(fd);
+  if (::rename(tmp_path.c_str(), snapshot_path().c_str()) != 0)
+    throw io_error("cannot rename " + tmp_path);
+  // make the rename durable before the log is truncated
+  const int dir_fd = ::open(dir_.c_str(), O_RDONLY | O_DIRECTORY);
+  if (dir_fd < 0) throw io_error("cannot open " + dir_);
+  const int result = ::fsync(dir_fd);
+  ::close(dir_fd);
+  if (result != 0) throw io_error("cannot sync " + dir_);
+}
+
+template <typename A>
+void theta_sketch_dup_wal_alloc<A>::recover() {
+  uint64_t snapshot_lsn = 0;
+  load_snapshot(&snapshot_lsn);
+  last_lsn_ = snapshot_lsn;
+  replay(snapshot_lsn);
+  durable_lsn_ = last_lsn_;
+}
+
+template <typename A>
+void theta_sketch_dup_wal_alloc<A>::load_snapshot(uint64_t* snapshot_lsn) {
+  const int fd = ::open(snapshot_path().c_str(), O_RDONLY);
+  if (fd < 0) {
+    if (errno == ENOENT) return;
+    throw io_error("cannot open " + snapshot_path());
+  }
+  struct stat st;
+  if (::fstat(fd, &st) != 0) {
+    ::close(fd);
+    throw io_error("cannot stat " + snapshot_path());
+  }
+  vector_u8_dup<A> bytes(st.st_size);
+  const size_t size = read_all(fd, bytes.data(), bytes.size(), 0);
+  ::close(fd);
+
+  const char* ptr = reinterpret_cast<const char*>(bytes.data());
+  const char* end = ptr + size;
+  auto read = [&ptr, end](void* dst, size_t n) {
+    if (static_cast<size_t>(end - ptr) < n)
+      throw std::invalid_argument("corrupted snapshot");
+    ptr += copy_from_mem(ptr, dst, n);
+  };
+  uint8_t serial_version;
+  read(&serial_version, sizeof(serial_version));
+  theta_sketch_dup_alloc<A>::check_serial_version(serial_version,
+                                                  SERIAL_VERSION);
+  read(snapshot_lsn, sizeof(*snapshot_lsn));
+  uint32_t num_sketches;
+  read(&num_sketches, sizeof(num_sketches));
+  for (uint32_t id = 0; id < num_sketches; id++) {
+    uint16_t name_size;
+    read(&name_size, sizeof(name_size));
+    std::string name(name_size, '\0');
+    read(&name[0], name_size);
+    uint32_t sketch_size;
+    read(&sketch_size, sizeof(sketch_size));
+    if (static_cast<size_t>(end - ptr) < sketch_size)
+      throw std::invalid_argument("corrupted snapshot");
+    sketches_.push_back(update_theta_sketch_dup_alloc<A>::deserialize(
+        ptr, sketch_size, prototype_.seed_));
+    ptr += sketch_size;
+    names_.push_back(name);
+    ids_.emplace(name, id);
+  }
+}
+
+/*
+ * Replay the frames of the log in order, skipping the records already in the
+ * snapshot (the log was not truncated yet when the checkpoint was
+ * interrupted). Consecutive operations on a sketch are applied as one batch.
+ */
+template <typename A>
+void theta_sketch_dup_wal_alloc<A>::replay(uint64_t snapshot_lsn) {
+  vector_u8_dup<A> frame;
+  std::vector<std::pair<uint64_t, int64_t>> ops;
+  uint32_t ops_id = 0;
+  auto apply_ops = [this, &ops, &ops_id]() {
+    if (!ops.empty()) sketches_[ops_id].internal_apply(ops.data(), ops.size());
+    ops.clear();
+  };
+  off_t offset = 0;
+  uint64_t next_lsn = 0;
+  while (true) {
+    uint8_t header[FRAME_HEADER_BYTES];
+    if (read_all(log_fd_, header, sizeof(header), offset) < sizeof(header))
+      break;
+    uint32_t payload_size;
+    uint32_t num_records;
+    uint64_t first_lsn;
+    uint64_t sum;
+    const uint8_t* ptr = header;
+    ptr += copy_from_mem(ptr, &payload_size, sizeof(payload_size));
+    ptr += copy_from_mem(ptr, &num_records, sizeof(num_records));
+    ptr += copy_from_mem(ptr, &first_lsn, sizeof(first_lsn));
+    copy_from_mem(ptr, &sum, sizeof(sum));
+    frame.resize(payload_size);
+    if (read_all(log_fd_, frame.data(), payload_size,
+                 offset + FRAME_HEADER_BYTES) < payload_size ||
+        checksum(frame.data(), payload_size, first_lsn) != sum)
+      break;
+    // the first frame may start before the end of the snapshot, the next
+    // ones follow each other
+    if (offset == 0 ? first_lsn > snapshot_lsn + 1 : first_lsn != next_lsn)
+      throw std::invalid_argument("missing operations in the log");
+    next_lsn = first_lsn + num_records;
+
+    ptr = frame.data();
+    const uint8_t* end = ptr + payload_size;
+    for (uint64_t lsn = first_lsn; lsn < first_lsn + num_records; lsn++) {
+      const size_t record_size = 1 + sizeof(uint32_t) + sizeof(uint64_t);
+      if (static_cast<size_t>(end - ptr) < 1 + sizeof(uint32_t))
+        throw std::invalid_argument("corrupted log");
+      const uint8_t op = *ptr;
+      uint32_t id;
+      copy_from_mem(ptr + 1, &id, sizeof(id));
+      if (op == DEFINE) {
+        uint16_t name_size;
+        if (static_cast<size_t>(end - ptr) <
+            1 + sizeof(id) + sizeof(name_size))
+          throw std::invalid_argument("corrupted log");
+        copy_from_mem(ptr + 1 + sizeof(id), &name_size, sizeof(name_size));
+        const uint8_t* name = ptr + 1 + sizeof(id) + sizeof(name_size);
+        if (end - name < name_size)
+          throw std::invalid_argument("corrupted log");
+        ptr = name + name_size;
+        if (lsn <= snapshot_lsn) continue;
+        if (id != sketches_.size())
+          throw std::invalid_argument("corrupted log");
+        sketches_.push_back(prototype_);
+        names_.emplace_back(reinterpret_cast<const char*>(name), name_size);
+        ids_.emplace(names_.back(), id);
+        continue;
+      }
+      if (static_cast<size_t>(end - ptr) < record_size ||
+          (op != UPDATE && op != REMOVE))
+        throw std::invalid_argument("corrupted log");
+      uint64_t hash;
+      copy_from_mem(ptr + 1 + sizeof(id), &hash, sizeof(hash));
+      ptr += record_size;
+      if (lsn <= snapshot_lsn) continue;
+      if (id >= sketches_.size()) throw std::invalid_argument("corrupted log");
+      if (id != ops_id) apply_ops();
+      ops_id = id;
+      ops.emplace_back(hash, op == UPDATE ? 1 : -1);
+    }
+    apply_ops();
+    last_lsn_ = std::max(last_lsn_, first_lsn + num_records - 1);
+    offset += FRAME_HEADER_BYTES + payload_size;
+  }
+  // cut off the frame torn by a crash, the next frames are appended after
+  // the last complete one
+  if (::ftruncate(log_fd_, offset) != 0)
+    throw io_error("cannot truncate the log");
+}
+
+template <typename A>
+bool theta_sketch_dup_wal_alloc<A>::contains(const std::string& name) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return ids_.count(name) > 0;
+}
+
+template <typename A>
+size_t theta_sketch_dup_wal_alloc<A>::size() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return sketches_.size();
+}
+
+template <typename A>
+update_theta_sketch_dup_alloc<A> theta_sketch_dup_wal_alloc<A>::get_result(
+    const std::string& name) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  const auto it = ids_.find(name);
+  if (it == ids_.end()) throw std::out_of_range("no sketch named " + name);
+  return sketches_[it->second];
+}
+
+template <typename A>
+double theta_sketch_dup_wal_alloc<A>::get_estimate(
+    const std::string& name) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  const auto it = ids_.find(name);
+  if (it == ids_.end()) return 0;
+  return sketches_[it->second].get_estimate();
+}
+
+template <typename A>
+uint64_t theta_sketch_dup_wal_alloc<A>::get_last_lsn() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return last_lsn_;
+}
+
+template <typename A>
+uint64_t theta_sketch_dup_wal_alloc<A>::get_durable_lsn() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return durable_lsn_;
+}
+
+template <typename A>
+size_t theta_sketch_dup_wal_alloc<A>::get_log_size_bytes() const {
+  struct stat st;
+  if (::fstat(log_fd_, &st) != 0) throw io_error("cannot stat the log");
+  return st.st_size;
+}
+
+template <typename A>
+const theta_sketch_dup_hasher& theta_sketch_dup_wal_alloc<A>::get_hasher()
+    const {
+  return hasher_;
+}
+
+template <typename A>
+void theta_sketch_dup_wal_alloc<A>::check_not_failed() const {
+  if (failed_)
+    throw std::logic_error("the log failed, reopen it to recover the sketches");
+}
+
+/*
+ * MurmurHash3_x64_128 of common/ reads past the end of inputs of 32 bytes or
+ * more (its block pointer is advanced twice), so frames are checked with a
+ * chain of fmix64 over their 8-byte words instead
+ */
+template <typename A>
+uint64_t theta_sketch_dup_wal_alloc<A>::checksum(const uint8_t* data,
+                                                 size_t size, uint64_t lsn) {
+  uint64_t sum = fmix64(lsn ^ size);
+  size_t i = 0;
+  for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+    uint64_t word;
+    copy_from_mem(data + i, &word, sizeof(word));
+    sum = fmix64(sum ^ word);
+  }
+  uint64_t tail = 0;
+  copy_from_mem(data + i, &tail, size - i);
+  return fmix64(sum ^ tail);
+}
+
+template <typename A>
+void theta_sketch_dup_wal_alloc<A>::write_all(int fd, const uint8_t* data,
+                                              size_t size) {
+  while (size > 0) {
+    const ssize_t n = ::write(fd, data, size);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      throw io_error("cannot write the log");
+    }
+    data += n;
+    size -= n;
+  }
+}
+
+template <typename A>
+size_t theta_sketch_dup_wal_alloc<A>::read_all(int fd, uint8_t* data,
+                                               size_t size, off_t offset) {
+  size_t total = 0;
+  while (total < size) {
+    const ssize_t n = ::pread(fd, data + total, size - total, offset + total);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      throw io_error("cannot read the log");
+    }
+    if (n == 0) break;
+    total += n;
+  }
+  return total;
+}
+
+template <typename A>
+void theta_sketch_dup_wal_alloc<A>::sync_fd(int fd) {
+  if (::fdatasync(fd) != 0) throw io_error("cannot sync the log");
+}
+
+template <typename A>
+std::system_error theta_sketch_dup_wal_alloc<A>::io_error(
+    const std::string& what) {
+  return std::system_error(errno, std::generic_category(), what);
+}
+
+/*
+ * alias with default allocator for convenience
+ */
+typedef theta_sketch_dup_wal_alloc<std::allocator<void>> theta_sketch_dup_wal;
+
+} /* namespace datasketches */
+
+#endif
@@ -0,0 +1,337 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef WINDOWED_THETA_SKETCH_DUP_H_
+#define WINDOWED_THETA_SKETCH_DUP_H_
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "theta_sketch_dup.h"
+
+namespace datasketches {
+
+/*
+ * windowed_theta_sketch_dup estimates the distinct count of the elements of
+ * the last num_buckets time buckets, e.g. the distinct active keys in the last
+ * 60 minutes with buckets of 1 minute.
+ * Each bucket has its own update_theta_sketch_dup:
+ *   - update() goes to the current (newest) bucket
+ *   - remove() takes the element out of the newest bucket that retains it; an
+ *     element that is retained by no bucket has already expired, and the
+ *     remove is ignored
+ *   - advance() starts a new bucket, the oldest bucket expires as a whole and
+ *     its sketch is reset in place to become the new bucket
+ * The window result merges the counts of the live buckets. Merges of the
+ * older buckets are cached: the sealed buckets are split into a front part,
+ * with the merge of every suffix of it precomputed, and a back part merged
+ * into one sketch as buckets get sealed. A query then merges at most three
+ * sketches, and the suffixes are recomputed only once every num_buckets
+ * advances.
+ * Example: distinct elements of the last 3 buckets.
+ *   windowed_theta_sketch_dup w(3);
+ *   w.update(1);
+ *   w.advance();
+ *   w.update(2);
+ *   w.get_estimate();  // 2
+ */
+template <typename A>
+class windowed_theta_sketch_dup_alloc {
+ public:
+  typedef typename update_theta_sketch_dup_alloc<A>::builder builder;
+
+  /**
+   * Creates a window of empty buckets
+   * @param num_buckets number of buckets in the window
+   * @param sketch_builder builder of the sketches of the buckets
+   */
+  explicit windowed_theta_sketch_dup_alloc(
+      uint32_t num_buckets, const builder& sketch_builder = builder());
+
+  /**
+   * Update the current bucket with a given value
+   * @param value value of any type accepted by update_theta_sketch_dup
+   */
+  template <typename T>
+  void update(const T& value);
+
+  /**
+   * Update the current bucket with an element hashed by
+   * theta_sketch_dup_hasher with the seed of the window
+   * @param key hashed element
+   */
+  void update(const theta_sketch_dup_key& key);
+
+  /**
+   * Remove one value from the newest bucket that retains it
+   * @param value value of any type accepted by update_theta_sketch_dup
+   */
+  template <typename T>
+  void remove(const T& value);
+
+  /**
+   * Remove an element hashed by theta_sketch_dup_hasher from the newest
+   * bucket that retains it
+   * @param key hashed element
+   */
+  void remove(const theta_sketch_dup_key& key);
+
+  /**
+   * Start new buckets, expiring the oldest buckets if the window is full
+   * @param num_buckets number of new buckets
+   */
+  void advance(uint32_t num_buckets = 1);
+
+  /**
+   * @return the number of buckets of the window
+   */
+  uint32_t get_num_buckets() const;
+
+  /**
+   * @return the number of live buckets, including the current one
+   */
+  uint32_t get_num_live_buckets() const;
+
+  /**
+   * @return the sketch of the current bucket
+   */
+  const update_theta_sketch_dup_alloc<A>& get_current() const;
+
+  /**
+   * @return the merge of the live buckets
+   */
+  const update_theta_sketch_dup_alloc<A>& get_result() const;
+
+  double get_estimate() const;
+  double get_lower_bound(uint8_t num_std_devs) const;
+  double get_upper_bound(uint8_t num_std_devs) const;
+
+ private:
+  typedef typename std::allocator_traits<A>::template rebind_alloc<
+      update_theta_sketch_dup_alloc<A>>
+      AllocSketch;
+  typedef std::vector<update_theta_sketch_dup_alloc<A>, AllocSketch>
+      vector_sketch;
+
+  theta_sketch_dup_hasher hasher_;
+  // ring of the buckets, newest_ is the slot of the current bucket
+  vector_sketch buckets_;
+  uint32_t newest_;
+  uint32_t num_live_;
+
+  /**
+   * The live buckets from the oldest to the newest are:
+   *   num_front_ buckets, suffix_[slot] is the merge of the buckets from slot
+   *   to the end of the front part
+   *   num_back_ buckets, back_ is their merge
+   *   the current bucket
+   * @dirty_ true if a sealed bucket changed since the merges were computed
+   */
+  mutable vector_sketch suffix_;
+  mutable update_theta_sketch_dup_alloc<A> back_;
+  mutable uint32_t num_front_;
+  mutable uint32_t num_back_;
+  mutable bool dirty_;
+  mutable update_theta_sketch_dup_alloc<A> result_;
+  mutable bool result_valid_;
+
+  uint32_t slot(uint32_t age) const;
+  void internal_remove(uint64_t hash);
+  void flip() const;
+};
+
+/*
+ * The following are implementations
+ */
+
+template <typename A>
+windowed_theta_sketch_dup_alloc<A>::windowed_theta_sketch_dup_alloc(
+    uint32_t num_buckets, const builder& sketch_builder)
+    : hasher_(0),
+      buckets_(),
+      newest_(0),
+      num_live_(1),
+      suffix_(),
+      back_(sketch_builder.build()),
+      num_front_(0),
+      num_back_(0),
+      dirty_(false),
+      result_(back_),
+      result_valid_(false) {
+  if (num_buckets == 0)
+    throw std::invalid_argument("num_buckets must be positive");
+  hasher_ = theta_sketch_dup_hasher(back_.seed_);
+  buckets_.assign(num_buckets, back_);
+  suffix_.assign(num_buckets, back_);
+}
+
+// @return the slot of the bucket age buckets older than the current one
+template <typename A>
+uint32_t windowed_theta_sketch_dup_alloc<A>::slot(uint32_t age) const {
+  return (newest_ + buckets_.size() - age) % buckets_.size();
+}
+
+template <typename A>
+template <typename T>
+void windowed_theta_sketch_dup_alloc<A>::update(const T& value) {
+  const theta_sketch_dup_key key = hasher_.hash(value);
+  // an empty string is ignored, as update_theta_sketch_dup does
+  if (key.hash == theta_sketch_dup_key::IGNORED_HASH) return;
+  buckets_[newest_].internal_update(key.hash, 1);
+  result_valid_ = false;
+}
+
+template <typename A>
+void windowed_theta_sketch_dup_alloc<A>::update(
+    const theta_sketch_dup_key& key) {
+  theta_sketch_dup_alloc<A>::check_seed_hash(key.seed_hash,
+                                             hasher_.get_seed_hash());
+  if (key.hash == theta_sketch_dup_key::IGNORED_HASH) return;
+  buckets_[newest_].internal_update(key.hash, 1);
+  result_valid_ = false;
+}
+
+template <typename A>
+template <typename T>
+void windowed_theta_sketch_dup_alloc<A>::remove(const T& value) {
+  const theta_sketch_dup_key key = hasher_.hash(value);
+  if (key.hash == theta_sketch_dup_key::IGNORED_HASH) return;
+  internal_remove(key.hash);
+}
+
+template <typename A>
+void windowed_theta_sketch_dup_alloc<A>::remove(
+    const theta_sketch_dup_key& key) {
+  theta_sketch_dup_alloc<A>::check_seed_hash(key.seed_hash,
+                                             hasher_.get_seed_hash());
+  if (key.hash == theta_sketch_dup_key::IGNORED_HASH) return;
+  internal_remove(key.hash);
+}
+
+template <typename A>
+void windowed_theta_sketch_dup_alloc<A>::internal_remove(uint64_t hash) {
+  for (uint32_t age = 0; age < num_live_; age++) {
+    update_theta_sketch_dup_alloc<A>& bucket = buckets_[slot(age)];
+    if (bucket.get_count(hash) > 0) {
+      bucket.internal_remove(hash);
+      if (age > 0) dirty_ = true;
+      result_valid_ = false;
+      return;
+    }
+  }
+}
+
+template <typename A>
+void windowed_theta_sketch_dup_alloc<A>::advance(uint32_t num_buckets) {
+  for (uint32_t i = 0; i < num_buckets; i++) {
+    // seal the current bucket, it is 1 bucket older than the new one
+    back_.internal_merge(buckets_[newest_]);
+    num_back_++;
+    newest_ = (newest_ + 1) % buckets_.size();
+    if (num_live_ == buckets_.size()) {
+      // expire the oldest bucket, which is in the slot of the new one
+      if (num_front_ == 0) flip();
+      num_front_--;
+      num_live_--;
+    }
+    buckets_[newest_].reset();
+    num_live_++;
+  }
+  result_valid_ = false;
+}
+
+/*
+ * move all the sealed buckets to the front part, computing the merges of its
+ * suffixes from the newest sealed bucket to the oldest
+ */
+template <typename A>
+void windowed_theta_sketch_dup_alloc<A>::flip() const {
+  const uint32_t num_sealed = num_front_ + num_back_;
+  for (uint32_t age = 1; age <= num_sealed; age++) {
+    update_theta_sketch_dup_alloc<A>& suffix = suffix_[slot(age)];
+    if (age == 1) {
+      suffix = buckets_[slot(age)];
+    } else {
+      suffix = suffix_[slot(age - 1)];
+      suffix.internal_merge(buckets_[slot(age)]);
+    }
+  }
+  num_front_ = num_sealed;
+  num_back_ = 0;
+  back_.reset();
+  dirty_ = false;
+}
+
+template <typename A>
+uint32_t windowed_theta_sketch_dup_alloc<A>::get_num_buckets() const {
+  return buckets_.size();
+}
+
+template <typename A>
+uint32_t windowed_theta_sketch_dup_alloc<A>::get_num_live_buckets() const {
+  return num_live_;
+}
+
+template <typename A>
+const update_theta_sketch_dup_alloc<A>&
+windowed_theta_sketch_dup_alloc<A>::get_current() const {
+  return buckets_[newest_];
+}
+
+template <typename A>
+const update_theta_sketch_dup_alloc<A>&
+windowed_theta_sketch_dup_alloc<A>::get_result() const {
+  if (result_valid_) return result_;
+  if (dirty_) flip();
+  result_.reset();
+  if (num_front_ > 0) result_ = suffix_[slot(num_live_ - 1)];
+  if (num_back_ > 0) result_.internal_merge(back_);
+  result_.internal_merge(buckets_[newest_]);
+  result_valid_ = true;
+  return result_;
+}
+
+template <typename A>
+double windowed_theta_sketch_dup_alloc<A>::get_estimate() const {
+  return get_result().get_estimate();
+}
+
+template <typename A>
+double windowed_theta_sketch_dup_alloc<A>::get_lower_bound(
+    uint8_t num_std_devs) const {
+  return get_result().get_lower_bound(num_std_devs);
+}
+
+template <typename A>
+double windowed_theta_sketch_dup_alloc<A>::get_upper_bound(
+    uint8_t num_std_devs) const {
+  return get_result().get_upper_bound(num_std_devs);
+}
+
+/*
+ * alias with default allocator for convenience
+ */
+typedef windowed_theta_sketch_dup_alloc<std::allocator<void>>
+    windowed_theta_sketch_dup;
+
+} /* namespace datasketches */
+
+#endif
@@ -42,6 +42,7 @@ template<typename A> class compact_theta_sketch_alloc;
 template<typename A> class theta_union_alloc;
 template<typename A> class theta_intersection_alloc;
 template<typename A> class theta_a_not_b_alloc;
+template<typename A> class theta_sketch_dup_converter_alloc;
 
 // for serialization as raw bytes
 template<typename A> using AllocU8 = typename std::allocator_traits<A>::template rebind_alloc<uint8_t>;
@@ -435,6 +436,8 @@ private:
   friend theta_union_alloc<A>;
   friend theta_intersection_alloc<A>;
   friend theta_a_not_b_alloc<A>;
+  // builds a compact sketch from the live hash values of a dup sketch
+  friend theta_sketch_dup_converter_alloc<A>;
   compact_theta_sketch_alloc(bool is_empty, uint64_t theta, vector_u64<A>&& keys, uint16_t seed_hash, bool is_ordered);
   static compact_theta_sketch_alloc<A> internal_deserialize(std::istream& is, uint8_t preamble_longs, uint8_t flags_byte, uint16_t seed_hash);
   static compact_theta_sketch_alloc<A> internal_deserialize(const void* bytes, size_t size, uint8_t preamble_longs, uint8_t flags_byte, uint16_t seed_hash);